@@ -0,0 +1,230 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <new>
+#include <atomic>
+
+#include "alloctrack.hpp"
+
+#if defined(__GLIBC__)
+// glibc's own entry points, so that malloc() below can forward to them.
+// operator new uses them too and is counted once.
+extern "C" void* __libc_malloc(size_t size);
+extern "C" void* __libc_calloc(size_t count, size_t size);
+extern "C" void* __libc_realloc(void* pointer, size_t size);
+extern "C" void __libc_free(void* pointer);
+#define RAW_MALLOC __libc_malloc
+#define RAW_FREE __libc_free
+// The program's code, from the GNU linker : allocations made from outside
+// of it come from a shared library, the GL driver most often
+extern "C" char __executable_start;
+extern "C" char etext;
+static inline bool fromProgram(void* caller)
+{
+    return (char*)caller >= &__executable_start && (char*)caller < &etext;
+}
+#else
+#define RAW_MALLOC malloc
+#define RAW_FREE free
+static inline bool fromProgram(void*)
+{
+    return true;
+}
+#endif
+
+#if defined(__GNUC__)
+#define CALLER __builtin_return_address(0)
+#else
+#define CALLER NULL
+#endif
+
+// Plain data only : these are touched from inside malloc(), where a
+// thread_local with a constructor could allocate in turn
+static thread_local AllocStats threadStats;
+static thread_local bool forbidden;
+static std::atomic<unsigned long long> processAllocations(0);
+static std::atomic<unsigned long long> processFrees(0);
+static std::atomic<unsigned long long> processBytes(0);
+
+static void forbiddenAllocation(size_t size)
+{
+    forbidden = false;
+    // stderr is unbuffered : this does not allocate
+    fprintf(stderr, "Allocation of %lu bytes during a frame, after the warm-up frames. Aborting.\n",
+            (unsigned long)size);
+    abort();
+}
+
+static inline void countAllocation(size_t size, void* caller)
+{
+    processAllocations.fetch_add(1, std::memory_order_relaxed);
+    processBytes.fetch_add(size, std::memory_order_relaxed);
+    if (!fromProgram(caller))
+    {
+        threadStats.libraryAllocations++;
+        return;
+    }
+    threadStats.allocations++;
+    threadStats.bytes += size;
+    if (forbidden)
+        forbiddenAllocation(size);
+}
+
+static inline void countFree(void* pointer)
+{
+    if (!pointer)
+        return;
+    threadStats.frees++;
+    processFrees.fetch_add(1, std::memory_order_relaxed);
+}
+
+#if defined(__GLIBC__)
+
+extern "C" void* malloc(size_t size) noexcept
+{
+    countAllocation(size, CALLER);
+    return __libc_malloc(size);
+}
+
+extern "C" void* calloc(size_t count, size_t size) noexcept
+{
+    countAllocation(count * size, CALLER);
+    return __libc_calloc(count, size);
+}
+
+extern "C" void* realloc(void* pointer, size_t size) noexcept
+{
+    // May move : counts as a new block
+    countAllocation(size, CALLER);
+    return __libc_realloc(pointer, size);
+}
+
+extern "C" void free(void* pointer) noexcept
+{
+    countFree(pointer);
+    __libc_free(pointer);
+}
+
+#endif
+
+static void* allocate(size_t size, void* caller)
+{
+    countAllocation(size, caller);
+    void* pointer = RAW_MALLOC(size ? size : 1);
+    if (!pointer)
+        throw std::bad_alloc();
+    return pointer;
+}
+
+// The nothrow forms call these, the deletes forward to the unsized one
+void* operator new(size_t size)
+{
+    return allocate(size, CALLER);
+}
+
+void operator delete(void* pointer) noexcept
+{
+    countFree(pointer);
+    RAW_FREE(pointer);
+}
+
+void* operator new[](size_t size)
+{
+    return allocate(size, CALLER);
+}
+
+void operator delete[](void* pointer) noexcept
+{
+    operator delete(pointer);
+}
+
+// Used instead of the above with -fsized-deallocation (C++14)
+void operator delete(void* pointer, size_t) noexcept
+{
+    operator delete(pointer);
+}
+
+void operator delete[](void* pointer, size_t) noexcept
+{
+    operator delete(pointer);
+}
+
+AllocStats getThreadAllocStats()
+{
+    return threadStats;
+}
+
+AllocStats getProcessAllocStats()
+{
+    AllocStats stats;
+    stats.allocations = processAllocations.load(std::memory_order_relaxed);
+    stats.frees = processFrees.load(std::memory_order_relaxed);
+    stats.bytes = processBytes.load(std::memory_order_relaxed);
+    stats.libraryAllocations = 0;
+    return stats;
+}
+
+static int warmupFrames = -1;
+static bool warmupRead = false;
+static int frameCount = 0;
+static AllocStats frameStart;
+static AllocStats lastFrame;
+// Summed for printAllocStats()
+static AllocStats printedFrames;
+static unsigned long long printedProcessStart = 0;
+static unsigned long long maxFrameAllocations = 0;
+
+void assertNoAllocationsAfter(int frames)
+{
+    warmupFrames = frames;
+    warmupRead = true;
+}
+
+void beginAllocFrame()
+{
+    if (!warmupRead)
+    {
+        const char* frames = getenv("TUTORIALS_NO_ALLOC_AFTER");
+        if (frames)
+            warmupFrames = atoi(frames);
+        warmupRead = true;
+    }
+    frameCount++;
+    frameStart = threadStats;
+    forbidden = warmupFrames >= 0 && frameCount > warmupFrames;
+}
+
+void endAllocFrame()
+{
+    forbidden = false;
+    lastFrame.allocations = threadStats.allocations - frameStart.allocations;
+    lastFrame.frees = threadStats.frees - frameStart.frees;
+    lastFrame.bytes = threadStats.bytes - frameStart.bytes;
+    lastFrame.libraryAllocations = threadStats.libraryAllocations - frameStart.libraryAllocations;
+    printedFrames.allocations += lastFrame.allocations;
+    printedFrames.frees += lastFrame.frees;
+    printedFrames.bytes += lastFrame.bytes;
+    printedFrames.libraryAllocations += lastFrame.libraryAllocations;
+    if (lastFrame.allocations > maxFrameAllocations)
+        maxFrameAllocations = lastFrame.allocations;
+}
+
+const AllocStats& getLastFrameAllocStats()
+{
+    return lastFrame;
+}
+
+void printAllocStats(int frames)
+{
+    if (frames <= 0)
+        return;
+    unsigned long long processAllocationsNow = processAllocations.load(std::memory_order_relaxed);
+    printf("  allocations      %8.1f/frame (max %llu), %.0f bytes/frame ; %.1f/frame by libraries, %.1f/frame on all threads\n",
+           (double)printedFrames.allocations / frames, maxFrameAllocations,
+           (double)printedFrames.bytes / frames,
+           (double)printedFrames.libraryAllocations / frames,
+           (double)(processAllocationsNow - printedProcessStart) / frames);
+    AllocStats empty = { 0, 0, 0, 0 };
+    printedFrames = empty;
+    maxFrameAllocations = 0;
+    printedProcessStart = processAllocationsNow;
+}
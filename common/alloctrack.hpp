@@ -0,0 +1,46 @@
+#ifndef ALLOCTRACK_HPP
+#define ALLOCTRACK_HPP
+
+// Counts heap allocations, to keep the frame loops from allocating. Linking
+// alloctrack.cpp replaces the global operator new and delete and, with
+// glibc, malloc, calloc, realloc and free, for the whole program.
+//
+// Frames are counted on the thread that calls beginAllocFrame() (the
+// profiler does it in beginProfilerFrame()). Other threads, the GL
+// driver's among them, only show in the process totals. With glibc, blocks
+// that shared libraries allocate on the frame thread (the driver inside a
+// GL call, the C++ runtime) are counted apart : the program cannot avoid
+// them.
+//
+// Once a frame budget is set with assertNoAllocationsAfter(), or with the
+// TUTORIALS_NO_ALLOC_AFTER=frames environment variable, an allocation by
+// the program on the frame thread between beginAllocFrame() and
+// endAllocFrame() prints its size and aborts, so a debugger or core dump
+// points at the culprit.
+
+struct AllocStats
+{
+    unsigned long long allocations;
+    unsigned long long frees;
+    unsigned long long bytes; // requested, freed memory is not subtracted
+    unsigned long long libraryAllocations; // not in the counts above
+};
+
+// Running totals since the program started. The process totals count
+// every allocation, the libraries' included.
+AllocStats getThreadAllocStats();
+AllocStats getProcessAllocStats();
+
+void beginAllocFrame();
+void endAllocFrame();
+// The frame thread's allocations during the last complete frame
+const AllocStats& getLastFrameAllocStats();
+
+// warmupFrames frames may allocate (loading, buffers growing to their
+// steady size), none after. A negative count turns the check off.
+void assertNoAllocationsAfter(int warmupFrames);
+
+// Prints allocations and bytes per frame since the last call, then resets.
+void printAllocStats(int frames);
+
+#endif
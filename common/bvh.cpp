@@ -0,0 +1,582 @@
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+
+#include <glm/glm.hpp>
+
+#include "culling.hpp"
+#include "bvh.hpp"
+
+static const int SAH_BINS = 12;
+// Nodes with more objects than this are always split
+static const int MAX_LEAF_SIZE = 8;
+// Deeper nodes are left as leaves, which bounds the traversal stacks
+static const int MAX_DEPTH = 48;
+static const int STACK_SIZE = MAX_DEPTH + 2;
+// Relative cost of visiting a node versus testing an object
+static const float TRAVERSAL_COST = 1.0f;
+static const float INTERSECTION_COST = 1.0f;
+
+static float halfArea(const glm::vec3& min, const glm::vec3& max)
+{
+    glm::vec3 d = glm::max(max - min, glm::vec3(0.0f));
+    return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+// Per object build data, moved around with the object so that the build
+// reads memory in order
+struct BuildObject
+{
+    glm::vec3 min;
+    glm::vec3 max;
+    glm::vec3 centroid;
+    unsigned object;
+};
+
+struct SAHBin
+{
+    glm::vec3 min;
+    glm::vec3 max;
+    int count;
+};
+
+static void emptyBounds(glm::vec3& min, glm::vec3& max)
+{
+    min = glm::vec3(FLT_MAX);
+    max = glm::vec3(-FLT_MAX);
+}
+
+static void nodeBounds(BVH& bvh, BVHNode& node)
+{
+    emptyBounds(node.boundsMin, node.boundsMax);
+    for (int i = node.first; i < node.first + node.count; i++)
+    {
+        unsigned object = bvh.objectIndices[i];
+        node.boundsMin = glm::min(node.boundsMin, bvh.objectMin[object]);
+        node.boundsMax = glm::max(node.boundsMax, bvh.objectMax[object]);
+    }
+}
+
+static void buildBounds(const std::vector<BuildObject>& objects,
+                        BVHNode& node)
+{
+    emptyBounds(node.boundsMin, node.boundsMax);
+    for (int i = node.first; i < node.first + node.count; i++)
+    {
+        node.boundsMin = glm::min(node.boundsMin, objects[i].min);
+        node.boundsMax = glm::max(node.boundsMax, objects[i].max);
+    }
+}
+
+static void splitNode(BVH& bvh, int nodeIndex, int depth,
+                      std::vector<BuildObject>& objects)
+{
+    BVHNode node = bvh.nodes[nodeIndex];
+    if (node.count <= 1 || depth >= MAX_DEPTH)
+        return;
+
+    glm::vec3 centroidMin, centroidMax;
+    emptyBounds(centroidMin, centroidMax);
+    for (int i = node.first; i < node.first + node.count; i++)
+    {
+        centroidMin = glm::min(centroidMin, objects[i].centroid);
+        centroidMax = glm::max(centroidMax, objects[i].centroid);
+    }
+
+    // Binned SAH : drop the centroids into bins along each axis, in one pass
+    // over the objects, then try the SAH_BINS - 1 planes between the bins
+    glm::vec3 extent = centroidMax - centroidMin;
+    glm::vec3 scale;
+    for (int axis = 0; axis < 3; axis++)
+        scale[axis] = extent[axis] > 0.0f ? SAH_BINS / extent[axis] : 0.0f;
+
+    SAHBin bins[3][SAH_BINS];
+    for (int axis = 0; axis < 3; axis++)
+    {
+        for (int b = 0; b < SAH_BINS; b++)
+        {
+            emptyBounds(bins[axis][b].min, bins[axis][b].max);
+            bins[axis][b].count = 0;
+        }
+    }
+    for (int i = node.first; i < node.first + node.count; i++)
+    {
+        const BuildObject& object = objects[i];
+        glm::vec3 position = (object.centroid - centroidMin) * scale;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            SAHBin& bin = bins[axis][std::min((int)position[axis], SAH_BINS - 1)];
+            bin.count++;
+            bin.min = glm::min(bin.min, object.min);
+            bin.max = glm::max(bin.max, object.max);
+        }
+    }
+
+    float leafCost = INTERSECTION_COST * node.count;
+    float bestCost = FLT_MAX;
+    int bestAxis = -1;
+    int bestSplit = 0;
+    glm::vec3 bestLeftMin, bestLeftMax, bestRightMin, bestRightMax;
+    float parentArea = halfArea(node.boundsMin, node.boundsMax);
+    for (int axis = 0; axis < 3; axis++)
+    {
+        if (extent[axis] <= 0.0f)
+            continue;
+
+        // Sweep from the right to get the bounds and count of each right side
+        glm::vec3 rightMin[SAH_BINS];
+        glm::vec3 rightMax[SAH_BINS];
+        int rightCount[SAH_BINS];
+        glm::vec3 min, max;
+        emptyBounds(min, max);
+        int count = 0;
+        for (int b = SAH_BINS - 1; b > 0; b--)
+        {
+            min = glm::min(min, bins[axis][b].min);
+            max = glm::max(max, bins[axis][b].max);
+            count += bins[axis][b].count;
+            rightMin[b] = min;
+            rightMax[b] = max;
+            rightCount[b] = count;
+        }
+
+        emptyBounds(min, max);
+        count = 0;
+        for (int b = 0; b < SAH_BINS - 1; b++)
+        {
+            min = glm::min(min, bins[axis][b].min);
+            max = glm::max(max, bins[axis][b].max);
+            count += bins[axis][b].count;
+            if (count == 0 || rightCount[b + 1] == 0)
+                continue;
+            float cost = TRAVERSAL_COST +
+                         INTERSECTION_COST *
+                             (halfArea(min, max) * count +
+                              halfArea(rightMin[b + 1], rightMax[b + 1]) *
+                                  rightCount[b + 1]) /
+                             parentArea;
+            if (cost < bestCost)
+            {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = b + 1;
+                bestLeftMin = min;
+                bestLeftMax = max;
+                bestRightMin = rightMin[b + 1];
+                bestRightMax = rightMax[b + 1];
+            }
+        }
+    }
+
+    std::vector<BuildObject>::iterator first = objects.begin() + node.first;
+    std::vector<BuildObject>::iterator last = first + node.count;
+    std::vector<BuildObject>::iterator middle;
+    bool binned = bestAxis >= 0 &&
+                  (bestCost < leafCost || node.count > MAX_LEAF_SIZE);
+    if (binned)
+    {
+        // Same computation as the binning, so each object lands on the
+        // side its bin was counted on
+        int axis = bestAxis;
+        int split = bestSplit;
+        middle = std::partition(first, last, [&](const BuildObject& object) {
+            glm::vec3 position = (object.centroid - centroidMin) * scale;
+            return std::min((int)position[axis], SAH_BINS - 1) < split;
+        });
+    }
+    else if (node.count > MAX_LEAF_SIZE)
+    {
+        // All the centroids are at the same place : split in the middle
+        middle = first + node.count / 2;
+    }
+    else
+        return; // Cheaper as a leaf
+
+    int leftCount = (int)(middle - first);
+    BVHNode left, right;
+    left.first = node.first;
+    left.count = leftCount;
+    right.first = node.first + leftCount;
+    right.count = node.count - leftCount;
+
+    int leftIndex = (int)bvh.nodes.size();
+    bvh.nodes.push_back(left);
+    bvh.nodes.push_back(right);
+    if (binned)
+    {
+        bvh.nodes[leftIndex].boundsMin = bestLeftMin;
+        bvh.nodes[leftIndex].boundsMax = bestLeftMax;
+        bvh.nodes[leftIndex + 1].boundsMin = bestRightMin;
+        bvh.nodes[leftIndex + 1].boundsMax = bestRightMax;
+    }
+    else
+    {
+        buildBounds(objects, bvh.nodes[leftIndex]);
+        buildBounds(objects, bvh.nodes[leftIndex + 1]);
+    }
+    bvh.nodes[nodeIndex].first = leftIndex;
+    bvh.nodes[nodeIndex].count = 0;
+
+    splitNode(bvh, leftIndex, depth + 1, objects);
+    splitNode(bvh, leftIndex + 1, depth + 1, objects);
+}
+
+static float computeCost(const BVH& bvh)
+{
+    if (bvh.nodes.empty())
+        return 0.0f;
+    float rootArea = halfArea(bvh.nodes[0].boundsMin, bvh.nodes[0].boundsMax);
+    if (rootArea <= 0.0f)
+        return 0.0f;
+    float cost = 0.0f;
+    for (size_t i = 0; i < bvh.nodes.size(); i++)
+    {
+        const BVHNode& node = bvh.nodes[i];
+        float area = halfArea(node.boundsMin, node.boundsMax);
+        if (node.count > 0)
+            cost += area * INTERSECTION_COST * node.count;
+        else
+            cost += area * TRAVERSAL_COST;
+    }
+    return cost / rootArea;
+}
+
+static void copyBoxes(BVH& bvh, const AABBArray& boxes)
+{
+    size_t count = boxes.minX.size();
+    bvh.objectMin.resize(count);
+    bvh.objectMax.resize(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        bvh.objectMin[i] =
+            glm::vec3(boxes.minX[i], boxes.minY[i], boxes.minZ[i]);
+        bvh.objectMax[i] =
+            glm::vec3(boxes.maxX[i], boxes.maxY[i], boxes.maxZ[i]);
+    }
+}
+
+void buildBVH(BVH& bvh, const AABBArray& boxes)
+{
+    copyBoxes(bvh, boxes);
+    size_t count = bvh.objectMin.size();
+
+    bvh.nodes.clear();
+    bvh.objectIndices.resize(count);
+    std::vector<BuildObject> objects(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        objects[i].min = bvh.objectMin[i];
+        objects[i].max = bvh.objectMax[i];
+        objects[i].centroid = 0.5f * (objects[i].min + objects[i].max);
+        objects[i].object = (unsigned)i;
+    }
+
+    if (count > 0)
+    {
+        // At most 2n - 1 nodes, reserved so the references stay valid
+        bvh.nodes.reserve(2 * count);
+        BVHNode root;
+        root.first = 0;
+        root.count = (int)count;
+        bvh.nodes.push_back(root);
+        buildBounds(objects, bvh.nodes[0]);
+        splitNode(bvh, 0, 0, objects);
+    }
+    for (size_t i = 0; i < count; i++)
+        bvh.objectIndices[i] = objects[i].object;
+
+    bvh.buildCost = computeCost(bvh);
+    bvh.cost = bvh.buildCost;
+    bvh.refitsSinceBuild = 0;
+}
+
+void refitBVH(BVH& bvh, const AABBArray& boxes)
+{
+    copyBoxes(bvh, boxes);
+    // Children are always stored after their parent, so going backwards
+    // updates both children before the parent
+    for (int i = (int)bvh.nodes.size() - 1; i >= 0; i--)
+    {
+        BVHNode& node = bvh.nodes[i];
+        if (node.count > 0)
+            nodeBounds(bvh, node);
+        else
+        {
+            const BVHNode& left = bvh.nodes[node.first];
+            const BVHNode& right = bvh.nodes[node.first + 1];
+            node.boundsMin = glm::min(left.boundsMin, right.boundsMin);
+            node.boundsMax = glm::max(left.boundsMax, right.boundsMax);
+        }
+    }
+    bvh.cost = computeCost(bvh);
+    bvh.refitsSinceBuild++;
+}
+
+bool updateBVH(BVH& bvh, const AABBArray& boxes)
+{
+    if (bvh.objectIndices.size() != boxes.minX.size())
+    {
+        // Objects were added or removed : refitting is not possible
+        buildBVH(bvh, boxes);
+        bvh.rebuilds++;
+        return true;
+    }
+
+    refitBVH(bvh, boxes);
+    if (bvh.cost > bvh.rebuildRatio * bvh.buildCost ||
+        (bvh.rebuildPeriod > 0 && bvh.refitsSinceBuild >= bvh.rebuildPeriod))
+    {
+        buildBVH(bvh, boxes);
+        bvh.rebuilds++;
+        return true;
+    }
+    return false;
+}
+
+enum PlaneSide
+{
+    OUTSIDE,
+    INTERSECTING,
+    INSIDE
+};
+
+static PlaneSide classifyBox(const Frustum& frustum, const glm::vec3& min,
+                             const glm::vec3& max)
+{
+    PlaneSide side = INSIDE;
+    for (int p = 0; p < 6; p++)
+    {
+        const glm::vec4& plane = frustum.planes[p];
+        glm::vec3 positive(plane.x >= 0.0f ? max.x : min.x,
+                           plane.y >= 0.0f ? max.y : min.y,
+                           plane.z >= 0.0f ? max.z : min.z);
+        glm::vec3 negative(plane.x >= 0.0f ? min.x : max.x,
+                           plane.y >= 0.0f ? min.y : max.y,
+                           plane.z >= 0.0f ? min.z : max.z);
+        if (glm::dot(glm::vec3(plane), positive) + plane.w < 0.0f)
+            return OUTSIDE;
+        if (glm::dot(glm::vec3(plane), negative) + plane.w < 0.0f)
+            side = INTERSECTING;
+    }
+    return side;
+}
+
+// Appends every object below a node
+static void addSubtree(const BVH& bvh, int nodeIndex,
+                       std::vector<unsigned>& objects,
+                       BVHQueryStats& stats)
+{
+    int stack[STACK_SIZE];
+    int stackSize = 0;
+    stack[stackSize++] = nodeIndex;
+    while (stackSize > 0)
+    {
+        const BVHNode& node = bvh.nodes[stack[--stackSize]];
+        stats.nodesVisited++;
+        if (node.count > 0)
+        {
+            objects.insert(objects.end(),
+                           bvh.objectIndices.begin() + node.first,
+                           bvh.objectIndices.begin() + node.first +
+                               node.count);
+        }
+        else
+        {
+            stack[stackSize++] = node.first;
+            stack[stackSize++] = node.first + 1;
+        }
+    }
+}
+
+int cullBVH(const BVH& bvh, const Frustum& frustum,
+            std::vector<unsigned>& visible, BVHQueryStats* stats)
+{
+    BVHQueryStats local = BVHQueryStats();
+    visible.clear();
+    if (!bvh.nodes.empty())
+    {
+        // At most one pending node per level
+        int stack[STACK_SIZE];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize > 0)
+        {
+            int nodeIndex = stack[--stackSize];
+            const BVHNode& node = bvh.nodes[nodeIndex];
+            local.nodesVisited++;
+
+            PlaneSide side =
+                classifyBox(frustum, node.boundsMin, node.boundsMax);
+            if (side == OUTSIDE)
+                continue;
+            if (side == INSIDE)
+            {
+                local.nodesVisited--; // counted again by addSubtree
+                addSubtree(bvh, nodeIndex, visible, local);
+                continue;
+            }
+            if (node.count > 0)
+            {
+                for (int i = node.first; i < node.first + node.count; i++)
+                {
+                    unsigned object = bvh.objectIndices[i];
+                    local.objectsTested++;
+                    if (classifyBox(frustum, bvh.objectMin[object],
+                                    bvh.objectMax[object]) != OUTSIDE)
+                        visible.push_back(object);
+                }
+            }
+            else
+            {
+                stack[stackSize++] = node.first;
+                stack[stackSize++] = node.first + 1;
+            }
+        }
+    }
+    if (stats)
+        *stats = local;
+    return (int)visible.size();
+}
+
+static bool boxesOverlap(const glm::vec3& minA, const glm::vec3& maxA,
+                         const glm::vec3& minB, const glm::vec3& maxB)
+{
+    return minA.x <= maxB.x && maxA.x >= minB.x && minA.y <= maxB.y &&
+           maxA.y >= minB.y && minA.z <= maxB.z && maxA.z >= minB.z;
+}
+
+int queryBVHOverlap(const BVH& bvh, const glm::vec3& min, const glm::vec3& max,
+                    std::vector<unsigned>& objects, BVHQueryStats* stats)
+{
+    BVHQueryStats local = BVHQueryStats();
+    objects.clear();
+    if (!bvh.nodes.empty())
+    {
+        int stack[STACK_SIZE];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize > 0)
+        {
+            const BVHNode& node = bvh.nodes[stack[--stackSize]];
+            local.nodesVisited++;
+            if (!boxesOverlap(node.boundsMin, node.boundsMax, min, max))
+                continue;
+            if (node.count > 0)
+            {
+                for (int i = node.first; i < node.first + node.count; i++)
+                {
+                    unsigned object = bvh.objectIndices[i];
+                    local.objectsTested++;
+                    if (boxesOverlap(bvh.objectMin[object],
+                                     bvh.objectMax[object], min, max))
+                        objects.push_back(object);
+                }
+            }
+            else
+            {
+                stack[stackSize++] = node.first;
+                stack[stackSize++] = node.first + 1;
+            }
+        }
+    }
+    if (stats)
+        *stats = local;
+    return (int)objects.size();
+}
+
+// Slab test. Returns the entry distance, or FLT_MAX if the ray misses the
+// box or enters it beyond maxDistance.
+static float rayBox(const glm::vec3& origin, const glm::vec3& inverseDirection,
+                    const glm::vec3& min, const glm::vec3& max,
+                    float maxDistance)
+{
+    glm::vec3 t0 = (min - origin) * inverseDirection;
+    glm::vec3 t1 = (max - origin) * inverseDirection;
+    glm::vec3 tNear = glm::min(t0, t1);
+    glm::vec3 tFar = glm::max(t0, t1);
+    float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+    float exit = std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxDistance));
+    return enter <= exit ? enter : FLT_MAX;
+}
+
+int raycastBVH(const BVH& bvh, const glm::vec3& origin,
+               const glm::vec3& direction, float maxDistance,
+               BVHRayTest test, void* userData, float& hitDistance,
+               BVHQueryStats* stats)
+{
+    BVHQueryStats local = BVHQueryStats();
+    int hit = -1;
+    float best = maxDistance;
+    // Divisions by zero give infinities, which the slab test handles
+    glm::vec3 inverseDirection = 1.0f / direction;
+
+    if (!bvh.nodes.empty() &&
+        rayBox(origin, inverseDirection, bvh.nodes[0].boundsMin,
+               bvh.nodes[0].boundsMax, best) != FLT_MAX)
+    {
+        int stack[STACK_SIZE];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize > 0)
+        {
+            const BVHNode& node = bvh.nodes[stack[--stackSize]];
+            local.nodesVisited++;
+            // May have been beaten by a closer hit since it was pushed
+            if (rayBox(origin, inverseDirection, node.boundsMin,
+                       node.boundsMax, best) == FLT_MAX)
+                continue;
+
+            if (node.count > 0)
+            {
+                for (int i = node.first; i < node.first + node.count; i++)
+                {
+                    unsigned object = bvh.objectIndices[i];
+                    local.objectsTested++;
+                    float distance = rayBox(origin, inverseDirection,
+                                            bvh.objectMin[object],
+                                            bvh.objectMax[object], best);
+                    if (distance == FLT_MAX)
+                        continue;
+                    if (test && !test(object, origin, direction, distance,
+                                      userData))
+                        continue;
+                    if (distance < best)
+                    {
+                        best = distance;
+                        hit = (int)object;
+                    }
+                }
+                continue;
+            }
+
+            // Visit the nearest child first : its hits shorten the ray for
+            // the other one
+            const BVHNode& left = bvh.nodes[node.first];
+            const BVHNode& right = bvh.nodes[node.first + 1];
+            float leftDistance = rayBox(origin, inverseDirection,
+                                        left.boundsMin, left.boundsMax, best);
+            float rightDistance = rayBox(origin, inverseDirection,
+                                         right.boundsMin, right.boundsMax,
+                                         best);
+            if (leftDistance <= rightDistance)
+            {
+                if (rightDistance != FLT_MAX)
+                    stack[stackSize++] = node.first + 1;
+                if (leftDistance != FLT_MAX)
+                    stack[stackSize++] = node.first;
+            }
+            else
+            {
+                if (leftDistance != FLT_MAX)
+                    stack[stackSize++] = node.first;
+                if (rightDistance != FLT_MAX)
+                    stack[stackSize++] = node.first + 1;
+            }
+        }
+    }
+
+    if (stats)
+        *stats = local;
+    hitDistance = best;
+    return hit;
+}
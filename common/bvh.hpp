@@ -0,0 +1,77 @@
+#ifndef BVH_HPP
+#define BVH_HPP
+
+// A bounding volume hierarchy over the world bounding boxes of a set of
+// objects (an AABBArray from culling.hpp, one box per object). Built with
+// the surface area heuristic ; when objects move, refitBVH() only updates
+// the node bounds, and updateBVH() rebuilds once the refitted tree has
+// become too loose.
+
+struct BVHNode
+{
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+    // Leaf : objects objectIndices[first .. first+count), count > 0
+    // Inner : children at first and first+1, count == 0
+    int first;
+    int count;
+};
+
+struct BVH
+{
+    std::vector<BVHNode> nodes; // nodes[0] is the root
+    std::vector<unsigned> objectIndices;
+    // Copy of the object boxes, for the tests in the leaves
+    std::vector<glm::vec3> objectMin;
+    std::vector<glm::vec3> objectMax;
+    // SAH cost right after the last build, and now
+    float buildCost = 0.0f;
+    float cost = 0.0f;
+    int refitsSinceBuild = 0;
+    // updateBVH() rebuilds when cost > rebuildRatio * buildCost, or after
+    // rebuildPeriod refits (0 = never). Refitting keeps every box right but
+    // lets the tree get looser : the period bounds how loose, even for
+    // motions that raise the cost slowly.
+    float rebuildRatio = 1.2f;
+    int rebuildPeriod = 120;
+    int rebuilds = 0;
+};
+
+// What a query did, to compare against testing every object
+struct BVHQueryStats
+{
+    int nodesVisited;
+    int objectsTested;
+};
+
+void buildBVH(BVH& bvh, const AABBArray& boxes);
+// The boxes must be the same objects, in the same order, as for the build.
+void refitBVH(BVH& bvh, const AABBArray& boxes);
+// Refits, then rebuilds if needed. Returns true if it rebuilt.
+bool updateBVH(BVH& bvh, const AABBArray& boxes);
+
+// Same result as cullAABBs() (indices in increasing order is not
+// guaranteed). Whole subtrees inside the frustum are added without tests.
+int cullBVH(const BVH& bvh, const Frustum& frustum,
+            std::vector<unsigned>& visible, BVHQueryStats* stats = NULL);
+
+// Objects whose box overlaps [min, max], e.g. the shadow casters inside a
+// light's bounds.
+int queryBVHOverlap(const BVH& bvh, const glm::vec3& min, const glm::vec3& max,
+                    std::vector<unsigned>& objects,
+                    BVHQueryStats* stats = NULL);
+
+// Precise test for one object, called in front to back order of the boxes.
+// Returns true and sets distance if the ray hits the object.
+typedef bool (*BVHRayTest)(unsigned object, const glm::vec3& origin,
+                           const glm::vec3& direction, float& distance,
+                           void* userData);
+
+// Closest object hit by the ray within maxDistance, or -1. With a NULL test
+// the object boxes themselves are what is hit.
+int raycastBVH(const BVH& bvh, const glm::vec3& origin,
+               const glm::vec3& direction, float maxDistance,
+               BVHRayTest test, void* userData, float& hitDistance,
+               BVHQueryStats* stats = NULL);
+
+#endif
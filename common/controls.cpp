@@ -1,3 +1,8 @@
+// Include standard headers
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
 // Include GLFW
 #include <GLFW/glfw3.h>
 extern GLFWwindow*
@@ -42,9 +47,107 @@ float theta = glm::radians(90.0f);
 float phi = 0.0f;
 float x_pos, y_pos, z_pos;
 
-void computeMatricesFromInputs()
+// ********************
+// Camera recording and replay. The file is a header, then one CameraRecord
+// per frame, as the floats are in memory (little endian everywhere the
+// tutorials run).
+struct CameraRecordHeader
+{
+    char magic[4];       // "CAMR"
+    unsigned version;    // CAMERA_RECORD_VERSION
+    unsigned recordSize; // sizeof(CameraRecord)
+};
+
+struct CameraRecord
+{
+    float radius;
+    float theta;
+    float phi;
+    float horizontalAngle;
+    float verticalAngle;
+    float FoV;
+};
+
+static const unsigned CAMERA_RECORD_VERSION = 1;
+
+static FILE* recordFile = NULL;
+static std::vector<CameraRecord> replayRecords;
+static size_t replayFrame = 0;
+static bool replaying = false;
+
+bool startCameraRecording(const char* path)
+{
+    stopCameraRecording();
+    recordFile = fopen(path, "wb");
+    if (!recordFile)
+    {
+        printf("Cannot write the camera path %s\n", path);
+        return false;
+    }
+    CameraRecordHeader header = {{'C', 'A', 'M', 'R'},
+                                 CAMERA_RECORD_VERSION,
+                                 sizeof(CameraRecord)};
+    fwrite(&header, sizeof(header), 1, recordFile);
+    return true;
+}
+
+void stopCameraRecording()
+{
+    if (recordFile)
+        fclose(recordFile);
+    recordFile = NULL;
+}
+
+bool startCameraReplay(const char* path)
 {
+    replaying = false;
+    replayRecords.clear();
+    replayFrame = 0;
+
+    FILE* file = fopen(path, "rb");
+    if (!file)
+    {
+        printf("Cannot open the camera path %s\n", path);
+        return false;
+    }
+    CameraRecordHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, "CAMR", 4) != 0 ||
+        header.version != CAMERA_RECORD_VERSION ||
+        header.recordSize != sizeof(CameraRecord))
+    {
+        printf("%s is not a camera path\n", path);
+        fclose(file);
+        return false;
+    }
+    CameraRecord record;
+    while (fread(&record, sizeof(record), 1, file) == 1)
+        replayRecords.push_back(record);
+    fclose(file);
 
+    replaying = !replayRecords.empty();
+    printf("Replaying %d frames from %s\n", (int)replayRecords.size(), path);
+    return replaying;
+}
+
+bool isCameraReplaying()
+{
+    return replaying;
+}
+
+int getCameraReplayFrames()
+{
+    return (int)replayRecords.size();
+}
+
+bool cameraReplayFinished()
+{
+    return replaying && replayFrame >= replayRecords.size();
+}
+
+// Reads the keys and the mouse into the camera state
+static void applyInputs()
+{
     // glfwGetTime is called only once, the first time this function is called
     static double lastTime = glfwGetTime();
 
@@ -63,18 +166,6 @@ void computeMatricesFromInputs()
     horizontalAngle += mouseSpeed * float(1024 / 2 - xpos);
     verticalAngle += mouseSpeed * float(768 / 2 - ypos);
 
-    // Direction : Spherical coordinates to Cartesian coordinates conversion
-    glm::vec3 direction(cos(verticalAngle) * sin(horizontalAngle),
-                        sin(verticalAngle),
-                        cos(verticalAngle) * cos(horizontalAngle));
-
-    // Right vector
-    glm::vec3 right = glm::vec3(sin(horizontalAngle - 3.14f / 2.0f), 0,
-                                cos(horizontalAngle - 3.14f / 2.0f));
-
-    // Up vector
-    glm::vec3 up = glm::cross(right, direction);
-
     if (glfwGetKey(window, GLFW_KEY_D) == GLFW_PRESS)
     {
         // position += right * deltaTime * speed;
@@ -107,17 +198,65 @@ void computeMatricesFromInputs()
         radius += 0.05;
     }
 
-    // ********************
-    x_pos = radius * sin(theta) * cos(phi);
-    y_pos = radius * sin(theta) * sin(phi);
-    z_pos = radius * cos(theta);
-    position = glm::vec3(x_pos, y_pos, z_pos);
+    // For the next frame, the "last time" will be "now"
+    lastTime = currentTime;
+}
 
+void computeMatricesFromInputs()
+{
     float FoV =
         initialFoV; // - 5 * glfwGetMouseWheel(); // Now GLFW 3 requires setting
                     // up a callback for this. It's a bit too complicated for
                     // this beginner's tutorial, so it's disabled instead.
 
+    // A replay moves exactly one recorded frame per call, whatever time
+    // passed, and stays on the last one at the end. The window is not
+    // touched, so it also works without one.
+    if (replaying)
+    {
+        size_t frame = replayFrame < replayRecords.size()
+                           ? replayFrame
+                           : replayRecords.size() - 1;
+        const CameraRecord& record = replayRecords[frame];
+        radius = record.radius;
+        theta = record.theta;
+        phi = record.phi;
+        horizontalAngle = record.horizontalAngle;
+        verticalAngle = record.verticalAngle;
+        FoV = record.FoV;
+        if (replayFrame < replayRecords.size())
+            replayFrame++;
+    }
+    else
+    {
+        applyInputs();
+    }
+
+    if (recordFile)
+    {
+        CameraRecord record = {radius, theta, phi, horizontalAngle,
+                               verticalAngle, FoV};
+        fwrite(&record, sizeof(record), 1, recordFile);
+    }
+
+    // Direction : Spherical coordinates to Cartesian coordinates conversion
+    glm::vec3 direction(cos(verticalAngle) * sin(horizontalAngle),
+                        sin(verticalAngle),
+                        cos(verticalAngle) * cos(horizontalAngle));
+
+    // Right vector
+    glm::vec3 right = glm::vec3(sin(horizontalAngle - 3.14f / 2.0f), 0,
+                                cos(horizontalAngle - 3.14f / 2.0f));
+
+    // Up vector
+    glm::vec3 up = glm::cross(right, direction);
+
+    // ********************
+    x_pos = radius * sin(theta) * cos(phi);
+    y_pos = radius * sin(theta) * sin(phi);
+    z_pos = radius * cos(theta);
+    position = glm::vec3(x_pos, y_pos, z_pos);
+
     // Projection matrix : 45� Field of View, 4:3 ratio, display range : 0.1
     // unit <-> 100 units
     ProjectionMatrix =
@@ -129,7 +268,4 @@ void computeMatricesFromInputs()
                                           // position, plus "direction"
                     up // Head is up (set to 0,-1,0 to look upside-down)
         );
-
-    // For the next frame, the "last time" will be "now"
-    lastTime = currentTime;
 }
\ No newline at end of file
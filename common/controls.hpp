@@ -5,4 +5,16 @@ void computeMatricesFromInputs();
 glm::mat4 getViewMatrix();
 glm::mat4 getProjectionMatrix();
 
+// Benchmark camera paths. While recording, every computeMatricesFromInputs()
+// appends the camera (radius, theta, phi, both angles, FoV) to the file.
+// While replaying, each call takes the next recorded frame instead of the
+// mouse and keys, so the same frame number always gets the same view.
+bool startCameraRecording(const char* path);
+void stopCameraRecording();
+bool startCameraReplay(const char* path);
+bool isCameraReplaying();
+int getCameraReplayFrames();
+// True once every recorded frame was used ; the last one is then repeated
+bool cameraReplayFinished();
+
 #endif
\ No newline at end of file
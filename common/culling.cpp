@@ -0,0 +1,357 @@
+#include <vector>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "simd.hpp"
+#include "culling.hpp"
+
+Frustum extractFrustum(const glm::mat4& projection, const glm::mat4& view)
+{
+    glm::mat4 m = projection * view;
+    // Rows of the matrix (glm is column major : m[column][row])
+    glm::vec4 row0(m[0][0], m[1][0], m[2][0], m[3][0]);
+    glm::vec4 row1(m[0][1], m[1][1], m[2][1], m[3][1]);
+    glm::vec4 row2(m[0][2], m[1][2], m[2][2], m[3][2]);
+    glm::vec4 row3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+    Frustum frustum;
+    frustum.planes[0] = row3 + row0; // left
+    frustum.planes[1] = row3 - row0; // right
+    frustum.planes[2] = row3 + row1; // bottom
+    frustum.planes[3] = row3 - row1; // top
+    frustum.planes[4] = row3 + row2; // near
+    frustum.planes[5] = row3 - row2; // far
+
+    // Normalized, so that the sphere test can compare with the radius
+    for (int i = 0; i < 6; i++)
+    {
+        float length = glm::length(glm::vec3(frustum.planes[i]));
+        frustum.planes[i] /= length;
+    }
+    return frustum;
+}
+
+void addAABB(AABBArray& boxes, const glm::vec3& min, const glm::vec3& max)
+{
+    boxes.minX.push_back(min.x);
+    boxes.minY.push_back(min.y);
+    boxes.minZ.push_back(min.z);
+    boxes.maxX.push_back(max.x);
+    boxes.maxY.push_back(max.y);
+    boxes.maxZ.push_back(max.z);
+}
+
+void addSphere(SphereArray& spheres, const glm::vec3& center, float radius)
+{
+    spheres.x.push_back(center.x);
+    spheres.y.push_back(center.y);
+    spheres.z.push_back(center.z);
+    spheres.radius.push_back(radius);
+}
+
+void clearAABBs(AABBArray& boxes)
+{
+    boxes.minX.clear();
+    boxes.minY.clear();
+    boxes.minZ.clear();
+    boxes.maxX.clear();
+    boxes.maxY.clear();
+    boxes.maxZ.clear();
+}
+
+void clearSpheres(SphereArray& spheres)
+{
+    spheres.x.clear();
+    spheres.y.clear();
+    spheres.z.clear();
+    spheres.radius.clear();
+}
+
+void transformAABB(const glm::mat4& model, const glm::vec3& min,
+                   const glm::vec3& max, glm::vec3& outMin, glm::vec3& outMax)
+{
+    // Transform the center, and grow the extent by the absolute value of
+    // the rotation/scale part (Arvo)
+    glm::vec3 center = 0.5f * (min + max);
+    glm::vec3 extent = 0.5f * (max - min);
+    glm::vec3 worldCenter = glm::vec3(model * glm::vec4(center, 1.0f));
+    glm::vec3 worldExtent;
+    for (int row = 0; row < 3; row++)
+    {
+        worldExtent[row] = std::fabs(model[0][row]) * extent.x +
+                           std::fabs(model[1][row]) * extent.y +
+                           std::fabs(model[2][row]) * extent.z;
+    }
+    outMin = worldCenter - worldExtent;
+    outMax = worldCenter + worldExtent;
+}
+
+// For a box, only the corner furthest along the plane normal (the
+// "positive vertex") needs testing. Which corner that is depends only on
+// the plane, so each plane simply reads either the min or the max array of
+// each axis : no per-box select.
+struct PlaneInputs
+{
+    const float* x;
+    const float* y;
+    const float* z;
+};
+
+static PlaneInputs positiveVertex(const glm::vec4& plane,
+                                  const AABBArray& boxes)
+{
+    PlaneInputs inputs;
+    inputs.x = plane.x >= 0.0f ? &boxes.maxX[0] : &boxes.minX[0];
+    inputs.y = plane.y >= 0.0f ? &boxes.maxY[0] : &boxes.minY[0];
+    inputs.z = plane.z >= 0.0f ? &boxes.maxZ[0] : &boxes.minZ[0];
+    return inputs;
+}
+
+static bool boxVisible(const Frustum& frustum, const PlaneInputs* inputs,
+                       size_t i)
+{
+    for (int p = 0; p < 6; p++)
+    {
+        const glm::vec4& plane = frustum.planes[p];
+        if (plane.x * inputs[p].x[i] + plane.y * inputs[p].y[i] +
+                plane.z * inputs[p].z[i] + plane.w <
+            0.0f)
+            return false;
+    }
+    return true;
+}
+
+static bool sphereVisible(const Frustum& frustum, const SphereArray& spheres,
+                          size_t i)
+{
+    for (int p = 0; p < 6; p++)
+    {
+        const glm::vec4& plane = frustum.planes[p];
+        if (plane.x * spheres.x[i] + plane.y * spheres.y[i] +
+                plane.z * spheres.z[i] + plane.w + spheres.radius[i] <
+            0.0f)
+            return false;
+    }
+    return true;
+}
+
+int cullAABBsScalar(const Frustum& frustum, const AABBArray& boxes,
+                    std::vector<unsigned>& visible)
+{
+    visible.clear();
+    size_t count = boxes.minX.size();
+    if (count == 0)
+        return 0;
+
+    PlaneInputs inputs[6];
+    for (int p = 0; p < 6; p++)
+        inputs[p] = positiveVertex(frustum.planes[p], boxes);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (boxVisible(frustum, inputs, i))
+            visible.push_back((unsigned)i);
+    }
+    return (int)visible.size();
+}
+
+int cullSpheresScalar(const Frustum& frustum, const SphereArray& spheres,
+                      std::vector<unsigned>& visible)
+{
+    visible.clear();
+    for (size_t i = 0; i < spheres.x.size(); i++)
+    {
+        if (sphereVisible(frustum, spheres, i))
+            visible.push_back((unsigned)i);
+    }
+    return (int)visible.size();
+}
+
+#if defined(SIMD_SSE2)
+
+// Appends base + lane for every bit set in mask
+static unsigned* appendLanes(unsigned* out, int mask, unsigned base)
+{
+    while (mask != 0)
+    {
+        int lane = 0;
+        while ((mask & (1 << lane)) == 0)
+            lane++;
+        *out++ = base + lane;
+        mask &= mask - 1;
+    }
+    return out;
+}
+
+#if defined(SIMD_AVX2)
+
+// Returns one bit per box of the 8 starting at i : set if visible
+static int boxesVisible8(const Frustum& frustum, const PlaneInputs* inputs,
+                         size_t i)
+{
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (int p = 0; p < 6; p++)
+    {
+        const glm::vec4& plane = frustum.planes[p];
+        __m256 d = _mm256_set1_ps(plane.w);
+        d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(plane.x),
+                                           _mm256_loadu_ps(inputs[p].x + i)));
+        d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(plane.y),
+                                           _mm256_loadu_ps(inputs[p].y + i)));
+        d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(plane.z),
+                                           _mm256_loadu_ps(inputs[p].z + i)));
+        inside = _mm256_and_ps(
+            inside, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_GE_OQ));
+        // Most boxes are rejected by the first planes
+        if (_mm256_movemask_ps(inside) == 0)
+            return 0;
+    }
+    return _mm256_movemask_ps(inside);
+}
+
+static int spheresVisible8(const Frustum& frustum, const SphereArray& spheres,
+                           size_t i)
+{
+    __m256 x = _mm256_loadu_ps(&spheres.x[i]);
+    __m256 y = _mm256_loadu_ps(&spheres.y[i]);
+    __m256 z = _mm256_loadu_ps(&spheres.z[i]);
+    __m256 radius = _mm256_loadu_ps(&spheres.radius[i]);
+    __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    for (int p = 0; p < 6; p++)
+    {
+        const glm::vec4& plane = frustum.planes[p];
+        __m256 d = _mm256_add_ps(radius, _mm256_set1_ps(plane.w));
+        d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(plane.x), x));
+        d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(plane.y), y));
+        d = _mm256_add_ps(d, _mm256_mul_ps(_mm256_set1_ps(plane.z), z));
+        inside = _mm256_and_ps(
+            inside, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_GE_OQ));
+    }
+    return _mm256_movemask_ps(inside);
+}
+
+#else
+
+static int boxesVisible4(const Frustum& frustum, const PlaneInputs* inputs,
+                         size_t i)
+{
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (int p = 0; p < 6; p++)
+    {
+        const glm::vec4& plane = frustum.planes[p];
+        __m128 d = _mm_set1_ps(plane.w);
+        d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(plane.x),
+                                     _mm_loadu_ps(inputs[p].x + i)));
+        d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(plane.y),
+                                     _mm_loadu_ps(inputs[p].y + i)));
+        d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(plane.z),
+                                     _mm_loadu_ps(inputs[p].z + i)));
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(d, _mm_setzero_ps()));
+        if (_mm_movemask_ps(inside) == 0)
+            return 0;
+    }
+    return _mm_movemask_ps(inside);
+}
+
+static int spheresVisible4(const Frustum& frustum, const SphereArray& spheres,
+                           size_t i)
+{
+    __m128 x = _mm_loadu_ps(&spheres.x[i]);
+    __m128 y = _mm_loadu_ps(&spheres.y[i]);
+    __m128 z = _mm_loadu_ps(&spheres.z[i]);
+    __m128 radius = _mm_loadu_ps(&spheres.radius[i]);
+    __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+    for (int p = 0; p < 6; p++)
+    {
+        const glm::vec4& plane = frustum.planes[p];
+        __m128 d = _mm_add_ps(radius, _mm_set1_ps(plane.w));
+        d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(plane.x), x));
+        d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(plane.y), y));
+        d = _mm_add_ps(d, _mm_mul_ps(_mm_set1_ps(plane.z), z));
+        inside = _mm_and_ps(inside, _mm_cmpge_ps(d, _mm_setzero_ps()));
+    }
+    return _mm_movemask_ps(inside);
+}
+
+#endif
+
+int cullAABBs(const Frustum& frustum, const AABBArray& boxes,
+              std::vector<unsigned>& visible)
+{
+    size_t count = boxes.minX.size();
+    // Worst case everything is visible ; trimmed at the end
+    visible.resize(count);
+    if (count == 0)
+        return 0;
+
+    PlaneInputs inputs[6];
+    for (int p = 0; p < 6; p++)
+        inputs[p] = positiveVertex(frustum.planes[p], boxes);
+
+    unsigned* out = &visible[0];
+    size_t i = 0;
+    for (; i + SIMD_WIDTH <= count; i += SIMD_WIDTH)
+    {
+#if defined(SIMD_AVX2)
+        int mask = boxesVisible8(frustum, inputs, i);
+#else
+        int mask = boxesVisible4(frustum, inputs, i);
+#endif
+        out = appendLanes(out, mask, (unsigned)i);
+    }
+    // The last few boxes that do not fill a register
+    for (; i < count; i++)
+    {
+        if (boxVisible(frustum, inputs, i))
+            *out++ = (unsigned)i;
+    }
+
+    visible.resize(out - &visible[0]);
+    return (int)visible.size();
+}
+
+int cullSpheres(const Frustum& frustum, const SphereArray& spheres,
+                std::vector<unsigned>& visible)
+{
+    size_t count = spheres.x.size();
+    visible.resize(count);
+    if (count == 0)
+        return 0;
+
+    unsigned* out = &visible[0];
+    size_t i = 0;
+    for (; i + SIMD_WIDTH <= count; i += SIMD_WIDTH)
+    {
+#if defined(SIMD_AVX2)
+        int mask = spheresVisible8(frustum, spheres, i);
+#else
+        int mask = spheresVisible4(frustum, spheres, i);
+#endif
+        out = appendLanes(out, mask, (unsigned)i);
+    }
+    for (; i < count; i++)
+    {
+        if (sphereVisible(frustum, spheres, i))
+            *out++ = (unsigned)i;
+    }
+
+    visible.resize(out - &visible[0]);
+    return (int)visible.size();
+}
+
+#else
+
+int cullAABBs(const Frustum& frustum, const AABBArray& boxes,
+              std::vector<unsigned>& visible)
+{
+    return cullAABBsScalar(frustum, boxes, visible);
+}
+
+int cullSpheres(const Frustum& frustum, const SphereArray& spheres,
+                std::vector<unsigned>& visible)
+{
+    return cullSpheresScalar(frustum, spheres, visible);
+}
+
+#endif
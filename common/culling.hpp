@@ -0,0 +1,52 @@
+#ifndef CULLING_HPP
+#define CULLING_HPP
+
+// The 6 planes of a view frustum, as (normal, distance) with the normals
+// pointing inside : a point p is inside a plane if dot(normal, p) + w >= 0.
+struct Frustum
+{
+    glm::vec4 planes[6];
+};
+
+// Gribb & Hartmann plane extraction from the combined matrix, so the planes
+// are in world space. Pass getProjectionMatrix() and getViewMatrix().
+Frustum extractFrustum(const glm::mat4& projection, const glm::mat4& view);
+
+// World space bounding boxes, one array per component (structure of arrays)
+// so that the SIMD path loads 8 boxes with one instruction per component.
+struct AABBArray
+{
+    std::vector<float> minX, minY, minZ;
+    std::vector<float> maxX, maxY, maxZ;
+};
+
+// Bounding spheres, same layout.
+struct SphereArray
+{
+    std::vector<float> x, y, z, radius;
+};
+
+void addAABB(AABBArray& boxes, const glm::vec3& min, const glm::vec3& max);
+void addSphere(SphereArray& spheres, const glm::vec3& center, float radius);
+void clearAABBs(AABBArray& boxes);
+void clearSpheres(SphereArray& spheres);
+
+// Bounds of a model space box once transformed by a model matrix.
+void transformAABB(const glm::mat4& model, const glm::vec3& min,
+                   const glm::vec3& max, glm::vec3& outMin, glm::vec3& outMax);
+
+// Replaces visible with the indices of the boxes / spheres that are at least
+// partly inside the frustum, in increasing order. Returns visible.size().
+// Uses AVX2 (8 at a time) or SSE2 (4 at a time) when available, see simd.hpp.
+int cullAABBs(const Frustum& frustum, const AABBArray& boxes,
+              std::vector<unsigned>& visible);
+int cullSpheres(const Frustum& frustum, const SphereArray& spheres,
+                std::vector<unsigned>& visible);
+
+// One box at a time, the reference the SIMD versions are checked against.
+int cullAABBsScalar(const Frustum& frustum, const AABBArray& boxes,
+                    std::vector<unsigned>& visible);
+int cullSpheresScalar(const Frustum& frustum, const SphereArray& spheres,
+                      std::vector<unsigned>& visible);
+
+#endif
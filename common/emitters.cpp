@@ -0,0 +1,259 @@
+#include <vector>
+#include <math.h>
+
+#include <glm/glm.hpp>
+
+#include "simd.hpp"
+#include "random.hpp"
+#include "culling.hpp"
+#include "radixsort.hpp"
+#include "jobs.hpp"
+#include "particles.hpp"
+#include "emitters.hpp"
+
+int addParticleEmitter(ParticleEffect& effect, const EmitterSettings& settings)
+{
+    ParticleEmitter* emitter = new ParticleEmitter;
+    emitter->settings = settings;
+    initParticleSystem(emitter->particles, settings.budget);
+    seedRandom(emitter->random, settings.seed);
+    emitter->spawnDebt = 0.0f;
+    emitter->lod = 1.0f;
+    emitter->awake = false;
+    emitter->cameraDistance = 0.0f;
+    effect.emitters.push_back(emitter);
+    return (int)effect.emitters.size() - 1;
+}
+
+int addForceField(ParticleEffect& effect, const ForceField& field)
+{
+    effect.fields.push_back(field);
+    return (int)effect.fields.size() - 1;
+}
+
+void deleteParticleEffect(ParticleEffect& effect)
+{
+    for (size_t e = 0; e < effect.emitters.size(); e++)
+        delete effect.emitters[e];
+    effect = ParticleEffect();
+}
+
+// One byte of each colour, picked between the bytes of min and max by the
+// 4 numbers of unit
+static unsigned randomColor(unsigned min, unsigned max, const float unit[4])
+{
+    unsigned color = 0;
+    for (int c = 0; c < 4; c++)
+    {
+        unsigned low = (min >> 8 * c) & 0xFF;
+        unsigned high = (max >> 8 * c) & 0xFF;
+        unsigned byte = high > low ? low + (unsigned)(unit[c] * (high - low + 1)) : low;
+        color |= byte << 8 * c;
+    }
+    return color;
+}
+
+// Two unit vectors across direction, to turn directions around it
+static void perpendiculars(const glm::vec3& direction, glm::vec3& u,
+                           glm::vec3& v)
+{
+    glm::vec3 other = fabsf(direction.x) < 0.9f ? glm::vec3(1.0f, 0.0f, 0.0f)
+                                                : glm::vec3(0.0f, 1.0f, 0.0f);
+    u = glm::normalize(glm::cross(direction, other));
+    v = glm::cross(direction, u);
+}
+
+void newEmitterParticle(const EmitterSettings& settings, RandomStream& random,
+                        glm::vec3& position, glm::vec3& velocity, float& life,
+                        float& size, unsigned& color)
+{
+    // Always 16 numbers, whatever is used
+    float unit[16];
+    randomFloats8(random, unit);
+    randomFloats8(random, unit + 8);
+
+    position = settings.position;
+    if (settings.positionSpread > 0.0f)
+        position += (glm::vec3(unit[0], unit[1], unit[2]) * 2.0f - 1.0f) *
+                    settings.positionSpread;
+
+    if (settings.velocity == VELOCITY_BOX)
+    {
+        glm::vec3 offset = glm::vec3(unit[3], unit[4], unit[5]) * 2.0f - 1.0f;
+        velocity = settings.direction * settings.speed + offset * settings.spread;
+    }
+    else
+    {
+        // Uniform over the cap of the sphere : cos(angle) is uniform
+        float minCos = settings.velocity == VELOCITY_CONE ? cosf(settings.spread)
+                                                          : -1.0f;
+        float cosAngle = minCos + (1.0f - minCos) * unit[3];
+        float sinAngle = sqrtf(glm::max(0.0f, 1.0f - cosAngle * cosAngle));
+        float turn = 6.2831853f * unit[4];
+        glm::vec3 u, v;
+        perpendiculars(settings.direction, u, v);
+        glm::vec3 direction = settings.direction * cosAngle +
+                              (u * cosf(turn) + v * sinf(turn)) * sinAngle;
+        velocity = direction * settings.speed;
+    }
+
+    life = settings.lifeMin + (settings.lifeMax - settings.lifeMin) * unit[6];
+    size = settings.sizeMin + (settings.sizeMax - settings.sizeMin) * unit[7];
+    color = randomColor(settings.colorMin, settings.colorMax, unit + 8);
+}
+
+// 1 up to lodNear, 0 from lodFar on
+static float emitterLOD(const EmitterSettings& settings, float distance)
+{
+    if (distance <= settings.lodNear)
+        return 1.0f;
+    if (distance >= settings.lodFar)
+        return 0.0f;
+    return (settings.lodFar - distance) / (settings.lodFar - settings.lodNear);
+}
+
+static void spawnEmitterParticles(ParticleEmitter& emitter, float delta)
+{
+    const EmitterSettings& settings = emitter.settings;
+    emitter.spawnDebt += settings.rate * emitter.lod * delta;
+    int spawns = (int)emitter.spawnDebt;
+    emitter.spawnDebt -= spawns;
+    // The budget shrinks with the detail too
+    int limit = (int)(settings.budget * emitter.lod);
+    for (int k = 0; k < spawns; k++)
+    {
+        if (emitter.particles.count >= limit)
+        {
+            emitter.spawnDebt = 0.0f;
+            break;
+        }
+        glm::vec3 position, velocity;
+        float life, size;
+        unsigned color;
+        newEmitterParticle(settings, emitter.random, position, velocity, life,
+                           size, color);
+        // The update moves every particle by the whole frame : the ones
+        // born later in it go back a little first, or a slow frame would
+        // spawn them all at once in a clump.
+        float later = delta * (k + 0.5f) / spawns;
+        spawnParticle(emitter.particles, position - velocity * later, velocity,
+                      life + later, size, color);
+    }
+}
+
+void startParticleEffectUpdate(ParticleEffect& effect, JobSystem* jobs,
+                               float delta, const glm::vec3& cameraPosition,
+                               const Frustum* frustum, float* positionSize,
+                               unsigned* color)
+{
+    effect.positionSize = positionSize;
+    effect.color = color;
+    int emitterCount = (int)effect.emitters.size();
+    std::vector<unsigned>& visible = effect.visible;
+    if (frustum)
+    {
+        clearSpheres(effect.bounds);
+        for (int e = 0; e < emitterCount; e++)
+        {
+            const EmitterSettings& settings = effect.emitters[e]->settings;
+            addSphere(effect.bounds, settings.position, settings.radius);
+        }
+        cullSpheres(*frustum, effect.bounds, visible);
+    }
+    else
+    {
+        visible.resize(emitterCount);
+        for (int e = 0; e < emitterCount; e++)
+            visible[e] = e;
+    }
+
+    // visible is in increasing order
+    size_t next = 0;
+    for (int e = 0; e < emitterCount; e++)
+    {
+        ParticleEmitter& emitter = *effect.emitters[e];
+        glm::vec3 toCamera = emitter.settings.position - cameraPosition;
+        emitter.cameraDistance = glm::dot(toCamera, toCamera);
+        emitter.lod = emitterLOD(emitter.settings, sqrtf(emitter.cameraDistance));
+        bool inView = next < visible.size() && visible[next] == (unsigned)e;
+        if (inView)
+            next++;
+        emitter.awake = inView && emitter.lod > 0.0f;
+        if (!emitter.awake)
+            continue;
+
+        spawnEmitterParticles(emitter, delta);
+        emitter.fields.clear();
+        for (size_t f = 0; f < effect.fields.size() && f < 32; f++)
+        {
+            if (emitter.settings.fieldMask & (1u << f))
+                emitter.fields.push_back(effect.fields[f]);
+        }
+        // Gravity is one of the fields, there is no other acceleration. Where
+        // the particles go is known once the emitters before are finished.
+        startParticleUpdate(emitter.update, jobs, emitter.particles, delta,
+                            glm::vec3(0.0f), cameraPosition, NULL, NULL,
+                            emitter.fields.empty() ? NULL : &emitter.fields[0],
+                            (int)emitter.fields.size());
+    }
+}
+
+int finishParticleEffectUpdate(ParticleEffect& effect, JobSystem* jobs)
+{
+    int written = 0;
+    for (size_t e = 0; e < effect.emitters.size(); e++)
+    {
+        if (!effect.emitters[e]->awake)
+            continue;
+        ParticleUpdate& update = effect.emitters[e]->update;
+        if (effect.positionSize)
+        {
+            update.positionSize = effect.positionSize + 4 * written;
+            update.color = effect.color + written;
+        }
+        int count = finishParticleUpdate(update, jobs);
+        if (effect.positionSize)
+            written += count;
+    }
+    effect.positionSize = NULL;
+    effect.color = NULL;
+    return written;
+}
+
+int writeParticleEffect(ParticleEffect& effect, float* positionSize,
+                        unsigned* color, JobSystem* jobs)
+{
+    // A handful of emitters : insertion sort, the farthest first
+    std::vector<int>& order = effect.drawOrder;
+    order.clear();
+    for (int e = 0; e < (int)effect.emitters.size(); e++)
+    {
+        if (!effect.emitters[e]->awake)
+            continue;
+        float distance = effect.emitters[e]->cameraDistance;
+        size_t i = order.size();
+        order.push_back(e);
+        for (; i > 0 && effect.emitters[order[i - 1]]->cameraDistance < distance; i--)
+            order[i] = order[i - 1];
+        order[i] = e;
+    }
+
+    int written = 0;
+    for (size_t i = 0; i < order.size(); i++)
+    {
+        ParticleSystem& particles = effect.emitters[order[i]]->particles;
+        sortParticles(particles, jobs);
+        writeSortedParticles(particles, positionSize + 4 * written,
+                             color + written, jobs);
+        written += particles.count;
+    }
+    return written;
+}
+
+int countParticleEffect(const ParticleEffect& effect)
+{
+    int count = 0;
+    for (size_t e = 0; e < effect.emitters.size(); e++)
+        count += effect.emitters[e]->particles.count;
+    return count;
+}
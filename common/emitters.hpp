@@ -0,0 +1,113 @@
+#ifndef EMITTERS_HPP
+#define EMITTERS_HPP
+
+// Particle effects described by data : emitters that spawn particles at a
+// rate, and force fields that move them (see ForceField in particles.hpp).
+// Each emitter owns a ParticleSystem as large as its budget, so it never
+// has more particles than that, and it is culled and given a level of
+// detail on its own : an emitter whose bounding sphere is off screen, or
+// that is farther than lodFar, sleeps. It spawns nothing, its particles do
+// not move and are not drawn until it wakes up.
+
+// How the velocity of a new particle is picked
+enum EmitterVelocity
+{
+    VELOCITY_BOX,    // direction * speed, plus a random point of a cube of half size spread
+    VELOCITY_CONE,   // speed, at most spread radians away from direction
+    VELOCITY_SPHERE, // speed, towards anywhere
+};
+
+struct EmitterSettings
+{
+    glm::vec3 position = glm::vec3(0.0f);
+    float positionSpread = 0.0f; // particles start in a cube of that half size
+    float rate = 1000.0f;        // particles per second
+    EmitterVelocity velocity = VELOCITY_BOX;
+    glm::vec3 direction = glm::vec3(0.0f, 1.0f, 0.0f); // unit length
+    float speed = 10.0f;
+    float spread = 1.5f;
+    float lifeMin = 5.0f, lifeMax = 5.0f;
+    float sizeMin = 0.1f, sizeMax = 0.6f;
+    // Each of the 4 bytes is picked between these, see packParticleColor()
+    unsigned colorMin = 0;
+    unsigned colorMax = 0xFFFFFFFF;
+    int budget = 10000; // most live particles
+    // Around position, holding all the particles, for culling
+    float radius = 20.0f;
+    // Full rate and budget closer than lodNear, down to nothing at lodFar
+    float lodNear = 50.0f;
+    float lodFar = 100.0f;
+    // Bit i set when the effect's field i applies
+    unsigned fieldMask = 0xFFFFFFFF;
+    unsigned seed = 1;
+};
+
+struct ParticleEmitter
+{
+    EmitterSettings settings;
+    ParticleSystem particles;
+    ParticleUpdate update;
+    RandomStream random; // seeded with settings.seed, see random.hpp
+    float spawnDebt; // fraction of a particle carried to the next frame
+    float lod;       // 1 at full detail, 0 asleep
+    bool awake;
+    float cameraDistance; // squared, from the last update
+    // The effect's fields in fieldMask, for the update in flight
+    std::vector<ForceField> fields;
+};
+
+struct ParticleEffect
+{
+    std::vector<ParticleEmitter*> emitters;
+    std::vector<ForceField> fields; // at most 32, see fieldMask
+    // Set by the last start, for cullSpheres()
+    SphereArray bounds;
+    std::vector<unsigned> visible;
+    // Emitters drawn by writeParticleEffect(), the farthest first
+    std::vector<int> drawOrder;
+    // Upload buffers of the update in flight, NULL when it writes nothing
+    float* positionSize = NULL;
+    unsigned* color = NULL;
+};
+
+// Returns the index of the new emitter in effect.emitters
+int addParticleEmitter(ParticleEffect& effect, const EmitterSettings& settings);
+// Returns the index of the field, for fieldMask
+int addForceField(ParticleEffect& effect, const ForceField& field);
+void deleteParticleEffect(ParticleEffect& effect);
+
+// A new particle from the settings, as spawned by the effect. For
+// simulations that keep particles elsewhere (see gpuparticles.hpp).
+void newEmitterParticle(const EmitterSettings& settings, RandomStream& random,
+                        glm::vec3& position, glm::vec3& velocity, float& life,
+                        float& size, unsigned& color);
+
+// Culls and picks the detail of every emitter, spawns the particles of the
+// awake ones for delta seconds, then starts their update on the job system
+// (see startParticleUpdate()). The particles spawned during the frame are
+// spread over it instead of all starting at its end. Without a frustum
+// nothing is culled. With upload buffers, the live particles are written
+// to them unsorted by the finish, for order independent transparency (see
+// oit.hpp) : they must stay mapped until then, with room for them all.
+void startParticleEffectUpdate(ParticleEffect& effect, JobSystem* jobs,
+                               float delta, const glm::vec3& cameraPosition,
+                               const Frustum* frustum = NULL,
+                               float* positionSize = NULL,
+                               unsigned* color = NULL);
+// Waits for the updates and removes the dead particles. With upload
+// buffers, each emitter's chunks are written in parallel after the ones of
+// the emitters before it (see finishParticleUpdate()). Returns how many
+// particles were written, 0 without buffers.
+int finishParticleEffectUpdate(ParticleEffect& effect, JobSystem* jobs);
+
+// Sorts the particles of each awake emitter (see sortParticles()) and
+// writes them to the upload buffers, emitter after emitter, from the
+// farthest. Particles of different emitters are not sorted with each other.
+// Returns how many particles were written.
+int writeParticleEffect(ParticleEffect& effect, float* positionSize,
+                        unsigned* color, JobSystem* jobs = NULL);
+
+// Live particles of all the emitters, awake or not
+int countParticleEffect(const ParticleEffect& effect);
+
+#endif
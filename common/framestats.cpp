@@ -0,0 +1,97 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+#include "framestats.hpp"
+
+double statsNow()
+{
+    std::chrono::steady_clock::duration now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration<double, std::milli>(now).count();
+}
+
+void beginStatsFrame(FrameStats& stats)
+{
+    stats.frameStart = statsNow();
+}
+
+void addStatsPhase(FrameStats& stats, const char* name, double ms)
+{
+    for (size_t i = 0; i < stats.phaseNames.size(); i++)
+    {
+        if (strcmp(stats.phaseNames[i], name) == 0)
+        {
+            stats.phaseMs[i] += ms;
+            return;
+        }
+    }
+    stats.phaseNames.push_back(name);
+    stats.phaseMs.push_back(ms);
+}
+
+void endStatsFrame(FrameStats& stats, int draws)
+{
+    stats.frameMs.push_back(statsNow() - stats.frameStart);
+    stats.draws.push_back(draws);
+}
+
+// Nearest rank percentile of sorted values
+static double percentile(const std::vector<double>& sorted, double p)
+{
+    if (sorted.empty())
+        return 0.0;
+    size_t rank = (size_t)(p / 100.0 * sorted.size() + 0.5);
+    return sorted[std::min(std::max(rank, (size_t)1), sorted.size()) - 1];
+}
+
+// Prints s as a JSON string
+static void printJSONString(const char* s)
+{
+    putchar('"');
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            printf("\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            printf("\\u%04x", *s);
+        else
+            putchar(*s);
+    }
+    putchar('"');
+}
+
+void printFrameStatsJSON(const FrameStats& stats, const char* sample,
+                         const char* renderer, int width, int height)
+{
+    int frames = (int)stats.frameMs.size();
+    std::vector<double> sorted = stats.frameMs;
+    std::sort(sorted.begin(), sorted.end());
+    double totalMs = 0.0;
+    long long totalDraws = 0;
+    for (int i = 0; i < frames; i++)
+    {
+        totalMs += stats.frameMs[i];
+        totalDraws += stats.draws[i];
+    }
+    double perFrame = frames > 0 ? 1.0 / frames : 0.0;
+
+    printf("{\"sample\": ");
+    printJSONString(sample);
+    printf(", \"renderer\": ");
+    printJSONString(renderer);
+    printf(", \"width\": %d, \"height\": %d, \"frames\": %d", width, height, frames);
+    printf(", \"frame_ms\": {\"mean\": %.4f, \"p50\": %.4f, \"p99\": %.4f}",
+           totalMs * perFrame, percentile(sorted, 50.0), percentile(sorted, 99.0));
+    printf(", \"cpu_ms\": {");
+    for (size_t i = 0; i < stats.phaseNames.size(); i++)
+    {
+        if (i > 0)
+            printf(", ");
+        printJSONString(stats.phaseNames[i]);
+        printf(": %.4f", stats.phaseMs[i] * perFrame);
+    }
+    printf("}, \"draws_per_frame\": %.2f}\n", totalDraws * perFrame);
+    fflush(stdout);
+}
@@ -0,0 +1,32 @@
+#ifndef FRAMESTATS_HPP
+#define FRAMESTATS_HPP
+
+// Per frame timings for benchmark runs : the length of every frame, the CPU
+// time of a few named phases and the draw calls, summarized as one line of
+// JSON at the end so that scripts can compare runs.
+
+struct FrameStats
+{
+    std::vector<double> frameMs;
+    std::vector<int> draws;
+    // Summed over all the frames, in the order they were first added
+    std::vector<const char*> phaseNames;
+    std::vector<double> phaseMs;
+    double frameStart = 0.0;
+};
+
+// Milliseconds on a monotonic clock. Works without glfwInit().
+double statsNow();
+
+void beginStatsFrame(FrameStats& stats);
+// Adds ms to the phase called name. The name is kept, not copied.
+void addStatsPhase(FrameStats& stats, const char* name, double ms);
+void endStatsFrame(FrameStats& stats, int draws);
+
+// Prints {"sample", "renderer", "width", "height", "frames",
+// "frame_ms": {"mean", "p50", "p99"}, "cpu_ms": {phase: mean per frame...},
+// "draws_per_frame"} on one line.
+void printFrameStatsJSON(const FrameStats& stats, const char* sample,
+                         const char* renderer, int width, int height);
+
+#endif
@@ -0,0 +1,321 @@
+#include <vector>
+#include <string.h>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "streambuffer.hpp"
+#include "geometrypool.hpp"
+#include "glstate.hpp"
+
+// Writes bytes to the next region of the stream and returns their offset.
+// The stream is created, or replaced by a bigger one, when they do not fit.
+static GLintptr writeStream(StreamBuffer& stream, GLenum target,
+                            const void* data, GLsizeiptr bytes)
+{
+    if (stream.buffer == 0 || bytes > stream.regionSize)
+    {
+        // Grow geometrically so a growing scene does not reallocate every
+        // rebuild
+        GLsizeiptr size = 2 * stream.regionSize;
+        if (bytes > size)
+            size = bytes;
+        deleteStreamBuffer(stream);
+        initStreamBuffer(stream, target, size);
+    }
+    memcpy(beginStreamWrite(stream), data, bytes);
+    GLintptr offset = endStreamWrite(stream, bytes);
+    // The stream binds its buffer behind the shadow state's back
+    stateBindBuffer(target, stream.buffer);
+    return offset;
+}
+
+static void pointInstanceAttributes(const GeometryPool& pool,
+                                    GLuint firstInstance)
+{
+    stateBindBuffer(GL_ARRAY_BUFFER, pool.instanceStream.buffer);
+    size_t base =
+        pool.instanceOffset + sizeof(PoolInstanceData) * firstInstance;
+    // A mat4 attribute takes 4 consecutive locations, one per column
+    for (int column = 0; column < 4; column++)
+    {
+        glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE,
+                              sizeof(PoolInstanceData),
+                              (void*)(base + sizeof(glm::vec4) * column));
+    }
+    glVertexAttribPointer(7, 1, GL_FLOAT, GL_FALSE, sizeof(PoolInstanceData),
+                          (void*)(base + sizeof(glm::mat4)));
+}
+
+int addPoolMesh(GeometryPool& pool, const std::vector<unsigned short>& indices,
+                const std::vector<glm::vec3>& vertices,
+                const std::vector<glm::vec2>& uvs,
+                const std::vector<glm::vec3>& normals)
+{
+    PoolMesh mesh;
+    mesh.indexCount = (GLsizei)indices.size();
+    mesh.firstIndex = (GLuint)pool.stagingIndices.size();
+    mesh.baseVertex = (GLint)pool.stagingVertices.size();
+    mesh.boundsMin = vertices.empty() ? glm::vec3(0.0f) : vertices[0];
+    mesh.boundsMax = mesh.boundsMin;
+    for (size_t i = 1; i < vertices.size(); i++)
+    {
+        mesh.boundsMin = glm::min(mesh.boundsMin, vertices[i]);
+        mesh.boundsMax = glm::max(mesh.boundsMax, vertices[i]);
+    }
+
+    pool.stagingIndices.insert(pool.stagingIndices.end(), indices.begin(),
+                               indices.end());
+    pool.stagingVertices.insert(pool.stagingVertices.end(), vertices.begin(),
+                                vertices.end());
+    // Keep the three vertex streams the same length even if a mesh has no
+    // UVs or normals, or the base vertex of the next mesh would be wrong
+    pool.stagingUvs.insert(pool.stagingUvs.end(), uvs.begin(), uvs.end());
+    pool.stagingUvs.resize(pool.stagingVertices.size());
+    pool.stagingNormals.insert(pool.stagingNormals.end(), normals.begin(),
+                               normals.end());
+    pool.stagingNormals.resize(pool.stagingVertices.size());
+
+    pool.meshes.push_back(mesh);
+    return (int)pool.meshes.size() - 1;
+}
+
+void uploadGeometryPool(GeometryPool& pool)
+{
+    if (pool.stagingVertices.empty() || pool.stagingIndices.empty())
+        return;
+
+    GLint previousVertexArray;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVertexArray);
+
+    glGenVertexArrays(1, &pool.vertexArray);
+    stateBindVertexArray(pool.vertexArray);
+
+    glGenBuffers(1, &pool.vertexBuffer);
+    stateBindBuffer(GL_ARRAY_BUFFER, pool.vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER,
+                 pool.stagingVertices.size() * sizeof(glm::vec3),
+                 &pool.stagingVertices[0], GL_STATIC_DRAW);
+    stateEnableVertexAttribArray(0);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+    glGenBuffers(1, &pool.uvBuffer);
+    stateBindBuffer(GL_ARRAY_BUFFER, pool.uvBuffer);
+    glBufferData(GL_ARRAY_BUFFER, pool.stagingUvs.size() * sizeof(glm::vec2),
+                 &pool.stagingUvs[0], GL_STATIC_DRAW);
+    stateEnableVertexAttribArray(1);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+    glGenBuffers(1, &pool.normalBuffer);
+    stateBindBuffer(GL_ARRAY_BUFFER, pool.normalBuffer);
+    glBufferData(GL_ARRAY_BUFFER,
+                 pool.stagingNormals.size() * sizeof(glm::vec3),
+                 &pool.stagingNormals[0], GL_STATIC_DRAW);
+    stateEnableVertexAttribArray(2);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+    glGenBuffers(1, &pool.elementBuffer);
+    stateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.elementBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                 pool.stagingIndices.size() * sizeof(unsigned short),
+                 &pool.stagingIndices[0], GL_STATIC_DRAW);
+
+    // The instance attributes are pointed at the stream once it has data
+    for (int attribute = 3; attribute <= 7; attribute++)
+    {
+        stateEnableVertexAttribArray(attribute);
+        glVertexAttribDivisor(attribute, 1);
+    }
+    pool.instanceAttributesStale = true;
+
+    stateBindVertexArray(previousVertexArray);
+
+    // Everything is on the GPU now
+    std::vector<unsigned short>().swap(pool.stagingIndices);
+    std::vector<glm::vec3>().swap(pool.stagingVertices);
+    std::vector<glm::vec2>().swap(pool.stagingUvs);
+    std::vector<glm::vec3>().swap(pool.stagingNormals);
+}
+
+bool geometryPoolHasIndirect()
+{
+    // The commands use baseInstance to find their instances, which
+    // ARB_multi_draw_indirect alone leaves reserved
+    return GLEW_ARB_multi_draw_indirect && GLEW_ARB_base_instance;
+}
+
+void setPoolInstances(GeometryPool& pool,
+                      const std::vector<PoolInstance>& instances)
+{
+    pool.instances = instances;
+    pool.instancesChanged = true;
+}
+
+bool updatePoolCommands(GeometryPool& pool,
+                        const std::vector<unsigned>& visible)
+{
+    if (!pool.instancesChanged && visible == pool.builtVisible)
+        return false;
+    pool.builtVisible = visible;
+    pool.instancesChanged = false;
+
+    pool.commands.clear();
+    if (visible.empty() || pool.vertexArray == 0)
+        return true;
+
+    // Counting sort by mesh : each command then covers a contiguous range
+    // of the instance buffer, starting at baseInstance
+    pool.meshInstances.assign(pool.meshes.size(), 0);
+    for (size_t i = 0; i < visible.size(); i++)
+        pool.meshInstances[pool.instances[visible[i]].mesh]++;
+
+    pool.nextInstance.resize(pool.meshes.size());
+    GLuint firstInstance = 0;
+    for (size_t m = 0; m < pool.meshes.size(); m++)
+    {
+        pool.nextInstance[m] = firstInstance;
+        if (pool.meshInstances[m] == 0)
+            continue;
+        PoolDrawCommand command;
+        command.count = pool.meshes[m].indexCount;
+        command.instanceCount = pool.meshInstances[m];
+        command.firstIndex = pool.meshes[m].firstIndex;
+        command.baseVertex = pool.meshes[m].baseVertex;
+        command.baseInstance = firstInstance;
+        pool.commands.push_back(command);
+        firstInstance += pool.meshInstances[m];
+    }
+
+    pool.instanceData.resize(visible.size());
+    for (size_t i = 0; i < visible.size(); i++)
+    {
+        const PoolInstance& instance = pool.instances[visible[i]];
+        PoolInstanceData& data =
+            pool.instanceData[pool.nextInstance[instance.mesh]++];
+        data.model = instance.model;
+        data.material = glm::vec4((float)instance.material, 0, 0, 0);
+    }
+
+    pool.instanceOffset =
+        writeStream(pool.instanceStream, GL_ARRAY_BUFFER, &pool.instanceData[0],
+                    pool.instanceData.size() * sizeof(PoolInstanceData));
+    pool.instanceAttributesStale = true;
+
+    if (geometryPoolHasIndirect())
+    {
+        pool.indirectOffset =
+            writeStream(pool.indirectStream, GL_DRAW_INDIRECT_BUFFER,
+                        &pool.commands[0],
+                        pool.commands.size() * sizeof(PoolDrawCommand));
+    }
+    return true;
+}
+
+// POOL_SHARED_VAO : the mesh attributes, then the instance attributes with
+// their divisors, all set again for every draw
+static void pointAllAttributes(const GeometryPool& pool, GLuint firstInstance)
+{
+    stateEnableVertexAttribArray(0);
+    stateBindBuffer(GL_ARRAY_BUFFER, pool.vertexBuffer);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    stateEnableVertexAttribArray(1);
+    stateBindBuffer(GL_ARRAY_BUFFER, pool.uvBuffer);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    stateEnableVertexAttribArray(2);
+    stateBindBuffer(GL_ARRAY_BUFFER, pool.normalBuffer);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+    stateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pool.elementBuffer);
+    for (int attribute = 3; attribute <= 7; attribute++)
+    {
+        stateEnableVertexAttribArray(attribute);
+        glVertexAttribDivisor(attribute, 1);
+    }
+    pointInstanceAttributes(pool, firstInstance);
+}
+
+// After the draws reading the streams : the regions they read may only be
+// written again once these fences have passed
+static void fenceStreams(GeometryPool& pool)
+{
+    fenceStreamWrite(pool.instanceStream);
+    if (pool.indirectStream.buffer != 0)
+        fenceStreamWrite(pool.indirectStream);
+}
+
+int drawGeometryPool(GeometryPool& pool, PoolDrawMode mode,
+                     GLuint sharedVertexArray)
+{
+    if (pool.commands.empty())
+        return 0;
+
+    if (mode == POOL_SHARED_VAO)
+    {
+        stateBindVertexArray(sharedVertexArray);
+        for (size_t i = 0; i < pool.commands.size(); i++)
+        {
+            const PoolDrawCommand& command = pool.commands[i];
+            pointAllAttributes(pool, command.baseInstance);
+            glDrawElementsInstancedBaseVertex(
+                GL_TRIANGLES, command.count, GL_UNSIGNED_SHORT,
+                (void*)(sizeof(unsigned short) * command.firstIndex),
+                command.instanceCount, command.baseVertex);
+        }
+        // The VAO is shared with non-instanced draws, leave it as we found
+        // it
+        for (int attribute = 3; attribute <= 7; attribute++)
+        {
+            glVertexAttribDivisor(attribute, 0);
+            stateDisableVertexAttribArray(attribute);
+        }
+        fenceStreams(pool);
+        return (int)pool.commands.size();
+    }
+
+    stateBindVertexArray(pool.vertexArray);
+    if (pool.instanceAttributesStale)
+    {
+        pointInstanceAttributes(pool, 0);
+        pool.instanceAttributesStale = false;
+    }
+
+    if (mode == POOL_MULTI_DRAW && pool.indirectStream.buffer != 0)
+    {
+        // The whole scene in one call, the GPU reads the commands itself
+        stateBindBuffer(GL_DRAW_INDIRECT_BUFFER, pool.indirectStream.buffer);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_SHORT,
+                                    (void*)pool.indirectOffset,
+                                    (GLsizei)pool.commands.size(), 0);
+        fenceStreams(pool);
+        return 1;
+    }
+
+    // Without base instances the instance attributes have to be moved to
+    // each command's range by hand before its draw
+    for (size_t i = 0; i < pool.commands.size(); i++)
+    {
+        const PoolDrawCommand& command = pool.commands[i];
+        pointInstanceAttributes(pool, command.baseInstance);
+        glDrawElementsInstancedBaseVertex(
+            GL_TRIANGLES, command.count, GL_UNSIGNED_SHORT,
+            (void*)(sizeof(unsigned short) * command.firstIndex),
+            command.instanceCount, command.baseVertex);
+    }
+    pointInstanceAttributes(pool, 0);
+    fenceStreams(pool);
+    return (int)pool.commands.size();
+}
+
+void deleteGeometryPool(GeometryPool& pool)
+{
+    glDeleteBuffers(1, &pool.vertexBuffer);
+    glDeleteBuffers(1, &pool.uvBuffer);
+    glDeleteBuffers(1, &pool.normalBuffer);
+    glDeleteBuffers(1, &pool.elementBuffer);
+    deleteStreamBuffer(pool.instanceStream);
+    deleteStreamBuffer(pool.indirectStream);
+    glDeleteVertexArrays(1, &pool.vertexArray);
+    // Deleting bound objects unbinds them
+    invalidateGLState();
+    pool = GeometryPool();
+}
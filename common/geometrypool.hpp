@@ -0,0 +1,133 @@
+#ifndef GEOMETRYPOOL_HPP
+#define GEOMETRYPOOL_HPP
+
+// Where one mesh lives inside the pool's shared buffers. The indices stay
+// local to the mesh; baseVertex is added to them at draw time.
+struct PoolMesh
+{
+    GLsizei indexCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    // Model space bounding box, for culling
+    glm::vec3 boundsMin;
+    glm::vec3 boundsMax;
+};
+
+// One object to draw this frame : which pooled mesh, its model matrix and
+// which of the bound textures it samples (see StandardShadingPool shaders).
+struct PoolInstance
+{
+    int mesh;
+    int material;
+    glm::mat4 model;
+};
+
+// What the instanced shaders read per instance : the model matrix columns
+// (attributes 3 to 6) and the material index (attribute 7).
+struct PoolInstanceData
+{
+    glm::mat4 model;
+    glm::vec4 material;
+};
+
+// Same layout as the GL DrawElementsIndirectCommand structure.
+struct PoolDrawCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+enum PoolDrawMode
+{
+    POOL_MULTI_DRAW,    // one glMultiDrawElementsIndirect for everything
+    POOL_DRAW_PER_MESH, // one instanced draw per command, on the pool's VAO
+    // Same, but every attribute is re-specified on a shared VAO before each
+    // draw, like the samples did before each mesh had its own VAO
+    POOL_SHARED_VAO
+};
+
+// All the meshes of a scene packed into one vertex, UV, normal and index
+// buffer behind a single VAO. Attributes 0 to 2 are the mesh data, 3 to 6
+// the per-instance model matrix and 7 the per-instance material.
+//
+// The instances and the indirect commands go through stream buffers
+// (streambuffer.hpp, to include first) : each rebuild writes the next
+// region, and the instance attributes follow it to its offset.
+struct GeometryPool
+{
+    GLuint vertexArray = 0;
+    GLuint vertexBuffer = 0;
+    GLuint uvBuffer = 0;
+    GLuint normalBuffer = 0;
+    GLuint elementBuffer = 0;
+    StreamBuffer instanceStream;
+    StreamBuffer indirectStream; // only with geometryPoolHasIndirect()
+    // Where the last rebuild wrote, in the streams
+    GLintptr instanceOffset = 0;
+    GLintptr indirectOffset = 0;
+    // The VAO's instance attributes do not point at instanceOffset yet
+    bool instanceAttributesStale = true;
+
+    std::vector<PoolMesh> meshes;
+    // The scene, from setPoolInstances()
+    std::vector<PoolInstance> instances;
+    // Rebuilt by updatePoolCommands(), one command per mesh that has at
+    // least one visible instance
+    std::vector<PoolDrawCommand> commands;
+    // What the commands were built from : nothing is rebuilt or uploaded
+    // while neither the visible list nor the instances change
+    std::vector<unsigned> builtVisible;
+    bool instancesChanged = true;
+    // Scratch space of updatePoolCommands(), kept between frames so that
+    // it does not allocate once the scene has been seen
+    std::vector<GLuint> meshInstances;
+    std::vector<GLuint> nextInstance;
+    std::vector<PoolInstanceData> instanceData;
+
+    // Filled by addPoolMesh(), released by uploadGeometryPool()
+    std::vector<unsigned short> stagingIndices;
+    std::vector<glm::vec3> stagingVertices;
+    std::vector<glm::vec2> stagingUvs;
+    std::vector<glm::vec3> stagingNormals;
+};
+
+// Appends a mesh to the pool and returns its index in pool.meshes.
+// Nothing reaches the GPU until uploadGeometryPool().
+int addPoolMesh(GeometryPool& pool, const std::vector<unsigned short>& indices,
+                const std::vector<glm::vec3>& vertices,
+                const std::vector<glm::vec2>& uvs,
+                const std::vector<glm::vec3>& normals);
+
+// Creates the shared buffers and the VAO from everything added so far.
+void uploadGeometryPool(GeometryPool& pool);
+
+// true when glMultiDrawElementsIndirect can be used (it needs both
+// ARB_multi_draw_indirect and ARB_base_instance).
+bool geometryPoolHasIndirect();
+
+// Replaces the instances of the scene, e.g. when pieces move. The next
+// updatePoolCommands() rebuilds the commands.
+void setPoolInstances(GeometryPool& pool,
+                      const std::vector<PoolInstance>& instances);
+
+// Groups the visible instances (indices into pool.instances) by mesh,
+// writes them to the instance stream and builds the matching draw
+// commands and indirect stream. Does nothing if neither the visible list
+// nor the instances changed since the last call. Returns true if it
+// rebuilt.
+bool updatePoolCommands(GeometryPool& pool,
+                        const std::vector<unsigned>& visible);
+
+// Submits the commands from the last updatePoolCommands(). POOL_MULTI_DRAW
+// falls back to POOL_DRAW_PER_MESH without driver support ;
+// POOL_SHARED_VAO needs the shared VAO. Returns the number of draw calls
+// issued. Leaves the VAO it used bound, and fences the streams' regions.
+int drawGeometryPool(GeometryPool& pool, PoolDrawMode mode,
+                     GLuint sharedVertexArray = 0);
+
+void deleteGeometryPool(GeometryPool& pool);
+
+#endif
@@ -0,0 +1,247 @@
+#include <stdio.h>
+#include <map>
+
+#include <GL/glew.h>
+
+#include "glstate.hpp"
+
+// Value of a shadowed binding that was never set, or was invalidated
+static const GLuint UNKNOWN = 0xFFFFFFFF;
+static const int MAX_TEXTURE_UNITS = 32;
+
+struct VertexArrayState
+{
+    GLuint elementBuffer = UNKNOWN;
+    unsigned enabledAttributes = 0; // one bit per attribute
+    unsigned knownAttributes = 0;   // bits we know the value of
+};
+
+static GLuint currentProgram = UNKNOWN;
+static GLuint currentVertexArray = UNKNOWN;
+static GLenum currentTextureUnit = UNKNOWN;
+static GLuint boundTextures2D[MAX_TEXTURE_UNITS];
+static bool texturesKnown = false;
+static GLenum currentBlendSource = UNKNOWN;
+static GLenum currentBlendDestination = UNKNOWN;
+static std::map<GLenum, GLuint> boundBuffers;
+static std::map<GLenum, bool> enabledCaps;
+static std::map<GLuint, VertexArrayState> vertexArrays;
+
+static GLStateStats stats;
+
+static const char* callNames[GLSTATE_CALL_COUNT] = {
+    "glUseProgram",
+    "glActiveTexture",
+    "glBindTexture",
+    "glBindBuffer",
+    "glBindVertexArray",
+    "glEnable/glDisable",
+    "glBlendFunc",
+    "glEnable/DisableVertexAttribArray",
+};
+
+// Returns true (and counts it) if the call has to be issued
+static bool changes(GLStateCall call, bool differs)
+{
+    if (differs)
+        stats.issued[call]++;
+    else
+        stats.elided[call]++;
+    return differs;
+}
+
+void stateUseProgram(GLuint program)
+{
+    if (changes(GLSTATE_USE_PROGRAM, program != currentProgram))
+    {
+        glUseProgram(program);
+        currentProgram = program;
+    }
+}
+
+void stateActiveTexture(GLenum unit)
+{
+    if (changes(GLSTATE_ACTIVE_TEXTURE, unit != currentTextureUnit))
+    {
+        glActiveTexture(unit);
+        currentTextureUnit = unit;
+    }
+}
+
+void stateBindTexture(GLenum target, GLuint texture)
+{
+    int unit = (int)currentTextureUnit - GL_TEXTURE0;
+    // Only 2D textures on a known unit are shadowed, the rest goes through
+    if (target != GL_TEXTURE_2D || currentTextureUnit == UNKNOWN ||
+        unit < 0 || unit >= MAX_TEXTURE_UNITS)
+    {
+        stats.issued[GLSTATE_BIND_TEXTURE]++;
+        glBindTexture(target, texture);
+        return;
+    }
+    if (!texturesKnown)
+    {
+        for (int i = 0; i < MAX_TEXTURE_UNITS; i++)
+            boundTextures2D[i] = UNKNOWN;
+        texturesKnown = true;
+    }
+    if (changes(GLSTATE_BIND_TEXTURE, texture != boundTextures2D[unit]))
+    {
+        glBindTexture(target, texture);
+        boundTextures2D[unit] = texture;
+    }
+}
+
+void stateBindBuffer(GLenum target, GLuint buffer)
+{
+    GLuint* bound;
+    if (target == GL_ELEMENT_ARRAY_BUFFER)
+    {
+        // Part of the VAO : unknown until we know which VAO is bound
+        if (currentVertexArray == UNKNOWN)
+        {
+            stats.issued[GLSTATE_BIND_BUFFER]++;
+            glBindBuffer(target, buffer);
+            return;
+        }
+        bound = &vertexArrays[currentVertexArray].elementBuffer;
+    }
+    else
+    {
+        std::map<GLenum, GLuint>::iterator it = boundBuffers.find(target);
+        if (it == boundBuffers.end())
+            it = boundBuffers.insert(std::make_pair(target, UNKNOWN)).first;
+        bound = &it->second;
+    }
+
+    if (changes(GLSTATE_BIND_BUFFER, buffer != *bound))
+    {
+        glBindBuffer(target, buffer);
+        *bound = buffer;
+    }
+}
+
+void stateBindVertexArray(GLuint vertexArray)
+{
+    if (changes(GLSTATE_BIND_VERTEX_ARRAY, vertexArray != currentVertexArray))
+    {
+        glBindVertexArray(vertexArray);
+        currentVertexArray = vertexArray;
+    }
+}
+
+static void setCap(GLenum cap, bool enable)
+{
+    std::map<GLenum, bool>::iterator it = enabledCaps.find(cap);
+    bool differs = it == enabledCaps.end() || it->second != enable;
+    if (changes(GLSTATE_ENABLE, differs))
+    {
+        if (enable)
+            glEnable(cap);
+        else
+            glDisable(cap);
+        enabledCaps[cap] = enable;
+    }
+}
+
+void stateEnable(GLenum cap)
+{
+    setCap(cap, true);
+}
+
+void stateDisable(GLenum cap)
+{
+    setCap(cap, false);
+}
+
+void stateBlendFunc(GLenum sfactor, GLenum dfactor)
+{
+    if (changes(GLSTATE_BLEND_FUNC, sfactor != currentBlendSource ||
+                                        dfactor != currentBlendDestination))
+    {
+        glBlendFunc(sfactor, dfactor);
+        currentBlendSource = sfactor;
+        currentBlendDestination = dfactor;
+    }
+}
+
+static void setVertexAttribArray(GLuint index, bool enable)
+{
+    if (currentVertexArray == UNKNOWN || index >= 32)
+    {
+        stats.issued[GLSTATE_ENABLE_VERTEX_ATTRIB_ARRAY]++;
+        if (enable)
+            glEnableVertexAttribArray(index);
+        else
+            glDisableVertexAttribArray(index);
+        return;
+    }
+
+    VertexArrayState& state = vertexArrays[currentVertexArray];
+    unsigned bit = 1u << index;
+    bool differs = (state.knownAttributes & bit) == 0 ||
+                   ((state.enabledAttributes & bit) != 0) != enable;
+    if (changes(GLSTATE_ENABLE_VERTEX_ATTRIB_ARRAY, differs))
+    {
+        if (enable)
+        {
+            glEnableVertexAttribArray(index);
+            state.enabledAttributes |= bit;
+        }
+        else
+        {
+            glDisableVertexAttribArray(index);
+            state.enabledAttributes &= ~bit;
+        }
+        state.knownAttributes |= bit;
+    }
+}
+
+void stateEnableVertexAttribArray(GLuint index)
+{
+    setVertexAttribArray(index, true);
+}
+
+void stateDisableVertexAttribArray(GLuint index)
+{
+    setVertexAttribArray(index, false);
+}
+
+void invalidateGLState()
+{
+    currentProgram = UNKNOWN;
+    currentVertexArray = UNKNOWN;
+    currentTextureUnit = UNKNOWN;
+    texturesKnown = false;
+    currentBlendSource = UNKNOWN;
+    currentBlendDestination = UNKNOWN;
+    boundBuffers.clear();
+    enabledCaps.clear();
+    vertexArrays.clear();
+}
+
+const GLStateStats& getGLStateStats()
+{
+    return stats;
+}
+
+void resetGLStateStats()
+{
+    stats = GLStateStats();
+}
+
+void printGLStateStats(int frames)
+{
+    if (frames <= 0)
+        frames = 1;
+    printf("GL state calls per frame (issued / elided):\n");
+    for (int call = 0; call < GLSTATE_CALL_COUNT; call++)
+    {
+        if (stats.issued[call] == 0 && stats.elided[call] == 0)
+            continue;
+        printf("  %-34s %8.1f / %8.1f\n", callNames[call],
+               stats.issued[call] / (double)frames,
+               stats.elided[call] / (double)frames);
+    }
+    resetGLStateStats();
+}
@@ -0,0 +1,54 @@
+#ifndef GLSTATE_HPP
+#define GLSTATE_HPP
+
+// A thin shadow of the GL state the samples change most often. Each call
+// compares against the last value set through this layer and skips the GL
+// call when nothing would change. Anything that changes the same state
+// behind its back (AntTweakBar, a plain glBindBuffer, deleting a bound
+// object) must be followed by invalidateGLState().
+//
+// Element buffer bindings and vertex attribute enables belong to the bound
+// VAO, so they are shadowed per VAO.
+
+enum GLStateCall
+{
+    GLSTATE_USE_PROGRAM,
+    GLSTATE_ACTIVE_TEXTURE,
+    GLSTATE_BIND_TEXTURE,
+    GLSTATE_BIND_BUFFER,
+    GLSTATE_BIND_VERTEX_ARRAY,
+    GLSTATE_ENABLE,
+    GLSTATE_BLEND_FUNC,
+    GLSTATE_ENABLE_VERTEX_ATTRIB_ARRAY,
+    GLSTATE_CALL_COUNT
+};
+
+struct GLStateStats
+{
+    unsigned issued[GLSTATE_CALL_COUNT];
+    unsigned elided[GLSTATE_CALL_COUNT];
+};
+
+void stateUseProgram(GLuint program);
+void stateActiveTexture(GLenum unit);
+void stateBindTexture(GLenum target, GLuint texture);
+void stateBindBuffer(GLenum target, GLuint buffer);
+void stateBindVertexArray(GLuint vertexArray);
+// Both count as GLSTATE_ENABLE
+void stateEnable(GLenum cap);
+void stateDisable(GLenum cap);
+void stateBlendFunc(GLenum sfactor, GLenum dfactor);
+// Both count as GLSTATE_ENABLE_VERTEX_ATTRIB_ARRAY
+void stateEnableVertexAttribArray(GLuint index);
+void stateDisableVertexAttribArray(GLuint index);
+
+// Forgets everything : the next call of each kind always reaches GL.
+void invalidateGLState();
+
+// Counts since the last resetGLStateStats().
+const GLStateStats& getGLStateStats();
+void resetGLStateStats();
+// Prints issued / elided calls per frame for each call type, then resets.
+void printGLStateStats(int frames);
+
+#endif
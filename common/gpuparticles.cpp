@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "shader.hpp"
+#include "gpuparticles.hpp"
+
+bool initGPUParticleSystem(GPUParticleSystem& system, int capacity,
+                           const char* simulationShaderPath)
+{
+    static const char* varyings[] = {"outPositionSize", "outVelocityLife"};
+    system.program = LoadTransformFeedbackShader(simulationShaderPath,
+                                                 varyings, 2);
+    GLint linked = GL_FALSE;
+    if (system.program)
+        glGetProgramiv(system.program, GL_LINK_STATUS, &linked);
+    if (!linked)
+    {
+        fprintf(stderr, "The particle simulation shader did not link\n");
+        return false;
+    }
+    system.deltaID = glGetUniformLocation(system.program, "delta");
+    system.accelerationID =
+        glGetUniformLocation(system.program, "acceleration");
+
+    system.capacity = capacity;
+    system.count = 0;
+    system.next = 0;
+    system.current = 0;
+
+    glGenBuffers(2, system.stateBuffers);
+    glGenVertexArrays(2, system.simulationArrays);
+    for (int i = 0; i < 2; i++)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, system.stateBuffers[i]);
+        glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)capacity * GPU_PARTICLE_STRIDE,
+                     NULL, GL_DYNAMIC_COPY);
+        glBindVertexArray(system.simulationArrays[i]);
+        glEnableVertexAttribArray(0);
+        glVertexAttribPointer(0, 4, GL_FLOAT, GL_FALSE, GPU_PARTICLE_STRIDE,
+                              (void*)0);
+        glEnableVertexAttribArray(1);
+        glVertexAttribPointer(1, 4, GL_FLOAT, GL_FALSE, GPU_PARTICLE_STRIDE,
+                              (void*)(4 * sizeof(float)));
+    }
+    glBindVertexArray(0);
+
+    glGenBuffers(1, &system.colorBuffer);
+    glBindBuffer(GL_ARRAY_BUFFER, system.colorBuffer);
+    glBufferData(GL_ARRAY_BUFFER, (GLsizeiptr)capacity * sizeof(unsigned), NULL,
+                 GL_STATIC_DRAW);
+    return true;
+}
+
+void spawnGPUParticle(GPUParticleSystem& system, const glm::vec3& position,
+                      const glm::vec3& velocity, float life, float size,
+                      unsigned color)
+{
+    if ((int)system.stagingColors.size() >= system.capacity)
+        return;
+    float state[8] = {position.x, position.y, position.z, size,
+                      velocity.x, velocity.y, velocity.z, life};
+    system.stagingState.insert(system.stagingState.end(), state, state + 8);
+    system.stagingColors.push_back(color);
+}
+
+// Copies staged particles [first, first + count) to the slots from slot on
+static void uploadSpawns(GPUParticleSystem& system, int slot, int first,
+                         int count)
+{
+    glBindBuffer(GL_ARRAY_BUFFER, system.stateBuffers[system.current]);
+    glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)slot * GPU_PARTICLE_STRIDE,
+                    (GLsizeiptr)count * GPU_PARTICLE_STRIDE,
+                    &system.stagingState[first * 8]);
+    glBindBuffer(GL_ARRAY_BUFFER, system.colorBuffer);
+    glBufferSubData(GL_ARRAY_BUFFER, (GLintptr)slot * sizeof(unsigned),
+                    (GLsizeiptr)count * sizeof(unsigned),
+                    &system.stagingColors[first]);
+}
+
+void updateGPUParticles(GPUParticleSystem& system, float delta,
+                        const glm::vec3& acceleration)
+{
+    // The spawns go to the state the pass reads, in one range up to the
+    // end of the ring and one from its start
+    int spawned = (int)system.stagingColors.size();
+    if (spawned > 0)
+    {
+        int first = system.next;
+        int tail = std::min(spawned, system.capacity - first);
+        uploadSpawns(system, first, 0, tail);
+        if (spawned > tail)
+            uploadSpawns(system, 0, tail, spawned - tail);
+        system.next = (first + spawned) % system.capacity;
+        system.count = std::min(system.capacity, system.count + spawned);
+        system.stagingState.clear();
+        system.stagingColors.clear();
+    }
+    if (system.count == 0)
+        return;
+
+    int source = system.current;
+    int target = 1 - source;
+    glUseProgram(system.program);
+    glUniform1f(system.deltaID, delta);
+    glUniform3f(system.accelerationID, acceleration.x, acceleration.y,
+                acceleration.z);
+    glBindVertexArray(system.simulationArrays[source]);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0,
+                     system.stateBuffers[target]);
+    glEnable(GL_RASTERIZER_DISCARD);
+    glBeginTransformFeedback(GL_POINTS);
+    glDrawArrays(GL_POINTS, 0, system.count);
+    glEndTransformFeedback();
+    glDisable(GL_RASTERIZER_DISCARD);
+    glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, 0, 0);
+    glBindVertexArray(0);
+    system.current = target;
+}
+
+void deleteGPUParticleSystem(GPUParticleSystem& system)
+{
+    glDeleteVertexArrays(2, system.simulationArrays);
+    glDeleteBuffers(2, system.stateBuffers);
+    glDeleteBuffers(1, &system.colorBuffer);
+    glDeleteProgram(system.program);
+    system = GPUParticleSystem();
+}
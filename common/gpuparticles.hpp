@@ -0,0 +1,64 @@
+#ifndef GPUPARTICLES_HPP
+#define GPUPARTICLES_HPP
+
+// Particles that live in GL buffers and are advanced by a transform
+// feedback pass : a vertex shader reads the state of every particle from
+// one buffer and the GPU writes the next state to the other, with the
+// rasterizer off. The CPU only writes the particles it spawns.
+//
+// Slots are reused in ring order, so a new particle replaces the oldest
+// one. Dead particles stay in their slot with a size of 0 : all the slots
+// spawned so far are drawn, and the dead ones make no fragments. There is
+// no sorting.
+
+// Per particle in the state buffers : position and size (the xyzs
+// attribute of Particle.vertexshader), then velocity and life left.
+static const int GPU_PARTICLE_STRIDE = 8 * sizeof(float);
+
+struct GPUParticleSystem
+{
+    int capacity = 0;
+    int count = 0;   // slots used so far, all of them drawn
+    int next = 0;    // the slot of the next spawn
+    int current = 0; // the state buffer with the latest state
+    GLuint stateBuffers[2] = {0, 0};
+    // Written once per particle when it spawns
+    GLuint colorBuffer = 0;
+    // Reads stateBuffers[i] for the simulation pass
+    GLuint simulationArrays[2] = {0, 0};
+    GLuint program = 0;
+    GLint deltaID = -1;
+    GLint accelerationID = -1;
+
+    // Spawned since the last update, from slot next on
+    std::vector<float> stagingState;
+    std::vector<unsigned> stagingColors;
+};
+
+// Loads the simulation shader and creates the buffers for capacity
+// particles. Prints why and returns false if the shader does not link.
+bool initGPUParticleSystem(GPUParticleSystem& system, int capacity,
+                           const char* simulationShaderPath);
+
+// Queues a particle for the next updateGPUParticles(). Past capacity
+// spawns in one frame, the extra particles are dropped.
+void spawnGPUParticle(GPUParticleSystem& system, const glm::vec3& position,
+                      const glm::vec3& velocity, float life, float size,
+                      unsigned color);
+
+// Uploads the queued particles with glBufferSubData, at most two ranges
+// when the ring wraps, then runs the simulation pass. Leaves the rasterizer
+// on and no vertex array bound.
+void updateGPUParticles(GPUParticleSystem& system, float delta,
+                        const glm::vec3& acceleration);
+
+// The state written by the last update, to draw from with
+// GPU_PARTICLE_STRIDE
+inline GLuint gpuParticleStateBuffer(const GPUParticleSystem& system)
+{
+    return system.stateBuffers[system.current];
+}
+
+void deleteGPUParticleSystem(GPUParticleSystem& system);
+
+#endif
@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+#include <GL/glew.h>
+
+#ifdef __linux__
+#include <dlfcn.h>
+#endif
+
+#include "headless.hpp"
+
+// The GL half of glewInit(), see below
+extern "C" GLenum GLEWAPIENTRY glewContextInit(void);
+
+void parseHeadlessOptions(int argc, char* argv[], HeadlessOptions& options)
+{
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--headless") == 0)
+        {
+            options.enabled = true;
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+                options.frames = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--size") == 0 && i + 1 < argc)
+        {
+            int width, height;
+            if (sscanf(argv[++i], "%dx%d", &width, &height) == 2 && width > 0 && height > 0)
+            {
+                options.width = width;
+                options.height = height;
+            }
+            else
+                fprintf(stderr, "Ignoring --size %s, expected WIDTHxHEIGHT\n", argv[i]);
+        }
+    }
+}
+
+static int framebufferWidth = 0;
+static int framebufferHeight = 0;
+static GLuint multisampleFramebuffer = 0;
+static GLuint colorRenderbuffer = 0;
+static GLuint depthRenderbuffer = 0;
+// Single sample copy for readHeadlessPixels(), made on first use
+static GLuint resolveFramebuffer = 0;
+static GLuint resolveRenderbuffer = 0;
+
+#ifdef __linux__
+
+// The few EGL 1.5 types and enums used here, so that neither the EGL
+// headers nor libEGL are needed to build
+typedef void* EGLDisplay;
+typedef void* EGLContext;
+typedef void* EGLConfig;
+typedef void* EGLSurface;
+typedef void* EGLDeviceEXT;
+typedef int EGLint;
+typedef unsigned EGLBoolean;
+typedef unsigned EGLenum;
+
+static const EGLint EGL_NONE = 0x3038;
+static const EGLint EGL_SUCCESS = 0x3000;
+static const EGLint EGL_SURFACE_TYPE = 0x3033;
+static const EGLint EGL_RENDERABLE_TYPE = 0x3040;
+static const EGLint EGL_OPENGL_BIT = 0x0008;
+static const EGLenum EGL_OPENGL_API = 0x30A2;
+static const EGLint EGL_CONTEXT_MAJOR_VERSION = 0x3098;
+static const EGLint EGL_CONTEXT_MINOR_VERSION = 0x30FB;
+static const EGLint EGL_CONTEXT_OPENGL_PROFILE_MASK = 0x30FD;
+static const EGLint EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT = 0x0001;
+static const EGLint EGL_CONTEXT_OPENGL_FORWARD_COMPATIBLE = 0x31B1;
+static const EGLenum EGL_PLATFORM_DEVICE_EXT = 0x313F;
+static const EGLenum EGL_PLATFORM_SURFACELESS_MESA = 0x31DD;
+
+typedef void* (*PFN_eglGetProcAddress)(const char* name);
+typedef EGLDisplay (*PFN_eglGetDisplay)(void* nativeDisplay);
+typedef EGLDisplay (*PFN_eglGetPlatformDisplayEXT)(EGLenum platform, void* nativeDisplay, const EGLint* attributes);
+typedef EGLBoolean (*PFN_eglQueryDevicesEXT)(EGLint maxDevices, EGLDeviceEXT* devices, EGLint* count);
+typedef EGLBoolean (*PFN_eglInitialize)(EGLDisplay display, EGLint* major, EGLint* minor);
+typedef EGLBoolean (*PFN_eglTerminate)(EGLDisplay display);
+typedef EGLBoolean (*PFN_eglBindAPI)(EGLenum api);
+typedef EGLBoolean (*PFN_eglChooseConfig)(EGLDisplay display, const EGLint* attributes, EGLConfig* configs, EGLint size, EGLint* count);
+typedef EGLContext (*PFN_eglCreateContext)(EGLDisplay display, EGLConfig config, EGLContext share, const EGLint* attributes);
+typedef EGLBoolean (*PFN_eglDestroyContext)(EGLDisplay display, EGLContext context);
+typedef EGLBoolean (*PFN_eglMakeCurrent)(EGLDisplay display, EGLSurface draw, EGLSurface read, EGLContext context);
+typedef EGLint (*PFN_eglGetError)();
+
+static void* libEGL = NULL;
+static PFN_eglGetProcAddress eglGetProcAddress_;
+static PFN_eglGetDisplay eglGetDisplay_;
+static PFN_eglInitialize eglInitialize_;
+static PFN_eglTerminate eglTerminate_;
+static PFN_eglBindAPI eglBindAPI_;
+static PFN_eglChooseConfig eglChooseConfig_;
+static PFN_eglCreateContext eglCreateContext_;
+static PFN_eglDestroyContext eglDestroyContext_;
+static PFN_eglMakeCurrent eglMakeCurrent_;
+static PFN_eglGetError eglGetError_;
+
+static EGLDisplay display = NULL;
+static EGLContext context = NULL;
+
+static bool loadEGL()
+{
+    libEGL = dlopen("libEGL.so.1", RTLD_NOW | RTLD_GLOBAL);
+    if (!libEGL)
+    {
+        fprintf(stderr, "Headless : cannot load libEGL.so.1 (%s)\n", dlerror());
+        return false;
+    }
+    eglGetProcAddress_ = (PFN_eglGetProcAddress)dlsym(libEGL, "eglGetProcAddress");
+    eglGetDisplay_ = (PFN_eglGetDisplay)dlsym(libEGL, "eglGetDisplay");
+    eglInitialize_ = (PFN_eglInitialize)dlsym(libEGL, "eglInitialize");
+    eglTerminate_ = (PFN_eglTerminate)dlsym(libEGL, "eglTerminate");
+    eglBindAPI_ = (PFN_eglBindAPI)dlsym(libEGL, "eglBindAPI");
+    eglChooseConfig_ = (PFN_eglChooseConfig)dlsym(libEGL, "eglChooseConfig");
+    eglCreateContext_ = (PFN_eglCreateContext)dlsym(libEGL, "eglCreateContext");
+    eglDestroyContext_ = (PFN_eglDestroyContext)dlsym(libEGL, "eglDestroyContext");
+    eglMakeCurrent_ = (PFN_eglMakeCurrent)dlsym(libEGL, "eglMakeCurrent");
+    eglGetError_ = (PFN_eglGetError)dlsym(libEGL, "eglGetError");
+    if (!eglGetProcAddress_ || !eglGetDisplay_ || !eglInitialize_ || !eglTerminate_ ||
+        !eglBindAPI_ || !eglChooseConfig_ || !eglCreateContext_ || !eglDestroyContext_ ||
+        !eglMakeCurrent_ || !eglGetError_)
+    {
+        fprintf(stderr, "Headless : libEGL.so.1 is missing EGL 1.4 entry points\n");
+        dlclose(libEGL);
+        libEGL = NULL;
+        return false;
+    }
+    return true;
+}
+
+// An initialized display that needs no window system : Mesa's surfaceless
+// platform first, then the first EGL device (NVIDIA), then the default
+// display, which may still be X11 or Wayland
+static EGLDisplay openDisplay()
+{
+    PFN_eglGetPlatformDisplayEXT getPlatformDisplay =
+        (PFN_eglGetPlatformDisplayEXT)eglGetProcAddress_("eglGetPlatformDisplayEXT");
+    PFN_eglQueryDevicesEXT queryDevices =
+        (PFN_eglQueryDevicesEXT)eglGetProcAddress_("eglQueryDevicesEXT");
+
+    std::vector<EGLDisplay> candidates;
+    if (getPlatformDisplay)
+    {
+        candidates.push_back(getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, NULL, NULL));
+        EGLDeviceEXT device;
+        EGLint deviceCount = 0;
+        if (queryDevices && queryDevices(1, &device, &deviceCount) && deviceCount > 0)
+            candidates.push_back(getPlatformDisplay(EGL_PLATFORM_DEVICE_EXT, device, NULL));
+    }
+    candidates.push_back(eglGetDisplay_(NULL));
+
+    for (size_t i = 0; i < candidates.size(); i++)
+    {
+        EGLint major, minor;
+        if (candidates[i] && eglInitialize_(candidates[i], &major, &minor))
+            return candidates[i];
+    }
+    return NULL;
+}
+
+static bool createContext()
+{
+    if (!loadEGL())
+        return false;
+    display = openDisplay();
+    if (!display)
+    {
+        fprintf(stderr, "Headless : no EGL display could be initialized\n");
+        return false;
+    }
+    if (!eglBindAPI_(EGL_OPENGL_API))
+    {
+        fprintf(stderr, "Headless : this EGL has no desktop OpenGL\n");
+        return false;
+    }
+
+    // No surface will ever be made, so any GL config does. Without one,
+    // EGL_KHR_no_config_context lets a NULL config through.
+    const EGLint configAttributes[] = {
+        EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+        EGL_SURFACE_TYPE, 0,
+        EGL_NONE
+    };
+    EGLConfig config = NULL;
+    EGLint configCount = 0;
+    if (!eglChooseConfig_(display, configAttributes, &config, 1, &configCount) || configCount == 0)
+        config = NULL;
+
+    // The same context as the GLFW hints in the samples ask for
+    const EGLint contextAttributes[] = {
+        EGL_CONTEXT_MAJOR_VERSION, 3,
+        EGL_CONTEXT_MINOR_VERSION, 3,
+        EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+        EGL_CONTEXT_OPENGL_FORWARD_COMPATIBLE, 1,
+        EGL_NONE
+    };
+    context = eglCreateContext_(display, config, NULL, contextAttributes);
+    if (!context)
+    {
+        fprintf(stderr, "Headless : cannot create an OpenGL 3.3 core context (EGL error 0x%x)\n", eglGetError_());
+        return false;
+    }
+    // EGL_KHR_surfaceless_context : current without any draw or read surface
+    if (!eglMakeCurrent_(display, NULL, NULL, context))
+    {
+        fprintf(stderr, "Headless : cannot make the context current without a surface (EGL error 0x%x)\n", eglGetError_());
+        return false;
+    }
+    return true;
+}
+
+static void destroyContext()
+{
+    if (display)
+    {
+        eglMakeCurrent_(display, NULL, NULL, NULL);
+        if (context)
+            eglDestroyContext_(display, context);
+        eglTerminate_(display);
+    }
+    context = NULL;
+    display = NULL;
+    if (libEGL)
+        dlclose(libEGL);
+    libEGL = NULL;
+}
+
+#else
+
+static bool createContext()
+{
+    fprintf(stderr, "Headless : only supported on Linux, through EGL\n");
+    return false;
+}
+
+static void destroyContext()
+{
+}
+
+#endif
+
+bool createHeadlessContext(const HeadlessOptions& options)
+{
+    if (!createContext())
+    {
+        destroyContext();
+        return false;
+    }
+
+    // Not glewInit() : without GLEW_MX it goes on to glxewInit(), which
+    // calls glXQueryVersion() on the current GLX display. An EGL context has
+    // none, so that may crash or read garbage. Only the GL entry points are
+    // needed here.
+    glewExperimental = true; // Needed for core profile
+    if (glewContextInit() != GLEW_OK)
+    {
+        fprintf(stderr, "Headless : failed to initialize GLEW\n");
+        destroyContext();
+        return false;
+    }
+    // GLEW asks for GL_EXTENSIONS the pre-3.0 way, which core
+    // profiles reject : drop that error
+    glGetError();
+
+    framebufferWidth = options.width;
+    framebufferHeight = options.height;
+    GLint maxSamples = 0;
+    glGetIntegerv(GL_MAX_SAMPLES, &maxSamples);
+    int samples = std::min(options.samples, (int)maxSamples);
+
+    glGenRenderbuffers(1, &colorRenderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, colorRenderbuffer);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_RGBA8, framebufferWidth, framebufferHeight);
+    glGenRenderbuffers(1, &depthRenderbuffer);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthRenderbuffer);
+    glRenderbufferStorageMultisample(GL_RENDERBUFFER, samples, GL_DEPTH_COMPONENT24, framebufferWidth, framebufferHeight);
+
+    glGenFramebuffers(1, &multisampleFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, multisampleFramebuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorRenderbuffer);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRenderbuffer);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+    {
+        fprintf(stderr, "Headless : the %dx%d framebuffer with %d samples is not complete\n",
+                framebufferWidth, framebufferHeight, samples);
+        destroyHeadlessContext();
+        return false;
+    }
+    glViewport(0, 0, framebufferWidth, framebufferHeight);
+
+    printf("Headless : %s, %s, %dx%d with %d samples\n", (const char*)glGetString(GL_RENDERER),
+           (const char*)glGetString(GL_VERSION), framebufferWidth, framebufferHeight, samples);
+    return true;
+}
+
+GLuint headlessFramebuffer()
+{
+    return multisampleFramebuffer;
+}
+
+void readHeadlessPixels(std::vector<unsigned char>& pixels)
+{
+    if (!resolveFramebuffer)
+    {
+        glGenRenderbuffers(1, &resolveRenderbuffer);
+        glBindRenderbuffer(GL_RENDERBUFFER, resolveRenderbuffer);
+        glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, framebufferWidth, framebufferHeight);
+        glGenFramebuffers(1, &resolveFramebuffer);
+        glBindFramebuffer(GL_FRAMEBUFFER, resolveFramebuffer);
+        glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, resolveRenderbuffer);
+    }
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, multisampleFramebuffer);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, resolveFramebuffer);
+    glBlitFramebuffer(0, 0, framebufferWidth, framebufferHeight, 0, 0, framebufferWidth, framebufferHeight,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+    pixels.resize(framebufferWidth * framebufferHeight * 4);
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, resolveFramebuffer);
+    glReadPixels(0, 0, framebufferWidth, framebufferHeight, GL_RGBA, GL_UNSIGNED_BYTE, &pixels[0]);
+    glBindFramebuffer(GL_FRAMEBUFFER, multisampleFramebuffer);
+}
+
+void destroyHeadlessContext()
+{
+    glDeleteFramebuffers(1, &resolveFramebuffer);
+    glDeleteRenderbuffers(1, &resolveRenderbuffer);
+    glDeleteFramebuffers(1, &multisampleFramebuffer);
+    glDeleteRenderbuffers(1, &colorRenderbuffer);
+    glDeleteRenderbuffers(1, &depthRenderbuffer);
+    resolveFramebuffer = resolveRenderbuffer = 0;
+    multisampleFramebuffer = colorRenderbuffer = depthRenderbuffer = 0;
+    destroyContext();
+}
@@ -0,0 +1,39 @@
+#ifndef HEADLESS_HPP
+#define HEADLESS_HPP
+
+// Rendering without a window, for benchmarks and CI machines with no
+// display : an EGL context with no surface at all (Mesa's surfaceless
+// platform, or an EGL device), and a multisampled framebuffer object that
+// takes the place of the window's back buffer. Linux only ; libEGL is
+// loaded at run time, so the samples still start where it is missing.
+
+struct HeadlessOptions
+{
+    bool enabled = false;
+    int frames = 300;
+    int width = 1024;
+    int height = 768;
+    int samples = 4; // as GLFW_SAMPLES in the samples
+};
+
+// --headless [frames] turns the mode on, --size WxH sets the resolution.
+// Other arguments are left to the caller.
+void parseHeadlessOptions(int argc, char* argv[], HeadlessOptions& options);
+
+// Creates and makes current a 3.3 core context, initializes GLEW, then
+// binds a framebuffer of options.width x options.height and sets the
+// viewport to it. Prints why and returns false if any step fails.
+bool createHeadlessContext(const HeadlessOptions& options);
+
+// What to bind instead of framebuffer 0 (the window) when the context is
+// headless.
+GLuint headlessFramebuffer();
+
+// Resolves the samples and reads the whole framebuffer back, RGBA8 rows
+// from the bottom up like glReadPixels(). Leaves headlessFramebuffer()
+// bound.
+void readHeadlessPixels(std::vector<unsigned char>& pixels);
+
+void destroyHeadlessContext();
+
+#endif
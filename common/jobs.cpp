@@ -0,0 +1,208 @@
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+
+#include "jobs.hpp"
+
+struct Job
+{
+    JobFunction function;
+    void* data;
+    int begin;
+    int end;
+    JobGroup* group;
+};
+
+// A fixed size deque : the owner pushes and pops at the back, thieves take
+// from the front. A lock per queue is plenty for chunks of thousands of
+// particles.
+static const int QUEUE_SIZE = 4096;
+
+struct JobQueue
+{
+    std::mutex mutex;
+    Job jobs[QUEUE_SIZE];
+    int front = 0; // both grow forever, wrapped on access
+    int back = 0;
+};
+
+struct JobSystem
+{
+    int threadCount;
+    std::vector<JobQueue*> queues; // one per thread, 0 is the caller's
+    std::vector<std::thread> workers;
+    // Chunks queued and not taken yet, for the workers to sleep on
+    std::atomic<int> queued;
+    std::mutex sleepMutex;
+    std::condition_variable wake;
+    bool quit;
+};
+
+static bool pushJob(JobQueue& queue, const Job& job)
+{
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.back - queue.front >= QUEUE_SIZE)
+        return false;
+    queue.jobs[queue.back++ % QUEUE_SIZE] = job;
+    return true;
+}
+
+static bool popJob(JobQueue& queue, Job& job)
+{
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.back == queue.front)
+        return false;
+    job = queue.jobs[--queue.back % QUEUE_SIZE];
+    return true;
+}
+
+static bool stealJob(JobQueue& queue, Job& job)
+{
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.back == queue.front)
+        return false;
+    job = queue.jobs[queue.front++ % QUEUE_SIZE];
+    return true;
+}
+
+// Own queue first, then the others, starting with the next thread
+static bool findJob(JobSystem& jobs, int thread, Job& job)
+{
+    if (jobs.queued.load(std::memory_order_acquire) == 0)
+        return false;
+    bool found = popJob(*jobs.queues[thread], job);
+    for (int i = 1; i < jobs.threadCount && !found; i++)
+        found = stealJob(*jobs.queues[(thread + i) % jobs.threadCount], job);
+    if (found)
+        jobs.queued.fetch_sub(1, std::memory_order_relaxed);
+    return found;
+}
+
+static void runJob(const Job& job, int thread)
+{
+    job.function(job.data, job.begin, job.end, thread);
+    job.group->remaining.fetch_sub(1, std::memory_order_release);
+}
+
+static void workerLoop(JobSystem* jobs, int thread)
+{
+    for (;;)
+    {
+        Job job;
+        if (findJob(*jobs, thread, job))
+        {
+            runJob(job, thread);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(jobs->sleepMutex);
+        jobs->wake.wait(lock, [jobs]() {
+            return jobs->quit || jobs->queued.load(std::memory_order_acquire) > 0;
+        });
+        if (jobs->quit)
+            return;
+    }
+}
+
+JobSystem* createJobSystem(int threadCount)
+{
+    if (threadCount <= 0)
+        threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+    JobSystem* jobs = new JobSystem;
+    jobs->threadCount = threadCount;
+    jobs->queued = 0;
+    jobs->quit = false;
+    for (int t = 0; t < threadCount; t++)
+        jobs->queues.push_back(new JobQueue);
+    for (int t = 1; t < threadCount; t++)
+        jobs->workers.push_back(std::thread(workerLoop, jobs, t));
+    return jobs;
+}
+
+void destroyJobSystem(JobSystem* jobs)
+{
+    if (!jobs)
+        return;
+    {
+        std::lock_guard<std::mutex> lock(jobs->sleepMutex);
+        jobs->quit = true;
+    }
+    jobs->wake.notify_all();
+    for (size_t i = 0; i < jobs->workers.size(); i++)
+        jobs->workers[i].join();
+    for (size_t i = 0; i < jobs->queues.size(); i++)
+        delete jobs->queues[i];
+    delete jobs;
+}
+
+int getJobThreadCount(const JobSystem* jobs)
+{
+    return jobs ? jobs->threadCount : 1;
+}
+
+void startJobs(JobSystem* jobs, JobGroup& group, JobFunction function,
+               void* data, int count, int chunkSize)
+{
+    if (!jobs)
+    {
+        runJobs(NULL, function, data, count, chunkSize);
+        return;
+    }
+    int chunks = (count + chunkSize - 1) / chunkSize;
+    if (chunks <= 0)
+        return;
+    group.remaining.fetch_add(chunks, std::memory_order_relaxed);
+
+    // Thread t gets chunks [chunks * t / threads, chunks * (t + 1) / threads),
+    // pushed last first so that it pops them in order
+    for (int t = 0; t < jobs->threadCount; t++)
+    {
+        int first = (int)((long long)chunks * t / jobs->threadCount);
+        int end = (int)((long long)chunks * (t + 1) / jobs->threadCount);
+        for (int c = end - 1; c >= first; c--)
+        {
+            Job job = { function, data, c * chunkSize,
+                        std::min(count, (c + 1) * chunkSize), &group };
+            if (pushJob(*jobs->queues[t], job))
+                jobs->queued.fetch_add(1, std::memory_order_release);
+            else
+                runJob(job, 0); // queue full
+        }
+    }
+    // A worker that saw nothing queued is either waiting already or will
+    // see the new chunks once it has the lock
+    {
+        std::lock_guard<std::mutex> lock(jobs->sleepMutex);
+    }
+    jobs->wake.notify_all();
+}
+
+void waitForJobs(JobSystem* jobs, JobGroup& group)
+{
+    if (!jobs)
+        return;
+    while (group.remaining.load(std::memory_order_acquire) > 0)
+    {
+        Job job;
+        if (findJob(*jobs, 0, job))
+            runJob(job, 0);
+        else
+            std::this_thread::yield(); // the last chunks are running elsewhere
+    }
+}
+
+void runJobs(JobSystem* jobs, JobFunction function, void* data, int count,
+             int chunkSize)
+{
+    if (!jobs || jobs->threadCount == 1)
+    {
+        for (int begin = 0; begin < count; begin += chunkSize)
+            function(data, begin, std::min(count, begin + chunkSize), 0);
+        return;
+    }
+    JobGroup group;
+    startJobs(jobs, group, function, data, count, chunkSize);
+    waitForJobs(jobs, group);
+}
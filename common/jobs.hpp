@@ -0,0 +1,48 @@
+#ifndef JOBS_HPP
+#define JOBS_HPP
+
+#include <atomic>
+
+// A pool of worker threads for data parallel work. A job is a function
+// called on a range of indices ; startJobs() cuts [0, count) into chunks
+// and deals them out, a contiguous run to each thread's queue so that
+// neighbouring chunks stay on one core. A thread takes its own chunks from
+// the back of its queue, and once it runs out steals from the front of the
+// others', so a thread that got cheap chunks helps the slow ones.
+//
+// The thread that created the pool is thread 0 : it runs jobs too while it
+// waits for them. Queues have a fixed size and nothing is allocated after
+// createJobSystem().
+
+// Called with [begin, end) and the index of the thread running it, from 0
+// to getJobThreadCount() - 1, for per-thread scratch space.
+typedef void (*JobFunction)(void* data, int begin, int end, int thread);
+
+// The chunks of one startJobs() call. Must stay alive until
+// waitForJobs() returns.
+struct JobGroup
+{
+    std::atomic<int> remaining;
+    JobGroup() : remaining(0) {}
+};
+
+struct JobSystem;
+
+// threadCount counts the calling thread ; 0 or less means one per hardware
+// thread.
+JobSystem* createJobSystem(int threadCount = 0);
+void destroyJobSystem(JobSystem* jobs);
+int getJobThreadCount(const JobSystem* jobs);
+
+// Queues function on [0, count) in chunks of chunkSize and returns at once.
+// Only from thread 0. With a NULL pool, runs everything before returning.
+void startJobs(JobSystem* jobs, JobGroup& group, JobFunction function,
+               void* data, int count, int chunkSize);
+// Runs queued chunks on this thread until the group is done.
+void waitForJobs(JobSystem* jobs, JobGroup& group);
+// Both : function on [0, count) with every thread. With a NULL pool, runs
+// everything on this thread.
+void runJobs(JobSystem* jobs, JobFunction function, void* data, int count,
+             int chunkSize);
+
+#endif
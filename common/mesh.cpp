@@ -0,0 +1,156 @@
+#include <stdio.h>
+#include <vector>
+
+#include <GL/glew.h>
+
+#include <GLFW/glfw3.h>
+
+#include <glm/glm.hpp>
+
+#include "glstate.hpp"
+#include "mesh.hpp"
+
+static void pointMeshAttributes(const Mesh& mesh)
+{
+    // 1rst attribute buffer : vertices
+    stateEnableVertexAttribArray(0);
+    stateBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBuffer);
+    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+    // 2nd attribute buffer : UVs
+    stateEnableVertexAttribArray(1);
+    stateBindBuffer(GL_ARRAY_BUFFER, mesh.uvBuffer);
+    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+    // 3rd attribute buffer : normals
+    stateEnableVertexAttribArray(2);
+    stateBindBuffer(GL_ARRAY_BUFFER, mesh.normalBuffer);
+    glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
+
+    // Index buffer
+    stateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.elementBuffer);
+}
+
+Mesh createMesh(const std::vector<unsigned short>& indices,
+                const std::vector<glm::vec3>& vertices,
+                const std::vector<glm::vec2>& uvs,
+                const std::vector<glm::vec3>& normals)
+{
+    Mesh mesh;
+    mesh.indexCount = (GLsizei)indices.size();
+    if (indices.empty() || vertices.empty())
+        return mesh;
+
+    // The VAO captures the element buffer binding too, so the caller's VAO
+    // must not be bound while we set this one up.
+    GLint previousVertexArray;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVertexArray);
+
+    glGenVertexArrays(1, &mesh.vertexArray);
+    stateBindVertexArray(mesh.vertexArray);
+
+    glGenBuffers(1, &mesh.vertexBuffer);
+    stateBindBuffer(GL_ARRAY_BUFFER, mesh.vertexBuffer);
+    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3),
+                 &vertices[0], GL_STATIC_DRAW);
+
+    glGenBuffers(1, &mesh.uvBuffer);
+    stateBindBuffer(GL_ARRAY_BUFFER, mesh.uvBuffer);
+    glBufferData(GL_ARRAY_BUFFER, uvs.size() * sizeof(glm::vec2),
+                 uvs.empty() ? NULL : &uvs[0], GL_STATIC_DRAW);
+
+    glGenBuffers(1, &mesh.normalBuffer);
+    stateBindBuffer(GL_ARRAY_BUFFER, mesh.normalBuffer);
+    glBufferData(GL_ARRAY_BUFFER, normals.size() * sizeof(glm::vec3),
+                 normals.empty() ? NULL : &normals[0], GL_STATIC_DRAW);
+
+    glGenBuffers(1, &mesh.elementBuffer);
+    stateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh.elementBuffer);
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+                 indices.size() * sizeof(unsigned short), &indices[0],
+                 GL_STATIC_DRAW);
+
+    pointMeshAttributes(mesh);
+
+    stateBindVertexArray(previousVertexArray);
+
+    return mesh;
+}
+
+void attachInstanceMatrices(Mesh& mesh, GLuint instanceBuffer)
+{
+    GLint previousVertexArray;
+    glGetIntegerv(GL_VERTEX_ARRAY_BINDING, &previousVertexArray);
+
+    stateBindVertexArray(mesh.vertexArray);
+    stateBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+    // A mat4 attribute takes 4 consecutive locations, one per column
+    for (int column = 0; column < 4; column++)
+    {
+        stateEnableVertexAttribArray(3 + column);
+        glVertexAttribPointer(3 + column, 4, GL_FLOAT, GL_FALSE,
+                              sizeof(glm::mat4),
+                              (void*)(sizeof(glm::vec4) * column));
+        glVertexAttribDivisor(3 + column, 1);
+    }
+
+    stateBindVertexArray(previousVertexArray);
+}
+
+void drawMesh(const Mesh& mesh)
+{
+    stateBindVertexArray(mesh.vertexArray);
+    glDrawElements(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_SHORT,
+                   (void*)0);
+}
+
+void drawMeshInstanced(const Mesh& mesh, GLsizei instanceCount)
+{
+    stateBindVertexArray(mesh.vertexArray);
+    glDrawElementsInstanced(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_SHORT,
+                            (void*)0, instanceCount);
+}
+
+void drawMeshLegacy(const Mesh& mesh, GLuint sharedVertexArray)
+{
+    stateBindVertexArray(sharedVertexArray);
+    pointMeshAttributes(mesh);
+    glDrawElements(GL_TRIANGLES, mesh.indexCount, GL_UNSIGNED_SHORT,
+                   (void*)0);
+}
+
+void deleteMesh(Mesh& mesh)
+{
+    glDeleteBuffers(1, &mesh.vertexBuffer);
+    glDeleteBuffers(1, &mesh.uvBuffer);
+    glDeleteBuffers(1, &mesh.normalBuffer);
+    glDeleteBuffers(1, &mesh.elementBuffer);
+    glDeleteVertexArrays(1, &mesh.vertexArray);
+    // Deleting bound objects unbinds them
+    invalidateGLState();
+    mesh = Mesh();
+}
+
+void updateMeshDrawToggle(MeshDrawTimer& timer, GLFWwindow* window)
+{
+    int keyState = glfwGetKey(window, GLFW_KEY_V);
+    if (keyState == GLFW_PRESS && timer.lastKeyState == GLFW_RELEASE)
+        timer.useMeshVAO = !timer.useMeshVAO;
+    timer.lastKeyState = keyState;
+}
+
+void addMeshDrawTime(MeshDrawTimer& timer, double seconds, int draws)
+{
+    timer.drawSeconds += seconds;
+    timer.drawCount += draws;
+}
+
+void printMeshDrawStats(MeshDrawTimer& timer, int frames)
+{
+    double usPerDraw = timer.drawCount > 0 ?
+        1000000.0 * timer.drawSeconds / timer.drawCount : 0.0;
+    printf("%f ms/frame, %f us/draw (%s)\n", 1000.0 / double(frames),
+           usPerDraw, timer.useMeshVAO ? "VAO per mesh" : "shared VAO");
+    timer.drawSeconds = 0.0;
+    timer.drawCount = 0;
+}
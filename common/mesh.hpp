@@ -0,0 +1,55 @@
+#ifndef MESH_HPP
+#define MESH_HPP
+
+// An indexed mesh in GPU memory : its buffers plus a vertex array object
+// that already knows the attribute layout (0 = position, 1 = UV,
+// 2 = normal), so drawing it is just "bind VAO + draw".
+struct Mesh
+{
+    GLuint vertexArray = 0;
+    GLuint vertexBuffer = 0;
+    GLuint uvBuffer = 0;
+    GLuint normalBuffer = 0;
+    GLuint elementBuffer = 0;
+    GLsizei indexCount = 0;
+};
+
+Mesh createMesh(const std::vector<unsigned short>& indices,
+                const std::vector<glm::vec3>& vertices,
+                const std::vector<glm::vec2>& uvs,
+                const std::vector<glm::vec3>& normals);
+
+// Records a per-instance mat4 buffer (attributes 3 to 6, divisor 1) into
+// the mesh's VAO. Only needs to be called again if the buffer ID changes.
+void attachInstanceMatrices(Mesh& mesh, GLuint instanceBuffer);
+
+// Both leave the mesh's VAO bound.
+void drawMesh(const Mesh& mesh);
+void drawMeshInstanced(const Mesh& mesh, GLsizei instanceCount);
+
+// The old way : re-specifies every attribute on a shared VAO before the
+// draw. Kept to measure what the per-mesh VAOs save.
+void drawMeshLegacy(const Mesh& mesh, GLuint sharedVertexArray);
+
+void deleteMesh(Mesh& mesh);
+
+struct GLFWwindow;
+
+// The V key switches between drawMesh() and drawMeshLegacy(), and the CPU
+// time per draw is reported for the mode in use. The samples time their
+// draws and pick the function themselves.
+struct MeshDrawTimer
+{
+    bool useMeshVAO = true;
+    int lastKeyState = 0; // GLFW_RELEASE
+    double drawSeconds = 0.0;
+    int drawCount = 0;
+};
+
+// Flips useMeshVAO when V was just pressed
+void updateMeshDrawToggle(MeshDrawTimer& timer, GLFWwindow* window);
+void addMeshDrawTime(MeshDrawTimer& timer, double seconds, int draws);
+// Prints the ms per frame and the us per draw since the last report
+void printMeshDrawStats(MeshDrawTimer& timer, int frames);
+
+#endif
@@ -0,0 +1,353 @@
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <cmath>
+#include <cfloat>
+
+#include <glm/glm.hpp>
+
+#include "simd.hpp"
+#include "culling.hpp"
+#include "jobs.hpp"
+#include "occlusion.hpp"
+
+void initOcclusionBuffer(OcclusionBuffer& buffer, int width, int height,
+                         int threadCount)
+{
+    buffer.width = width;
+    buffer.height = height;
+    if (threadCount <= 0)
+        threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+    buffer.threadCount = std::min(threadCount, std::max(1, height / 8));
+    destroyJobSystem(buffer.jobs);
+    buffer.jobs = buffer.threadCount > 1 ? createJobSystem(buffer.threadCount)
+                                         : NULL;
+
+    buffer.depth.assign(width * height, 1.0f);
+    buffer.levels.clear();
+    int levelWidth = width;
+    int levelHeight = height;
+    while (levelWidth > 1 || levelHeight > 1)
+    {
+        levelWidth = std::max(1, (levelWidth + 1) / 2);
+        levelHeight = std::max(1, (levelHeight + 1) / 2);
+        OcclusionLevel level;
+        level.width = levelWidth;
+        level.height = levelHeight;
+        level.minDepth.assign(levelWidth * levelHeight, 1.0f);
+        level.maxDepth.assign(levelWidth * levelHeight, 1.0f);
+        buffer.levels.push_back(level);
+    }
+    buffer.stats = OcclusionStats();
+}
+
+void deleteOcclusionBuffer(OcclusionBuffer& buffer)
+{
+    destroyJobSystem(buffer.jobs);
+    buffer.jobs = NULL;
+}
+
+void beginOcclusionFrame(OcclusionBuffer& buffer, const glm::mat4& projection,
+                         const glm::mat4& view)
+{
+    buffer.viewProjection = projection * view;
+    buffer.triangles.clear();
+    buffer.stats = OcclusionStats();
+}
+
+// Clip space to pixels, with z as window depth
+static glm::vec3 toScreen(const OcclusionBuffer& buffer, const glm::vec4& clip)
+{
+    glm::vec3 ndc = glm::vec3(clip) / clip.w;
+    return glm::vec3((ndc.x * 0.5f + 0.5f) * buffer.width,
+                     (ndc.y * 0.5f + 0.5f) * buffer.height,
+                     ndc.z * 0.5f + 0.5f);
+}
+
+static void setupTriangle(OcclusionBuffer& buffer, const glm::vec3& v0,
+                          const glm::vec3& v1, const glm::vec3& v2)
+{
+    // Twice the signed area : positive for counter-clockwise front faces
+    float area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+    if (area <= 0.0f)
+        return;
+
+    OcclusionTriangle triangle;
+    // Pixel centers are at +0.5
+    triangle.minX = std::max(0, (int)std::ceil(std::min(v0.x, std::min(v1.x, v2.x)) - 0.5f));
+    triangle.maxX = std::min(buffer.width - 1, (int)std::floor(std::max(v0.x, std::max(v1.x, v2.x)) - 0.5f));
+    triangle.minY = std::max(0, (int)std::ceil(std::min(v0.y, std::min(v1.y, v2.y)) - 0.5f));
+    triangle.maxY = std::min(buffer.height - 1, (int)std::floor(std::max(v0.y, std::max(v1.y, v2.y)) - 0.5f));
+    if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+        return;
+
+    const glm::vec3* v[3] = { &v0, &v1, &v2 };
+    for (int e = 0; e < 3; e++)
+    {
+        const glm::vec3& a = *v[e];
+        const glm::vec3& b = *v[(e + 1) % 3];
+        triangle.edgeA[e] = a.y - b.y;
+        triangle.edgeB[e] = b.x - a.x;
+        triangle.edgeC[e] = -(triangle.edgeA[e] * a.x + triangle.edgeB[e] * a.y);
+    }
+
+    // Window depth is affine in screen space
+    triangle.depthA = ((v1.z - v0.z) * (v2.y - v0.y) - (v2.z - v0.z) * (v1.y - v0.y)) / area;
+    triangle.depthB = ((v2.z - v0.z) * (v1.x - v0.x) - (v1.z - v0.z) * (v2.x - v0.x)) / area;
+    triangle.depthC = v0.z - triangle.depthA * v0.x - triangle.depthB * v0.y;
+
+    buffer.triangles.push_back(triangle);
+    buffer.stats.rasterizedTriangles++;
+}
+
+void addOccluder(OcclusionBuffer& buffer, const glm::mat4& model,
+                 const std::vector<glm::vec3>& vertices,
+                 const std::vector<unsigned short>& indices)
+{
+    glm::mat4 mvp = buffer.viewProjection * model;
+    buffer.clipVertices.resize(vertices.size());
+    for (size_t i = 0; i < vertices.size(); i++)
+        buffer.clipVertices[i] = mvp * glm::vec4(vertices[i], 1.0f);
+
+    for (size_t i = 0; i + 2 < indices.size(); i += 3)
+    {
+        buffer.stats.occluderTriangles++;
+        glm::vec4 in[3] = { buffer.clipVertices[indices[i]],
+                            buffer.clipVertices[indices[i + 1]],
+                            buffer.clipVertices[indices[i + 2]] };
+
+        // Entirely outside one of the side planes
+        bool outside = false;
+        for (int axis = 0; axis < 2 && !outside; axis++)
+        {
+            outside = (in[0][axis] > in[0].w && in[1][axis] > in[1].w && in[2][axis] > in[2].w) ||
+                      (in[0][axis] < -in[0].w && in[1][axis] < -in[1].w && in[2][axis] < -in[2].w);
+        }
+        if (outside)
+            continue;
+
+        // Clip against the near plane z = -w (Sutherland-Hodgman, so up to
+        // 4 vertices come out)
+        glm::vec4 out[4];
+        int outCount = 0;
+        for (int e = 0; e < 3; e++)
+        {
+            const glm::vec4& a = in[e];
+            const glm::vec4& b = in[(e + 1) % 3];
+            float da = a.z + a.w;
+            float db = b.z + b.w;
+            if (da >= 0.0f)
+                out[outCount++] = a;
+            if ((da >= 0.0f) != (db >= 0.0f))
+                out[outCount++] = a + (b - a) * (da / (da - db));
+        }
+        if (outCount < 3)
+            continue;
+
+        glm::vec3 screen[4];
+        for (int v = 0; v < outCount; v++)
+            screen[v] = toScreen(buffer, out[v]);
+        setupTriangle(buffer, screen[0], screen[1], screen[2]);
+        if (outCount == 4)
+            setupTriangle(buffer, screen[0], screen[2], screen[3]);
+    }
+}
+
+// Rasterizes every triangle into the rows of bands [firstBand, endBand) :
+// each thread owns its rows, so no locking is needed.
+static void rasterizeBands(void* data, int firstBand, int endBand, int)
+{
+    OcclusionBuffer* buffer = (OcclusionBuffer*)data;
+    int bandHeight =
+        (buffer->height + buffer->threadCount - 1) / buffer->threadCount;
+    int firstRow = std::min(firstBand * bandHeight, buffer->height);
+    int endRow = std::min(endBand * bandHeight, buffer->height);
+    float* depth = &buffer->depth[0];
+    int width = buffer->width;
+    std::fill(depth + firstRow * width, depth + endRow * width, 1.0f);
+
+    for (size_t t = 0; t < buffer->triangles.size(); t++)
+    {
+        const OcclusionTriangle& triangle = buffer->triangles[t];
+        int minY = std::max(triangle.minY, firstRow);
+        int maxY = std::min(triangle.maxY, endRow - 1);
+        // Start on a SIMD_WIDTH boundary so a step never crosses the row end
+        int minX = triangle.minX & ~(SIMD_WIDTH - 1);
+
+        for (int y = minY; y <= maxY; y++)
+        {
+            float py = y + 0.5f;
+            float* row = depth + y * width;
+            float rowEdge[3];
+            for (int e = 0; e < 3; e++)
+                rowEdge[e] = triangle.edgeB[e] * py + triangle.edgeC[e];
+            float rowDepth = triangle.depthB * py + triangle.depthC;
+
+#if defined(SIMD_SSE2)
+            Lanes zero = lanesSet(0.0f);
+            Lanes offsets = lanesOffsets();
+            Lanes edgeA0 = lanesSet(triangle.edgeA[0]);
+            Lanes edgeA1 = lanesSet(triangle.edgeA[1]);
+            Lanes edgeA2 = lanesSet(triangle.edgeA[2]);
+            Lanes depthA = lanesSet(triangle.depthA);
+            for (int x = minX; x <= triangle.maxX; x += SIMD_WIDTH)
+            {
+                Lanes px = lanesAdd(lanesSet(x + 0.5f), offsets);
+                Lanes e0 = lanesAdd(lanesMul(edgeA0, px), lanesSet(rowEdge[0]));
+                Lanes e1 = lanesAdd(lanesMul(edgeA1, px), lanesSet(rowEdge[1]));
+                Lanes e2 = lanesAdd(lanesMul(edgeA2, px), lanesSet(rowEdge[2]));
+                Lanes inside = lanesAnd(lanesGreaterEqual(e0, zero),
+                                        lanesAnd(lanesGreaterEqual(e1, zero),
+                                                 lanesGreaterEqual(e2, zero)));
+                if (lanesMask(inside) == 0)
+                    continue;
+                Lanes z = lanesAdd(lanesMul(depthA, px), lanesSet(rowDepth));
+                Lanes old = lanesLoad(row + x);
+                lanesStore(row + x, lanesSelect(inside, lanesMin(old, z), old));
+            }
+#else
+            for (int x = minX; x <= triangle.maxX; x++)
+            {
+                float px = x + 0.5f;
+                if (triangle.edgeA[0] * px + rowEdge[0] < 0.0f ||
+                    triangle.edgeA[1] * px + rowEdge[1] < 0.0f ||
+                    triangle.edgeA[2] * px + rowEdge[2] < 0.0f)
+                    continue;
+                row[x] = std::min(row[x], triangle.depthA * px + rowDepth);
+            }
+#endif
+        }
+    }
+}
+
+static void buildLevel(const float* sourceMin, const float* sourceMax,
+                       int sourceWidth, int sourceHeight,
+                       OcclusionLevel& level)
+{
+    for (int y = 0; y < level.height; y++)
+    {
+        int y0 = 2 * y;
+        int y1 = std::min(2 * y + 1, sourceHeight - 1);
+        for (int x = 0; x < level.width; x++)
+        {
+            int x0 = 2 * x;
+            int x1 = std::min(2 * x + 1, sourceWidth - 1);
+            int i00 = y0 * sourceWidth + x0, i01 = y0 * sourceWidth + x1;
+            int i10 = y1 * sourceWidth + x0, i11 = y1 * sourceWidth + x1;
+            level.minDepth[y * level.width + x] =
+                std::min(std::min(sourceMin[i00], sourceMin[i01]),
+                         std::min(sourceMin[i10], sourceMin[i11]));
+            level.maxDepth[y * level.width + x] =
+                std::max(std::max(sourceMax[i00], sourceMax[i01]),
+                         std::max(sourceMax[i10], sourceMax[i11]));
+        }
+    }
+}
+
+void rasterizeOccluders(OcclusionBuffer& buffer)
+{
+    runJobs(buffer.jobs, rasterizeBands, &buffer, buffer.threadCount, 1);
+
+    const float* depth = &buffer.depth[0];
+    buildLevel(depth, depth, buffer.width, buffer.height, buffer.levels[0]);
+    for (size_t l = 1; l < buffer.levels.size(); l++)
+    {
+        const OcclusionLevel& source = buffer.levels[l - 1];
+        buildLevel(&source.minDepth[0], &source.maxDepth[0], source.width,
+                   source.height, buffer.levels[l]);
+    }
+}
+
+bool isAABBOccluded(const OcclusionBuffer& buffer, const glm::vec3& min,
+                    const glm::vec3& max)
+{
+    // Screen rectangle and nearest depth of the 8 corners
+    float ndcMinX = FLT_MAX, ndcMinY = FLT_MAX, ndcMinZ = FLT_MAX;
+    float ndcMaxX = -FLT_MAX, ndcMaxY = -FLT_MAX;
+    // One corner, plus the box edges along each axis, in clip space
+    const glm::mat4& m = buffer.viewProjection;
+    glm::vec4 base = m * glm::vec4(min, 1.0f);
+    glm::vec4 edgeX = m[0] * (max.x - min.x);
+    glm::vec4 edgeY = m[1] * (max.y - min.y);
+    glm::vec4 edgeZ = m[2] * (max.z - min.z);
+    for (int c = 0; c < 8; c++)
+    {
+        glm::vec4 clip = base;
+        if (c & 1)
+            clip += edgeX;
+        if (c & 2)
+            clip += edgeY;
+        if (c & 4)
+            clip += edgeZ;
+        if (clip.z < -clip.w)
+            return false;
+        float invW = 1.0f / clip.w;
+        float x = clip.x * invW, y = clip.y * invW, z = clip.z * invW;
+        ndcMinX = std::min(ndcMinX, x);
+        ndcMaxX = std::max(ndcMaxX, x);
+        ndcMinY = std::min(ndcMinY, y);
+        ndcMaxY = std::max(ndcMaxY, y);
+        ndcMinZ = std::min(ndcMinZ, z);
+    }
+    glm::vec3 screenMin = toScreen(buffer, glm::vec4(ndcMinX, ndcMinY, ndcMinZ, 1.0f));
+    glm::vec3 screenMax = toScreen(buffer, glm::vec4(ndcMaxX, ndcMaxY, ndcMinZ, 1.0f));
+    float nearest = screenMin.z;
+
+    // Every pixel the rectangle touches
+    int x0 = std::max(0, (int)std::floor(screenMin.x));
+    int x1 = std::min(buffer.width - 1, (int)std::floor(screenMax.x));
+    int y0 = std::max(0, (int)std::floor(screenMin.y));
+    int y1 = std::min(buffer.height - 1, (int)std::floor(screenMax.y));
+    if (x0 > x1 || y0 > y1)
+        return false; // Off screen : left to the frustum culling
+
+    // Coarsest useful level : the rectangle spans at most 2x2 texels
+    int start = 0;
+    while (start + 1 < (int)buffer.levels.size() &&
+           ((x1 >> (start + 1)) - (x0 >> (start + 1)) > 1 ||
+            (y1 >> (start + 1)) - (y0 >> (start + 1)) > 1))
+        start++;
+
+    // If that is not enough, try up to two finer levels
+    for (int l = start; l >= 0 && l >= start - 2; l--)
+    {
+        const OcclusionLevel& level = buffer.levels[l];
+        int shift = l + 1;
+        bool occluded = true;
+        for (int y = y0 >> shift; y <= y1 >> shift; y++)
+        {
+            for (int x = x0 >> shift; x <= x1 >> shift; x++)
+            {
+                int i = y * level.width + x;
+                // In front of everything in this texel : the finer texels
+                // inside it can't be farther than that either
+                if (nearest <= level.minDepth[i])
+                    return false;
+                if (nearest <= level.maxDepth[i])
+                    occluded = false;
+            }
+        }
+        if (occluded)
+            return true;
+    }
+    return false;
+}
+
+int cullOccludedAABBs(OcclusionBuffer& buffer, const AABBArray& boxes,
+                      std::vector<unsigned>& visible)
+{
+    size_t kept = 0;
+    for (size_t v = 0; v < visible.size(); v++)
+    {
+        unsigned i = visible[v];
+        glm::vec3 min(boxes.minX[i], boxes.minY[i], boxes.minZ[i]);
+        glm::vec3 max(boxes.maxX[i], boxes.maxY[i], boxes.maxZ[i]);
+        buffer.stats.tested++;
+        if (isAABBOccluded(buffer, min, max))
+            buffer.stats.occluded++;
+        else
+            visible[kept++] = i;
+    }
+    visible.resize(kept);
+    return (int)kept;
+}
@@ -0,0 +1,92 @@
+#ifndef OCCLUSION_HPP
+#define OCCLUSION_HPP
+
+// Software occlusion culling : a few large, low-poly occluders (walls,
+// floors) are rasterized into a small CPU depth buffer, then the bounding
+// box of each object is tested against it before the object is drawn.
+//
+// Depth is the window depth (0 = near plane, 1 = far plane, as in the GL
+// depth buffer). The rasterizer processes SIMD_WIDTH pixels at a time (see
+// simd.hpp), and the buffer is split in horizontal bands, one per thread
+// of a job system (jobs.hpp, which must be included first).
+// After rasterization a hierarchy of half resolution levels keeps the
+// nearest and farthest depth of each 2x2 block below it, so a box is tested
+// against at most 3x3 texels whatever its size on screen.
+
+// A triangle ready to rasterize, in pixels. Pixel (x, y) is covered if the
+// three edge functions a * px + b * py + c are >= 0 at its center.
+struct OcclusionTriangle
+{
+    int minX, minY, maxX, maxY;
+    float edgeA[3], edgeB[3], edgeC[3];
+    // Depth plane : z = depthA * px + depthB * py + depthC
+    float depthA, depthB, depthC;
+};
+
+struct OcclusionLevel
+{
+    int width;
+    int height;
+    std::vector<float> minDepth;
+    std::vector<float> maxDepth;
+};
+
+struct OcclusionStats
+{
+    int occluderTriangles;   // given to addOccluder()
+    int rasterizedTriangles; // left after clipping and back face culling
+    int tested;
+    int occluded;
+};
+
+struct OcclusionBuffer
+{
+    // The width must be a multiple of 8 (the widest SIMD path)
+    int width = 256;
+    int height = 128;
+    int threadCount = 4;
+    JobSystem* jobs = NULL; // threadCount threads, created with the buffer
+    glm::mat4 viewProjection;
+    std::vector<OcclusionTriangle> triangles;
+    // Full resolution depth, row by row from the bottom of the screen
+    std::vector<float> depth;
+    // levels[0] is half the resolution of depth, levels[1] a quarter...
+    std::vector<OcclusionLevel> levels;
+    OcclusionStats stats;
+    // Scratch space for addOccluder()
+    std::vector<glm::vec4> clipVertices;
+};
+
+// Allocates the buffer and its hierarchy. threadCount 0 picks the number of
+// hardware threads, up to one band per 8 rows.
+void initOcclusionBuffer(OcclusionBuffer& buffer, int width, int height,
+                         int threadCount);
+void deleteOcclusionBuffer(OcclusionBuffer& buffer);
+
+// Starts a new frame seen through projection * view : forgets the
+// occluders and resets the stats.
+void beginOcclusionFrame(OcclusionBuffer& buffer, const glm::mat4& projection,
+                         const glm::mat4& view);
+
+// Transforms, clips against the near plane and sets up the triangles of an
+// occluder. Only front faces (counter-clockwise, as with GL_CULL_FACE) are
+// kept, so the mesh should be closed.
+void addOccluder(OcclusionBuffer& buffer, const glm::mat4& model,
+                 const std::vector<glm::vec3>& vertices,
+                 const std::vector<unsigned short>& indices);
+
+// Rasterizes the occluders on the buffer's threads, then builds the
+// hierarchy.
+void rasterizeOccluders(OcclusionBuffer& buffer);
+
+// True if the box is certainly hidden behind the occluders. Boxes that
+// cross the near plane are never occluded.
+bool isAABBOccluded(const OcclusionBuffer& buffer, const glm::vec3& min,
+                    const glm::vec3& max);
+
+// Removes the occluded boxes from visible (typically the output of
+// cullAABBs()), keeping the order. Returns visible.size().
+int cullOccludedAABBs(OcclusionBuffer& buffer, const AABBArray& boxes,
+                      std::vector<unsigned>& visible);
+
+#endif
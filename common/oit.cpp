@@ -0,0 +1,116 @@
+#include <stdio.h>
+
+#include <GL/glew.h>
+
+#include "shader.hpp"
+#include "oit.hpp"
+
+static GLuint createTarget(GLint format, GLenum channels, int width,
+                           int height)
+{
+    GLuint texture;
+    glGenTextures(1, &texture);
+    glBindTexture(GL_TEXTURE_2D, texture);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, channels,
+                 GL_FLOAT, NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    return texture;
+}
+
+bool initOIT(OITTargets& oit, int width, int height,
+             const char* compositeVertexPath,
+             const char* compositeFragmentPath)
+{
+    oit.compositeProgram =
+        LoadShaders(compositeVertexPath, compositeFragmentPath);
+    GLint linked = GL_FALSE;
+    if (oit.compositeProgram)
+        glGetProgramiv(oit.compositeProgram, GL_LINK_STATUS, &linked);
+    if (!linked)
+    {
+        fprintf(stderr, "The transparency composite shader did not link\n");
+        return false;
+    }
+    oit.accumID = glGetUniformLocation(oit.compositeProgram, "accumTexture");
+    oit.weightID = glGetUniformLocation(oit.compositeProgram, "weightTexture");
+    glGenVertexArrays(1, &oit.compositeArray);
+
+    oit.width = width;
+    oit.height = height;
+    GLint previous = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+    oit.accumTexture = createTarget(GL_RGBA16F, GL_RGBA, width, height);
+    oit.weightTexture = createTarget(GL_R16F, GL_RED, width, height);
+    glGenFramebuffers(1, &oit.framebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, oit.framebuffer);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
+                           oit.accumTexture, 0);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D,
+                           oit.weightTexture, 0);
+    GLenum drawBuffers[2] = {GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1};
+    glDrawBuffers(2, drawBuffers);
+    GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindFramebuffer(GL_FRAMEBUFFER, previous);
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+    {
+        fprintf(stderr, "The transparency targets are incomplete (0x%x)\n",
+                status);
+        return false;
+    }
+    return true;
+}
+
+void beginOIT(OITTargets& oit)
+{
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &oit.previousFramebuffer);
+    glBindFramebuffer(GL_FRAMEBUFFER, oit.framebuffer);
+    static const GLfloat accumClear[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    static const GLfloat weightClear[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    glClearBufferfv(GL_COLOR, 0, accumClear);
+    glClearBufferfv(GL_COLOR, 1, weightClear);
+
+    // Sums for the colours, the weights and the weighted alphas ; the
+    // product of the (1 - a) in the alpha of the first target. The second
+    // target has no alpha.
+    glEnable(GL_BLEND);
+    glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+    glDepthMask(GL_FALSE);
+}
+
+void endOIT(OITTargets& oit)
+{
+    glBindFramebuffer(GL_FRAMEBUFFER, oit.previousFramebuffer);
+    glDepthMask(GL_TRUE);
+    GLboolean depthTest = glIsEnabled(GL_DEPTH_TEST);
+    glDisable(GL_DEPTH_TEST);
+
+    // The average colour, as opaque as the background is hidden
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glUseProgram(oit.compositeProgram);
+    glActiveTexture(GL_TEXTURE0);
+    glBindTexture(GL_TEXTURE_2D, oit.accumTexture);
+    glUniform1i(oit.accumID, 0);
+    glActiveTexture(GL_TEXTURE1);
+    glBindTexture(GL_TEXTURE_2D, oit.weightTexture);
+    glUniform1i(oit.weightID, 1);
+    glActiveTexture(GL_TEXTURE0);
+    glBindVertexArray(oit.compositeArray);
+    glDrawArrays(GL_TRIANGLES, 0, 3);
+    glBindVertexArray(0);
+
+    if (depthTest)
+        glEnable(GL_DEPTH_TEST);
+}
+
+void deleteOIT(OITTargets& oit)
+{
+    glDeleteFramebuffers(1, &oit.framebuffer);
+    glDeleteTextures(1, &oit.accumTexture);
+    glDeleteTextures(1, &oit.weightTexture);
+    glDeleteVertexArrays(1, &oit.compositeArray);
+    glDeleteProgram(oit.compositeProgram);
+    oit = OITTargets();
+}
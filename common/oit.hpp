@@ -0,0 +1,56 @@
+#ifndef OIT_HPP
+#define OIT_HPP
+
+// Weighted blended order independent transparency (McGuire and Bavoil,
+// 2013) : transparent surfaces are drawn in any order into two targets,
+// then one pass blends their weighted average over the frame.
+//
+// Shaders drawing between beginOIT() and endOIT() write two outputs, with
+// a the alpha of the surface and w a weight that favours the surfaces
+// close to the camera (see ParticleOIT.fragmentshader in tutorial 18) :
+//   location 0 : vec4(color.rgb * a * w, a)
+//   location 1 : vec4(a * w)
+// The first target sums the weighted colours and multiplies the (1 - a)
+// of every surface, what still shows of the background. The second sums
+// the weighted alphas, to divide the colours by. The result does not
+// depend on the draw order, so there is nothing to sort ; it is exact for
+// one layer and an approximation past that, best when the surfaces have
+// about the same colour or very different depths.
+//
+// The targets have no depth buffer : only transparent surfaces are drawn
+// into them, none of them hides another.
+
+struct OITTargets
+{
+    int width = 0;
+    int height = 0;
+    GLuint framebuffer = 0;
+    GLuint accumTexture = 0;  // RGBA16F, cleared to (0, 0, 0, 1)
+    GLuint weightTexture = 0; // R16F, cleared to 0
+    GLuint compositeProgram = 0;
+    GLint accumID = -1;
+    GLint weightID = -1;
+    GLuint compositeArray = 0; // no attributes, for the full screen triangle
+    // Saved by beginOIT(), restored by endOIT()
+    GLint previousFramebuffer = 0;
+};
+
+// Creates the targets at the given size and loads the composite shaders.
+// Prints why and returns false if the shaders do not link or the targets
+// cannot be drawn to.
+bool initOIT(OITTargets& oit, int width, int height,
+             const char* compositeVertexPath,
+             const char* compositeFragmentPath);
+
+// Binds and clears the targets, and sets the blending of the two outputs.
+// Depth writes are turned off.
+void beginOIT(OITTargets& oit);
+// Goes back to the framebuffer bound before beginOIT() and blends the
+// average colour over it. Leaves depth writes on and blending on with
+// (GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA) ; the program, the vertex array
+// and the textures of units 0 and 1 are changed.
+void endOIT(OITTargets& oit);
+
+void deleteOIT(OITTargets& oit);
+
+#endif
@@ -0,0 +1,708 @@
+#include <vector>
+#include <string.h>
+#include <math.h>
+
+#include <glm/glm.hpp>
+
+#include "simd.hpp"
+#include "radixsort.hpp"
+#include "jobs.hpp"
+#include "particles.hpp"
+
+void initParticleSystem(ParticleSystem& system, int capacity)
+{
+    system.count = 0;
+    system.capacity = capacity;
+    system.posX.assign(capacity, 0.0f);
+    system.posY.assign(capacity, 0.0f);
+    system.posZ.assign(capacity, 0.0f);
+    system.velX.assign(capacity, 0.0f);
+    system.velY.assign(capacity, 0.0f);
+    system.velZ.assign(capacity, 0.0f);
+    system.life.assign(capacity, 0.0f);
+    system.size.assign(capacity, 0.0f);
+    system.color.assign(capacity, 0);
+    system.cameraDistance.assign(capacity, 0.0f);
+    system.handle.resize(capacity);
+    system.handleIndex.resize(capacity);
+    for (int i = 0; i < capacity; i++)
+    {
+        system.handle[i] = i;
+        system.handleIndex[i] = i;
+    }
+    system.handleGeneration.assign(capacity, 0);
+    system.sortOrder.assign(capacity, 0);
+    system.sortKeyBits = 16;
+    system.sortWasCoherent = false;
+    system.sortCount = 0;
+    system.sortSkipCoherent = 0;
+    system.sortMoved.assign(capacity, 1);
+    system.sortKeys.assign(capacity, 0);
+    system.sortBuffers.keys.assign(capacity, 0);
+    system.sortBuffers.indices.assign(capacity, 0);
+}
+
+ParticleHandle spawnParticle(ParticleSystem& system, const glm::vec3& position,
+                             const glm::vec3& velocity, float life, float size,
+                             unsigned color)
+{
+    ParticleHandle handle = { -1, 0 };
+    if (system.count >= system.capacity)
+        return handle;
+    int i = system.count++;
+    system.posX[i] = position.x;
+    system.posY[i] = position.y;
+    system.posZ[i] = position.z;
+    system.velX[i] = velocity.x;
+    system.velY[i] = velocity.y;
+    system.velZ[i] = velocity.z;
+    system.life[i] = life;
+    system.size[i] = size;
+    system.color[i] = color;
+    system.cameraDistance[i] = 0.0f;
+    system.sortMoved[i] = 1;
+    // The first free handle slot is already there
+    handle.slot = system.handle[i];
+    handle.generation = system.handleGeneration[handle.slot];
+    return handle;
+}
+
+int particleIndex(const ParticleSystem& system, ParticleHandle handle)
+{
+    if (handle.slot < 0 || system.handleGeneration[handle.slot] != handle.generation)
+        return -1;
+    return system.handleIndex[handle.slot];
+}
+
+void removeParticle(ParticleSystem& system, int index)
+{
+    int last = --system.count;
+    unsigned dead = system.handle[index];
+    system.handleGeneration[dead]++;
+    if (index != last)
+    {
+        system.sortMoved[index] = 1;
+        system.posX[index] = system.posX[last];
+        system.posY[index] = system.posY[last];
+        system.posZ[index] = system.posZ[last];
+        system.velX[index] = system.velX[last];
+        system.velY[index] = system.velY[last];
+        system.velZ[index] = system.velZ[last];
+        system.life[index] = system.life[last];
+        system.size[index] = system.size[last];
+        system.color[index] = system.color[last];
+        system.cameraDistance[index] = system.cameraDistance[last];
+        // The handle slots swap too, so that the dead one is free
+        system.handle[index] = system.handle[last];
+        system.handleIndex[system.handle[index]] = index;
+        system.handle[last] = dead;
+        system.handleIndex[dead] = last;
+    }
+}
+
+// Ages the particles in [begin, end). Returns how many are still alive.
+static int ageRange(ParticleSystem& system, int begin, int end, float delta)
+{
+    int alive = 0;
+    for (int i = begin; i < end; i++)
+    {
+        system.life[i] -= delta;
+        alive += system.life[i] > 0.0f ? 1 : 0;
+    }
+    return alive;
+}
+
+// Removes the particles from index on whose life ran out. The particle
+// moved in place of a dead one was aged already, and is checked in turn.
+static void killRange(ParticleSystem& system, int index)
+{
+    for (int i = index; i < system.count; i++)
+    {
+        while (i < system.count && system.life[i] <= 0.0f)
+            removeParticle(system, i);
+    }
+}
+
+// Squared distance added under the inverse laws of vortices and attractors
+static const float FORCE_SOFTENING = 1.0f;
+
+// What a field turns into once delta is known
+struct FieldStep
+{
+    float x, y, z;  // gravity : the velocity step
+    float factor;   // drag : what is left of the velocity
+    float strength; // vortex, attractor : strength * delta
+    float radius2;  // vortex, attractor : squared radius, 0 for none
+};
+
+static FieldStep fieldStep(const ForceField& field, float delta)
+{
+    FieldStep step;
+    step.x = field.direction.x * field.strength * delta;
+    step.y = field.direction.y * field.strength * delta;
+    step.z = field.direction.z * field.strength * delta;
+    step.factor = glm::max(0.0f, 1.0f - field.strength * delta);
+    step.strength = field.strength * delta;
+    step.radius2 = field.radius * field.radius;
+    return step;
+}
+
+// Changes the velocity of one particle at position p by all the fields. The
+// operations are in the order of the SIMD version, for the same results.
+static void applyFields(const ForceField* fields, int fieldCount, float delta,
+                        float px, float py, float pz,
+                        float& vx, float& vy, float& vz)
+{
+    for (int f = 0; f < fieldCount; f++)
+    {
+        const ForceField& field = fields[f];
+        FieldStep step = fieldStep(field, delta);
+        if (field.type == FORCE_GRAVITY)
+        {
+            vx += step.x;
+            vy += step.y;
+            vz += step.z;
+        }
+        else if (field.type == FORCE_DRAG)
+        {
+            vx *= step.factor;
+            vy *= step.factor;
+            vz *= step.factor;
+        }
+        else if (field.type == FORCE_VORTEX)
+        {
+            // Around the axis : the part of p - center across it, turned
+            const glm::vec3& a = field.direction;
+            float rx = px - field.position.x;
+            float ry = py - field.position.y;
+            float rz = pz - field.position.z;
+            float along = rx * a.x + ry * a.y + rz * a.z;
+            float qx = rx - a.x * along;
+            float qy = ry - a.y * along;
+            float qz = rz - a.z * along;
+            float q2 = qx * qx + qy * qy + qz * qz;
+            float s = step.strength / (q2 + FORCE_SOFTENING);
+            if (step.radius2 > 0.0f && !(q2 < step.radius2))
+                s = 0.0f;
+            vx += (a.y * qz - a.z * qy) * s;
+            vy += (a.z * qx - a.x * qz) * s;
+            vz += (a.x * qy - a.y * qx) * s;
+        }
+        else
+        {
+            float dx = field.position.x - px;
+            float dy = field.position.y - py;
+            float dz = field.position.z - pz;
+            float d2 = dx * dx + dy * dy + dz * dz;
+            float q = d2 + FORCE_SOFTENING;
+            float s = step.strength / (q * sqrtf(q));
+            if (step.radius2 > 0.0f && !(d2 < step.radius2))
+                s = 0.0f;
+            vx += dx * s;
+            vy += dy * s;
+            vz += dz * s;
+        }
+    }
+}
+
+// Integrates the particles in [begin, end) and writes them to the buffers
+static void integrateRange(ParticleSystem& system, int begin, int end,
+                           float delta, const glm::vec3& acceleration,
+                           const ForceField* fields, int fieldCount,
+                           const glm::vec3& cameraPosition,
+                           float* positionSize, unsigned* color)
+{
+    glm::vec3 velocityStep = acceleration * delta;
+    for (int i = begin; i < end; i++)
+    {
+        glm::vec3 velocity(system.velX[i], system.velY[i], system.velZ[i]);
+        glm::vec3 position(system.posX[i], system.posY[i], system.posZ[i]);
+        applyFields(fields, fieldCount, delta, position.x, position.y,
+                    position.z, velocity.x, velocity.y, velocity.z);
+        velocity += velocityStep;
+        position += velocity * delta;
+        glm::vec3 toCamera = position - cameraPosition;
+
+        system.posX[i] = position.x;
+        system.posY[i] = position.y;
+        system.posZ[i] = position.z;
+        system.velX[i] = velocity.x;
+        system.velY[i] = velocity.y;
+        system.velZ[i] = velocity.z;
+        system.cameraDistance[i] = glm::dot(toCamera, toCamera);
+
+        if (!positionSize)
+            continue;
+        positionSize[4 * i + 0] = position.x;
+        positionSize[4 * i + 1] = position.y;
+        positionSize[4 * i + 2] = position.z;
+        positionSize[4 * i + 3] = system.size[i];
+        color[i] = system.color[i];
+    }
+}
+
+int updateParticlesScalar(ParticleSystem& system, float delta,
+                          const glm::vec3& acceleration,
+                          const glm::vec3& cameraPosition,
+                          float* positionSize, unsigned* color,
+                          const ForceField* fields, int fieldCount)
+{
+    ageRange(system, 0, system.count, delta);
+    killRange(system, 0);
+    integrateRange(system, 0, system.count, delta, acceleration, fields,
+                   fieldCount, cameraPosition, positionSize, color);
+    return system.count;
+}
+
+#if defined(SIMD_SSE2)
+
+// Writes 4 particles as x, y, z, size : a 4x4 transpose
+static inline void storeInterleaved4(float* out, __m128 x, __m128 y,
+                                     __m128 z, __m128 s)
+{
+    _MM_TRANSPOSE4_PS(x, y, z, s);
+    _mm_storeu_ps(out + 0, x);
+    _mm_storeu_ps(out + 4, y);
+    _mm_storeu_ps(out + 8, z);
+    _mm_storeu_ps(out + 12, s);
+}
+
+static inline void storeInterleaved(float* out, Lanes x, Lanes y, Lanes z,
+                                    Lanes s)
+{
+#if defined(SIMD_AVX2)
+    storeInterleaved4(out, _mm256_castps256_ps128(x), _mm256_castps256_ps128(y),
+                      _mm256_castps256_ps128(z), _mm256_castps256_ps128(s));
+    storeInterleaved4(out + 16, _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1),
+                      _mm256_extractf128_ps(z, 1), _mm256_extractf128_ps(s, 1));
+#else
+    storeInterleaved4(out, x, y, z, s);
+#endif
+}
+
+static inline int countLanes(int mask)
+{
+    int count = 0;
+    for (; mask; mask &= mask - 1)
+        count++;
+    return count;
+}
+
+static int ageParticles(ParticleSystem& system, int begin, int end,
+                        float delta)
+{
+    Lanes zero = lanesSet(0.0f);
+    Lanes dt = lanesSet(delta);
+    int alive = 0;
+    int i = begin;
+    for (; i + SIMD_WIDTH <= end; i += SIMD_WIDTH)
+    {
+        Lanes life = lanesSub(lanesLoad(&system.life[i]), dt);
+        lanesStore(&system.life[i], life);
+        alive += countLanes(lanesMask(lanesLess(zero, life)));
+    }
+    return alive + ageRange(system, i, end, delta);
+}
+
+// A few particles die each frame : the blocks without any are skipped
+static void killParticles(ParticleSystem& system)
+{
+    Lanes zero = lanesSet(0.0f);
+    int i = 0;
+    while (i + SIMD_WIDTH <= system.count)
+    {
+        if (lanesMask(lanesGreaterEqual(zero, lanesLoad(&system.life[i]))) == 0)
+        {
+            i += SIMD_WIDTH;
+            continue;
+        }
+        int end = i + SIMD_WIDTH;
+        for (; i < end && i < system.count; i++)
+        {
+            while (i < system.count && system.life[i] <= 0.0f)
+                removeParticle(system, i);
+        }
+    }
+    killRange(system, i);
+}
+
+// applyFields() on a register of particles
+static inline void applyFieldLanes(const ForceField* fields, int fieldCount,
+                                   float delta, Lanes px, Lanes py, Lanes pz,
+                                   Lanes& vx, Lanes& vy, Lanes& vz)
+{
+    for (int f = 0; f < fieldCount; f++)
+    {
+        const ForceField& field = fields[f];
+        FieldStep step = fieldStep(field, delta);
+        if (field.type == FORCE_GRAVITY)
+        {
+            vx = lanesAdd(vx, lanesSet(step.x));
+            vy = lanesAdd(vy, lanesSet(step.y));
+            vz = lanesAdd(vz, lanesSet(step.z));
+            continue;
+        }
+        if (field.type == FORCE_DRAG)
+        {
+            Lanes factor = lanesSet(step.factor);
+            vx = lanesMul(vx, factor);
+            vy = lanesMul(vy, factor);
+            vz = lanesMul(vz, factor);
+            continue;
+        }
+        Lanes strength = lanesSet(step.strength);
+        Lanes softening = lanesSet(FORCE_SOFTENING);
+        if (field.type == FORCE_VORTEX)
+        {
+            Lanes ax = lanesSet(field.direction.x);
+            Lanes ay = lanesSet(field.direction.y);
+            Lanes az = lanesSet(field.direction.z);
+            Lanes rx = lanesSub(px, lanesSet(field.position.x));
+            Lanes ry = lanesSub(py, lanesSet(field.position.y));
+            Lanes rz = lanesSub(pz, lanesSet(field.position.z));
+            Lanes along = lanesAdd(lanesAdd(lanesMul(rx, ax), lanesMul(ry, ay)), lanesMul(rz, az));
+            Lanes qx = lanesSub(rx, lanesMul(ax, along));
+            Lanes qy = lanesSub(ry, lanesMul(ay, along));
+            Lanes qz = lanesSub(rz, lanesMul(az, along));
+            Lanes q2 = lanesAdd(lanesAdd(lanesMul(qx, qx), lanesMul(qy, qy)), lanesMul(qz, qz));
+            Lanes s = lanesDiv(strength, lanesAdd(q2, softening));
+            if (step.radius2 > 0.0f)
+                s = lanesAnd(lanesLess(q2, lanesSet(step.radius2)), s);
+            vx = lanesAdd(vx, lanesMul(lanesSub(lanesMul(ay, qz), lanesMul(az, qy)), s));
+            vy = lanesAdd(vy, lanesMul(lanesSub(lanesMul(az, qx), lanesMul(ax, qz)), s));
+            vz = lanesAdd(vz, lanesMul(lanesSub(lanesMul(ax, qy), lanesMul(ay, qx)), s));
+            continue;
+        }
+        Lanes dx = lanesSub(lanesSet(field.position.x), px);
+        Lanes dy = lanesSub(lanesSet(field.position.y), py);
+        Lanes dz = lanesSub(lanesSet(field.position.z), pz);
+        Lanes d2 = lanesAdd(lanesAdd(lanesMul(dx, dx), lanesMul(dy, dy)), lanesMul(dz, dz));
+        Lanes q = lanesAdd(d2, softening);
+        Lanes s = lanesDiv(strength, lanesMul(q, lanesSqrt(q)));
+        if (step.radius2 > 0.0f)
+            s = lanesAnd(lanesLess(d2, lanesSet(step.radius2)), s);
+        vx = lanesAdd(vx, lanesMul(dx, s));
+        vy = lanesAdd(vy, lanesMul(dy, s));
+        vz = lanesAdd(vz, lanesMul(dz, s));
+    }
+}
+
+static void integrateParticles(ParticleSystem& system, int begin, int end,
+                               float delta, const glm::vec3& acceleration,
+                               const ForceField* fields, int fieldCount,
+                               const glm::vec3& cameraPosition,
+                               float* positionSize, unsigned* color)
+{
+    Lanes dt = lanesSet(delta);
+    Lanes stepX = lanesSet(acceleration.x * delta);
+    Lanes stepY = lanesSet(acceleration.y * delta);
+    Lanes stepZ = lanesSet(acceleration.z * delta);
+    Lanes cameraX = lanesSet(cameraPosition.x);
+    Lanes cameraY = lanesSet(cameraPosition.y);
+    Lanes cameraZ = lanesSet(cameraPosition.z);
+    int i = begin;
+    for (; i + SIMD_WIDTH <= end; i += SIMD_WIDTH)
+    {
+        Lanes velX = lanesLoad(&system.velX[i]);
+        Lanes velY = lanesLoad(&system.velY[i]);
+        Lanes velZ = lanesLoad(&system.velZ[i]);
+        Lanes posX = lanesLoad(&system.posX[i]);
+        Lanes posY = lanesLoad(&system.posY[i]);
+        Lanes posZ = lanesLoad(&system.posZ[i]);
+        applyFieldLanes(fields, fieldCount, delta, posX, posY, posZ, velX,
+                        velY, velZ);
+        velX = lanesAdd(velX, stepX);
+        velY = lanesAdd(velY, stepY);
+        velZ = lanesAdd(velZ, stepZ);
+        posX = lanesAdd(posX, lanesMul(velX, dt));
+        posY = lanesAdd(posY, lanesMul(velY, dt));
+        posZ = lanesAdd(posZ, lanesMul(velZ, dt));
+        Lanes dx = lanesSub(posX, cameraX);
+        Lanes dy = lanesSub(posY, cameraY);
+        Lanes dz = lanesSub(posZ, cameraZ);
+        Lanes distance = lanesAdd(lanesAdd(lanesMul(dx, dx), lanesMul(dy, dy)), lanesMul(dz, dz));
+
+        lanesStore(&system.posX[i], posX);
+        lanesStore(&system.posY[i], posY);
+        lanesStore(&system.posZ[i], posZ);
+        lanesStore(&system.velX[i], velX);
+        lanesStore(&system.velY[i], velY);
+        lanesStore(&system.velZ[i], velZ);
+        lanesStore(&system.cameraDistance[i], distance);
+        if (!positionSize)
+            continue;
+        storeInterleaved(positionSize + 4 * i, posX, posY, posZ,
+                         lanesLoad(&system.size[i]));
+        for (int j = 0; j < SIMD_WIDTH; j++)
+            color[i + j] = system.color[i + j];
+    }
+    // The last few particles that do not fill a register
+    integrateRange(system, i, end, delta, acceleration, fields, fieldCount,
+                   cameraPosition, positionSize, color);
+}
+
+#else
+
+static int ageParticles(ParticleSystem& system, int begin, int end,
+                        float delta)
+{
+    return ageRange(system, begin, end, delta);
+}
+
+static void killParticles(ParticleSystem& system)
+{
+    killRange(system, 0);
+}
+
+static void integrateParticles(ParticleSystem& system, int begin, int end,
+                               float delta, const glm::vec3& acceleration,
+                               const ForceField* fields, int fieldCount,
+                               const glm::vec3& cameraPosition,
+                               float* positionSize, unsigned* color)
+{
+    integrateRange(system, begin, end, delta, acceleration, fields,
+                   fieldCount, cameraPosition, positionSize, color);
+}
+
+#endif
+
+int updateParticles(ParticleSystem& system, float delta,
+                    const glm::vec3& acceleration,
+                    const glm::vec3& cameraPosition,
+                    float* positionSize, unsigned* color,
+                    const ForceField* fields, int fieldCount)
+{
+    ageParticles(system, 0, system.count, delta);
+    killParticles(system);
+    integrateParticles(system, 0, system.count, delta, acceleration, fields,
+                       fieldCount, cameraPosition, positionSize, color);
+    return system.count;
+}
+
+// Ages and integrates a chunk, counting its live particles. The dead ones
+// are integrated too : it is cheaper than skipping them.
+static void updateChunkJob(void* data, int begin, int end, int)
+{
+    ParticleUpdate& update = *(ParticleUpdate*)data;
+    ParticleSystem& system = *update.system;
+    update.chunkAlive[begin / PARTICLE_CHUNK_SIZE] =
+        ageParticles(system, begin, end, update.delta);
+    integrateParticles(system, begin, end, update.delta, update.acceleration,
+                       update.fields, update.fieldCount,
+                       update.cameraPosition, NULL, NULL);
+}
+
+// Writes the live particles of a chunk at its offset in the buffers
+static void writeChunkJob(void* data, int begin, int end, int)
+{
+    ParticleUpdate& update = *(ParticleUpdate*)data;
+    const ParticleSystem& system = *update.system;
+    int w = update.chunkAlive[begin / PARTICLE_CHUNK_SIZE];
+    for (int i = begin; i < end; i++)
+    {
+        if (system.life[i] <= 0.0f)
+            continue;
+        update.positionSize[4 * w + 0] = system.posX[i];
+        update.positionSize[4 * w + 1] = system.posY[i];
+        update.positionSize[4 * w + 2] = system.posZ[i];
+        update.positionSize[4 * w + 3] = system.size[i];
+        update.color[w] = system.color[i];
+        w++;
+    }
+}
+
+void startParticleUpdate(ParticleUpdate& update, JobSystem* jobs,
+                         ParticleSystem& system, float delta,
+                         const glm::vec3& acceleration,
+                         const glm::vec3& cameraPosition,
+                         float* positionSize, unsigned* color,
+                         const ForceField* fields, int fieldCount)
+{
+    update.system = &system;
+    update.delta = delta;
+    update.acceleration = acceleration;
+    update.cameraPosition = cameraPosition;
+    update.positionSize = positionSize;
+    update.color = color;
+    update.fields = fields;
+    update.fieldCount = fieldCount;
+    update.count = system.count;
+    int chunks = (system.capacity + PARTICLE_CHUNK_SIZE - 1) / PARTICLE_CHUNK_SIZE;
+    if ((int)update.chunkAlive.size() < chunks)
+        update.chunkAlive.resize(chunks);
+    startJobs(jobs, update.group, updateChunkJob, &update, system.count,
+              PARTICLE_CHUNK_SIZE);
+}
+
+int finishParticleUpdate(ParticleUpdate& update, JobSystem* jobs)
+{
+    waitForJobs(jobs, update.group);
+    ParticleSystem& system = *update.system;
+
+    if (update.positionSize)
+    {
+        // Live particles per chunk to offsets
+        int chunks = (update.count + PARTICLE_CHUNK_SIZE - 1) / PARTICLE_CHUNK_SIZE;
+        int offset = 0;
+        for (int c = 0; c < chunks; c++)
+        {
+            int alive = update.chunkAlive[c];
+            update.chunkAlive[c] = offset;
+            offset += alive;
+        }
+        runJobs(jobs, writeChunkJob, &update, update.count, PARTICLE_CHUNK_SIZE);
+    }
+
+    killParticles(system);
+    return system.count;
+}
+
+// Far particles get small keys. Distances are positive, so their bits
+// compare like integers ; 16 bits keep 7 bits of mantissa, less than 1%
+// of the distance.
+static inline unsigned sortKey(float distance, int keyBits)
+{
+    unsigned bits;
+    memcpy(&bits, &distance, 4);
+    if (keyBits == 16)
+        return 0xFFFF - (bits >> 16);
+    return ~bits;
+}
+
+// Merges the sorted pairs [0, middle) and [middle, count) through the
+// scratch arrays. On equal keys the first run goes first.
+static void mergeSorted(unsigned* keys, unsigned* indices, int middle,
+                        int count, RadixSortBuffers& buffers)
+{
+    unsigned* mergedKeys = &buffers.keys[0];
+    unsigned* mergedIndices = &buffers.indices[0];
+    int a = 0, b = middle, out = 0;
+    while (a < middle && b < count)
+    {
+        int from = keys[b] < keys[a] ? b++ : a++;
+        mergedKeys[out] = keys[from];
+        mergedIndices[out++] = indices[from];
+    }
+    for (; a < middle; a++, out++)
+    {
+        mergedKeys[out] = keys[a];
+        mergedIndices[out] = indices[a];
+    }
+    for (; b < count; b++, out++)
+    {
+        mergedKeys[out] = keys[b];
+        mergedIndices[out] = indices[b];
+    }
+    memcpy(keys, mergedKeys, count * sizeof(unsigned));
+    memcpy(indices, mergedIndices, count * sizeof(unsigned));
+}
+
+static void sortKeysJob(void* data, int begin, int end, int)
+{
+    ParticleSystem& system = *(ParticleSystem*)data;
+    for (int k = begin; k < end; k++)
+        system.sortKeys[k] = sortKey(system.cameraDistance[system.sortOrder[k]],
+                                     system.sortKeyBits);
+}
+
+void sortParticles(ParticleSystem& system, JobSystem* jobs)
+{
+    unsigned* order = &system.sortOrder[0];
+    unsigned* keys = &system.sortKeys[0];
+    unsigned char* moved = &system.sortMoved[0];
+    int count = system.count;
+
+    // The previous order, without the particles that died, moved or
+    // spawned since. The particle at an index that is not marked is the
+    // one that was there.
+    int survivors = 0;
+    for (int k = 0; k < system.sortCount; k++)
+    {
+        unsigned index = order[k];
+        if ((int)index < count && !moved[index])
+            order[survivors++] = index;
+    }
+    // Then the others
+    int sorted = survivors;
+    for (int i = 0; i < count; i++)
+    {
+        if (moved[i])
+        {
+            order[sorted++] = i;
+            moved[i] = 0;
+        }
+    }
+
+    runJobs(jobs, sortKeysJob, &system, count, PARTICLE_CHUNK_SIZE);
+
+    // The survivors moved a little since the last frame : an insertion
+    // sort beats the 2 or 4 passes of the radix sort while it moves them
+    // less than about 4 places each on average. The others are sorted on
+    // their own and merged in, since each one would move far. When the
+    // insertion sort gives up, the next few frames go straight to the
+    // radix sort : dense or fast particles overtake too many others. The
+    // fountain of tutorial18 always ends there ; slow smoke and hanging
+    // dust stay on this path (see the sort benchmark of misc06).
+    system.sortWasCoherent = false;
+    if (system.sortSkipCoherent > 0)
+        system.sortSkipCoherent--;
+    else if (survivors > 0)
+    {
+        system.sortWasCoherent = insertionSort(keys, order, survivors, 4LL * survivors);
+        if (!system.sortWasCoherent)
+            system.sortSkipCoherent = 15;
+    }
+    if (!system.sortWasCoherent)
+    {
+        radixSort(keys, order, count, system.sortKeyBits, system.sortBuffers);
+    }
+    else if (survivors < count)
+    {
+        radixSort(keys + survivors, order + survivors, count - survivors,
+                  system.sortKeyBits, system.sortBuffers);
+        mergeSorted(keys, order, survivors, count, system.sortBuffers);
+    }
+    system.sortCount = count;
+}
+
+void forgetParticleOrder(ParticleSystem& system)
+{
+    system.sortCount = 0;
+    system.sortSkipCoherent = 0;
+    for (int i = 0; i < system.count; i++)
+        system.sortMoved[i] = 1;
+}
+
+struct WriteParticlesJob
+{
+    const ParticleSystem* system;
+    const unsigned* order;
+    float* positionSize;
+    unsigned* color;
+};
+
+static inline void writeParticle(const WriteParticlesJob& job, int k,
+                                 unsigned i)
+{
+    const ParticleSystem& system = *job.system;
+    job.positionSize[4 * k + 0] = system.posX[i];
+    job.positionSize[4 * k + 1] = system.posY[i];
+    job.positionSize[4 * k + 2] = system.posZ[i];
+    job.positionSize[4 * k + 3] = system.size[i];
+    job.color[k] = system.color[i];
+}
+
+static void writeParticlesJob(void* data, int begin, int end, int)
+{
+    WriteParticlesJob& job = *(WriteParticlesJob*)data;
+    for (int k = begin; k < end; k++)
+        writeParticle(job, k, job.order[k]);
+}
+
+void writeSortedParticles(const ParticleSystem& system, float* positionSize,
+                          unsigned* color, JobSystem* jobs)
+{
+    WriteParticlesJob job = { &system, &system.sortOrder[0], positionSize,
+                              color };
+    runJobs(jobs, writeParticlesJob, &job, system.count, PARTICLE_CHUNK_SIZE);
+}
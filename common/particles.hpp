@@ -0,0 +1,169 @@
+#ifndef PARTICLES_HPP
+#define PARTICLES_HPP
+
+// Particles stored as a structure of arrays, one array per component, so
+// that the update kernel loads 8 (AVX2) or 4 (SSE2) particles with one
+// instruction per component. The live particles are always the first count
+// entries : a particle that dies is replaced by the last live one, so
+// spawning is O(1) and nothing ever looks at the free slots.
+//
+// Since particles move when others die, whatever follows a particle (a
+// light, a trail, a sound) keeps a ParticleHandle instead of an index.
+struct ParticleHandle
+{
+    int slot;
+    unsigned generation; // changes when the particle dies
+};
+
+struct ParticleSystem
+{
+    int count;
+    int capacity;
+    std::vector<float> posX, posY, posZ;
+    std::vector<float> velX, velY, velZ;
+    std::vector<float> life; // seconds left
+    std::vector<float> size;
+    std::vector<unsigned> color; // RGBA bytes, see packParticleColor()
+    // *Squared* distance to the camera, from the last update
+    std::vector<float> cameraDistance;
+    // The handle slot of each particle. Past count, the free handle slots.
+    std::vector<unsigned> handle;
+    // Per handle slot : the index of its particle, and its generation
+    std::vector<unsigned> handleIndex;
+    std::vector<unsigned> handleGeneration;
+    // Draw order from sortParticles() : indices of the live particles,
+    // the farthest first
+    std::vector<unsigned> sortOrder;
+    // 16 (the default) or 32 bits of the camera distance to sort on
+    int sortKeyBits;
+    // Whether the last sort only had to fix up the previous order, and for
+    // how many sorts not to try after that failed
+    bool sortWasCoherent;
+    int sortSkipCoherent;
+    // Entries of sortOrder from the last sort, and the indices whose
+    // particle changed since (spawned, or moved in place of a dead one)
+    int sortCount;
+    std::vector<unsigned char> sortMoved;
+    std::vector<unsigned> sortKeys;
+    RadixSortBuffers sortBuffers;
+};
+
+void initParticleSystem(ParticleSystem& system, int capacity);
+
+// The 4 bytes in memory order on little endian machines, as
+// GL_UNSIGNED_BYTE vertex attributes read them
+inline unsigned packParticleColor(unsigned char r, unsigned char g,
+                                  unsigned char b, unsigned char a)
+{
+    return r | (g << 8) | (b << 16) | ((unsigned)a << 24);
+}
+
+// Returns the handle of the new particle, with a slot of -1 when the
+// system is full : new particles never replace live ones.
+ParticleHandle spawnParticle(ParticleSystem& system, const glm::vec3& position,
+                             const glm::vec3& velocity, float life, float size,
+                             unsigned color);
+
+// Forces on top of the uniform acceleration of an update, evaluated in the
+// same pass as the integration, for a register of particles at a time.
+enum ForceFieldType
+{
+    FORCE_GRAVITY,   // strength along direction, everywhere
+    FORCE_DRAG,      // takes strength times the velocity away, per second
+    FORCE_VORTEX,    // turns around the axis through position along direction
+    FORCE_ATTRACTOR, // pulls towards position, with the inverse square law
+};
+
+// Vortices and attractors stop growing within about 1 unit of their
+// center, and have no effect past radius unless it is 0. A negative
+// strength pushes away, or turns the other way.
+struct ForceField
+{
+    ForceFieldType type;
+    glm::vec3 position;
+    glm::vec3 direction; // unit length
+    float strength;
+    float radius;
+};
+
+// The current index of the particle, or -1 once it is dead
+int particleIndex(const ParticleSystem& system, ParticleHandle handle);
+
+// Removes the particle at index, moving the last one in its place
+void removeParticle(ParticleSystem& system, int index);
+
+// Ages the particles by delta seconds, removes the ones whose life ran out,
+// applies the force fields then the acceleration and moves the others,
+// then computes their distance to the camera. The live particles are
+// written to the upload buffers as they go, in their order in the system :
+// x, y, z, size floats to positionSize and the packed colours to color,
+// both with room for count entries, unless they are NULL. Returns the new count.
+// Only the first count entries are touched, however large the capacity.
+// Uses AVX2 (8 at a time) or SSE2 (4 at a time) when available, see simd.hpp.
+int updateParticles(ParticleSystem& system, float delta,
+                    const glm::vec3& acceleration,
+                    const glm::vec3& cameraPosition,
+                    float* positionSize, unsigned* color,
+                    const ForceField* fields = NULL, int fieldCount = 0);
+
+// One particle at a time, the reference the SIMD version is checked against.
+int updateParticlesScalar(ParticleSystem& system, float delta,
+                          const glm::vec3& acceleration,
+                          const glm::vec3& cameraPosition,
+                          float* positionSize, unsigned* color,
+                          const ForceField* fields = NULL,
+                          int fieldCount = 0);
+
+// Orders the live particles from the farthest to the closest to the
+// camera into sortOrder, for alpha blending, using the camera distances of
+// the last update. The particles themselves do not move. The order of the
+// previous frame is almost right most of the time : it is fixed up with an
+// insertion sort, and the keys are radix sorted when that fails. With a
+// job system the keys are computed on all its threads.
+void sortParticles(ParticleSystem& system, JobSystem* jobs = NULL);
+
+// Makes the next sort start from scratch, when the camera jumps
+void forgetParticleOrder(ParticleSystem& system);
+
+// Writes the live particles in sortOrder to the upload buffers, see
+// updateParticles().
+void writeSortedParticles(const ParticleSystem& system, float* positionSize,
+                          unsigned* color, JobSystem* jobs = NULL);
+
+// Particles per job in the parallel functions
+static const int PARTICLE_CHUNK_SIZE = 16384;
+
+// updateParticles() on the threads of a job system, in chunks of
+// PARTICLE_CHUNK_SIZE particles : see startParticleUpdate().
+struct ParticleUpdate
+{
+    ParticleSystem* system;
+    float delta;
+    glm::vec3 acceleration;
+    glm::vec3 cameraPosition;
+    // May be set until the finish, when the offset is not known at the start
+    float* positionSize;
+    unsigned* color;
+    const ForceField* fields; // must stay alive until the update finishes
+    int fieldCount;
+    int count; // when the update started
+    // Live particles per chunk, then their first index in the buffers
+    std::vector<int> chunkAlive;
+    JobGroup group;
+};
+
+// Ages and integrates the chunks on the job threads and returns at once,
+// so that the simulation of the next frame runs while this thread waits
+// for the GPU. The system must not be used until finishParticleUpdate().
+void startParticleUpdate(ParticleUpdate& update, JobSystem* jobs,
+                         ParticleSystem& system, float delta,
+                         const glm::vec3& acceleration,
+                         const glm::vec3& cameraPosition,
+                         float* positionSize, unsigned* color,
+                         const ForceField* fields = NULL, int fieldCount = 0);
+// Waits for the chunks. With buffers, each chunk then writes its live
+// particles at the sum of the live counts of the chunks before it, in
+// parallel. The dead particles are removed last. Returns the new count.
+int finishParticleUpdate(ParticleUpdate& update, JobSystem* jobs);
+
+#endif
@@ -0,0 +1,393 @@
+#include <vector>
+#include <algorithm>
+#include <cfloat>
+
+#include <glm/glm.hpp>
+
+#include "simd.hpp"
+#include "culling.hpp"
+#include "bvh.hpp"
+#include "picking.hpp"
+
+// The collapsed tree is no deeper than the binary one (at most 48 levels,
+// plus the halvings of oversized leaves), and each visit pushes at most
+// PICKING_WIDTH children
+static const int STACK_SIZE = 96 * PICKING_WIDTH;
+
+static float halfArea(const glm::vec3& min, const glm::vec3& max)
+{
+    glm::vec3 d = glm::max(max - min, glm::vec3(0.0f));
+    return d.x * d.y + d.y * d.z + d.z * d.x;
+}
+
+int addPickingObject(PickingScene& scene, const glm::mat4& model,
+                     const glm::vec3& min, const glm::vec3& max)
+{
+    glm::mat4 inverse = glm::inverse(model);
+    PickingObject object;
+    for (int row = 0; row < 3; row++)
+        object.inverseRows[row] = glm::vec4(inverse[0][row], inverse[1][row],
+                                            inverse[2][row], inverse[3][row]);
+    object.min = min;
+    object.max = max;
+    scene.objects.push_back(object);
+
+    glm::vec3 worldMin, worldMax;
+    transformAABB(model, min, max, worldMin, worldMax);
+    addAABB(scene.bounds, worldMin, worldMax);
+    return (int)scene.objects.size() - 1;
+}
+
+void clearPickingObjects(PickingScene& scene)
+{
+    scene.objects.clear();
+    clearAABBs(scene.bounds);
+    scene.nodes.clear();
+}
+
+// A subtree of the binary BVH waiting for a slot of a wide node : an inner
+// node, or a range of objects (a leaf, part of one, or a single object)
+struct CollapseEntry
+{
+    int node; // >= 0 : inner node, -1 : range
+    int first; // range : bvh.objectIndices[first .. first+count)
+    int count;
+    glm::vec3 min;
+    glm::vec3 max;
+};
+
+static CollapseEntry rangeEntry(const BVH& bvh, int first, int count)
+{
+    CollapseEntry entry;
+    entry.node = -1;
+    entry.first = first;
+    entry.count = count;
+    entry.min = glm::vec3(FLT_MAX);
+    entry.max = glm::vec3(-FLT_MAX);
+    for (int i = first; i < first + count; i++)
+    {
+        unsigned object = bvh.objectIndices[i];
+        entry.min = glm::min(entry.min, bvh.objectMin[object]);
+        entry.max = glm::max(entry.max, bvh.objectMax[object]);
+    }
+    return entry;
+}
+
+static CollapseEntry nodeEntry(const BVH& bvh, int index)
+{
+    const BVHNode& node = bvh.nodes[index];
+    if (node.count > 0)
+        return rangeEntry(bvh, node.first, node.count);
+    CollapseEntry entry;
+    entry.node = index;
+    entry.first = 0;
+    entry.count = 0;
+    entry.min = node.boundsMin;
+    entry.max = node.boundsMax;
+    return entry;
+}
+
+// Makes a wide node out of a subtree and returns its index. The largest
+// entries are opened first, as long as their children still fit, so that
+// the big boxes are tested together ; what is left gets wide nodes of its
+// own.
+static int collapseNode(PickingScene& scene, const BVH& bvh,
+                        const CollapseEntry& root)
+{
+    CollapseEntry entries[PICKING_WIDTH];
+    entries[0] = root;
+    int count = 1;
+    for (;;)
+    {
+        int best = -1;
+        float bestArea = -1.0f;
+        for (int i = 0; i < count; i++)
+        {
+            const CollapseEntry& entry = entries[i];
+            if (entry.node < 0 && entry.count == 1)
+                continue; // a single object
+            // Ranges become single objects when they fit, else two halves
+            bool split = entry.node >= 0 ||
+                         count + entry.count - 1 > PICKING_WIDTH;
+            if (count + (split ? 1 : entry.count - 1) > PICKING_WIDTH)
+                continue;
+            float area = halfArea(entry.min, entry.max);
+            if (area > bestArea)
+            {
+                bestArea = area;
+                best = i;
+            }
+        }
+        if (best < 0)
+            break;
+
+        CollapseEntry entry = entries[best];
+        if (entry.node >= 0)
+        {
+            int left = bvh.nodes[entry.node].first;
+            entries[best] = nodeEntry(bvh, left);
+            entries[count++] = nodeEntry(bvh, left + 1);
+        }
+        else if (count + entry.count - 1 <= PICKING_WIDTH)
+        {
+            entries[best] = rangeEntry(bvh, entry.first, 1);
+            for (int i = 1; i < entry.count; i++)
+                entries[count++] = rangeEntry(bvh, entry.first + i, 1);
+        }
+        else
+        {
+            int half = entry.count / 2;
+            entries[best] = rangeEntry(bvh, entry.first, half);
+            entries[count++] =
+                rangeEntry(bvh, entry.first + half, entry.count - half);
+        }
+    }
+
+    int index = (int)scene.nodes.size();
+    PickingNode empty;
+    for (int i = 0; i < PICKING_WIDTH; i++)
+    {
+        for (int axis = 0; axis < 3; axis++)
+        {
+            empty.bounds[axis][i] = FLT_MAX;
+            empty.bounds[axis + 3][i] = -FLT_MAX;
+        }
+        empty.children[i] = 0;
+    }
+    scene.nodes.push_back(empty);
+
+    for (int i = 0; i < count; i++)
+    {
+        const CollapseEntry& entry = entries[i];
+        int child;
+        if (entry.node < 0 && entry.count == 1)
+            child = ~(int)bvh.objectIndices[entry.first];
+        else
+            child = collapseNode(scene, bvh, entry);
+        // After the recursion, which grows scene.nodes
+        PickingNode& node = scene.nodes[index];
+        for (int axis = 0; axis < 3; axis++)
+        {
+            node.bounds[axis][i] = entry.min[axis];
+            node.bounds[axis + 3][i] = entry.max[axis];
+        }
+        node.children[i] = child;
+    }
+    return index;
+}
+
+void buildPickingScene(PickingScene& scene)
+{
+    scene.nodes.clear();
+    if (scene.objects.empty())
+        return;
+    BVH bvh;
+    buildBVH(bvh, scene.bounds);
+    collapseNode(scene, bvh, nodeEntry(bvh, 0));
+}
+
+bool intersectPickingObject(const PickingObject& object,
+                            const glm::vec3& origin,
+                            const glm::vec3& direction, float maxDistance,
+                            float& distance)
+{
+    // An affine transform keeps the distances along the ray, so the slab
+    // test in model space gives the world distance
+    glm::vec4 worldOrigin(origin, 1.0f);
+    glm::vec4 worldDirection(direction, 0.0f);
+    float enter = 0.0f;
+    float exit = maxDistance;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        float localOrigin = glm::dot(object.inverseRows[axis], worldOrigin);
+        float localDirection =
+            glm::dot(object.inverseRows[axis], worldDirection);
+        if (localDirection != 0.0f)
+        {
+            float t0 = (object.min[axis] - localOrigin) / localDirection;
+            float t1 = (object.max[axis] - localOrigin) / localDirection;
+            enter = std::max(enter, std::min(t0, t1));
+            exit = std::min(exit, std::max(t0, t1));
+        }
+        else if (localOrigin < object.min[axis] ||
+                 localOrigin > object.max[axis])
+            return false; // parallel to the slab, and outside of it
+    }
+    if (enter > exit)
+        return false;
+    distance = enter;
+    return true;
+}
+
+int pickRayLinear(const PickingScene& scene, const glm::vec3& origin,
+                  const glm::vec3& direction, float maxDistance,
+                  float& hitDistance)
+{
+    int hit = -1;
+    float best = maxDistance;
+    for (size_t i = 0; i < scene.objects.size(); i++)
+    {
+        float distance;
+        if (intersectPickingObject(scene.objects[i], origin, direction, best,
+                                   distance) &&
+            distance < best)
+        {
+            best = distance;
+            hit = (int)i;
+        }
+    }
+    hitDistance = best;
+    return hit;
+}
+
+struct PickingRay
+{
+    glm::vec3 origin;
+    glm::vec3 inverseDirection;
+    // Rows of PickingNode::bounds with the planes the ray crosses first and
+    // last on each axis. Picked by the sign of the direction rather than
+    // sorting the two distances, so the empty lanes (min > max) are missed.
+    int nearBounds[3];
+    int farBounds[3];
+};
+
+static PickingRay makeRay(const glm::vec3& origin, const glm::vec3& direction)
+{
+    PickingRay ray;
+    ray.origin = origin;
+    for (int axis = 0; axis < 3; axis++)
+    {
+        // Not infinity : 0 * infinity is NaN, for the planes through the
+        // origin
+        float d = direction[axis];
+        ray.inverseDirection[axis] = 1.0f / (d != 0.0f ? d : 1e-30f);
+        bool positive = ray.inverseDirection[axis] >= 0.0f;
+        ray.nearBounds[axis] = positive ? axis : axis + 3;
+        ray.farBounds[axis] = positive ? axis + 3 : axis;
+    }
+    return ray;
+}
+
+// Slab tests of the ray against the children of a node. Stores where the
+// ray enters each child and returns the mask of those it enters before
+// maxDistance.
+static int rayNode(const PickingNode& node, const PickingRay& ray,
+                   float maxDistance, float* enter)
+{
+#if SIMD_WIDTH >= 4
+    Lanes nearest = lanesSet(0.0f);
+    Lanes farthest = lanesSet(maxDistance);
+    for (int axis = 0; axis < 3; axis++)
+    {
+        Lanes origin = lanesSet(ray.origin[axis]);
+        Lanes inverse = lanesSet(ray.inverseDirection[axis]);
+        Lanes nearPlane = lanesLoad(node.bounds[ray.nearBounds[axis]]);
+        Lanes farPlane = lanesLoad(node.bounds[ray.farBounds[axis]]);
+        nearest = lanesMax(nearest,
+                           lanesMul(lanesSub(nearPlane, origin), inverse));
+        farthest = lanesMin(farthest,
+                            lanesMul(lanesSub(farPlane, origin), inverse));
+    }
+    lanesStore(enter, nearest);
+    return lanesMask(lanesGreaterEqual(farthest, nearest));
+#else
+    int mask = 0;
+    for (int i = 0; i < PICKING_WIDTH; i++)
+    {
+        float nearest = 0.0f;
+        float farthest = maxDistance;
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float nearPlane = node.bounds[ray.nearBounds[axis]][i];
+            float farPlane = node.bounds[ray.farBounds[axis]][i];
+            nearest = std::max(nearest, (nearPlane - ray.origin[axis]) *
+                                            ray.inverseDirection[axis]);
+            farthest = std::min(farthest, (farPlane - ray.origin[axis]) *
+                                              ray.inverseDirection[axis]);
+        }
+        enter[i] = nearest;
+        if (farthest >= nearest)
+            mask |= 1 << i;
+    }
+    return mask;
+#endif
+}
+
+int pickRay(const PickingScene& scene, const glm::vec3& origin,
+            const glm::vec3& direction, float maxDistance, float& hitDistance,
+            BVHQueryStats* stats)
+{
+    BVHQueryStats local = BVHQueryStats();
+    int hit = -1;
+    float best = maxDistance;
+
+    if (!scene.nodes.empty())
+    {
+        PickingRay ray = makeRay(origin, direction);
+        // Nodes to visit, and where the ray enters them
+        int stack[STACK_SIZE];
+        float stackDistance[STACK_SIZE];
+        int stackSize = 0;
+        stack[stackSize] = 0;
+        stackDistance[stackSize++] = 0.0f;
+        while (stackSize > 0)
+        {
+            stackSize--;
+            // May have been beaten by a closer hit since it was pushed
+            if (stackDistance[stackSize] > best)
+                continue;
+            const PickingNode& node = scene.nodes[stack[stackSize]];
+            local.nodesVisited++;
+
+            float enter[PICKING_WIDTH];
+            int mask = rayNode(node, ray, best, enter);
+            if (mask == 0)
+                continue;
+
+            // The children the ray enters, nearest first
+            int order[PICKING_WIDTH];
+            int hits = 0;
+            for (int i = 0; i < PICKING_WIDTH; i++)
+            {
+                if (!(mask & (1 << i)))
+                    continue;
+                int j = hits++;
+                for (; j > 0 && enter[order[j - 1]] > enter[i]; j--)
+                    order[j] = order[j - 1];
+                order[j] = i;
+            }
+
+            // The objects first, their hits shorten the ray for the nodes
+            for (int k = 0; k < hits; k++)
+            {
+                int child = node.children[order[k]];
+                if (child >= 0 || enter[order[k]] > best)
+                    continue;
+                local.objectsTested++;
+                float distance;
+                if (intersectPickingObject(scene.objects[~child], origin,
+                                           direction, best, distance) &&
+                    distance < best)
+                {
+                    best = distance;
+                    hit = ~child;
+                }
+            }
+            // Then the nodes, the farthest pushed first so the nearest is
+            // visited next
+            for (int k = hits - 1; k >= 0; k--)
+            {
+                int child = node.children[order[k]];
+                if (child < 0 || enter[order[k]] > best)
+                    continue;
+                stack[stackSize] = child;
+                stackDistance[stackSize++] = enter[order[k]];
+            }
+        }
+    }
+
+    if (stats)
+        *stats = local;
+    hitDistance = best;
+    return hit;
+}
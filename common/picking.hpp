@@ -0,0 +1,73 @@
+#ifndef PICKING_HPP
+#define PICKING_HPP
+
+// Ray picking against many oriented boxes, e.g. the object under the mouse.
+// Each object is a box in model space and its model matrix. A BVH
+// (bvh.hpp) is built over their world bounding boxes, then collapsed into
+// nodes of PICKING_WIDTH children whose boxes are tested against the ray
+// all at once, with SIMD slab tests. Only the objects whose world box the
+// ray enters before the closest hit so far get the exact test, done in the
+// object's space so that any affine model matrix works, scale included.
+//
+// simd.hpp, culling.hpp and bvh.hpp must be included first.
+
+// One SIMD register of children per node, and at least 4 without SIMD
+#if SIMD_WIDTH >= 4
+#define PICKING_WIDTH SIMD_WIDTH
+#else
+#define PICKING_WIDTH 4
+#endif
+
+struct PickingNode
+{
+    // Child boxes, min x, y, z then max x, y, z, one lane per child. The
+    // unused lanes have min > max, which no ray enters.
+    float bounds[6][PICKING_WIDTH];
+    // >= 0 : index of a child node, < 0 : ~object
+    int children[PICKING_WIDTH];
+};
+
+struct PickingObject
+{
+    // World to model space : the first three rows of the inverse of the
+    // model matrix
+    glm::vec4 inverseRows[3];
+    glm::vec3 min; // the box in model space
+    glm::vec3 max;
+};
+
+struct PickingScene
+{
+    std::vector<PickingObject> objects;
+    AABBArray bounds; // world bounds of the objects, for the build
+    std::vector<PickingNode> nodes; // nodes[0] is the root
+};
+
+// Returns the index of the object, which pickRay() returns when it is hit.
+int addPickingObject(PickingScene& scene, const glm::mat4& model,
+                     const glm::vec3& min, const glm::vec3& max);
+void clearPickingObjects(PickingScene& scene);
+// Builds the tree over the objects added so far. Objects that move need
+// clearPickingObjects(), adding them again and a new build.
+void buildPickingScene(PickingScene& scene);
+
+// Closest object hit by the ray within maxDistance, or -1. Distances are
+// in lengths of direction, which does not have to be normalized. Objects
+// the ray starts inside of are hit at 0. stats counts the nodes visited
+// and the exact tests.
+int pickRay(const PickingScene& scene, const glm::vec3& origin,
+            const glm::vec3& direction, float maxDistance, float& hitDistance,
+            BVHQueryStats* stats = NULL);
+// Same result, testing every object : the reference for pickRay().
+int pickRayLinear(const PickingScene& scene, const glm::vec3& origin,
+                  const glm::vec3& direction, float maxDistance,
+                  float& hitDistance);
+
+// The exact test of one object. Returns true and sets distance if the ray
+// hits the box before maxDistance.
+bool intersectPickingObject(const PickingObject& object,
+                            const glm::vec3& origin,
+                            const glm::vec3& direction, float maxDistance,
+                            float& distance);
+
+#endif
@@ -0,0 +1,420 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+
+#include <GL/glew.h>
+
+#include "alloctrack.hpp"
+#include "profiler.hpp"
+
+static const unsigned RING_SIZE = 4096;      // closed scopes per thread between two frames
+static const unsigned TRACE_EVENTS = 65536;  // kept for writeProfilerTrace()
+static const int MAX_DEPTH = 32;
+
+static double nowUs()
+{
+    static const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+}
+
+struct CPUEvent
+{
+    const char* name;
+    double beginUs;
+    double endUs;
+    unsigned allocations;
+    unsigned long long allocatedBytes;
+};
+
+// One per thread that opened a scope. Only the owner writes events and
+// head, only the collector moves tail : a single producer, single consumer
+// ring.
+struct ThreadEvents
+{
+    int threadId;
+    CPUEvent events[RING_SIZE];
+    std::atomic<unsigned> head;
+    std::atomic<unsigned> tail;
+    std::atomic<unsigned> dropped;
+    std::atomic<bool> retired; // the thread is gone, free after the last read
+    // Open scopes, owner only
+    const char* openNames[MAX_DEPTH];
+    double openUs[MAX_DEPTH];
+    AllocStats openAllocations[MAX_DEPTH];
+    int depth;
+};
+
+// Registration is the only lock a thread takes
+static std::mutex threadsMutex;
+static std::vector<ThreadEvents*> threads;
+static int nextThreadId = 0;
+
+// Hands the buffer over to the collector when its thread exits
+struct ThreadEventsOwner
+{
+    ThreadEvents* events = NULL;
+    ~ThreadEventsOwner()
+    {
+        if (events)
+            events->retired.store(true, std::memory_order_release);
+    }
+};
+
+static thread_local ThreadEventsOwner threadEvents;
+
+static ThreadEvents* currentThreadEvents()
+{
+    if (!threadEvents.events)
+    {
+        ThreadEvents* events = new ThreadEvents;
+        events->head.store(0);
+        events->tail.store(0);
+        events->dropped.store(0);
+        events->retired.store(false);
+        events->depth = 0;
+        std::lock_guard<std::mutex> lock(threadsMutex);
+        events->threadId = nextThreadId++;
+        threads.push_back(events);
+        threadEvents.events = events;
+    }
+    return threadEvents.events;
+}
+
+struct TraceEvent
+{
+    const char* name;
+    int threadId; // -1 for the GPU
+    double beginUs;
+    double durationUs;
+    unsigned allocations;
+};
+
+static std::vector<TraceEvent> trace;
+static unsigned traceNext = 0; // total ever added, the ring index is traceNext % TRACE_EVENTS
+
+static std::vector<ProfilePassStats> stats;
+
+static ProfilePassStats& passStats(const char* name)
+{
+    for (size_t i = 0; i < stats.size(); i++)
+        if (stats[i].name == name || strcmp(stats[i].name, name) == 0)
+            return stats[i];
+    ProfilePassStats pass = { name, 0, 0.0, 0.0, 0, 0.0, 0.0, 0, 0 };
+    stats.push_back(pass);
+    return stats.back();
+}
+
+static void addTraceEvent(const char* name, int threadId, double beginUs, double durationUs,
+                          unsigned allocations)
+{
+    if (trace.size() < TRACE_EVENTS)
+        trace.resize(TRACE_EVENTS);
+    TraceEvent& event = trace[traceNext % TRACE_EVENTS];
+    event.name = name;
+    event.threadId = threadId;
+    event.beginUs = beginUs;
+    event.durationUs = durationUs;
+    event.allocations = allocations;
+    traceNext++;
+}
+
+void beginCPUScope(const char* name)
+{
+    ThreadEvents* events = currentThreadEvents();
+    if (events->depth < MAX_DEPTH)
+    {
+        events->openNames[events->depth] = name;
+        events->openAllocations[events->depth] = getThreadAllocStats();
+        events->openUs[events->depth] = nowUs();
+    }
+    events->depth++;
+}
+
+void endCPUScope()
+{
+    ThreadEvents* events = currentThreadEvents();
+    if (events->depth == 0)
+        return;
+    events->depth--;
+    if (events->depth >= MAX_DEPTH)
+        return;
+
+    unsigned head = events->head.load(std::memory_order_relaxed);
+    if (head - events->tail.load(std::memory_order_acquire) >= RING_SIZE)
+    {
+        events->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    CPUEvent& event = events->events[head % RING_SIZE];
+    event.name = events->openNames[events->depth];
+    event.beginUs = events->openUs[events->depth];
+    event.endUs = nowUs();
+    AllocStats allocations = getThreadAllocStats();
+    event.allocations = (unsigned)(allocations.allocations - events->openAllocations[events->depth].allocations);
+    event.allocatedBytes = allocations.bytes - events->openAllocations[events->depth].bytes;
+    events->head.store(head + 1, std::memory_order_release);
+}
+
+// Moves the closed scopes of every thread into the stats and the trace
+static void collectCPUEvents()
+{
+    std::lock_guard<std::mutex> lock(threadsMutex);
+    for (size_t t = 0; t < threads.size();)
+    {
+        ThreadEvents* events = threads[t];
+        // Read before head, so that nothing written after it is missed
+        bool retired = events->retired.load(std::memory_order_acquire);
+        unsigned head = events->head.load(std::memory_order_acquire);
+        unsigned tail = events->tail.load(std::memory_order_relaxed);
+        for (; tail != head; tail++)
+        {
+            const CPUEvent& event = events->events[tail % RING_SIZE];
+            double ms = (event.endUs - event.beginUs) / 1000.0;
+            ProfilePassStats& pass = passStats(event.name);
+            pass.cpuCalls++;
+            pass.cpuMs += ms;
+            pass.cpuMaxMs = std::max(pass.cpuMaxMs, ms);
+            pass.allocations += event.allocations;
+            pass.allocatedBytes += event.allocatedBytes;
+            addTraceEvent(event.name, events->threadId, event.beginUs, event.endUs - event.beginUs,
+                          event.allocations);
+        }
+        events->tail.store(tail, std::memory_order_release);
+
+        unsigned dropped = events->dropped.exchange(0);
+        if (dropped > 0)
+            printf("Profiler : %u scopes of thread %d dropped, the ring is full\n", dropped, events->threadId);
+
+        if (retired)
+        {
+            delete events;
+            threads.erase(threads.begin() + t);
+        }
+        else
+            t++;
+    }
+}
+
+struct GPUScope
+{
+    const char* name;
+    GLuint beginQuery;
+    GLuint endQuery;
+};
+
+// The queries of one frame. Frame n reuses the slot of frame
+// n - PROFILER_GPU_LATENCY, reading its results first.
+struct GPUFrame
+{
+    std::vector<GLuint> queries;
+    size_t usedQueries = 0;
+    std::vector<GPUScope> scopes;
+    std::vector<int> openScopes;
+    GLuint lastQuery = 0; // issued last, so completes last
+    // The same instant on both clocks, to put GPU times on the CPU timeline
+    double cpuUs = 0.0;
+    GLint64 gpuNs = 0;
+};
+
+static GPUFrame gpuFrames[PROFILER_GPU_LATENCY];
+static unsigned frameIndex = 0;
+static bool inFrame = false;
+static int gpuTimers = -1; // unknown until the first frame
+static int skippedGPUFrames = 0;
+
+static GLuint nextQuery(GPUFrame& frame)
+{
+    if (frame.usedQueries == frame.queries.size())
+    {
+        size_t count = std::max((size_t)16, frame.queries.size());
+        frame.queries.resize(frame.queries.size() + count);
+        glGenQueries((GLsizei)count, &frame.queries[frame.queries.size() - count]);
+    }
+    frame.lastQuery = frame.queries[frame.usedQueries++];
+    return frame.lastQuery;
+}
+
+static void collectGPUFrame(GPUFrame& frame)
+{
+    if (frame.scopes.empty())
+        return;
+    // Timestamps complete in order : if the last one is there, all are
+    GLuint available = 0;
+    glGetQueryObjectuiv(frame.lastQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+    if (!available)
+    {
+        skippedGPUFrames++;
+        return;
+    }
+    for (size_t i = 0; i < frame.scopes.size(); i++)
+    {
+        const GPUScope& scope = frame.scopes[i];
+        if (!scope.endQuery)
+            continue; // never closed
+        GLuint64 begin = 0, end = 0;
+        glGetQueryObjectui64v(scope.beginQuery, GL_QUERY_RESULT, &begin);
+        glGetQueryObjectui64v(scope.endQuery, GL_QUERY_RESULT, &end);
+        double ms = (double)(end - begin) / 1000000.0;
+        ProfilePassStats& pass = passStats(scope.name);
+        pass.gpuCalls++;
+        pass.gpuMs += ms;
+        pass.gpuMaxMs = std::max(pass.gpuMaxMs, ms);
+        double beginUs = frame.cpuUs + (double)((GLint64)begin - frame.gpuNs) / 1000.0;
+        addTraceEvent(scope.name, -1, beginUs, (double)(end - begin) / 1000.0, 0);
+    }
+}
+
+void beginProfilerFrame()
+{
+    beginAllocFrame();
+    if (gpuTimers < 0)
+        gpuTimers = (glQueryCounter != NULL && glGetInteger64v != NULL) ? 1 : 0;
+
+    inFrame = true;
+    if (!gpuTimers)
+        return;
+    GPUFrame& frame = gpuFrames[frameIndex % PROFILER_GPU_LATENCY];
+    collectGPUFrame(frame);
+    frame.usedQueries = 0;
+    frame.scopes.clear();
+    frame.openScopes.clear();
+    frame.cpuUs = nowUs();
+    glGetInteger64v(GL_TIMESTAMP, &frame.gpuNs);
+}
+
+void endProfilerFrame()
+{
+    inFrame = false;
+    frameIndex++;
+    collectCPUEvents();
+    endAllocFrame();
+}
+
+void beginGPUScope(const char* name)
+{
+    if (!inFrame || !gpuTimers)
+        return;
+    GPUFrame& frame = gpuFrames[frameIndex % PROFILER_GPU_LATENCY];
+    GPUScope scope;
+    scope.name = name;
+    scope.beginQuery = nextQuery(frame);
+    scope.endQuery = 0;
+    glQueryCounter(scope.beginQuery, GL_TIMESTAMP);
+    frame.openScopes.push_back((int)frame.scopes.size());
+    frame.scopes.push_back(scope);
+}
+
+void endGPUScope()
+{
+    if (!inFrame || !gpuTimers)
+        return;
+    GPUFrame& frame = gpuFrames[frameIndex % PROFILER_GPU_LATENCY];
+    if (frame.openScopes.empty())
+        return;
+    GLuint query = nextQuery(frame);
+    glQueryCounter(query, GL_TIMESTAMP);
+    frame.scopes[frame.openScopes.back()].endQuery = query;
+    frame.openScopes.pop_back();
+}
+
+void beginProfilePass(const char* name)
+{
+    beginCPUScope(name);
+    beginGPUScope(name);
+}
+
+void endProfilePass()
+{
+    endGPUScope();
+    endCPUScope();
+}
+
+const std::vector<ProfilePassStats>& getProfilerStats()
+{
+    return stats;
+}
+
+void resetProfilerStats()
+{
+    for (size_t i = 0; i < stats.size(); i++)
+    {
+        const char* name = stats[i].name;
+        ProfilePassStats empty = { name, 0, 0.0, 0.0, 0, 0.0, 0.0, 0, 0 };
+        stats[i] = empty;
+    }
+    skippedGPUFrames = 0;
+}
+
+void printProfilerStats(int frames)
+{
+    if (frames <= 0)
+        return;
+    for (size_t i = 0; i < stats.size(); i++)
+    {
+        const ProfilePassStats& pass = stats[i];
+        printf("  %-16s CPU %8.3f ms (max %7.3f)", pass.name, pass.cpuMs / frames, pass.cpuMaxMs);
+        if (pass.gpuCalls > 0)
+            printf("  GPU %8.3f ms (max %7.3f)", pass.gpuMs / frames, pass.gpuMaxMs);
+        printf("  %.1f/frame", (double)pass.cpuCalls / frames);
+        if (pass.allocations > 0)
+            printf("  %.1f allocations/frame (%.0f bytes)", (double)pass.allocations / frames,
+                   (double)pass.allocatedBytes / frames);
+        printf("\n");
+    }
+    printAllocStats(frames);
+    if (skippedGPUFrames > 0)
+        printf("  %d frames of GPU timings were not ready after %d frames and were skipped\n",
+               skippedGPUFrames, PROFILER_GPU_LATENCY);
+    resetProfilerStats();
+}
+
+// Prints s as a JSON string
+static void writeJSONString(FILE* file, const char* s)
+{
+    fputc('"', file);
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            fprintf(file, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(file, "\\u%04x", *s);
+        else
+            fputc(*s, file);
+    }
+    fputc('"', file);
+}
+
+bool writeProfilerTrace(const char* path)
+{
+    FILE* file = fopen(path, "w");
+    if (!file)
+    {
+        printf("Cannot write %s\n", path);
+        return false;
+    }
+    // CPU threads in process 1, the GPU in process 2
+    fprintf(file, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 1, \"args\": {\"name\": \"CPU\"}},\n");
+    fprintf(file, "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": 2, \"args\": {\"name\": \"GPU\"}}");
+    unsigned count = std::min(traceNext, TRACE_EVENTS);
+    for (unsigned i = traceNext - count; i != traceNext; i++)
+    {
+        const TraceEvent& event = trace[i % TRACE_EVENTS];
+        fprintf(file, ",\n{\"name\": ");
+        writeJSONString(file, event.name);
+        fprintf(file, ", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": %d, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f",
+                event.threadId < 0 ? "gpu" : "cpu", event.threadId < 0 ? 2 : 1,
+                std::max(event.threadId, 0), event.beginUs, event.durationUs);
+        if (event.threadId >= 0)
+            fprintf(file, ", \"args\": {\"allocations\": %u}", event.allocations);
+        fprintf(file, "}");
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+    printf("Wrote %u profiler scopes to %s\n", count, path);
+    return true;
+}
@@ -0,0 +1,68 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+// A frame profiler. Scopes are named passes ("shadow pass", "particles"...)
+// that may nest. CPU scopes work on any thread : each thread writes the
+// scopes it closes into its own ring buffer, with no lock once it is
+// registered, and the GL thread collects them in endProfilerFrame(). GPU
+// scopes put a timestamp query at each end and are read back
+// PROFILER_GPU_LATENCY frames later, when the GPU is long done with them,
+// so nothing ever waits for it.
+//
+// Times are summed per pass name for printProfilerStats(), and the most
+// recent scopes are kept for writeProfilerTrace(), which writes the
+// Chrome trace format (chrome://tracing, ui.perfetto.dev).
+
+static const int PROFILER_GPU_LATENCY = 4;
+
+// Frames start and end on the GL thread, and are also the frames of
+// beginAllocFrame() and endAllocFrame(). The GPU part is skipped without a
+// GL 3.3 context.
+void beginProfilerFrame();
+void endProfilerFrame();
+
+void beginCPUScope(const char* name);
+void endCPUScope();
+// Only between beginProfilerFrame() and endProfilerFrame(), on the GL thread
+void beginGPUScope(const char* name);
+void endGPUScope();
+
+// Both of the above under one name
+void beginProfilePass(const char* name);
+void endProfilePass();
+
+// Closes the CPU scope when it goes out of scope, for worker threads and
+// early returns
+struct CPUProfileScope
+{
+    explicit CPUProfileScope(const char* name) { beginCPUScope(name); }
+    ~CPUProfileScope() { endCPUScope(); }
+};
+
+struct ProfilePassStats
+{
+    const char* name;
+    int cpuCalls;
+    double cpuMs;    // summed
+    double cpuMaxMs; // longest single scope
+    int gpuCalls;
+    double gpuMs;
+    double gpuMaxMs;
+    // Heap allocations inside the CPU scopes (see alloctrack.hpp)
+    unsigned long long allocations;
+    unsigned long long allocatedBytes;
+};
+
+// Sums since the last resetProfilerStats(), in the order the passes were
+// first seen. GPU sums lag PROFILER_GPU_LATENCY frames behind.
+const std::vector<ProfilePassStats>& getProfilerStats();
+void resetProfilerStats();
+// Prints the time and allocations of each pass per frame, and
+// printAllocStats(), then resets.
+void printProfilerStats(int frames);
+
+// Writes the last scopes kept (up to 65536, CPU and GPU) as Chrome trace
+// JSON.
+bool writeProfilerTrace(const char* path);
+
+#endif
@@ -0,0 +1,97 @@
+#include <vector>
+#include <string.h>
+
+#include "radixsort.hpp"
+
+void radixSort(unsigned* keys, unsigned* indices, int count, int keyBits,
+               RadixSortBuffers& buffers)
+{
+    if (count < 2)
+        return;
+    if ((int)buffers.keys.size() < count)
+    {
+        buffers.keys.resize(count);
+        buffers.indices.resize(count);
+    }
+
+    // The histograms of all the passes, in one read of the keys
+    int passes = keyBits / 8;
+    unsigned histograms[4][256];
+    memset(histograms, 0, sizeof(histograms));
+    for (int i = 0; i < count; i++)
+    {
+        unsigned key = keys[i];
+        for (int p = 0; p < passes; p++)
+            histograms[p][(key >> (8 * p)) & 0xFF]++;
+    }
+
+    unsigned* sourceKeys = keys;
+    unsigned* sourceIndices = indices;
+    unsigned* destinationKeys = &buffers.keys[0];
+    unsigned* destinationIndices = &buffers.indices[0];
+    for (int p = 0; p < passes; p++)
+    {
+        unsigned* histogram = histograms[p];
+        int shift = 8 * p;
+        // Nothing to do if every key falls in the same bucket
+        if (histogram[(sourceKeys[0] >> shift) & 0xFF] == (unsigned)count)
+            continue;
+
+        // Bucket starts
+        unsigned offset = 0;
+        for (int d = 0; d < 256; d++)
+        {
+            unsigned bucket = histogram[d];
+            histogram[d] = offset;
+            offset += bucket;
+        }
+        for (int i = 0; i < count; i++)
+        {
+            unsigned key = sourceKeys[i];
+            unsigned destination = histogram[(key >> shift) & 0xFF]++;
+            destinationKeys[destination] = key;
+            destinationIndices[destination] = sourceIndices[i];
+        }
+
+        unsigned* swap = sourceKeys;
+        sourceKeys = destinationKeys;
+        destinationKeys = swap;
+        swap = sourceIndices;
+        sourceIndices = destinationIndices;
+        destinationIndices = swap;
+    }
+
+    // After an odd number of passes the result is in the scratch arrays
+    if (sourceKeys != keys)
+    {
+        memcpy(keys, sourceKeys, count * sizeof(unsigned));
+        memcpy(indices, sourceIndices, count * sizeof(unsigned));
+    }
+}
+
+bool insertionSort(unsigned* keys, unsigned* indices, int count,
+                   long long maxMoves)
+{
+    long long moves = 0;
+    for (int i = 1; i < count; i++)
+    {
+        unsigned key = keys[i];
+        if (keys[i - 1] <= key)
+            continue;
+        unsigned index = indices[i];
+        int j = i;
+        do
+        {
+            keys[j] = keys[j - 1];
+            indices[j] = indices[j - 1];
+            j--;
+        } while (j > 0 && keys[j - 1] > key);
+        keys[j] = key;
+        indices[j] = index;
+
+        moves += i - j;
+        if (moves > maxMoves)
+            return false;
+    }
+    return true;
+}
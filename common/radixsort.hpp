@@ -0,0 +1,27 @@
+#ifndef RADIXSORT_HPP
+#define RADIXSORT_HPP
+
+// Sorting of (key, index) pairs, for draw orders : the indices say where
+// the data is, and only the pairs move, never the data.
+
+// Scratch space, kept between calls to not allocate every frame
+struct RadixSortBuffers
+{
+    std::vector<unsigned> keys;
+    std::vector<unsigned> indices;
+};
+
+// Least significant digit radix sort by increasing key, 8 bits per pass.
+// Only the low keyBits bits (16 or 32) of the keys are looked at, and a
+// pass is skipped when all the keys have the same digit. Stable.
+void radixSort(unsigned* keys, unsigned* indices, int count, int keyBits,
+               RadixSortBuffers& buffers);
+
+// Insertion sort by increasing key, for pairs that are almost sorted
+// already, like the draw order of the previous frame. Gives up and returns
+// false once it has moved pairs more than maxMoves places in total : the
+// pairs are then shuffled but unsorted. Stable.
+bool insertionSort(unsigned* keys, unsigned* indices, int count,
+                   long long maxMoves);
+
+#endif
@@ -0,0 +1,134 @@
+#ifndef RANDOM_HPP
+#define RANDOM_HPP
+
+// Counter based random numbers : the n-th number of a stream is a hash of
+// n and of the stream's key, so it does not depend on the numbers drawn
+// before it. A seed gives the same numbers on every run, on every
+// instruction set (see simd.hpp, to include first) and on any number of
+// threads : parallel code gives each chunk its own stream, or draws numbers
+// by index with randomAt().
+//
+// The hash is two rounds of a 32 bit integer mixer (the "lowbias32" of
+// Chris Wellons), each round keyed by a different half of the key. Streams
+// repeat after 2^32 numbers.
+
+struct RandomStream
+{
+    unsigned key[2];
+    unsigned counter; // index of the next number
+};
+
+// 32 bit mixer, a bijection
+inline unsigned randomMix(unsigned x)
+{
+    x ^= x >> 16;
+    x *= 0x7FEB352Du;
+    x ^= x >> 15;
+    x *= 0x846CA68Bu;
+    x ^= x >> 16;
+    return x;
+}
+
+// Streams of the same seed are independent, for one per thread or chunk
+inline void seedRandom(RandomStream& random, unsigned seed, unsigned stream = 0)
+{
+    random.key[0] = randomMix(seed + 0x9E3779B9u);
+    random.key[1] = randomMix(random.key[0] ^ randomMix(stream + 0x85EBCA6Bu));
+    random.counter = 0;
+}
+
+// The index-th number of the stream, whatever its counter
+inline unsigned randomAt(const RandomStream& random, unsigned index)
+{
+    return randomMix(randomMix(index ^ random.key[0]) + random.key[1]);
+}
+
+// The 24 high bits, in [0, 1)
+inline float randomUnit(unsigned bits)
+{
+    return (float)(bits >> 8) * (1.0f / 16777216.0f);
+}
+
+inline float randomFloat(RandomStream& random)
+{
+    return randomUnit(randomAt(random, random.counter++));
+}
+
+// 8 floats in [0, 1), the next 8 numbers of the stream, one at a time :
+// the reference randomFloats8() is checked against.
+inline void randomFloats8Scalar(RandomStream& random, float out[8])
+{
+    for (int i = 0; i < 8; i++)
+        out[i] = randomUnit(randomAt(random, random.counter + i));
+    random.counter += 8;
+}
+
+#if defined(SIMD_SSE2)
+// Integer lanes for the mixer : 8 with AVX2, 4 with SSE2
+#if defined(SIMD_AVX2)
+typedef __m256i RandomLanes;
+static inline RandomLanes randomLanesSet(unsigned u) { return _mm256_set1_epi32((int)u); }
+static inline RandomLanes randomLanesXor(RandomLanes a, RandomLanes b) { return _mm256_xor_si256(a, b); }
+static inline RandomLanes randomLanesAdd(RandomLanes a, RandomLanes b) { return _mm256_add_epi32(a, b); }
+static inline RandomLanes randomLanesMul(RandomLanes a, RandomLanes b) { return _mm256_mullo_epi32(a, b); }
+static inline RandomLanes randomLanesShift(RandomLanes a, int n) { return _mm256_srli_epi32(a, n); }
+static inline RandomLanes randomLanesCounters(unsigned first) { return _mm256_add_epi32(_mm256_set1_epi32((int)first), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)); }
+static inline void randomLanesStoreUnit(float* p, RandomLanes a)
+{
+    __m256 f = _mm256_cvtepi32_ps(_mm256_srli_epi32(a, 8));
+    _mm256_storeu_ps(p, _mm256_mul_ps(f, _mm256_set1_ps(1.0f / 16777216.0f)));
+}
+#else
+typedef __m128i RandomLanes;
+static inline RandomLanes randomLanesSet(unsigned u) { return _mm_set1_epi32((int)u); }
+static inline RandomLanes randomLanesXor(RandomLanes a, RandomLanes b) { return _mm_xor_si128(a, b); }
+static inline RandomLanes randomLanesAdd(RandomLanes a, RandomLanes b) { return _mm_add_epi32(a, b); }
+// SSE2 has no 32 bit multiply : the even lanes, then the odd ones
+static inline RandomLanes randomLanesMul(RandomLanes a, RandomLanes b)
+{
+    __m128i even = _mm_mul_epu32(a, b);
+    __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)),
+                              _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+static inline RandomLanes randomLanesShift(RandomLanes a, int n) { return _mm_srli_epi32(a, n); }
+static inline RandomLanes randomLanesCounters(unsigned first) { return _mm_add_epi32(_mm_set1_epi32((int)first), _mm_setr_epi32(0, 1, 2, 3)); }
+static inline void randomLanesStoreUnit(float* p, RandomLanes a)
+{
+    __m128 f = _mm_cvtepi32_ps(_mm_srli_epi32(a, 8));
+    _mm_storeu_ps(p, _mm_mul_ps(f, _mm_set1_ps(1.0f / 16777216.0f)));
+}
+#endif
+
+static inline RandomLanes randomMixLanes(RandomLanes x)
+{
+    x = randomLanesXor(x, randomLanesShift(x, 16));
+    x = randomLanesMul(x, randomLanesSet(0x7FEB352Du));
+    x = randomLanesXor(x, randomLanesShift(x, 15));
+    x = randomLanesMul(x, randomLanesSet(0x846CA68Bu));
+    x = randomLanesXor(x, randomLanesShift(x, 16));
+    return x;
+}
+#endif
+
+// 8 floats in [0, 1), the next 8 numbers of the stream. Not faster than
+// randomFloat() in a plain loop, which the compiler vectorizes as well (see
+// the random benchmark of misc06) : this is for loops it cannot vectorize.
+inline void randomFloats8(RandomStream& random, float out[8])
+{
+#if defined(SIMD_SSE2)
+    RandomLanes key0 = randomLanesSet(random.key[0]);
+    RandomLanes key1 = randomLanesSet(random.key[1]);
+    for (int i = 0; i < 8; i += SIMD_WIDTH)
+    {
+        RandomLanes x = randomLanesCounters(random.counter + i);
+        x = randomMixLanes(randomLanesAdd(randomMixLanes(randomLanesXor(x, key0)), key1));
+        randomLanesStoreUnit(out + i, x);
+    }
+    random.counter += 8;
+#else
+    randomFloats8Scalar(random, out);
+#endif
+}
+
+#endif
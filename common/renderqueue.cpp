@@ -0,0 +1,200 @@
+#include <vector>
+
+#include <GL/glew.h>
+
+#include <glm/glm.hpp>
+
+#include "glstate.hpp"
+#include "mesh.hpp"
+#include "renderqueue.hpp"
+
+struct SortItem
+{
+    unsigned long long key;
+    unsigned packet;
+};
+
+// Kept between frames so sorting does not allocate
+static std::vector<SortItem> sortItems;
+static std::vector<SortItem> sortScratch;
+
+static const int PASS_BITS = 4;
+static const int PROGRAM_BITS = 10;
+static const int MATERIAL_BITS = 12;
+static const int MESH_BITS = 14;
+static const int DEPTH_BITS = 24;
+
+int addRenderProgram(RenderQueue& queue, GLuint programID)
+{
+    RenderProgram program;
+    program.programID = programID;
+    program.matrixID = glGetUniformLocation(programID, "MVP");
+    program.modelMatrixID = glGetUniformLocation(programID, "M");
+    program.viewMatrixID = glGetUniformLocation(programID, "V");
+    program.lightID = glGetUniformLocation(programID, "LightPosition_worldspace");
+    program.textureID = glGetUniformLocation(programID, "myTextureSampler");
+    queue.programs.push_back(program);
+    return (int)queue.programs.size() - 1;
+}
+
+int addRenderMaterial(RenderQueue& queue, GLuint texture)
+{
+    queue.materials.push_back(texture);
+    return (int)queue.materials.size() - 1;
+}
+
+int addRenderMesh(RenderQueue& queue, const Mesh& mesh)
+{
+    queue.meshes.push_back(mesh);
+    return (int)queue.meshes.size() - 1;
+}
+
+unsigned long long makeSortKey(unsigned pass, unsigned program,
+                               unsigned material, unsigned mesh,
+                               float depth, float depthRange)
+{
+    const unsigned long long depthMax = (1ull << DEPTH_BITS) - 1;
+    float normalized = depth / depthRange;
+    if (normalized < 0.0f)
+        normalized = 0.0f;
+    if (normalized > 1.0f)
+        normalized = 1.0f;
+    unsigned long long depthBits =
+        (unsigned long long)(normalized * (float)depthMax);
+
+    unsigned long long key = pass & ((1u << PASS_BITS) - 1);
+    key = (key << PROGRAM_BITS) | (program & ((1u << PROGRAM_BITS) - 1));
+    key = (key << MATERIAL_BITS) | (material & ((1u << MATERIAL_BITS) - 1));
+    key = (key << MESH_BITS) | (mesh & ((1u << MESH_BITS) - 1));
+    key = (key << DEPTH_BITS) | depthBits;
+    return key;
+}
+
+void submitRenderPacket(RenderQueue& queue, unsigned pass, int program,
+                        int material, int mesh, const glm::mat4& model,
+                        const glm::mat4& view)
+{
+    // Distance along the view direction of the object's origin
+    glm::vec4 center = view * model[3];
+
+    RenderPacket packet;
+    packet.key = makeSortKey(pass, program, material, mesh, -center.z,
+                             queue.depthRange);
+    packet.model = model;
+    queue.packets.push_back(packet);
+}
+
+static void radixSort(std::vector<SortItem>& items,
+                      std::vector<SortItem>& scratch)
+{
+    scratch.resize(items.size());
+    // 8 passes of 8 bits, least significant byte first. A byte that is the
+    // same in every key (unused program bits, a single pass...) is skipped.
+    for (int shift = 0; shift < 64; shift += 8)
+    {
+        size_t counts[257] = {0};
+        for (size_t i = 0; i < items.size(); i++)
+            counts[((items[i].key >> shift) & 0xFF) + 1]++;
+
+        bool allSame = false;
+        for (int b = 1; b <= 256; b++)
+        {
+            if (counts[b] == items.size())
+                allSame = true;
+        }
+        if (allSame)
+            continue;
+
+        for (int b = 1; b <= 256; b++)
+            counts[b] += counts[b - 1];
+        for (size_t i = 0; i < items.size(); i++)
+            scratch[counts[(items[i].key >> shift) & 0xFF]++] = items[i];
+        items.swap(scratch);
+    }
+}
+
+void flushRenderQueue(RenderQueue& queue, const glm::mat4& view,
+                      const glm::mat4& projection, const glm::vec3& lightPos)
+{
+    RenderQueueStats stats = RenderQueueStats();
+    stats.packets = (int)queue.packets.size();
+
+    sortItems.resize(queue.packets.size());
+    for (size_t i = 0; i < queue.packets.size(); i++)
+    {
+        sortItems[i].key = queue.packets[i].key;
+        sortItems[i].packet = (unsigned)i;
+    }
+    if (queue.sortEnabled)
+        radixSort(sortItems, sortScratch);
+
+    glm::mat4 viewProjection = projection * view;
+    int currentProgram = -1;
+    int currentMaterial = -1;
+    int currentMesh = -1;
+
+    for (size_t i = 0; i < sortItems.size(); i++)
+    {
+        const RenderPacket& packet = queue.packets[sortItems[i].packet];
+        unsigned long long key = packet.key >> DEPTH_BITS;
+        int mesh = (int)(key & ((1u << MESH_BITS) - 1));
+        key >>= MESH_BITS;
+        int material = (int)(key & ((1u << MATERIAL_BITS) - 1));
+        key >>= MATERIAL_BITS;
+        int program = (int)(key & ((1u << PROGRAM_BITS) - 1));
+
+        const RenderProgram& renderProgram = queue.programs[program];
+        if (program != currentProgram)
+        {
+            stateUseProgram(renderProgram.programID);
+            // Per frame uniforms only change with the program
+            glUniformMatrix4fv(renderProgram.viewMatrixID, 1, GL_FALSE,
+                               &view[0][0]);
+            glUniform3f(renderProgram.lightID, lightPos.x, lightPos.y,
+                        lightPos.z);
+            glUniform1i(renderProgram.textureID, 0);
+            currentProgram = program;
+            stats.programBinds++;
+        }
+        else
+            stats.programBindsSkipped++;
+
+        if (material != currentMaterial)
+        {
+            stateActiveTexture(GL_TEXTURE0);
+            stateBindTexture(GL_TEXTURE_2D, queue.materials[material]);
+            currentMaterial = material;
+            stats.textureBinds++;
+        }
+        else
+            stats.textureBindsSkipped++;
+
+        const Mesh& renderMesh = queue.meshes[mesh];
+        if (mesh != currentMesh)
+        {
+            stateBindVertexArray(renderMesh.vertexArray);
+            currentMesh = mesh;
+            stats.meshBinds++;
+        }
+        else
+            stats.meshBindsSkipped++;
+
+        glm::mat4 MVP = viewProjection * packet.model;
+        glUniformMatrix4fv(renderProgram.matrixID, 1, GL_FALSE, &MVP[0][0]);
+        glUniformMatrix4fv(renderProgram.modelMatrixID, 1, GL_FALSE,
+                           &packet.model[0][0]);
+        glDrawElements(GL_TRIANGLES, renderMesh.indexCount, GL_UNSIGNED_SHORT,
+                       (void*)0);
+    }
+
+    queue.packets.clear();
+    queue.stats = stats;
+}
+
+void clearRenderQueue(RenderQueue& queue)
+{
+    queue.programs.clear();
+    queue.materials.clear();
+    queue.meshes.clear();
+    queue.packets.clear();
+}
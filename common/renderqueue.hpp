@@ -0,0 +1,76 @@
+#ifndef RENDERQUEUE_HPP
+#define RENDERQUEUE_HPP
+
+// Draws are recorded as packets during the frame, sorted by a 64 bit key and
+// submitted in that order, so that objects sharing a program, texture or
+// mesh end up next to each other and the binds between them can be skipped.
+//
+// Sort key, most significant bits first :
+//   pass (4) | program (10) | material (12) | mesh (14) | depth (24)
+// Depth is the view space distance, so opaque objects inside one state
+// bucket go front to back.
+
+// A program that follows the StandardShading uniform names
+// (MVP, M, V, LightPosition_worldspace, myTextureSampler).
+struct RenderProgram
+{
+    GLuint programID;
+    GLint matrixID;
+    GLint modelMatrixID;
+    GLint viewMatrixID;
+    GLint lightID;
+    GLint textureID;
+};
+
+struct RenderPacket
+{
+    unsigned long long key;
+    glm::mat4 model;
+};
+
+// Counts for the last flushRenderQueue() : how many binds were actually
+// issued, and how many were skipped because the state was already set.
+struct RenderQueueStats
+{
+    int packets;
+    int programBinds, programBindsSkipped;
+    int textureBinds, textureBindsSkipped;
+    int meshBinds, meshBindsSkipped;
+};
+
+struct RenderQueue
+{
+    std::vector<RenderProgram> programs;
+    std::vector<GLuint> materials; // one texture each, bound to unit 0
+    std::vector<Mesh> meshes;
+    std::vector<RenderPacket> packets;
+    // Distance mapped to the largest depth key ; further objects share it
+    float depthRange = 100.0f;
+    // When false the packets are submitted in recording order, to compare
+    bool sortEnabled = true;
+    RenderQueueStats stats = RenderQueueStats();
+};
+
+// The returned ids are what submitRenderPacket() takes.
+int addRenderProgram(RenderQueue& queue, GLuint programID);
+int addRenderMaterial(RenderQueue& queue, GLuint texture);
+int addRenderMesh(RenderQueue& queue, const Mesh& mesh);
+
+unsigned long long makeSortKey(unsigned pass, unsigned program,
+                               unsigned material, unsigned mesh,
+                               float depth, float depthRange);
+
+// Records one draw. view is only used to compute the depth part of the key.
+void submitRenderPacket(RenderQueue& queue, unsigned pass, int program,
+                        int material, int mesh, const glm::mat4& model,
+                        const glm::mat4& view);
+
+// Sorts (LSD radix sort on the keys), draws and clears the packets. The view,
+// projection and light are set once per program switch.
+void flushRenderQueue(RenderQueue& queue, const glm::mat4& view,
+                      const glm::mat4& projection, const glm::vec3& lightPos);
+
+// Does not delete the meshes, textures or programs, which the caller owns.
+void clearRenderQueue(RenderQueue& queue);
+
+#endif
@@ -3,4 +3,8 @@
 
 GLuint LoadShaders(const char * vertex_file_path,const char * fragment_file_path);
 
+// A program with only a vertex shader, for transform feedback : the
+// varyings are captured interleaved, in this order, into one buffer.
+GLuint LoadTransformFeedbackShader(const char * vertex_file_path, const char * const * varyings, int varyingCount);
+
 #endif
@@ -0,0 +1,81 @@
+#ifndef SIMD_HPP
+#define SIMD_HPP
+
+// Picks the widest instruction set the compiler was allowed to use. AVX2 is
+// only enabled with the TUTORIALS_AVX2 CMake option (-mavx2 / /arch:AVX2),
+// since the binaries would not start on older CPUs ; SSE2 is always there on
+// x86-64. Everything has a plain C++ path for the other architectures.
+#if defined(__AVX2__)
+#define SIMD_AVX2 1
+#define SIMD_SSE2 1
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIMD_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// Number of floats processed per step by the SIMD paths
+#if defined(SIMD_AVX2)
+#define SIMD_WIDTH 8
+#elif defined(SIMD_SSE2)
+#define SIMD_WIDTH 4
+#else
+#define SIMD_WIDTH 1
+#endif
+
+// SIMD_WIDTH floats and the few operations the rasterizers
+// (occlusion.cpp, softrender.cpp), the particles (particles.cpp) and the
+// ray picking (picking.cpp) need.
+// Comparisons return all-ones lanes, which lanesSelect() and lanesMask()
+// expect.
+#if defined(SIMD_AVX2)
+typedef __m256 Lanes;
+static inline Lanes lanesSet(float f) { return _mm256_set1_ps(f); }
+static inline Lanes lanesOffsets() { return _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7); }
+static inline Lanes lanesAdd(Lanes a, Lanes b) { return _mm256_add_ps(a, b); }
+static inline Lanes lanesSub(Lanes a, Lanes b) { return _mm256_sub_ps(a, b); }
+static inline Lanes lanesMul(Lanes a, Lanes b) { return _mm256_mul_ps(a, b); }
+static inline Lanes lanesDiv(Lanes a, Lanes b) { return _mm256_div_ps(a, b); }
+static inline Lanes lanesSqrt(Lanes a) { return _mm256_sqrt_ps(a); }
+static inline Lanes lanesMin(Lanes a, Lanes b) { return _mm256_min_ps(a, b); }
+static inline Lanes lanesMax(Lanes a, Lanes b) { return _mm256_max_ps(a, b); }
+static inline Lanes lanesAnd(Lanes a, Lanes b) { return _mm256_and_ps(a, b); }
+static inline Lanes lanesGreaterEqual(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_GE_OQ); }
+static inline Lanes lanesLess(Lanes a, Lanes b) { return _mm256_cmp_ps(a, b, _CMP_LT_OQ); }
+static inline Lanes lanesSelect(Lanes mask, Lanes a, Lanes b) { return _mm256_blendv_ps(b, a, mask); }
+static inline int lanesMask(Lanes a) { return _mm256_movemask_ps(a); }
+static inline Lanes lanesLoad(const float* p) { return _mm256_loadu_ps(p); }
+static inline void lanesStore(float* p, Lanes a) { _mm256_storeu_ps(p, a); }
+#elif defined(SIMD_SSE2)
+typedef __m128 Lanes;
+static inline Lanes lanesSet(float f) { return _mm_set1_ps(f); }
+static inline Lanes lanesOffsets() { return _mm_setr_ps(0, 1, 2, 3); }
+static inline Lanes lanesAdd(Lanes a, Lanes b) { return _mm_add_ps(a, b); }
+static inline Lanes lanesSub(Lanes a, Lanes b) { return _mm_sub_ps(a, b); }
+static inline Lanes lanesMul(Lanes a, Lanes b) { return _mm_mul_ps(a, b); }
+static inline Lanes lanesDiv(Lanes a, Lanes b) { return _mm_div_ps(a, b); }
+static inline Lanes lanesSqrt(Lanes a) { return _mm_sqrt_ps(a); }
+static inline Lanes lanesMin(Lanes a, Lanes b) { return _mm_min_ps(a, b); }
+static inline Lanes lanesMax(Lanes a, Lanes b) { return _mm_max_ps(a, b); }
+static inline Lanes lanesAnd(Lanes a, Lanes b) { return _mm_and_ps(a, b); }
+static inline Lanes lanesGreaterEqual(Lanes a, Lanes b) { return _mm_cmpge_ps(a, b); }
+static inline Lanes lanesLess(Lanes a, Lanes b) { return _mm_cmplt_ps(a, b); }
+static inline Lanes lanesSelect(Lanes mask, Lanes a, Lanes b) { return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b)); }
+static inline int lanesMask(Lanes a) { return _mm_movemask_ps(a); }
+static inline Lanes lanesLoad(const float* p) { return _mm_loadu_ps(p); }
+static inline void lanesStore(float* p, Lanes a) { _mm_storeu_ps(p, a); }
+#endif
+
+inline const char* simdName()
+{
+#if defined(SIMD_AVX2)
+    return "AVX2";
+#elif defined(SIMD_SSE2)
+    return "SSE2";
+#else
+    return "scalar";
+#endif
+}
+
+#endif
@@ -0,0 +1,843 @@
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+#include <cmath>
+
+#include <glm/glm.hpp>
+
+#include "simd.hpp"
+#include "jobs.hpp"
+#include "softrender.hpp"
+
+static const unsigned NO_TRIANGLE = 0xFFFFFFFFu;
+
+static double nowMs()
+{
+    std::chrono::steady_clock::duration now = std::chrono::steady_clock::now().time_since_epoch();
+    return std::chrono::duration<double, std::milli>(now).count();
+}
+
+void buildSoftMipmaps(SoftTexture& texture)
+{
+    texture.levels.resize(1);
+    while (texture.levels.back().width > 1 || texture.levels.back().height > 1)
+    {
+        const SoftImage& source = texture.levels.back();
+        SoftImage level;
+        level.width = std::max(1, source.width / 2);
+        level.height = std::max(1, source.height / 2);
+        level.pixels.resize(level.width * level.height * 4);
+        for (int y = 0; y < level.height; y++)
+        {
+            int y0 = std::min(2 * y, source.height - 1);
+            int y1 = std::min(2 * y + 1, source.height - 1);
+            for (int x = 0; x < level.width; x++)
+            {
+                int x0 = std::min(2 * x, source.width - 1);
+                int x1 = std::min(2 * x + 1, source.width - 1);
+                for (int c = 0; c < 4; c++)
+                {
+                    int sum = source.pixels[(y0 * source.width + x0) * 4 + c] +
+                              source.pixels[(y0 * source.width + x1) * 4 + c] +
+                              source.pixels[(y1 * source.width + x0) * 4 + c] +
+                              source.pixels[(y1 * source.width + x1) * 4 + c];
+                    level.pixels[(y * level.width + x) * 4 + c] = (unsigned char)((sum + 2) / 4);
+                }
+            }
+        }
+        texture.levels.push_back(level);
+    }
+}
+
+bool loadSoftTextureBMP(const char* imagepath, SoftTexture& texture)
+{
+    FILE* file = fopen(imagepath, "rb");
+    if (!file)
+    {
+        printf("%s could not be opened.\n", imagepath);
+        return false;
+    }
+    unsigned char header[54];
+    if (fread(header, 1, 54, file) != 54 || header[0] != 'B' || header[1] != 'M' ||
+        *(int*)&(header[0x1E]) != 0 || *(int*)&(header[0x1C]) != 24)
+    {
+        printf("Not a correct BMP file\n");
+        fclose(file);
+        return false;
+    }
+    unsigned int dataPos = *(int*)&(header[0x0A]);
+    unsigned int imageSize = *(int*)&(header[0x22]);
+    int width = *(int*)&(header[0x12]);
+    int height = *(int*)&(header[0x16]);
+    if (imageSize == 0)
+        imageSize = width * height * 3;
+    if (dataPos == 0)
+        dataPos = 54;
+
+    // Same reading as loadBMP_custom() : no row padding, BGR
+    std::vector<unsigned char> data(std::max(imageSize, (unsigned)(width * height * 3)));
+    fseek(file, dataPos, SEEK_SET);
+    fread(&data[0], 1, imageSize, file);
+    fclose(file);
+
+    texture.levels.resize(1);
+    SoftImage& image = texture.levels[0];
+    image.width = width;
+    image.height = height;
+    image.pixels.resize(width * height * 4);
+    for (int i = 0; i < width * height; i++)
+    {
+        image.pixels[i * 4 + 0] = data[i * 3 + 2];
+        image.pixels[i * 4 + 1] = data[i * 3 + 1];
+        image.pixels[i * 4 + 2] = data[i * 3 + 0];
+        image.pixels[i * 4 + 3] = 255;
+    }
+    buildSoftMipmaps(texture);
+    return true;
+}
+
+#define FOURCC_DXT1 0x31545844 // Equivalent to "DXT1" in ASCII
+#define FOURCC_DXT3 0x33545844 // Equivalent to "DXT3" in ASCII
+#define FOURCC_DXT5 0x35545844 // Equivalent to "DXT5" in ASCII
+
+static void decodeColor565(unsigned short c, int rgb[3])
+{
+    rgb[0] = ((c >> 11) & 31) * 255 / 31;
+    rgb[1] = ((c >> 5) & 63) * 255 / 63;
+    rgb[2] = (c & 31) * 255 / 31;
+}
+
+// One 4x4 block into image, at (blockX, blockY) in blocks
+static void decodeDXTBlock(const unsigned char* block, unsigned int fourCC,
+                           SoftImage& image, int blockX, int blockY)
+{
+    unsigned char alpha[16];
+    memset(alpha, 255, sizeof(alpha));
+    if (fourCC == FOURCC_DXT3)
+    {
+        for (int i = 0; i < 16; i++)
+            alpha[i] = ((block[i / 2] >> (4 * (i & 1))) & 15) * 17;
+        block += 8;
+    }
+    else if (fourCC == FOURCC_DXT5)
+    {
+        int a[8] = { block[0], block[1] };
+        for (int i = 2; i < 8; i++)
+        {
+            if (a[0] > a[1])
+                a[i] = ((8 - i) * a[0] + (i - 1) * a[1]) / 7;
+            else
+                a[i] = i < 6 ? ((6 - i) * a[0] + (i - 1) * a[1]) / 5 : (i == 6 ? 0 : 255);
+        }
+        unsigned long long bits = 0;
+        for (int i = 0; i < 6; i++)
+            bits |= (unsigned long long)block[2 + i] << (8 * i);
+        for (int i = 0; i < 16; i++)
+            alpha[i] = (unsigned char)a[(bits >> (3 * i)) & 7];
+        block += 8;
+    }
+
+    unsigned short c0 = block[0] | (block[1] << 8);
+    unsigned short c1 = block[2] | (block[3] << 8);
+    int colors[4][4];
+    decodeColor565(c0, colors[0]);
+    decodeColor565(c1, colors[1]);
+    colors[0][3] = colors[1][3] = colors[2][3] = colors[3][3] = 255;
+    for (int c = 0; c < 3; c++)
+    {
+        if (c0 > c1 || fourCC != FOURCC_DXT1)
+        {
+            colors[2][c] = (2 * colors[0][c] + colors[1][c]) / 3;
+            colors[3][c] = (colors[0][c] + 2 * colors[1][c]) / 3;
+        }
+        else
+        {
+            colors[2][c] = (colors[0][c] + colors[1][c]) / 2;
+            colors[3][c] = 0;
+        }
+    }
+    if (c0 <= c1 && fourCC == FOURCC_DXT1)
+        colors[3][3] = 0;
+
+    for (int i = 0; i < 16; i++)
+    {
+        int x = blockX * 4 + (i & 3);
+        int y = blockY * 4 + (i >> 2);
+        if (x >= image.width || y >= image.height)
+            continue;
+        int index = (block[4 + (i >> 2)] >> (2 * (i & 3))) & 3;
+        unsigned char* pixel = &image.pixels[(y * image.width + x) * 4];
+        pixel[0] = (unsigned char)colors[index][0];
+        pixel[1] = (unsigned char)colors[index][1];
+        pixel[2] = (unsigned char)colors[index][2];
+        pixel[3] = (unsigned char)std::min(colors[index][3], (int)alpha[i]);
+    }
+}
+
+bool loadSoftTextureDDS(const char* imagepath, SoftTexture& texture)
+{
+    FILE* fp = fopen(imagepath, "rb");
+    if (fp == NULL)
+    {
+        printf("%s could not be opened.\n", imagepath);
+        return false;
+    }
+    char filecode[4];
+    unsigned char header[124];
+    if (fread(filecode, 1, 4, fp) != 4 || strncmp(filecode, "DDS ", 4) != 0 ||
+        fread(header, 124, 1, fp) != 1)
+    {
+        fclose(fp);
+        return false;
+    }
+    unsigned int height = *(unsigned int*)&(header[8]);
+    unsigned int width = *(unsigned int*)&(header[12]);
+    unsigned int mipMapCount = *(unsigned int*)&(header[24]);
+    unsigned int fourCC = *(unsigned int*)&(header[80]);
+    if (fourCC != FOURCC_DXT1 && fourCC != FOURCC_DXT3 && fourCC != FOURCC_DXT5)
+    {
+        fclose(fp);
+        return false;
+    }
+    unsigned int blockSize = (fourCC == FOURCC_DXT1) ? 8 : 16;
+
+    // Every level stored in the file, as loadDDS() gives them to GL
+    texture.levels.clear();
+    std::vector<unsigned char> blocks;
+    for (unsigned int level = 0; level < std::max(1u, mipMapCount) && (width || height); ++level)
+    {
+        int blocksX = (width + 3) / 4;
+        int blocksY = (height + 3) / 4;
+        blocks.resize(blocksX * blocksY * blockSize);
+        if (fread(&blocks[0], 1, blocks.size(), fp) != blocks.size())
+            break;
+
+        SoftImage image;
+        image.width = std::max(1u, width);
+        image.height = std::max(1u, height);
+        image.pixels.resize(image.width * image.height * 4);
+        for (int by = 0; by < blocksY; by++)
+            for (int bx = 0; bx < blocksX; bx++)
+                decodeDXTBlock(&blocks[(by * blocksX + bx) * blockSize], fourCC, image, bx, by);
+        texture.levels.push_back(image);
+
+        width /= 2;
+        height /= 2;
+    }
+    fclose(fp);
+
+    if (texture.levels.empty())
+        return false;
+    if (texture.levels.size() == 1)
+        buildSoftMipmaps(texture);
+    return true;
+}
+
+int addSoftMesh(std::vector<SoftMesh>& meshes,
+                const std::vector<unsigned short>& indices,
+                const std::vector<glm::vec3>& vertices,
+                const std::vector<glm::vec2>& uvs,
+                const std::vector<glm::vec3>& normals)
+{
+    SoftMesh mesh;
+    mesh.indices = indices;
+    mesh.vertices = vertices;
+    mesh.uvs = uvs;
+    mesh.normals = normals;
+    meshes.push_back(mesh);
+    return (int)meshes.size() - 1;
+}
+
+void initSoftRenderer(SoftRenderer& renderer, int width, int height,
+                      int threadCount)
+{
+    if (threadCount <= 0)
+        threadCount = std::max(1, (int)std::thread::hardware_concurrency());
+    renderer.width = width;
+    renderer.height = height;
+    renderer.threadCount = threadCount;
+    renderer.tilesX = (width + renderer.tileSize - 1) / renderer.tileSize;
+    renderer.tilesY = (height + renderer.tileSize - 1) / renderer.tileSize;
+
+    renderer.color.width = width;
+    renderer.color.height = height;
+    renderer.color.pixels.assign(width * height * 4, 0);
+    int paddedPixels = renderer.tilesX * renderer.tileSize * renderer.tilesY * renderer.tileSize;
+    renderer.depth.assign(paddedPixels, 1.0f);
+    renderer.visibility.assign(paddedPixels, NO_TRIANGLE);
+    renderer.triangles.assign(threadCount, std::vector<SoftTriangle>());
+    renderer.vertices.assign(threadCount, std::vector<SoftVertex>());
+    renderer.bins.assign(threadCount, std::vector<std::vector<unsigned> >(
+                                          renderer.tilesX * renderer.tilesY));
+    renderer.stats = SoftRenderStats();
+    destroyJobSystem(renderer.jobs);
+    renderer.jobs = threadCount > 1 ? createJobSystem(threadCount) : NULL;
+}
+
+void deleteSoftRenderer(SoftRenderer& renderer)
+{
+    destroyJobSystem(renderer.jobs);
+    renderer.jobs = NULL;
+}
+
+// What every stage of a frame reads
+struct SoftFrame
+{
+    SoftRenderer* renderer;
+    const std::vector<SoftMesh>* meshes;
+    const std::vector<SoftInstance>* instances;
+    const std::vector<SoftTexture>* materials;
+    glm::mat4 viewProjection;
+    glm::mat4 view;
+    glm::vec3 lightPosition;
+    glm::vec3 clearColor;
+    // Instances [instanceStart[t], instanceStart[t + 1]) go to part t
+    std::vector<int> instanceStart;
+};
+
+static SoftVertex lerpVertex(const SoftVertex& a, const SoftVertex& b, float t)
+{
+    SoftVertex v;
+    v.clip = a.clip + (b.clip - a.clip) * t;
+    v.uv = a.uv + (b.uv - a.uv) * t;
+    v.position = a.position + (b.position - a.position) * t;
+    v.positionCamera = a.positionCamera + (b.positionCamera - a.positionCamera) * t;
+    v.normal = a.normal + (b.normal - a.normal) * t;
+    return v;
+}
+
+// Screen gradient of the plane through (x, y, value) at the 3 vertices
+static void planeGradient(const glm::vec3* screen, float f0, float f1, float f2,
+                          float invArea, float& dx, float& dy)
+{
+    dx = ((f1 - f0) * (screen[2].y - screen[0].y) - (f2 - f0) * (screen[1].y - screen[0].y)) * invArea;
+    dy = ((f2 - f0) * (screen[1].x - screen[0].x) - (f1 - f0) * (screen[2].x - screen[0].x)) * invArea;
+}
+
+static void setupTriangle(SoftRenderer& renderer, int part, int material,
+                          const SoftVertex& v0, const SoftVertex& v1,
+                          const SoftVertex& v2)
+{
+    const SoftVertex* v[3] = { &v0, &v1, &v2 };
+    glm::vec3 screen[3];
+    float invW[3];
+    for (int i = 0; i < 3; i++)
+    {
+        invW[i] = 1.0f / v[i]->clip.w;
+        glm::vec3 ndc = glm::vec3(v[i]->clip) * invW[i];
+        screen[i] = glm::vec3((ndc.x * 0.5f + 0.5f) * renderer.width,
+                              (ndc.y * 0.5f + 0.5f) * renderer.height,
+                              ndc.z * 0.5f + 0.5f);
+    }
+
+    // Twice the signed area : positive for counter-clockwise front faces
+    float area = (screen[1].x - screen[0].x) * (screen[2].y - screen[0].y) -
+                 (screen[2].x - screen[0].x) * (screen[1].y - screen[0].y);
+    if (!(area > 0.0f))
+        return;
+
+    SoftTriangle triangle;
+    // Pixel centers are at +0.5
+    triangle.minX = std::max(0, (int)std::ceil(std::min(screen[0].x, std::min(screen[1].x, screen[2].x)) - 0.5f));
+    triangle.maxX = std::min(renderer.width - 1, (int)std::floor(std::max(screen[0].x, std::max(screen[1].x, screen[2].x)) - 0.5f));
+    triangle.minY = std::max(0, (int)std::ceil(std::min(screen[0].y, std::min(screen[1].y, screen[2].y)) - 0.5f));
+    triangle.maxY = std::min(renderer.height - 1, (int)std::floor(std::max(screen[0].y, std::max(screen[1].y, screen[2].y)) - 0.5f));
+    if (triangle.minX > triangle.maxX || triangle.minY > triangle.maxY)
+        return;
+
+    for (int e = 0; e < 3; e++)
+    {
+        const glm::vec3& a = screen[e];
+        const glm::vec3& b = screen[(e + 1) % 3];
+        triangle.edgeA[e] = a.y - b.y;
+        triangle.edgeB[e] = b.x - a.x;
+        triangle.edgeC[e] = -(triangle.edgeA[e] * a.x + triangle.edgeB[e] * a.y);
+    }
+    triangle.invArea = 1.0f / area;
+
+    // Window depth is affine in screen space, and so are u/w, v/w and 1/w
+    planeGradient(screen, screen[0].z, screen[1].z, screen[2].z, triangle.invArea,
+                  triangle.depthA, triangle.depthB);
+    triangle.depthC = screen[0].z - triangle.depthA * screen[0].x - triangle.depthB * screen[0].y;
+    planeGradient(screen, invW[0], invW[1], invW[2], triangle.invArea,
+                  triangle.invWdx, triangle.invWdy);
+    planeGradient(screen, v0.uv.x * invW[0], v1.uv.x * invW[1], v2.uv.x * invW[2],
+                  triangle.invArea, triangle.uWdx, triangle.uWdy);
+    planeGradient(screen, v0.uv.y * invW[0], v1.uv.y * invW[1], v2.uv.y * invW[2],
+                  triangle.invArea, triangle.vWdx, triangle.vWdy);
+
+    for (int i = 0; i < 3; i++)
+    {
+        triangle.invW[i] = invW[i];
+        triangle.uv[i] = v[i]->uv;
+        triangle.position[i] = v[i]->position;
+        triangle.positionCamera[i] = v[i]->positionCamera;
+        triangle.normal[i] = v[i]->normal;
+    }
+    triangle.material = material;
+
+    std::vector<SoftTriangle>& triangles = renderer.triangles[part];
+    unsigned index = (unsigned)triangles.size();
+    triangles.push_back(triangle);
+
+    // Bin into every tile the bounding box touches
+    std::vector<std::vector<unsigned> >& bins = renderer.bins[part];
+    for (int ty = triangle.minY / renderer.tileSize; ty <= triangle.maxY / renderer.tileSize; ty++)
+        for (int tx = triangle.minX / renderer.tileSize; tx <= triangle.maxX / renderer.tileSize; tx++)
+            bins[ty * renderer.tilesX + tx].push_back(index);
+}
+
+// Vertex shading, clipping, setup and binning of this part's instances
+static void processGeometry(SoftRenderer* renderer, SoftFrame* frame, int part)
+{
+    renderer->triangles[part].clear();
+    std::vector<std::vector<unsigned> >& bins = renderer->bins[part];
+    for (size_t b = 0; b < bins.size(); b++)
+        bins[b].clear();
+
+    std::vector<SoftVertex>& vertices = renderer->vertices[part];
+    for (int i = frame->instanceStart[part]; i < frame->instanceStart[part + 1]; i++)
+    {
+        const SoftInstance& instance = (*frame->instances)[i];
+        const SoftMesh& mesh = (*frame->meshes)[instance.mesh];
+
+        // As StandardShadingInstanced.vertexshader
+        glm::mat4 viewModel = frame->view * instance.model;
+        vertices.resize(mesh.vertices.size());
+        for (size_t n = 0; n < mesh.vertices.size(); n++)
+        {
+            SoftVertex& vertex = vertices[n];
+            vertex.position = glm::vec3(instance.model * glm::vec4(mesh.vertices[n], 1.0f));
+            vertex.positionCamera = glm::vec3(frame->view * glm::vec4(vertex.position, 1.0f));
+            vertex.clip = frame->viewProjection * glm::vec4(vertex.position, 1.0f);
+            vertex.uv = mesh.uvs[n];
+            vertex.normal = glm::vec3(viewModel * glm::vec4(mesh.normals[n], 0.0f));
+        }
+
+        for (size_t n = 0; n + 2 < mesh.indices.size(); n += 3)
+        {
+            const SoftVertex* in[3] = { &vertices[mesh.indices[n]],
+                                        &vertices[mesh.indices[n + 1]],
+                                        &vertices[mesh.indices[n + 2]] };
+
+            // Entirely outside one of the side planes
+            bool outside = false;
+            for (int axis = 0; axis < 2 && !outside; axis++)
+            {
+                outside = (in[0]->clip[axis] > in[0]->clip.w && in[1]->clip[axis] > in[1]->clip.w &&
+                           in[2]->clip[axis] > in[2]->clip.w) ||
+                          (in[0]->clip[axis] < -in[0]->clip.w && in[1]->clip[axis] < -in[1]->clip.w &&
+                           in[2]->clip[axis] < -in[2]->clip.w);
+            }
+            if (outside)
+                continue;
+
+            if (in[0]->clip.z >= -in[0]->clip.w && in[1]->clip.z >= -in[1]->clip.w &&
+                in[2]->clip.z >= -in[2]->clip.w)
+            {
+                setupTriangle(*renderer, part, instance.material, *in[0], *in[1], *in[2]);
+                continue;
+            }
+
+            // Clip against the near plane z = -w, as in occlusion.cpp
+            SoftVertex out[4];
+            int outCount = 0;
+            for (int e = 0; e < 3; e++)
+            {
+                const SoftVertex& a = *in[e];
+                const SoftVertex& b = *in[(e + 1) % 3];
+                float da = a.clip.z + a.clip.w;
+                float db = b.clip.z + b.clip.w;
+                if (da >= 0.0f)
+                    out[outCount++] = a;
+                if ((da >= 0.0f) != (db >= 0.0f))
+                    out[outCount++] = lerpVertex(a, b, da / (da - db));
+            }
+            if (outCount >= 3)
+                setupTriangle(*renderer, part, instance.material, out[0], out[1], out[2]);
+            if (outCount == 4)
+                setupTriangle(*renderer, part, instance.material, out[0], out[2], out[3]);
+        }
+    }
+}
+
+// Coverage and depth test of every triangle binned to the tile, in
+// submission order, keeping the nearest triangle of each pixel
+static void rasterizeTile(SoftRenderer& renderer, int tile)
+{
+    int stride = renderer.tilesX * renderer.tileSize;
+    int tileX = (tile % renderer.tilesX) * renderer.tileSize;
+    int tileY = (tile / renderer.tilesX) * renderer.tileSize;
+    for (int y = tileY; y < tileY + renderer.tileSize; y++)
+    {
+        std::fill(&renderer.depth[y * stride + tileX], &renderer.depth[y * stride + tileX] + renderer.tileSize, 1.0f);
+        std::fill(&renderer.visibility[y * stride + tileX],
+                  &renderer.visibility[y * stride + tileX] + renderer.tileSize, NO_TRIANGLE);
+    }
+
+    for (int part = 0; part < renderer.threadCount; part++)
+    {
+        const std::vector<unsigned>& bin = renderer.bins[part][tile];
+        for (size_t b = 0; b < bin.size(); b++)
+        {
+            const SoftTriangle& triangle = renderer.triangles[part][bin[b]];
+            unsigned id = ((unsigned)part << 24) | bin[b];
+            int minY = std::max(triangle.minY, tileY);
+            int maxY = std::min(triangle.maxY, tileY + renderer.tileSize - 1);
+            // Tiles are a multiple of SIMD_WIDTH wide, so starting on a
+            // boundary a step never crosses the tile's edge
+            int minX = std::max(triangle.minX, tileX) & ~(SIMD_WIDTH - 1);
+            int maxX = std::min(triangle.maxX, tileX + renderer.tileSize - 1);
+
+            for (int y = minY; y <= maxY; y++)
+            {
+                float py = y + 0.5f;
+                float* depthRow = &renderer.depth[y * stride];
+                unsigned* visibilityRow = &renderer.visibility[y * stride];
+                float rowEdge[3];
+                for (int e = 0; e < 3; e++)
+                    rowEdge[e] = triangle.edgeB[e] * py + triangle.edgeC[e];
+                float rowDepth = triangle.depthB * py + triangle.depthC;
+
+#if defined(SIMD_SSE2)
+                Lanes zero = lanesSet(0.0f);
+                Lanes offsets = lanesOffsets();
+                Lanes edgeA0 = lanesSet(triangle.edgeA[0]);
+                Lanes edgeA1 = lanesSet(triangle.edgeA[1]);
+                Lanes edgeA2 = lanesSet(triangle.edgeA[2]);
+                Lanes depthA = lanesSet(triangle.depthA);
+                for (int x = minX; x <= maxX; x += SIMD_WIDTH)
+                {
+                    Lanes px = lanesAdd(lanesSet(x + 0.5f), offsets);
+                    Lanes e0 = lanesAdd(lanesMul(edgeA0, px), lanesSet(rowEdge[0]));
+                    Lanes e1 = lanesAdd(lanesMul(edgeA1, px), lanesSet(rowEdge[1]));
+                    Lanes e2 = lanesAdd(lanesMul(edgeA2, px), lanesSet(rowEdge[2]));
+                    Lanes inside = lanesAnd(lanesGreaterEqual(e0, zero),
+                                            lanesAnd(lanesGreaterEqual(e1, zero),
+                                                     lanesGreaterEqual(e2, zero)));
+                    if (lanesMask(inside) == 0)
+                        continue;
+                    Lanes z = lanesAdd(lanesMul(depthA, px), lanesSet(rowDepth));
+                    Lanes old = lanesLoad(depthRow + x);
+                    Lanes pass = lanesAnd(inside, lanesLess(z, old));
+                    int mask = lanesMask(pass);
+                    if (mask == 0)
+                        continue;
+                    lanesStore(depthRow + x, lanesSelect(pass, z, old));
+                    for (int lane = 0; lane < SIMD_WIDTH; lane++)
+                        if (mask & (1 << lane))
+                            visibilityRow[x + lane] = id;
+                }
+#else
+                for (int x = minX; x <= maxX; x++)
+                {
+                    float px = x + 0.5f;
+                    if (triangle.edgeA[0] * px + rowEdge[0] < 0.0f ||
+                        triangle.edgeA[1] * px + rowEdge[1] < 0.0f ||
+                        triangle.edgeA[2] * px + rowEdge[2] < 0.0f)
+                        continue;
+                    float z = triangle.depthA * px + rowDepth;
+                    if (z < depthRow[x])
+                    {
+                        depthRow[x] = z;
+                        visibilityRow[x] = id;
+                    }
+                }
+#endif
+            }
+        }
+    }
+}
+
+static glm::vec3 fetchTexel(const SoftImage& image, int x, int y)
+{
+    const unsigned char* pixel = &image.pixels[(y * image.width + x) * 4];
+    return glm::vec3(pixel[0], pixel[1], pixel[2]);
+}
+
+static glm::vec3 sampleBilinear(const SoftImage& image, const glm::vec2& uv)
+{
+    float x = uv.x * image.width - 0.5f;
+    float y = uv.y * image.height - 0.5f;
+    float x0 = std::floor(x);
+    float y0 = std::floor(y);
+    float fx = x - x0;
+    float fy = y - y0;
+    // GL_REPEAT. The division is only needed outside [0, 1)
+    int ix0 = (int)x0;
+    int iy0 = (int)y0;
+    if ((unsigned)ix0 >= (unsigned)image.width)
+        ix0 = ((ix0 % image.width) + image.width) % image.width;
+    if ((unsigned)iy0 >= (unsigned)image.height)
+        iy0 = ((iy0 % image.height) + image.height) % image.height;
+    int ix1 = ix0 + 1 < image.width ? ix0 + 1 : 0;
+    int iy1 = iy0 + 1 < image.height ? iy0 + 1 : 0;
+    glm::vec3 bottom = glm::mix(fetchTexel(image, ix0, iy0), fetchTexel(image, ix1, iy0), fx);
+    glm::vec3 top = glm::mix(fetchTexel(image, ix0, iy1), fetchTexel(image, ix1, iy1), fx);
+    return glm::mix(bottom, top, fy) * (1.0f / 255.0f);
+}
+
+// GL_LINEAR_MIPMAP_LINEAR, lod being log2 of the texels per pixel of level 0
+static glm::vec3 sampleTrilinear(const SoftTexture& texture, const glm::vec2& uv,
+                                 float lod)
+{
+    int last = (int)texture.levels.size() - 1;
+    if (!(lod > 0.0f))
+        return sampleBilinear(texture.levels[0], uv);
+    if (lod >= last)
+        return sampleBilinear(texture.levels[last], uv);
+    int level = (int)lod;
+    return glm::mix(sampleBilinear(texture.levels[level], uv),
+                    sampleBilinear(texture.levels[level + 1], uv), lod - level);
+}
+
+// To RGBA8, as the framebuffer stores the vec3 the shader outputs
+static void toPixel(const glm::vec3& color, unsigned char* pixel)
+{
+    for (int c = 0; c < 3; c++)
+        pixel[c] = (unsigned char)(glm::clamp(color[c], 0.0f, 1.0f) * 255.0f + 0.5f);
+    pixel[3] = 255;
+}
+
+// StandardShadingPool.fragmentshader for every pixel of the tile
+static void shadeTile(SoftRenderer& renderer, const SoftFrame& frame, int tile)
+{
+    int stride = renderer.tilesX * renderer.tileSize;
+    int tileX = (tile % renderer.tilesX) * renderer.tileSize;
+    int tileY = (tile / renderer.tilesX) * renderer.tileSize;
+    int endX = std::min(tileX + renderer.tileSize, renderer.width);
+    int endY = std::min(tileY + renderer.tileSize, renderer.height);
+
+    glm::vec3 lightColor = glm::vec3(1, 1, 1);
+    float lightPower = 50.0f;
+    glm::vec3 specularColor = glm::vec3(0.3f, 0.3f, 0.3f);
+    glm::vec3 lightPositionCamera = glm::vec3(frame.view * glm::vec4(frame.lightPosition, 1.0f));
+    unsigned char clearPixel[4];
+    toPixel(frame.clearColor, clearPixel);
+
+    for (int y = tileY; y < endY; y++)
+    {
+        for (int x = tileX; x < endX; x++)
+        {
+            unsigned id = renderer.visibility[y * stride + x];
+            unsigned char* pixel = &renderer.color.pixels[(y * renderer.width + x) * 4];
+            if (id == NO_TRIANGLE)
+            {
+                memcpy(pixel, clearPixel, 4);
+                continue;
+            }
+            const SoftTriangle& triangle = renderer.triangles[id >> 24][id & 0xFFFFFF];
+            float px = x + 0.5f;
+            float py = y + 0.5f;
+
+            // Screen space weights, then perspective correct ones
+            float weight[3];
+            for (int e = 0; e < 3; e++)
+                weight[(e + 2) % 3] = (triangle.edgeA[e] * px + triangle.edgeB[e] * py +
+                                       triangle.edgeC[e]) * triangle.invArea;
+            float invW = 0.0f;
+            for (int i = 0; i < 3; i++)
+            {
+                weight[i] *= triangle.invW[i];
+                invW += weight[i];
+            }
+            float w = 1.0f / invW;
+            glm::vec2 uv(0.0f);
+            glm::vec3 position(0.0f), positionCamera(0.0f), normal(0.0f);
+            for (int i = 0; i < 3; i++)
+            {
+                float weightW = weight[i] * w;
+                uv += triangle.uv[i] * weightW;
+                position += triangle.position[i] * weightW;
+                positionCamera += triangle.positionCamera[i] * weightW;
+                normal += triangle.normal[i] * weightW;
+            }
+
+            // Derivatives of u = (u/w) / (1/w) along x and y, in texels
+            const SoftTexture& texture = (*frame.materials)[triangle.material];
+            const SoftImage& level0 = texture.levels[0];
+            float dudx = (triangle.uWdx - uv.x * triangle.invWdx) * w * level0.width;
+            float dvdx = (triangle.vWdx - uv.y * triangle.invWdx) * w * level0.height;
+            float dudy = (triangle.uWdy - uv.x * triangle.invWdy) * w * level0.width;
+            float dvdy = (triangle.vWdy - uv.y * triangle.invWdy) * w * level0.height;
+            float rho2 = std::max(dudx * dudx + dvdx * dvdx, dudy * dudy + dvdy * dvdy);
+            float lod = 0.5f * std::log2(std::max(rho2, 1e-12f));
+            glm::vec3 diffuseColor = sampleTrilinear(texture, uv, lod);
+
+            // Eye and light directions are affine in the position, so
+            // computing them here is the same as interpolating them
+            glm::vec3 eyeDirection = -positionCamera;
+            glm::vec3 lightDirection = lightPositionCamera + eyeDirection;
+            float distance = glm::length(frame.lightPosition - position);
+
+            glm::vec3 n = glm::normalize(normal);
+            glm::vec3 l = glm::normalize(lightDirection);
+            float cosTheta = glm::clamp(glm::dot(n, l), 0.0f, 1.0f);
+            glm::vec3 E = glm::normalize(eyeDirection);
+            glm::vec3 R = glm::reflect(-l, n);
+            float cosAlpha = glm::clamp(glm::dot(E, R), 0.0f, 1.0f);
+            float cosAlpha2 = cosAlpha * cosAlpha;
+
+            glm::vec3 color =
+                // Ambient, diffuse and specular, as in the shader
+                glm::vec3(0.1f, 0.1f, 0.1f) * diffuseColor +
+                diffuseColor * lightColor * lightPower * cosTheta / (distance * distance) +
+                specularColor * lightColor * lightPower * cosAlpha2 * cosAlpha2 * cosAlpha / (distance * distance);
+            toPixel(color, pixel);
+        }
+    }
+}
+
+// The stages as jobs on the renderer's pool. Geometry runs one job per
+// run of instances ; tiles are one job each, so a thread that got the
+// empty sky steals more of the rest.
+static void geometryJob(void* data, int begin, int end, int)
+{
+    SoftFrame* frame = (SoftFrame*)data;
+    for (int part = begin; part < end; part++)
+        processGeometry(frame->renderer, frame, part);
+}
+
+static void rasterizeJob(void* data, int begin, int end, int)
+{
+    SoftFrame* frame = (SoftFrame*)data;
+    for (int tile = begin; tile < end; tile++)
+        rasterizeTile(*frame->renderer, tile);
+}
+
+static void shadeJob(void* data, int begin, int end, int)
+{
+    SoftFrame* frame = (SoftFrame*)data;
+    for (int tile = begin; tile < end; tile++)
+        shadeTile(*frame->renderer, *frame, tile);
+}
+
+void renderSoftScene(SoftRenderer& renderer,
+                     const std::vector<SoftMesh>& meshes,
+                     const std::vector<SoftInstance>& instances,
+                     const std::vector<SoftTexture>& materials,
+                     const glm::mat4& projection, const glm::mat4& view,
+                     const glm::vec3& lightPosition,
+                     const glm::vec3& clearColor)
+{
+    SoftFrame frame;
+    frame.renderer = &renderer;
+    frame.meshes = &meshes;
+    frame.instances = &instances;
+    frame.materials = &materials;
+    frame.viewProjection = projection * view;
+    frame.view = view;
+    frame.lightPosition = lightPosition;
+    frame.clearColor = clearColor;
+
+    // Split the instances in runs of about the same number of triangles
+    renderer.stats = SoftRenderStats();
+    for (size_t i = 0; i < instances.size(); i++)
+        renderer.stats.triangles += (int)meshes[instances[i].mesh].indices.size() / 3;
+    frame.instanceStart.assign(renderer.threadCount + 1, (int)instances.size());
+    frame.instanceStart[0] = 0;
+    int part = 1;
+    long long triangles = 0;
+    for (size_t i = 0; i < instances.size() && part < renderer.threadCount; i++)
+    {
+        triangles += meshes[instances[i].mesh].indices.size() / 3;
+        while (part < renderer.threadCount &&
+               triangles * renderer.threadCount >= (long long)renderer.stats.triangles * part)
+            frame.instanceStart[part++] = (int)i + 1;
+    }
+
+    double start = nowMs();
+    int tileCount = renderer.tilesX * renderer.tilesY;
+    runJobs(renderer.jobs, geometryJob, &frame, renderer.threadCount, 1);
+    double geometryEnd = nowMs();
+    runJobs(renderer.jobs, rasterizeJob, &frame, tileCount, 1);
+    double rasterEnd = nowMs();
+    runJobs(renderer.jobs, shadeJob, &frame, tileCount, 1);
+    double shadeEnd = nowMs();
+
+    renderer.stats.geometryMs = geometryEnd - start;
+    renderer.stats.rasterMs = rasterEnd - geometryEnd;
+    renderer.stats.shadeMs = shadeEnd - rasterEnd;
+    for (int t = 0; t < renderer.threadCount; t++)
+        renderer.stats.binnedTriangles += (int)renderer.triangles[t].size();
+}
+
+bool writeSoftImagePPM(const char* path, const SoftImage& image)
+{
+    FILE* file = fopen(path, "wb");
+    if (!file)
+        return false;
+    fprintf(file, "P6\n%d %d\n255\n", image.width, image.height);
+    for (int y = image.height - 1; y >= 0; y--)
+        for (int x = 0; x < image.width; x++)
+            fwrite(&image.pixels[(y * image.width + x) * 4], 1, 3, file);
+    fclose(file);
+    return true;
+}
+
+bool readSoftImagePPM(const char* path, SoftImage& image)
+{
+    FILE* file = fopen(path, "rb");
+    if (!file)
+    {
+        printf("%s could not be opened.\n", path);
+        return false;
+    }
+    int width, height, maxValue;
+    if (fscanf(file, "P6 %d %d %d", &width, &height, &maxValue) != 3 ||
+        maxValue != 255 || fgetc(file) == EOF)
+    {
+        printf("%s is not an 8 bit binary PPM file\n", path);
+        fclose(file);
+        return false;
+    }
+    image.width = width;
+    image.height = height;
+    image.pixels.assign(width * height * 4, 255);
+    for (int y = height - 1; y >= 0; y--)
+        for (int x = 0; x < width; x++)
+            fread(&image.pixels[(y * width + x) * 4], 1, 3, file);
+    fclose(file);
+    return true;
+}
+
+SoftImageDiff diffSoftImages(const SoftImage& a, const SoftImage& b,
+                             int threshold, SoftImage* diff)
+{
+    SoftImageDiff result = SoftImageDiff();
+    int width = std::min(a.width, b.width);
+    int height = std::min(a.height, b.height);
+    if (diff)
+    {
+        diff->width = width;
+        diff->height = height;
+        diff->pixels.assign(width * height * 4, 255);
+    }
+    double total = 0.0;
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            const unsigned char* pa = &a.pixels[(y * a.width + x) * 4];
+            const unsigned char* pb = &b.pixels[(y * b.width + x) * 4];
+            int largest = 0;
+            for (int c = 0; c < 3; c++)
+            {
+                int error = std::abs(pa[c] - pb[c]);
+                total += error;
+                largest = std::max(largest, error);
+            }
+            result.maxError = std::max(result.maxError, largest);
+            if (largest > threshold)
+                result.differentPixels++;
+            if (diff)
+                memset(&diff->pixels[(y * width + x) * 4], largest, 3);
+        }
+    }
+    if (width > 0 && height > 0)
+        result.meanError = total / (3.0 * width * height);
+    return result;
+}
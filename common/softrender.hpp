@@ -0,0 +1,162 @@
+#ifndef SOFTRENDER_HPP
+#define SOFTRENDER_HPP
+
+// A CPU renderer for the scenes the samples draw with the StandardShading
+// shaders, for machines without a GPU (thumbnails, regression images). It
+// takes the same meshes, textures and matrices as the GL path and needs no
+// GL context.
+//
+// The screen is cut in tiles. Triangles are transformed, clipped and binned
+// to the tiles they touch, then each tile is rasterized by one of the
+// threads of a job system (jobs.hpp, which must be included first) : SIMD
+// edge functions and depth test first, keeping only the nearest triangle of
+// each pixel, then one shading pass per pixel with perspective correct
+// attributes and trilinear texture filtering.
+
+// An RGBA8 image, rows from the bottom up like glReadPixels() and the
+// texture data GL receives.
+struct SoftImage
+{
+    int width = 0;
+    int height = 0;
+    std::vector<unsigned char> pixels;
+};
+
+// Level 0 and its box filtered mipmaps, down to 1x1.
+struct SoftTexture
+{
+    std::vector<SoftImage> levels;
+};
+
+// Same files as loadBMP_custom() and loadDDS() (24 bit BMP ; DXT1, DXT3 or
+// DXT5 DDS), decoded to RGBA8 with the rows in the order GL gets them.
+bool loadSoftTextureBMP(const char* imagepath, SoftTexture& texture);
+bool loadSoftTextureDDS(const char* imagepath, SoftTexture& texture);
+// Replaces everything but level 0 with its box filtered mipmaps, as
+// glGenerateMipmap() does.
+void buildSoftMipmaps(SoftTexture& texture);
+
+// Indexed mesh data as given to createMesh() or addPoolMesh().
+struct SoftMesh
+{
+    std::vector<unsigned short> indices;
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec2> uvs;
+    std::vector<glm::vec3> normals;
+};
+
+// Appends a mesh and returns its index, like addPoolMesh().
+int addSoftMesh(std::vector<SoftMesh>& meshes,
+                const std::vector<unsigned short>& indices,
+                const std::vector<glm::vec3>& vertices,
+                const std::vector<glm::vec2>& uvs,
+                const std::vector<glm::vec3>& normals);
+
+// One object to draw : a mesh, the texture it samples and its model matrix.
+struct SoftInstance
+{
+    int mesh;
+    int material;
+    glm::mat4 model;
+};
+
+// Milliseconds spent in each stage of the last renderSoftScene()
+struct SoftRenderStats
+{
+    double geometryMs; // vertex transform, clipping, setup and binning
+    double rasterMs;   // coverage and depth test, all the tiles
+    double shadeMs;    // texturing and lighting, once per pixel
+    int triangles;       // submitted
+    int binnedTriangles; // left after clipping and back face culling
+};
+
+// A triangle ready to rasterize, in pixels, with what the shading needs.
+// Pixel (x, y) is covered if the three edge functions
+// a * px + b * py + c are >= 0 at its center ; edge i, divided by the
+// area, is the screen space weight of vertex (i + 2) % 3.
+struct SoftTriangle
+{
+    int minX, minY, maxX, maxY;
+    float edgeA[3], edgeB[3], edgeC[3];
+    float invArea;
+    // Window depth plane : z = depthA * px + depthB * py + depthC
+    float depthA, depthB, depthC;
+    // 1 / w of each vertex for perspective correction, and the screen
+    // gradients of 1/w, u/w and v/w for the texture LOD
+    float invW[3];
+    float invWdx, invWdy, uWdx, uWdy, vWdx, vWdy;
+    glm::vec2 uv[3];
+    glm::vec3 position[3];       // world space
+    glm::vec3 positionCamera[3]; // camera space
+    glm::vec3 normal[3];         // camera space
+    int material;
+};
+
+// A vertex after the vertex shader
+struct SoftVertex
+{
+    glm::vec4 clip;
+    glm::vec2 uv;
+    glm::vec3 position;
+    glm::vec3 positionCamera;
+    glm::vec3 normal;
+};
+
+// The geometry stage splits the instances in threadCount parts, one job
+// each, whatever thread ends up running it.
+struct SoftRenderer
+{
+    int width = 0;
+    int height = 0;
+    int threadCount = 1;
+    JobSystem* jobs = NULL; // threadCount threads, created by init
+    int tileSize = 64;
+    int tilesX = 0;
+    int tilesY = 0;
+    SoftImage color;
+    std::vector<float> depth; // same layout as visibility
+    // Per pixel : which triangle is nearest, as (part << 24) | index.
+    // Rows are tilesX * tileSize long, so the SIMD steps never leave a row.
+    std::vector<unsigned> visibility;
+    // Per geometry part : the triangles it set up, and for each tile the
+    // ones that touch it, in submission order
+    std::vector<std::vector<SoftTriangle> > triangles;
+    std::vector<std::vector<std::vector<unsigned> > > bins;
+    // Per geometry part : the transformed vertices of the current mesh
+    std::vector<std::vector<SoftVertex> > vertices;
+    SoftRenderStats stats;
+};
+
+// threadCount 0 uses every hardware thread.
+void initSoftRenderer(SoftRenderer& renderer, int width, int height,
+                      int threadCount);
+void deleteSoftRenderer(SoftRenderer& renderer);
+
+// Draws the instances into renderer.color with depth testing (GL_LESS)
+// and back face culling, lit like StandardShading.fragmentshader by a
+// point light. clearColor is what glClearColor() would be.
+void renderSoftScene(SoftRenderer& renderer,
+                     const std::vector<SoftMesh>& meshes,
+                     const std::vector<SoftInstance>& instances,
+                     const std::vector<SoftTexture>& materials,
+                     const glm::mat4& projection, const glm::mat4& view,
+                     const glm::vec3& lightPosition,
+                     const glm::vec3& clearColor);
+
+// Binary PPM (P6, 8 bits), top row first.
+bool writeSoftImagePPM(const char* path, const SoftImage& image);
+bool readSoftImagePPM(const char* path, SoftImage& image);
+
+struct SoftImageDiff
+{
+    double meanError;     // per channel, 0 to 255
+    int maxError;
+    int differentPixels;  // with a channel off by more than the threshold
+};
+
+// Compares two images of the same size. If diff is given it receives a
+// grey image of the largest channel difference of each pixel.
+SoftImageDiff diffSoftImages(const SoftImage& a, const SoftImage& b,
+                             int threshold, SoftImage* diff);
+
+#endif
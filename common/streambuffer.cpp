@@ -0,0 +1,104 @@
+#include <vector>
+
+#include <GL/glew.h>
+
+#include "streambuffer.hpp"
+
+void initStreamBuffer(StreamBuffer& stream, GLenum target,
+                      GLsizeiptr regionSize, bool persistent)
+{
+    stream.target = target;
+    stream.regionSize = regionSize;
+    stream.region = 0;
+    stream.stalls = 0;
+    stream.persistent = persistent && GLEW_ARB_buffer_storage;
+    glGenBuffers(1, &stream.buffer);
+    glBindBuffer(target, stream.buffer);
+
+    if (stream.persistent)
+    {
+        // Coherent : the writes reach the GPU without being flushed
+        GLbitfield flags =
+            GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        GLsizeiptr size = regionSize * STREAM_BUFFER_REGIONS;
+        glBufferStorage(target, size, NULL, flags);
+        stream.mapped = (unsigned char*)glMapBufferRange(target, 0, size, flags);
+        if (stream.mapped)
+            return;
+        // Some drivers refuse : start again with mutable storage
+        glDeleteBuffers(1, &stream.buffer);
+        glGenBuffers(1, &stream.buffer);
+        glBindBuffer(target, stream.buffer);
+        stream.persistent = false;
+    }
+    glBufferData(target, regionSize, NULL, GL_STREAM_DRAW);
+    stream.staging.resize(regionSize);
+}
+
+void* beginStreamWrite(StreamBuffer& stream)
+{
+    glBindBuffer(stream.target, stream.buffer);
+    if (!stream.persistent)
+        return stream.staging.empty() ? NULL : &stream.staging[0];
+
+    stream.region = (stream.region + 1) % STREAM_BUFFER_REGIONS;
+    GLsync& fence = stream.fences[stream.region];
+    if (fence)
+    {
+        // Usually signaled long ago, two frames back
+        GLenum status = glClientWaitSync(fence, 0, 0);
+        if (status == GL_TIMEOUT_EXPIRED)
+        {
+            stream.stalls++;
+            do
+                status = glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT,
+                                          1000000000);
+            while (status == GL_TIMEOUT_EXPIRED);
+        }
+        glDeleteSync(fence);
+        fence = 0;
+    }
+    return stream.mapped + stream.region * stream.regionSize;
+}
+
+GLintptr endStreamWrite(StreamBuffer& stream, GLsizeiptr bytes)
+{
+    if (stream.persistent)
+        return stream.region * stream.regionSize;
+
+    // Buffer orphaning : the draws still reading the old storage keep it,
+    // the upload gets a new one and does not wait for them
+    glBindBuffer(stream.target, stream.buffer);
+    glBufferData(stream.target, stream.regionSize, NULL, GL_STREAM_DRAW);
+    if (bytes > 0)
+        glBufferSubData(stream.target, 0, bytes, &stream.staging[0]);
+    return 0;
+}
+
+void fenceStreamWrite(StreamBuffer& stream)
+{
+    if (!stream.persistent)
+        return;
+    // A region drawn from again without a new write : the last fence is
+    // the one to wait for
+    GLsync& fence = stream.fences[stream.region];
+    if (fence)
+        glDeleteSync(fence);
+    fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void deleteStreamBuffer(StreamBuffer& stream)
+{
+    for (int i = 0; i < STREAM_BUFFER_REGIONS; i++)
+    {
+        if (stream.fences[i])
+            glDeleteSync(stream.fences[i]);
+    }
+    if (stream.mapped)
+    {
+        glBindBuffer(stream.target, stream.buffer);
+        glUnmapBuffer(stream.target);
+    }
+    glDeleteBuffers(1, &stream.buffer);
+    stream = StreamBuffer();
+}
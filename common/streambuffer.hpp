@@ -0,0 +1,49 @@
+#ifndef STREAMBUFFER_HPP
+#define STREAMBUFFER_HPP
+
+// A buffer rewritten every frame, written in place by the CPU. With
+// ARB_buffer_storage it is mapped once, persistent and coherent, and split
+// into STREAM_BUFFER_REGIONS regions used in turn : the CPU writes one
+// while the GPU may still read the two before it. A fence after the draws
+// of each region tells when it can be written again, which is only waited
+// for when the CPU gets that far ahead.
+//
+// Without the extension, writes go to a CPU copy that endStreamWrite()
+// uploads after orphaning the buffer (see tutorial 18).
+
+static const int STREAM_BUFFER_REGIONS = 3;
+
+struct StreamBuffer
+{
+    GLenum target = GL_ARRAY_BUFFER;
+    GLuint buffer = 0;
+    GLsizeiptr regionSize = 0;
+    int region = 0;           // the region of the last beginStreamWrite()
+    bool persistent = false;  // false : orphaning
+    unsigned char* mapped = NULL; // all the regions, when persistent
+    GLsync fences[STREAM_BUFFER_REGIONS] = {0, 0, 0};
+    int stalls = 0; // beginStreamWrite() calls that waited for the GPU
+    // The fallback's copy of one region
+    std::vector<unsigned char> staging;
+};
+
+// Creates the buffer with room for regionSize bytes per frame. Falls back
+// to orphaning without ARB_buffer_storage, or when persistent is false.
+void initStreamBuffer(StreamBuffer& stream, GLenum target,
+                      GLsizeiptr regionSize, bool persistent = true);
+
+// Moves to the next region, waits until the GPU is done with it if needed,
+// and returns where to write the frame's regionSize bytes. Leaves the
+// buffer bound to its target.
+void* beginStreamWrite(StreamBuffer& stream);
+// Makes the first bytes written visible to the GPU and returns their
+// offset in the buffer, for glVertexAttribPointer() and the like.
+GLintptr endStreamWrite(StreamBuffer& stream, GLsizeiptr bytes);
+// After the last command reading the region : lets a later
+// beginStreamWrite() know when it is free. Can be called again for later
+// commands reading the same region.
+void fenceStreamWrite(StreamBuffer& stream);
+
+void deleteStreamBuffer(StreamBuffer& stream);
+
+#endif
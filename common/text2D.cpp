@@ -1,5 +1,6 @@
 #include <vector>
 #include <cstring>
+#include <cstddef>
 
 #include <GL/glew.h>
 
@@ -9,116 +10,308 @@ using namespace glm;
 
 #include "shader.hpp"
 #include "texture.hpp"
+#include "glstate.hpp"
 
 #include "text2D.hpp"
 
+// One character, as sent to the GPU in instanced mode : 8 bytes.
+// The vertex shader derives the quad and the UVs in the 16x16 font grid from it.
+struct Text2DGlyph{
+	GLshort x, y;
+	GLshort size;
+	GLshort character;
+};
+
+// Interleaved vertex : position and UV share one buffer, so one attribute setup covers both.
+struct Text2DVertex{
+	glm::vec2 position;
+	glm::vec2 uv;
+};
+
+// A retained string : its vertices inside Text2DStaticBufferID, and its glyphs inside Text2DStaticGlyphs.
+struct Text2DRange{
+	GLint first;
+	GLsizei count;
+	size_t firstGlyph;
+	size_t glyphCount;
+};
+
 unsigned int Text2DTextureID;
-unsigned int Text2DVertexBufferID;
-unsigned int Text2DUVBufferID;
 unsigned int Text2DShaderID;
 unsigned int Text2DUniformID;
+unsigned int Text2DInstancedUniformID;
+
+bool Text2DInstanced = false;
+
+// Per-frame strings are streamed into this buffer, which is only reallocated when it must grow.
+unsigned int Text2DStreamVertexArrayID;
+unsigned int Text2DStreamBufferID;
+size_t Text2DStreamCapacity = 0; // in bytes
+
+// Same thing for instanced mode : one Text2DGlyph per instance, no per-vertex data at all.
+unsigned int Text2DInstanceVertexArrayID;
+unsigned int Text2DInstanceBufferID;
+size_t Text2DInstanceCapacity = 0; // in bytes
+
+// Cached strings live here, written once by cacheText2D().
+unsigned int Text2DStaticVertexArrayID;
+unsigned int Text2DStaticBufferID;
+
+// CPU side. These are cleared but never shrunk, so a steady-state frame does not allocate.
+std::vector<Text2DGlyph>  Text2DStreamGlyphs;
+std::vector<Text2DVertex> Text2DStreamVertices;
+std::vector<Text2DGlyph>  Text2DStaticGlyphs;
+std::vector<Text2DVertex> Text2DStaticVertices;
+std::vector<Text2DRange>  Text2DStaticRanges;
+std::vector<int>          Text2DQueuedHandles;
+std::vector<GLint>        Text2DQueuedFirsts;
+std::vector<GLsizei>      Text2DQueuedCounts;
+
+static void setupText2DVertexArray(GLuint vertexArrayID, GLuint bufferID){
+
+	stateBindVertexArray(vertexArrayID);
+	stateBindBuffer(GL_ARRAY_BUFFER, bufferID);
+
+	// 1rst attribute : vertices
+	stateEnableVertexAttribArray(0);
+	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, sizeof(Text2DVertex), (void*)offsetof(Text2DVertex, position) );
+
+	// 2nd attribute : UVs
+	stateEnableVertexAttribArray(1);
+	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, sizeof(Text2DVertex), (void*)offsetof(Text2DVertex, uv) );
+}
+
+static void setupText2DInstanceVertexArray(GLuint vertexArrayID, GLuint bufferID){
+
+	stateBindVertexArray(vertexArrayID);
+	stateBindBuffer(GL_ARRAY_BUFFER, bufferID);
+
+	// 3rd attribute : x, y, size, character. Integer attribute, one per quad.
+	stateEnableVertexAttribArray(2);
+	glVertexAttribIPointer(2, 4, GL_SHORT, sizeof(Text2DGlyph), (void*)0 );
+	glVertexAttribDivisor(2, 1);
+}
+
+static void appendText2DGlyphs(std::vector<Text2DGlyph> & out, const char * text, int x, int y, int size){
+
+	unsigned int length = strlen(text);
+
+	for ( unsigned int i=0 ; i<length ; i++ ){
+		Text2DGlyph glyph;
+		glyph.x = (GLshort)(x+i*size);
+		glyph.y = (GLshort)y;
+		glyph.size = (GLshort)size;
+		glyph.character = (GLshort)(unsigned char)text[i];
+		out.push_back(glyph);
+	}
+}
+
+static void appendText2DVertices(std::vector<Text2DVertex> & out, const Text2DGlyph * glyphs, size_t count){
+
+	for ( size_t i=0 ; i<count ; i++ ){
+
+		float x = glyphs[i].x;
+		float y = glyphs[i].y;
+		float size = glyphs[i].size;
+
+		glm::vec2 vertex_up_left    = glm::vec2( x     , y+size );
+		glm::vec2 vertex_up_right   = glm::vec2( x+size, y+size );
+		glm::vec2 vertex_down_right = glm::vec2( x+size, y      );
+		glm::vec2 vertex_down_left  = glm::vec2( x     , y      );
+
+		int character = glyphs[i].character;
+		float uv_x = (character%16)/16.0f;
+		float uv_y = (character/16)/16.0f;
+
+		glm::vec2 uv_up_left    = glm::vec2( uv_x           , uv_y );
+		glm::vec2 uv_up_right   = glm::vec2( uv_x+1.0f/16.0f, uv_y );
+		glm::vec2 uv_down_right = glm::vec2( uv_x+1.0f/16.0f, (uv_y + 1.0f/16.0f) );
+		glm::vec2 uv_down_left  = glm::vec2( uv_x           , (uv_y + 1.0f/16.0f) );
+
+		Text2DVertex quad[6] = {
+			{ vertex_up_left   , uv_up_left    },
+			{ vertex_down_left , uv_down_left  },
+			{ vertex_up_right  , uv_up_right   },
+
+			{ vertex_down_right, uv_down_right },
+			{ vertex_up_right  , uv_up_right   },
+			{ vertex_down_left , uv_down_left  },
+		};
+		out.insert(out.end(), quad, quad+6);
+	}
+}
+
+// Orphans the buffer (growing it if needed) and uploads the frame's data in one call.
+static void uploadText2DStream(GLuint bufferID, size_t & capacity, const void * data, size_t bytes){
+
+	stateBindBuffer(GL_ARRAY_BUFFER, bufferID);
+	if ( bytes > capacity ){
+		capacity = bytes > 2 * capacity ? bytes : 2 * capacity;
+	}
+	glBufferData(GL_ARRAY_BUFFER, capacity, NULL, GL_STREAM_DRAW); // Buffer orphaning, see tutorial 18
+	glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, data);
+}
 
 void initText2D(const char * texturePath){
 
 	// Initialize texture
 	Text2DTextureID = loadDDS(texturePath);
+	// loadDDS() binds the texture without going through glstate
+	invalidateGLState();
 
-	// Initialize VBO
-	glGenBuffers(1, &Text2DVertexBufferID);
-	glGenBuffers(1, &Text2DUVBufferID);
+	// Initialize VBOs, and the VAOs that remember how to read them
+	glGenBuffers(1, &Text2DStreamBufferID);
+	glGenBuffers(1, &Text2DInstanceBufferID);
+	glGenBuffers(1, &Text2DStaticBufferID);
+
+	glGenVertexArrays(1, &Text2DStreamVertexArrayID);
+	setupText2DVertexArray(Text2DStreamVertexArrayID, Text2DStreamBufferID);
+	glGenVertexArrays(1, &Text2DStaticVertexArrayID);
+	setupText2DVertexArray(Text2DStaticVertexArrayID, Text2DStaticBufferID);
+	glGenVertexArrays(1, &Text2DInstanceVertexArrayID);
+	setupText2DInstanceVertexArray(Text2DInstanceVertexArrayID, Text2DInstanceBufferID);
+
+	// Enough for a few lines of HUD before the first reallocation
+	Text2DStreamGlyphs.reserve(1024);
+	Text2DStreamVertices.reserve(6 * 1024);
 
 	// Initialize Shader
 	Text2DShaderID = LoadShaders( "TextVertexShader.vertexshader", "TextVertexShader.fragmentshader" );
 
 	// Initialize uniforms' IDs
 	Text2DUniformID = glGetUniformLocation( Text2DShaderID, "myTextureSampler" );
+	Text2DInstancedUniformID = glGetUniformLocation( Text2DShaderID, "glyphInstanced" );
 
 }
 
-void printText2D(const char * text, int x, int y, int size){
+void setText2DInstanced(bool instanced){
 
-	unsigned int length = strlen(text);
+	Text2DInstanced = instanced;
 
-	// Fill buffers
-	std::vector<glm::vec2> vertices;
-	std::vector<glm::vec2> UVs;
-	for ( unsigned int i=0 ; i<length ; i++ ){
-		
-		glm::vec2 vertex_up_left    = glm::vec2( x+i*size     , y+size );
-		glm::vec2 vertex_up_right   = glm::vec2( x+i*size+size, y+size );
-		glm::vec2 vertex_down_right = glm::vec2( x+i*size+size, y      );
-		glm::vec2 vertex_down_left  = glm::vec2( x+i*size     , y      );
+}
 
-		vertices.push_back(vertex_up_left   );
-		vertices.push_back(vertex_down_left );
-		vertices.push_back(vertex_up_right  );
+void printText2D(const char * text, int x, int y, int size){
 
-		vertices.push_back(vertex_down_right);
-		vertices.push_back(vertex_up_right);
-		vertices.push_back(vertex_down_left);
+	appendText2DGlyphs(Text2DStreamGlyphs, text, x, y, size);
 
-		char character = text[i];
-		float uv_x = (character%16)/16.0f;
-		float uv_y = (character/16)/16.0f;
+}
 
-		glm::vec2 uv_up_left    = glm::vec2( uv_x           , uv_y );
-		glm::vec2 uv_up_right   = glm::vec2( uv_x+1.0f/16.0f, uv_y );
-		glm::vec2 uv_down_right = glm::vec2( uv_x+1.0f/16.0f, (uv_y + 1.0f/16.0f) );
-		glm::vec2 uv_down_left  = glm::vec2( uv_x           , (uv_y + 1.0f/16.0f) );
-		UVs.push_back(uv_up_left   );
-		UVs.push_back(uv_down_left );
-		UVs.push_back(uv_up_right  );
+int cacheText2D(const char * text, int x, int y, int size){
+
+	// Keep the glyphs for instanced mode, and the expanded vertices for the retained VBO
+	Text2DRange range;
+	range.firstGlyph = Text2DStaticGlyphs.size();
+	appendText2DGlyphs(Text2DStaticGlyphs, text, x, y, size);
+	range.glyphCount = Text2DStaticGlyphs.size() - range.firstGlyph;
 
-		UVs.push_back(uv_down_right);
-		UVs.push_back(uv_up_right);
-		UVs.push_back(uv_down_left);
+	range.first = (GLint)Text2DStaticVertices.size();
+	if ( range.glyphCount > 0 )
+		appendText2DVertices(Text2DStaticVertices, &Text2DStaticGlyphs[range.firstGlyph], range.glyphCount);
+	range.count = (GLsizei)(Text2DStaticVertices.size() - range.first);
+	Text2DStaticRanges.push_back(range);
+
+	// Cached strings are built at load time, so re-specifying the whole buffer here is fine.
+	if ( !Text2DStaticVertices.empty() ){
+		stateBindBuffer(GL_ARRAY_BUFFER, Text2DStaticBufferID);
+		glBufferData(GL_ARRAY_BUFFER, Text2DStaticVertices.size() * sizeof(Text2DVertex), &Text2DStaticVertices[0], GL_STATIC_DRAW);
 	}
-	glBindBuffer(GL_ARRAY_BUFFER, Text2DVertexBufferID);
-	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec2), &vertices[0], GL_STATIC_DRAW);
-	glBindBuffer(GL_ARRAY_BUFFER, Text2DUVBufferID);
-	glBufferData(GL_ARRAY_BUFFER, UVs.size() * sizeof(glm::vec2), &UVs[0], GL_STATIC_DRAW);
+
+	return (int)Text2DStaticRanges.size() - 1;
+}
+
+void printCachedText2D(int handle){
+
+	if ( handle < 0 || handle >= (int)Text2DStaticRanges.size() || Text2DStaticRanges[handle].glyphCount == 0 )
+		return;
+
+	Text2DQueuedHandles.push_back(handle);
+
+}
+
+void flushText2D(){
+
+	if ( Text2DStreamGlyphs.empty() && Text2DQueuedHandles.empty() )
+		return;
 
 	// Bind shader
-	glUseProgram(Text2DShaderID);
+	stateUseProgram(Text2DShaderID);
+	glUniform1i(Text2DInstancedUniformID, Text2DInstanced ? 1 : 0);
 
 	// Bind texture
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, Text2DTextureID);
+	stateActiveTexture(GL_TEXTURE0);
+	stateBindTexture(GL_TEXTURE_2D, Text2DTextureID);
 	// Set our "myTextureSampler" sampler to use Texture Unit 0
 	glUniform1i(Text2DUniformID, 0);
 
-	// 1rst attribute buffer : vertices
-	glEnableVertexAttribArray(0);
-	glBindBuffer(GL_ARRAY_BUFFER, Text2DVertexBufferID);
-	glVertexAttribPointer(0, 2, GL_FLOAT, GL_FALSE, 0, (void*)0 );
+	stateEnable(GL_BLEND);
+	stateBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	// 2nd attribute buffer : UVs
-	glEnableVertexAttribArray(1);
-	glBindBuffer(GL_ARRAY_BUFFER, Text2DUVBufferID);
-	glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0 );
+	if ( Text2DInstanced ){
 
-	glEnable(GL_BLEND);
-	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		// Cached glyphs are only 8 bytes each : simply stream them along with the rest
+		for ( size_t i=0 ; i<Text2DQueuedHandles.size() ; i++ ){
+			const Text2DRange & range = Text2DStaticRanges[Text2DQueuedHandles[i]];
+			const Text2DGlyph * first = &Text2DStaticGlyphs[range.firstGlyph];
+			Text2DStreamGlyphs.insert(Text2DStreamGlyphs.end(), first, first + range.glyphCount);
+		}
 
-	// Draw call
-	glDrawArrays(GL_TRIANGLES, 0, vertices.size() );
+		// One upload, one instanced draw : 4 vertices of a triangle strip per glyph
+		size_t count = Text2DStreamGlyphs.size();
+		uploadText2DStream(Text2DInstanceBufferID, Text2DInstanceCapacity, &Text2DStreamGlyphs[0], count * sizeof(Text2DGlyph));
 
-	glDisable(GL_BLEND);
+		stateBindVertexArray(Text2DInstanceVertexArrayID);
+		glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, (GLsizei)count);
 
-	glDisableVertexAttribArray(0);
-	glDisableVertexAttribArray(1);
+	}else{
+
+		// Cached strings : one multi-draw over their retained ranges
+		if ( !Text2DQueuedHandles.empty() ){
+			for ( size_t i=0 ; i<Text2DQueuedHandles.size() ; i++ ){
+				Text2DQueuedFirsts.push_back(Text2DStaticRanges[Text2DQueuedHandles[i]].first);
+				Text2DQueuedCounts.push_back(Text2DStaticRanges[Text2DQueuedHandles[i]].count);
+			}
+			stateBindVertexArray(Text2DStaticVertexArrayID);
+			glMultiDrawArrays(GL_TRIANGLES, &Text2DQueuedFirsts[0], &Text2DQueuedCounts[0], (GLsizei)Text2DQueuedFirsts.size());
+		}
+
+		// Per-frame strings : one upload, one draw
+		if ( !Text2DStreamGlyphs.empty() ){
+			appendText2DVertices(Text2DStreamVertices, &Text2DStreamGlyphs[0], Text2DStreamGlyphs.size());
+
+			size_t count = Text2DStreamVertices.size();
+			uploadText2DStream(Text2DStreamBufferID, Text2DStreamCapacity, &Text2DStreamVertices[0], count * sizeof(Text2DVertex));
+
+			stateBindVertexArray(Text2DStreamVertexArrayID);
+			glDrawArrays(GL_TRIANGLES, 0, (GLsizei)count );
+		}
+	}
+
+	stateDisable(GL_BLEND);
+
+	Text2DStreamGlyphs.clear();
+	Text2DStreamVertices.clear();
+	Text2DQueuedHandles.clear();
+	Text2DQueuedFirsts.clear();
+	Text2DQueuedCounts.clear();
 
 }
 
 void cleanupText2D(){
 
 	// Delete buffers
-	glDeleteBuffers(1, &Text2DVertexBufferID);
-	glDeleteBuffers(1, &Text2DUVBufferID);
+	glDeleteBuffers(1, &Text2DStreamBufferID);
+	glDeleteBuffers(1, &Text2DInstanceBufferID);
+	glDeleteBuffers(1, &Text2DStaticBufferID);
+	glDeleteVertexArrays(1, &Text2DStreamVertexArrayID);
+	glDeleteVertexArrays(1, &Text2DInstanceVertexArrayID);
+	glDeleteVertexArrays(1, &Text2DStaticVertexArrayID);
 
 	// Delete texture
 	glDeleteTextures(1, &Text2DTextureID);
 
 	// Delete shader
 	glDeleteProgram(Text2DShaderID);
+
+	// Deleting bound objects unbinds them
+	invalidateGLState();
 }
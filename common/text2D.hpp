@@ -1,8 +1,25 @@
 #ifndef TEXT2D_HPP
 #define TEXT2D_HPP
 
+// initText2D() and flushText2D() leave one of the text VAOs bound : bind yours again
+// (through stateBindVertexArray()) before drawing with it. Asking GL which one was bound
+// would stall the pipeline.
 void initText2D(const char * texturePath);
+
+// Instanced mode sends 8 bytes per character instead of 6 vertices ; the quad and UVs are built in the vertex shader.
+void setText2DInstanced(bool instanced);
+
+// Queues a string for the current frame. Nothing is drawn until flushText2D().
 void printText2D(const char * text, int x, int y, int size);
+
+// Builds a string once into a retained VBO range and returns a handle to it.
+// Use this for labels that never change ; printCachedText2D() then costs nothing on the CPU.
+int cacheText2D(const char * text, int x, int y, int size);
+void printCachedText2D(int handle);
+
+// Draws everything queued since the last flush (one program/texture bind, one draw per buffer).
+void flushText2D();
+
 void cleanupText2D();
 
 #endif
\ No newline at end of file
@@ -9283,9 +9283,8 @@ GLboolean GLEWAPIENTRY glewGetExtension (const char* name)
 
 /* ------------------------------------------------------------------------- */
 
-#ifndef GLEW_MX
-static
-#endif
+/* Not static : common/headless.cpp calls it on EGL contexts, where the
+   GLX part of glewInit() would query a NULL display */
 GLenum GLEWAPIENTRY glewContextInit (GLEW_CONTEXT_ARG_DEF_LIST)
 {
   const GLubyte* s;
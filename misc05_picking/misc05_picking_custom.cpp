@@ -26,6 +26,12 @@ using namespace glm;
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
+#include <common/mesh.hpp>
+#include <common/glstate.hpp>
+#include <common/culling.hpp>
+#include <common/bvh.hpp>
+#include <common/simd.hpp>
+#include <common/picking.hpp>
 
 void ScreenPosToWorldRay(
 	int mouseX, int mouseY,             // Mouse position, in pixels, from bottom-left corner of the window
@@ -196,6 +202,7 @@ bool TestRayOBBIntersection(
 
 }
 
+
 int main( void )
 {
 	// Initialize GLFW
@@ -285,28 +292,8 @@ int main( void )
 	std::vector<glm::vec3> indexed_normals;
 	indexVBO(vertices, uvs, normals, indices, indexed_vertices, indexed_uvs, indexed_normals);
 
-	// Load it into a VBO
-
-	GLuint vertexbuffer;
-	glGenBuffers(1, &vertexbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-	glBufferData(GL_ARRAY_BUFFER, indexed_vertices.size() * sizeof(glm::vec3), &indexed_vertices[0], GL_STATIC_DRAW);
-
-	GLuint uvbuffer;
-	glGenBuffers(1, &uvbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-	glBufferData(GL_ARRAY_BUFFER, indexed_uvs.size() * sizeof(glm::vec2), &indexed_uvs[0], GL_STATIC_DRAW);
-
-	GLuint normalbuffer;
-	glGenBuffers(1, &normalbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-	glBufferData(GL_ARRAY_BUFFER, indexed_normals.size() * sizeof(glm::vec3), &indexed_normals[0], GL_STATIC_DRAW);
-
-	// Generate a buffer for the indices as well
-	GLuint elementbuffer;
-	glGenBuffers(1, &elementbuffer);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), &indices[0] , GL_STATIC_DRAW);
+	// Load it into a VBO, with a VAO that remembers its layout
+	Mesh suzanneMesh = createMesh(indices, indexed_vertices, indexed_uvs, indexed_normals);
 
 
 
@@ -318,6 +305,42 @@ int main( void )
 		orientations[i] = glm::quat(glm::vec3(rand()%360, rand()%360, rand()%360));
 	}
 
+	std::vector<glm::mat4> modelMatrices(100);
+	for(int i=0; i<100; i++){
+		glm::mat4 RotationMatrix = glm::toMat4(orientations[i]);
+		glm::mat4 TranslationMatrix = translate(mat4(), positions[i]);
+		modelMatrices[i] = TranslationMatrix * RotationMatrix;
+	}
+
+	// World space bounds of each monkey : the mesh, and the (-1,1) box used
+	// for picking, which the ears stick out of. The monkeys don't move, so
+	// the BVH is only built once.
+	glm::vec3 suzanneMin(-1.0f, -1.0f, -1.0f);
+	glm::vec3 suzanneMax( 1.0f,  1.0f,  1.0f);
+	for(size_t i=0; i<indexed_vertices.size(); i++){
+		suzanneMin = glm::min(suzanneMin, indexed_vertices[i]);
+		suzanneMax = glm::max(suzanneMax, indexed_vertices[i]);
+	}
+	AABBArray bounds;
+	for(int i=0; i<100; i++){
+		glm::vec3 worldMin, worldMax;
+		transformAABB(modelMatrices[i], suzanneMin, suzanneMax, worldMin, worldMax);
+		addAABB(bounds, worldMin, worldMax);
+	}
+	BVH sceneBVH;
+	buildBVH(sceneBVH, bounds);
+
+	// The picking has its own tree, over the (-1,1) boxes. Same test as
+	// TestRayOBBIntersection() above, on the few monkeys the ray gets close
+	// to ; see misc06_benchmarks for 1M objects.
+	PickingScene pickingScene;
+	for(int i=0; i<100; i++)
+		addPickingObject(pickingScene, modelMatrices[i], glm::vec3(-1.0f, -1.0f, -1.0f), glm::vec3(1.0f, 1.0f, 1.0f));
+	buildPickingScene(pickingScene);
+	std::vector<unsigned> visible;
+	BVHQueryStats cullStats = BVHQueryStats();
+	BVHQueryStats pickStats = BVHQueryStats();
+
 
 
 	// Get a handle for our "LightPosition" uniform
@@ -328,6 +351,10 @@ int main( void )
 	double lastTime = glfwGetTime();
 	int nbFrames = 0;
 
+	// Press V to switch between the per-mesh VAO and re-specifying every
+	// attribute before each draw ; the CPU time per draw is printed for both
+	MeshDrawTimer drawTimer;
+
 	do{
 
 		// Measure speed
@@ -335,11 +362,16 @@ int main( void )
 		nbFrames++;
 		if ( currentTime - lastTime >= 1.0 ){ // If last prinf() was more than 1sec ago
 			// printf and reset
-			printf("%f ms/frame\n", 1000.0/double(nbFrames));
+			printMeshDrawStats(drawTimer, nbFrames);
+			printf("BVH : %d nodes, culling visits %d ; last pick visited %d of %d nodes and tested %d of 100 monkeys\n",
+				(int)sceneBVH.nodes.size(), cullStats.nodesVisited, pickStats.nodesVisited,
+				(int)pickingScene.nodes.size(), pickStats.objectsTested);
 			nbFrames = 0;
 			lastTime += 1.0;
 		}
 
+		updateMeshDrawToggle(drawTimer, window);
+
 
 		// Compute the MVP matrix from keyboard and mouse input
 		computeMatricesFromInputs();
@@ -368,38 +400,17 @@ int main( void )
 
 			message = "background";
 
-			// Test each each Oriented Bounding Box (OBB).
-			// A physics engine can be much smarter than this, 
-			// because it already has some spatial partitionning structure, 
-			// like Binary Space Partitionning Tree (BSP-Tree),
-			// Bounding Volume Hierarchy (BVH) or other.
-			for(int i=0; i<100; i++){
-
-				float intersection_distance; // Output of TestRayOBBIntersection()
-				glm::vec3 aabb_min(-1.0f, -1.0f, -1.0f);
-				glm::vec3 aabb_max( 1.0f,  1.0f,  1.0f);
-
-				// The ModelMatrix transforms :
-				// - the mesh to its desired position and orientation
-				// - but also the AABB (defined with aabb_min and aabb_max) into an OBB
-				glm::mat4 RotationMatrix = glm::toMat4(orientations[i]);
-				glm::mat4 TranslationMatrix = translate(mat4(), positions[i]);
-				glm::mat4 ModelMatrix = TranslationMatrix * RotationMatrix;
-
-
-				if ( TestRayOBBIntersection(
-					ray_origin, 
-					ray_direction, 
-					aabb_min, 
-					aabb_max,
-					ModelMatrix,
-					intersection_distance)
-				){
-					std::ostringstream oss;
-					oss << "mesh " << i;
-					message = oss.str();
-					break;
-				}
+			// Instead of testing each Oriented Bounding Box (OBB), walk the
+			// picking tree : the ray is tested against the world boxes of
+			// several children at once, only the monkeys whose box is on the
+			// ray get the OBB test, nearest first, and the closest hit wins.
+			float intersection_distance;
+			int picked = pickRay(pickingScene, ray_origin, ray_direction, 100000.0f,
+				intersection_distance, &pickStats);
+			if (picked >= 0){
+				std::ostringstream oss;
+				oss << "mesh " << picked;
+				message = oss.str();
 			}
 
 
@@ -415,16 +426,15 @@ int main( void )
 		// Use our shader
 		glUseProgram(programID);
 
-		glEnableVertexAttribArray(0);
-		glEnableVertexAttribArray(1);
-		glEnableVertexAttribArray(2);
+		double drawStartTime = glfwGetTime();
 
-		for(int i=0; i<100; i++){
+		// Only draw the monkeys that are in the view frustum
+		cullBVH(sceneBVH, extractFrustum(ProjectionMatrix, ViewMatrix), visible, &cullStats);
 
+		for(size_t v=0; v<visible.size(); v++){
 
-			glm::mat4 RotationMatrix = glm::toMat4(orientations[i]);
-			glm::mat4 TranslationMatrix = translate(mat4(), positions[i]);
-			glm::mat4 ModelMatrix = TranslationMatrix * RotationMatrix;
+			int i = visible[v];
+			glm::mat4 ModelMatrix = modelMatrices[i];
 
 			glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
 
@@ -443,59 +453,21 @@ int main( void )
 			// Set our "myTextureSampler" sampler to use Texture Unit 0
 			glUniform1i(TextureID, 0);
 
-			// 1rst attribute buffer : vertices
-			glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-			glVertexAttribPointer(
-				0,                  // attribute
-				3,                  // size
-				GL_FLOAT,           // type
-				GL_FALSE,           // normalized?
-				0,                  // stride
-				(void*)0            // array buffer offset
-			);
-
-			// 2nd attribute buffer : UVs
-			glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-			glVertexAttribPointer(
-				1,                                // attribute
-				2,                                // size
-				GL_FLOAT,                         // type
-				GL_FALSE,                         // normalized?
-				0,                                // stride
-				(void*)0                          // array buffer offset
-			);
-
-			// 3rd attribute buffer : normals
-			glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-			glVertexAttribPointer(
-				2,                                // attribute
-				3,                                // size
-				GL_FLOAT,                         // type
-				GL_FALSE,                         // normalized?
-				0,                                // stride
-				(void*)0                          // array buffer offset
-			);
-
-			// Index buffer
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-
 			// Draw the triangles !
-			glDrawElements(
-				GL_TRIANGLES,      // mode
-				indices.size(),    // count
-				GL_UNSIGNED_SHORT,   // type
-				(void*)0           // element array buffer offset
-			);
+			if (drawTimer.useMeshVAO)
+				drawMesh(suzanneMesh);
+			else
+				drawMeshLegacy(suzanneMesh, VertexArrayID);
 
 
 		}
 
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-		glDisableVertexAttribArray(2);
+		addMeshDrawTime(drawTimer, glfwGetTime() - drawStartTime, (int)visible.size());
 
 		// Draw GUI
 		TwDraw();
+		// AntTweakBar binds its own buffers without going through glstate
+		invalidateGLState();
 
 		// Swap buffers
 		glfwSwapBuffers(window);
@@ -506,10 +478,7 @@ int main( void )
 		   glfwWindowShouldClose(window) == 0 );
 
 	// Cleanup VBO and shader
-	glDeleteBuffers(1, &vertexbuffer);
-	glDeleteBuffers(1, &uvbuffer);
-	glDeleteBuffers(1, &normalbuffer);
-	glDeleteBuffers(1, &elementbuffer);
+	deleteMesh(suzanneMesh);
 	glDeleteProgram(programID);
 	glDeleteTextures(1, &Texture);
 	glDeleteVertexArrays(1, &VertexArrayID);
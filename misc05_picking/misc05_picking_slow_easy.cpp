@@ -26,6 +26,8 @@ using namespace glm;
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
+#include <common/mesh.hpp>
+#include <common/glstate.hpp>
 
 int main( void )
 {
@@ -119,28 +121,8 @@ int main( void )
 	std::vector<glm::vec3> indexed_normals;
 	indexVBO(vertices, uvs, normals, indices, indexed_vertices, indexed_uvs, indexed_normals);
 
-	// Load it into a VBO
-
-	GLuint vertexbuffer;
-	glGenBuffers(1, &vertexbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-	glBufferData(GL_ARRAY_BUFFER, indexed_vertices.size() * sizeof(glm::vec3), &indexed_vertices[0], GL_STATIC_DRAW);
-
-	GLuint uvbuffer;
-	glGenBuffers(1, &uvbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-	glBufferData(GL_ARRAY_BUFFER, indexed_uvs.size() * sizeof(glm::vec2), &indexed_uvs[0], GL_STATIC_DRAW);
-
-	GLuint normalbuffer;
-	glGenBuffers(1, &normalbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-	glBufferData(GL_ARRAY_BUFFER, indexed_normals.size() * sizeof(glm::vec3), &indexed_normals[0], GL_STATIC_DRAW);
-
-	// Generate a buffer for the indices as well
-	GLuint elementbuffer;
-	glGenBuffers(1, &elementbuffer);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), &indices[0] , GL_STATIC_DRAW);
+	// Load it into a VBO, with a VAO that remembers its layout
+	Mesh suzanneMesh = createMesh(indices, indexed_vertices, indexed_uvs, indexed_normals);
 
 
 
@@ -166,6 +148,10 @@ int main( void )
 	double lastTime = glfwGetTime();
 	int nbFrames = 0;
 
+	// Press V to switch between the per-mesh VAO and re-specifying every
+	// attribute before each draw ; the CPU time per draw is printed for both
+	MeshDrawTimer drawTimer;
+
 	do{
 
 		// Measure speed
@@ -173,11 +159,13 @@ int main( void )
 		nbFrames++;
 		if ( currentTime - lastTime >= 1.0 ){ // If last prinf() was more than 1sec ago
 			// printf and reset
-			printf("%f ms/frame\n", 1000.0/double(nbFrames));
+			printMeshDrawStats(drawTimer, nbFrames);
 			nbFrames = 0;
 			lastTime += 1.0;
 		}
 
+		updateMeshDrawToggle(drawTimer, window);
+
 
 		// Compute the MVP matrix from keyboard and mouse input
 		computeMatricesFromInputs();
@@ -196,8 +184,9 @@ int main( void )
 			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 			glUseProgram(pickingProgramID);
 
-			// Only the positions are needed (not the UVs and normals)
-			glEnableVertexAttribArray(0);
+			// Only the positions are needed (not the UVs and normals),
+			// the picking shader simply ignores the other attributes
+			double pickingStartTime = glfwGetTime();
 
 			// Draw the 100 monkeys, each with a slighly different color
 			for(int i=0; i<100; i++){
@@ -221,31 +210,15 @@ int main( void )
 				// OpenGL expects colors to be in [0,1], so divide by 255.
 				glUniform4f(pickingColorID, r/255.0f, g/255.0f, b/255.0f, 1.0f);
 
-				// 1rst attribute buffer : vertices
-				glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-				glVertexAttribPointer(
-					0,                  // attribute
-					3,                  // size
-					GL_FLOAT,           // type
-					GL_FALSE,           // normalized?
-					0,                  // stride
-					(void*)0            // array buffer offset
-				);
-
-				// Index buffer
-				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-
 				// Draw the triangles !
-				glDrawElements(
-					GL_TRIANGLES,      // mode
-					indices.size(),    // count
-					GL_UNSIGNED_SHORT,   // type
-					(void*)0           // element array buffer offset
-				);
+				if (drawTimer.useMeshVAO)
+					drawMesh(suzanneMesh);
+				else
+					drawMeshLegacy(suzanneMesh, VertexArrayID);
 
 			}
 
-			glDisableVertexAttribArray(0);
+			addMeshDrawTime(drawTimer, glfwGetTime() - pickingStartTime, 100);
 
 
 			// Wait until all the pending drawing commands are really done.
@@ -296,9 +269,7 @@ int main( void )
 		// Use our shader
 		glUseProgram(programID);
 
-		glEnableVertexAttribArray(0);
-		glEnableVertexAttribArray(1);
-		glEnableVertexAttribArray(2);
+		double drawStartTime = glfwGetTime();
 
 		for(int i=0; i<100; i++){
 
@@ -324,59 +295,21 @@ int main( void )
 			// Set our "myTextureSampler" sampler to use Texture Unit 0
 			glUniform1i(TextureID, 0);
 
-			// 1rst attribute buffer : vertices
-			glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-			glVertexAttribPointer(
-				0,                  // attribute
-				3,                  // size
-				GL_FLOAT,           // type
-				GL_FALSE,           // normalized?
-				0,                  // stride
-				(void*)0            // array buffer offset
-			);
-
-			// 2nd attribute buffer : UVs
-			glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-			glVertexAttribPointer(
-				1,                                // attribute
-				2,                                // size
-				GL_FLOAT,                         // type
-				GL_FALSE,                         // normalized?
-				0,                                // stride
-				(void*)0                          // array buffer offset
-			);
-
-			// 3rd attribute buffer : normals
-			glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-			glVertexAttribPointer(
-				2,                                // attribute
-				3,                                // size
-				GL_FLOAT,                         // type
-				GL_FALSE,                         // normalized?
-				0,                                // stride
-				(void*)0                          // array buffer offset
-			);
-
-			// Index buffer
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-
 			// Draw the triangles !
-			glDrawElements(
-				GL_TRIANGLES,      // mode
-				indices.size(),    // count
-				GL_UNSIGNED_SHORT,   // type
-				(void*)0           // element array buffer offset
-			);
+			if (drawTimer.useMeshVAO)
+				drawMesh(suzanneMesh);
+			else
+				drawMeshLegacy(suzanneMesh, VertexArrayID);
 
 
 		}
 
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-		glDisableVertexAttribArray(2);
+		addMeshDrawTime(drawTimer, glfwGetTime() - drawStartTime, 100);
 
 		// Draw GUI
 		TwDraw();
+		// AntTweakBar binds its own buffers without going through glstate
+		invalidateGLState();
 
 		// Swap buffers
 		glfwSwapBuffers(window);
@@ -387,10 +320,7 @@ int main( void )
 		   glfwWindowShouldClose(window) == 0 );
 
 	// Cleanup VBO and shader
-	glDeleteBuffers(1, &vertexbuffer);
-	glDeleteBuffers(1, &uvbuffer);
-	glDeleteBuffers(1, &normalbuffer);
-	glDeleteBuffers(1, &elementbuffer);
+	deleteMesh(suzanneMesh);
 	glDeleteProgram(programID);
 	glDeleteTextures(1, &Texture);
 	glDeleteVertexArrays(1, &VertexArrayID);
@@ -0,0 +1,133 @@
+// BVH over 1k to 1M random boxes : build and refit times, and what the
+// frustum, ray and overlap queries cost compared to testing every box.
+
+// Include standard headers
+#include <stdio.h>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+// Include GLM
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+using namespace glm;
+
+#include <common/culling.hpp>
+#include <common/bvh.hpp>
+
+#include "benchmarks.hpp"
+
+void benchmarkBVH(){
+
+	// Same camera as benchmark_culling.cpp
+	glm::mat4 ProjectionMatrix = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f);
+	glm::mat4 ViewMatrix = glm::lookAt(glm::vec3(0,0,0), glm::vec3(0,0,-1), glm::vec3(0,1,0));
+	Frustum frustum = extractFrustum(ProjectionMatrix, ViewMatrix);
+
+	printf("%8s %10s %10s %12s %12s %10s %10s %10s\n", "objects", "build ms", "refit ms",
+		"flat cull us", "BVH cull us", "cull nodes", "ray nodes", "box nodes");
+
+	int sizes[] = { 1000, 10000, 100000, 1000000 };
+	for (int s = 0; s < 4; s++){
+		int n = sizes[s];
+
+		std::mt19937 generator(1234);
+		std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+		std::uniform_real_distribution<float> size(0.1f, 2.0f);
+		std::vector<glm::vec3> centers(n);
+		std::vector<float> radii(n);
+		AABBArray boxes;
+		for (int i = 0; i < n; i++){
+			centers[i] = glm::vec3(position(generator), position(generator), position(generator));
+			radii[i] = size(generator);
+			addAABB(boxes, centers[i] - glm::vec3(radii[i]), centers[i] + glm::vec3(radii[i]));
+		}
+
+		BVH bvh;
+		double start = benchmarkTime();
+		buildBVH(bvh, boxes);
+		double buildSeconds = benchmarkTime() - start;
+
+		start = benchmarkTime();
+		refitBVH(bvh, boxes);
+		double refitSeconds = benchmarkTime() - start;
+
+		// Frustum culling, against the flat SIMD loop
+		std::vector<unsigned> flatVisible;
+		std::vector<unsigned> bvhVisible;
+		BVHQueryStats cullStats;
+		int iterations = std::max(1, benchmarkIterations(n) / 10);
+		start = benchmarkTime();
+		for (int i = 0; i < iterations; i++)
+			cullAABBs(frustum, boxes, flatVisible);
+		double flatSeconds = benchmarkTime() - start;
+		start = benchmarkTime();
+		for (int i = 0; i < iterations; i++)
+			cullBVH(bvh, frustum, bvhVisible, &cullStats);
+		double bvhSeconds = benchmarkTime() - start;
+
+		std::sort(bvhVisible.begin(), bvhVisible.end());
+		if (flatVisible != bvhVisible)
+			printf("ERROR : the BVH disagrees with cullAABBs()\n");
+
+		// Rays from the origin in random directions, checked against a
+		// brute force loop over all the boxes
+		std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+		int rays = 1000;
+		long long rayNodes = 0;
+		for (int r = 0; r < rays; r++){
+			glm::vec3 direction = glm::normalize(glm::vec3(unit(generator), unit(generator), unit(generator)));
+			float distance;
+			BVHQueryStats rayStats;
+			int hit = raycastBVH(bvh, glm::vec3(0,0,0), direction, 1000.0f, NULL, NULL, distance, &rayStats);
+			rayNodes += rayStats.nodesVisited;
+
+			if (r < 20){
+				int bruteHit = -1;
+				float bruteDistance = 1000.0f;
+				for (int i = 0; i < n; i++){
+					glm::vec3 t0 = (bvh.objectMin[i] - glm::vec3(0,0,0)) / direction;
+					glm::vec3 t1 = (bvh.objectMax[i] - glm::vec3(0,0,0)) / direction;
+					glm::vec3 tNear = glm::min(t0, t1);
+					glm::vec3 tFar = glm::max(t0, t1);
+					float enter = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.0f));
+					float exit = std::min(std::min(tFar.x, tFar.y), tFar.z);
+					if (enter <= exit && enter < bruteDistance){
+						bruteDistance = enter;
+						bruteHit = i;
+					}
+				}
+				if (bruteHit != hit && bruteDistance != distance)
+					printf("ERROR : ray %d hits %d at %f, expected %d at %f\n", r, hit, distance, bruteHit, bruteDistance);
+			}
+		}
+
+		// Shadow casters : everything within 10 units of a point light
+		std::vector<unsigned> casters;
+		BVHQueryStats overlapStats;
+		queryBVHOverlap(bvh, glm::vec3(-10.0f), glm::vec3(10.0f), casters, &overlapStats);
+
+		printf("%8d %10.3f %10.3f %12.3f %12.3f %10d %10d %10d\n", n,
+			buildSeconds * 1e3, refitSeconds * 1e3,
+			flatSeconds * 1e6 / iterations, bvhSeconds * 1e6 / iterations,
+			cullStats.nodesVisited, (int)(rayNodes / rays), overlapStats.nodesVisited);
+
+		// Objects drifting a bit every frame : refit, and rebuild only when
+		// the tree has become too loose
+		std::uniform_real_distribution<float> jitter(-0.5f, 0.5f);
+		int frames = std::max(10, std::min(200, 2000000 / n));
+		bvh.rebuilds = 0;
+		start = benchmarkTime();
+		for (int f = 0; f < frames; f++){
+			clearAABBs(boxes);
+			for (int i = 0; i < n; i++){
+				centers[i] += glm::vec3(jitter(generator), jitter(generator), jitter(generator));
+				addAABB(boxes, centers[i] - glm::vec3(radii[i]), centers[i] + glm::vec3(radii[i]));
+			}
+			updateBVH(bvh, boxes);
+		}
+		double updateSeconds = benchmarkTime() - start;
+		printf("%8s %d moving frames : %.3f ms/frame (boxes included), %d rebuilds, SAH cost %.1f -> %.1f\n", "",
+			frames, updateSeconds * 1e3 / frames, bvh.rebuilds, bvh.buildCost, bvh.cost);
+	}
+}
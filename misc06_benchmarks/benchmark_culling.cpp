@@ -0,0 +1,82 @@
+// Frustum culling of 1k to 1M random boxes and spheres, one box at a time
+// versus the SIMD path.
+
+// Include standard headers
+#include <stdio.h>
+#include <vector>
+#include <random>
+
+// Include GLM
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+using namespace glm;
+
+#include <common/culling.hpp>
+
+#include "benchmarks.hpp"
+
+void benchmarkCulling(){
+
+	// Same projection as common/controls.cpp, looking down -Z from the origin
+	glm::mat4 ProjectionMatrix = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f);
+	glm::mat4 ViewMatrix = glm::lookAt(glm::vec3(0,0,0), glm::vec3(0,0,-1), glm::vec3(0,1,0));
+	Frustum frustum = extractFrustum(ProjectionMatrix, ViewMatrix);
+
+	printf("%8s %8s %16s %16s %8s\n", "objects", "visible", "scalar ns/obj", "SIMD ns/obj", "speedup");
+
+	int sizes[] = { 1000, 10000, 100000, 1000000 };
+	for (int s = 0; s < 4; s++){
+		int n = sizes[s];
+
+		// Objects scattered all around the camera, so that only a part of
+		// them is in the frustum
+		std::mt19937 generator(1234);
+		std::uniform_real_distribution<float> position(-100.0f, 100.0f);
+		std::uniform_real_distribution<float> size(0.1f, 2.0f);
+		AABBArray boxes;
+		SphereArray spheres;
+		for (int i = 0; i < n; i++){
+			glm::vec3 center(position(generator), position(generator), position(generator));
+			float radius = size(generator);
+			addAABB(boxes, center - glm::vec3(radius), center + glm::vec3(radius));
+			addSphere(spheres, center, radius);
+		}
+
+		std::vector<unsigned> scalarVisible;
+		std::vector<unsigned> simdVisible;
+		int iterations = benchmarkIterations(n);
+
+		double start = benchmarkTime();
+		for (int i = 0; i < iterations; i++)
+			cullAABBsScalar(frustum, boxes, scalarVisible);
+		double scalarSeconds = benchmarkTime() - start;
+
+		start = benchmarkTime();
+		for (int i = 0; i < iterations; i++)
+			cullAABBs(frustum, boxes, simdVisible);
+		double simdSeconds = benchmarkTime() - start;
+
+		if (scalarVisible != simdVisible)
+			printf("ERROR : the SIMD path disagrees with the scalar one on boxes\n");
+
+		double scale = 1e9 / (double(n) * iterations);
+		printf("%8d %8d %16.3f %16.3f %7.2fx  boxes\n", n, (int)simdVisible.size(),
+			scalarSeconds * scale, simdSeconds * scale, scalarSeconds / simdSeconds);
+
+		start = benchmarkTime();
+		for (int i = 0; i < iterations; i++)
+			cullSpheresScalar(frustum, spheres, scalarVisible);
+		scalarSeconds = benchmarkTime() - start;
+
+		start = benchmarkTime();
+		for (int i = 0; i < iterations; i++)
+			cullSpheres(frustum, spheres, simdVisible);
+		simdSeconds = benchmarkTime() - start;
+
+		if (scalarVisible != simdVisible)
+			printf("ERROR : the SIMD path disagrees with the scalar one on spheres\n");
+
+		printf("%8d %8d %16.3f %16.3f %7.2fx  spheres\n", n, (int)simdVisible.size(),
+			scalarSeconds * scale, simdSeconds * scale, scalarSeconds / simdSeconds);
+	}
+}
@@ -0,0 +1,144 @@
+// Software occlusion culling : a town of walls hiding a field of boxes.
+// Rasterization time per thread count, test time, and how many boxes that
+// passed the frustum test the depth buffer rejects.
+
+// Include standard headers
+#include <stdio.h>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+// Include GLM
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+using namespace glm;
+
+#include <common/culling.hpp>
+#include <common/jobs.hpp>
+#include <common/occlusion.hpp>
+
+#include "benchmarks.hpp"
+
+// A closed box as an occluder mesh, faces counter-clockwise from outside
+static void boxMesh(std::vector<glm::vec3>& vertices, std::vector<unsigned short>& indices){
+	for (int c = 0; c < 8; c++)
+		vertices.push_back(glm::vec3(c & 1 ? 1.0f : -1.0f, c & 2 ? 1.0f : -1.0f, c & 4 ? 1.0f : -1.0f));
+	static const unsigned short faces[36] = {
+		0,2,3, 0,3,1, // -Z
+		4,5,7, 4,7,6, // +Z
+		0,4,6, 0,6,2, // -X
+		1,3,7, 1,7,5, // +X
+		0,1,5, 0,5,4, // -Y
+		2,6,7, 2,7,3, // +Y
+	};
+	indices.assign(faces, faces + 36);
+}
+
+// Same test as isAABBOccluded() but against every full resolution pixel :
+// the hierarchy may say "visible" more often, never "occluded" more often.
+static bool occludedAtFullResolution(const OcclusionBuffer& buffer, const glm::vec3& min, const glm::vec3& max){
+	glm::vec3 screenMin(1e30f), screenMax(-1e30f);
+	for (int c = 0; c < 8; c++){
+		glm::vec4 clip = buffer.viewProjection * glm::vec4(c & 1 ? max.x : min.x, c & 2 ? max.y : min.y, c & 4 ? max.z : min.z, 1.0f);
+		if (clip.z < -clip.w)
+			return false;
+		glm::vec3 ndc = glm::vec3(clip) / clip.w;
+		glm::vec3 screen((ndc.x*0.5f+0.5f) * buffer.width, (ndc.y*0.5f+0.5f) * buffer.height, ndc.z*0.5f+0.5f);
+		screenMin = glm::min(screenMin, screen);
+		screenMax = glm::max(screenMax, screen);
+	}
+	int x0 = std::max(0, (int)floor(screenMin.x)), x1 = std::min(buffer.width-1, (int)floor(screenMax.x));
+	int y0 = std::max(0, (int)floor(screenMin.y)), y1 = std::min(buffer.height-1, (int)floor(screenMax.y));
+	if (x0 > x1 || y0 > y1)
+		return false;
+	for (int y = y0; y <= y1; y++)
+		for (int x = x0; x <= x1; x++)
+			if (screenMin.z <= buffer.depth[y * buffer.width + x])
+				return false;
+	return true;
+}
+
+void benchmarkOcclusion(){
+
+	// Standing in a street, looking along it
+	glm::mat4 ProjectionMatrix = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f);
+	glm::mat4 ViewMatrix = glm::lookAt(glm::vec3(0,1.5f,0), glm::vec3(0.3f,1.5f,-1), glm::vec3(0,1,0));
+
+	std::vector<glm::vec3> boxVertices;
+	std::vector<unsigned short> boxIndices;
+	boxMesh(boxVertices, boxIndices);
+
+	// Buildings : a grid of large boxes with streets between them
+	std::vector<glm::mat4> buildings;
+	for (int x = -5; x <= 5; x++){
+		for (int z = -10; z <= 0; z++){
+			glm::vec3 center(x * 12.0f + 6.0f, 5.0f, z * 12.0f - 6.0f);
+			buildings.push_back(glm::scale(glm::translate(glm::mat4(), center), glm::vec3(4.5f, 5.0f, 4.5f)));
+		}
+	}
+
+	// Props everywhere, inside the buildings or not
+	std::mt19937 generator(1234);
+	std::uniform_real_distribution<float> position(-70.0f, 70.0f);
+	AABBArray props;
+	for (int i = 0; i < 20000; i++){
+		glm::vec3 center(position(generator), 0.5f, position(generator) - 60.0f);
+		addAABB(props, center - glm::vec3(0.5f), center + glm::vec3(0.5f));
+	}
+
+	std::vector<unsigned> frustumVisible;
+	cullAABBs(extractFrustum(ProjectionMatrix, ViewMatrix), props, frustumVisible);
+
+	printf("%d occluder triangles, %d props, %d in the frustum\n",
+		(int)(buildings.size() * boxIndices.size() / 3), (int)props.minX.size(), (int)frustumVisible.size());
+	printf("%8s %8s %12s %12s %10s %10s\n", "size", "threads", "raster us", "test us", "rejected", "full res");
+
+	int sizes[][2] = { { 256, 128 }, { 512, 256 } };
+	int threadCounts[] = { 1, 2, 4 };
+	for (int s = 0; s < 2; s++){
+		for (int t = 0; t < 3; t++){
+			OcclusionBuffer buffer;
+			initOcclusionBuffer(buffer, sizes[s][0], sizes[s][1], threadCounts[t]);
+
+			int iterations = 100;
+			double rasterSeconds = 0.0, testSeconds = 0.0;
+			std::vector<unsigned> visible;
+			for (int i = 0; i < iterations; i++){
+				double start = benchmarkTime();
+				beginOcclusionFrame(buffer, ProjectionMatrix, ViewMatrix);
+				for (size_t b = 0; b < buildings.size(); b++)
+					addOccluder(buffer, buildings[b], boxVertices, boxIndices);
+				rasterizeOccluders(buffer);
+				rasterSeconds += benchmarkTime() - start;
+
+				start = benchmarkTime();
+				visible = frustumVisible;
+				cullOccludedAABBs(buffer, props, visible);
+				testSeconds += benchmarkTime() - start;
+			}
+
+			// How many of the frustum survivors a per-pixel test would reject,
+			// and check that the hierarchy never rejects one of the others
+			int fullResolution = 0;
+			std::vector<bool> kept(props.minX.size(), false);
+			for (size_t v = 0; v < visible.size(); v++)
+				kept[visible[v]] = true;
+			for (size_t v = 0; v < frustumVisible.size(); v++){
+				unsigned i = frustumVisible[v];
+				glm::vec3 min(props.minX[i], props.minY[i], props.minZ[i]);
+				glm::vec3 max(props.maxX[i], props.maxY[i], props.maxZ[i]);
+				bool occluded = occludedAtFullResolution(buffer, min, max);
+				if (occluded)
+					fullResolution++;
+				if (!kept[i] && !occluded)
+					printf("ERROR : prop %u rejected by the hierarchy but visible at full resolution\n", i);
+			}
+
+			printf("%4dx%-4d %7d %12.1f %12.1f %9.1f%% %9.1f%%\n", buffer.width, buffer.height, buffer.threadCount,
+				rasterSeconds * 1e6 / iterations, testSeconds * 1e6 / iterations,
+				100.0 * buffer.stats.occluded / std::max(1, buffer.stats.tested),
+				100.0 * fullResolution / std::max(1, (int)frustumVisible.size()));
+			deleteOcclusionBuffer(buffer);
+		}
+	}
+}
@@ -0,0 +1,383 @@
+// Particle update : the array of structures loop of tutorial18_particles,
+// which walks every slot, versus the structure of arrays system of
+// common/particles.cpp, one particle at a time and SIMD. Then spawning :
+// FindUnusedParticle()'s scan versus the dense pool. Then the update of
+// 1M particles on 1 to N threads of a job system. Last, the force fields,
+// and many emitters with and without culling and levels of detail.
+
+// Include standard headers
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <thread>
+
+// Include GLM
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtx/norm.hpp>
+using namespace glm;
+
+#include <common/simd.hpp>
+#include <common/random.hpp>
+#include <common/culling.hpp>
+#include <common/radixsort.hpp>
+#include <common/jobs.hpp>
+#include <common/particles.hpp>
+#include <common/emitters.hpp>
+
+#include "benchmarks.hpp"
+
+// The particle of tutorial18_particles.cpp
+struct Particle{
+	glm::vec3 pos, speed;
+	unsigned char r,g,b,a;
+	float size, angle, weight;
+	float life;
+	float cameradistance;
+};
+
+// The simulation loop of tutorial18_particles.cpp. Returns the number of
+// particles written to the buffers.
+static int updateParticlesAoS(std::vector<Particle>& particles, float delta,
+                              const glm::vec3& CameraPosition,
+                              float* positionSize, unsigned char* color){
+	int ParticlesCount = 0;
+	for(size_t i=0; i<particles.size(); i++){
+		Particle& p = particles[i];
+		if(p.life > 0.0f){
+			p.life -= delta;
+			if (p.life > 0.0f){
+				p.speed += glm::vec3(0.0f,-9.81f, 0.0f) * (float)delta * 0.5f;
+				p.pos += p.speed * (float)delta;
+				p.cameradistance = glm::length2( p.pos - CameraPosition );
+				positionSize[4*ParticlesCount+0] = p.pos.x;
+				positionSize[4*ParticlesCount+1] = p.pos.y;
+				positionSize[4*ParticlesCount+2] = p.pos.z;
+				positionSize[4*ParticlesCount+3] = p.size;
+				color[4*ParticlesCount+0] = p.r;
+				color[4*ParticlesCount+1] = p.g;
+				color[4*ParticlesCount+2] = p.b;
+				color[4*ParticlesCount+3] = p.a;
+			}else{
+				p.cameradistance = -1.0f;
+			}
+			ParticlesCount++;
+		}
+	}
+	return ParticlesCount;
+}
+
+// FindUnusedParticle() of tutorial18_particles.cpp
+static int findUnusedParticle(std::vector<Particle>& particles, int& LastUsedParticle){
+	int MaxParticles = (int)particles.size();
+	for(int i=LastUsedParticle; i<MaxParticles; i++){
+		if (particles[i].life < 0){
+			LastUsedParticle = i;
+			return i;
+		}
+	}
+	for(int i=0; i<LastUsedParticle; i++){
+		if (particles[i].life < 0){
+			LastUsedParticle = i;
+			return i;
+		}
+	}
+	return 0;
+}
+
+// Random particles like the fountain of the tutorial, at various ages
+static void randomParticle(std::mt19937& generator, glm::vec3& pos, glm::vec3& speed,
+                           float& life, float& size, unsigned char rgba[4]){
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	pos = glm::vec3(0.0f, 0.0f, -20.0f) + glm::vec3(unit(generator), unit(generator), unit(generator)) * 5.0f;
+	speed = glm::vec3(0.0f, 10.0f, 0.0f) + glm::vec3(unit(generator), unit(generator), unit(generator)) * 1.5f;
+	life = 2.5f + unit(generator) * 2.5f;
+	size = 0.35f + unit(generator) * 0.25f;
+	for (int c = 0; c < 4; c++)
+		rgba[c] = (unsigned char)(generator() % 256);
+}
+
+void benchmarkParticles(){
+
+	const float delta = 1.0f / 60.0f;
+	const int frames = 60; // particles die and slots empty along the way
+	glm::vec3 CameraPosition(0.0f, 0.0f, 5.0f);
+	glm::vec3 gravity = glm::vec3(0.0f, -9.81f, 0.0f) * 0.5f;
+
+	printf("%8s %8s %16s %16s %16s %8s\n", "slots", "live", "AoS part/ms",
+		"SoA part/ms", "SIMD part/ms", "speedup");
+
+	// Slots in the pool, and how many of them are used
+	int slots[] = { 100000, 100000, 1000000 };
+	int live[] = { 25000, 100000, 1000000 };
+	for (int s = 0; s < 3; s++){
+		int n = live[s];
+
+		std::vector<Particle> particles(slots[s]);
+		for (size_t i = 0; i < particles.size(); i++)
+			particles[i].life = -1.0f;
+		ParticleSystem system;
+		initParticleSystem(system, slots[s]);
+
+		// The live particles spread over all the slots, as they end up in
+		// the tutorial once particles die and get replaced
+		std::mt19937 generator(1234);
+		for (int i = 0; i < n; i++){
+			Particle& p = particles[(size_t)i * slots[s] / n];
+			randomParticle(generator, p.pos, p.speed, p.life, p.size, &p.r);
+			spawnParticle(system, p.pos, p.speed, p.life, p.size,
+				packParticleColor(p.r, p.g, p.b, p.a));
+		}
+		ParticleSystem scalarSystem = system;
+
+		std::vector<float> positionSize(4 * slots[s]);
+		std::vector<unsigned char> aosColor(4 * slots[s]);
+		std::vector<float> simdPositionSize(4 * slots[s]);
+		std::vector<unsigned> colors(slots[s]);
+
+		// Particles processed, summed over the frames
+		long long aosParticles = 0, scalarParticles = 0, simdParticles = 0;
+		double start = benchmarkTime();
+		for (int f = 0; f < frames; f++){
+			int count = updateParticlesAoS(particles, delta, CameraPosition,
+				&positionSize[0], &aosColor[0]);
+			aosParticles += count;
+		}
+		double aosSeconds = benchmarkTime() - start;
+
+		start = benchmarkTime();
+		for (int f = 0; f < frames; f++){
+			scalarParticles += scalarSystem.count;
+			updateParticlesScalar(scalarSystem, delta, gravity, CameraPosition,
+				&positionSize[0], &colors[0]);
+		}
+		double scalarSeconds = benchmarkTime() - start;
+
+		start = benchmarkTime();
+		for (int f = 0; f < frames; f++){
+			simdParticles += system.count;
+			updateParticles(system, delta, gravity, CameraPosition,
+				&simdPositionSize[0], &colors[0]);
+		}
+		double simdSeconds = benchmarkTime() - start;
+
+		if (scalarSystem.count != system.count ||
+			memcmp(&positionSize[0], &simdPositionSize[0], system.count * 4 * sizeof(float)) != 0)
+			printf("ERROR : the SIMD path disagrees with the scalar one\n");
+
+		printf("%8d %8d %16.0f %16.0f %16.0f %7.2fx\n", slots[s], n,
+			aosParticles / (aosSeconds * 1000.0), scalarParticles / (scalarSeconds * 1000.0),
+			simdParticles / (simdSeconds * 1000.0),
+			(simdParticles / simdSeconds) / (aosParticles / aosSeconds));
+	}
+
+	// Spawning in a pool of 100000 slots kept at a given occupancy : every
+	// frame 160 random particles die, then 160 are spawned, like the
+	// tutorial at 60 fps. Only the spawns are timed.
+	printf("\n%8s %8s %16s %16s %8s\n", "slots", "live", "scan ns/spawn",
+		"pool ns/spawn", "speedup");
+	const int poolSlots = 100000;
+	const int perFrame = 160;
+	const int spawnFrames = 2000;
+	float occupancy[] = { 0.5f, 0.9f, 0.99f };
+	for (int o = 0; o < 3; o++){
+		int n = (int)(poolSlots * occupancy[o]);
+		std::mt19937 generator(1234);
+
+		std::vector<Particle> particles(poolSlots);
+		std::vector<int> liveSlots; // to pick the particles that die
+		for (int i = 0; i < poolSlots; i++)
+			particles[i].life = -1.0f;
+		ParticleSystem system;
+		initParticleSystem(system, poolSlots);
+		for (int i = 0; i < n; i++){
+			int slot = (int)((size_t)i * poolSlots / n);
+			particles[slot].life = 1.0f;
+			liveSlots.push_back(slot);
+			spawnParticle(system, glm::vec3(0.0f), glm::vec3(0.0f), 1.0f, 1.0f, 0);
+		}
+
+		int LastUsedParticle = 0;
+		double scanSeconds = 0.0, poolSeconds = 0.0;
+		int victims[perFrame];
+		for (int f = 0; f < spawnFrames; f++){
+			for (int i = 0; i < perFrame; i++){
+				victims[i] = generator() % (n - i);
+				// Both pools lose the same particles
+				std::swap(liveSlots[victims[i]], liveSlots[n - 1 - i]);
+				particles[liveSlots[n - 1 - i]].life = -1.0f;
+				removeParticle(system, victims[i]);
+			}
+
+			double start = benchmarkTime();
+			for (int i = 0; i < perFrame; i++){
+				int slot = findUnusedParticle(particles, LastUsedParticle);
+				particles[slot].life = 1.0f;
+				victims[i] = slot;
+			}
+			scanSeconds += benchmarkTime() - start;
+			for (int i = 0; i < perFrame; i++)
+				liveSlots[n - perFrame + i] = victims[i];
+
+			start = benchmarkTime();
+			for (int i = 0; i < perFrame; i++)
+				spawnParticle(system, glm::vec3(0.0f), glm::vec3(0.0f), 1.0f, 1.0f, 0);
+			poolSeconds += benchmarkTime() - start;
+		}
+
+		double scale = 1e9 / (double(spawnFrames) * perFrame);
+		printf("%8d %8d %16.3f %16.3f %7.2fx\n", poolSlots, n,
+			scanSeconds * scale, poolSeconds * scale, scanSeconds / poolSeconds);
+	}
+
+	// Update, cull and write to the buffers at 1M particles, 10000 dying
+	// and spawning each frame, on more and more threads
+	const int threadedCount = 1000000;
+	int hardwareThreads = std::max(1, (int)std::thread::hardware_concurrency());
+	printf("\n%8s %8s %16s %8s\n", "live", "threads", "part/ms", "scaling");
+	double singleThread = 0.0;
+	for (int threads = 1; ; threads = std::min(threads * 2, hardwareThreads)){
+		std::mt19937 generator(1234);
+		std::uniform_real_distribution<float> life(0.0f, 100.0f / 60.0f);
+		ParticleSystem system;
+		initParticleSystem(system, threadedCount);
+		std::vector<float> positionSize(4 * threadedCount);
+		std::vector<unsigned> colors(threadedCount);
+		JobSystem* jobs = createJobSystem(threads);
+		ParticleUpdate update;
+
+		long long particles = 0;
+		double seconds = 0.0;
+		for (int f = 0; f < frames; f++){
+			while (system.count < threadedCount){
+				glm::vec3 pos, speed;
+				float particleLife, size;
+				unsigned char rgba[4];
+				randomParticle(generator, pos, speed, particleLife, size, rgba);
+				spawnParticle(system, pos, speed, life(generator), size, 0);
+			}
+			particles += system.count;
+			double start = benchmarkTime();
+			startParticleUpdate(update, jobs, system, delta, gravity, CameraPosition,
+				&positionSize[0], &colors[0]);
+			finishParticleUpdate(update, jobs);
+			seconds += benchmarkTime() - start;
+		}
+		destroyJobSystem(jobs);
+
+		double perMs = particles / (seconds * 1000.0);
+		if (threads == 1)
+			singleThread = perMs;
+		printf("%8d %8d %16.0f %7.2fx\n", threadedCount, threads, perMs, perMs / singleThread);
+		if (threads == hardwareThreads)
+			break;
+	}
+
+	// 100000 particles under each kind of field, then all of them at once,
+	// one particle at a time and SIMD
+	ForceField fields[] = {
+		{ FORCE_GRAVITY, glm::vec3(0.0f), glm::vec3(0.0f, -1.0f, 0.0f), 4.905f, 0.0f },
+		{ FORCE_DRAG, glm::vec3(0.0f), glm::vec3(0.0f), 0.5f, 0.0f },
+		{ FORCE_VORTEX, glm::vec3(0.0f, 0.0f, -20.0f), glm::vec3(0.0f, 1.0f, 0.0f), 20.0f, 10.0f },
+		{ FORCE_ATTRACTOR, glm::vec3(0.0f, 10.0f, -20.0f), glm::vec3(0.0f), 50.0f, 0.0f },
+	};
+	const char* fieldNames[] = { "none", "gravity", "drag", "vortex", "attractor", "all" };
+	const int fieldCount = 100000;
+	printf("\n%10s %8s %16s %16s %8s\n", "fields", "live", "SoA part/ms",
+		"SIMD part/ms", "speedup");
+	for (int c = 0; c < 6; c++){
+		const ForceField* used = c == 0 ? NULL : c == 5 ? fields : &fields[c - 1];
+		int usedCount = c == 0 ? 0 : c == 5 ? 4 : 1;
+
+		std::mt19937 generator(1234);
+		ParticleSystem system;
+		initParticleSystem(system, fieldCount);
+		for (int i = 0; i < fieldCount; i++){
+			glm::vec3 pos, speed;
+			float life, size;
+			unsigned char rgba[4];
+			randomParticle(generator, pos, speed, life, size, rgba);
+			spawnParticle(system, pos, speed, life, size, 0);
+		}
+		ParticleSystem scalarSystem = system;
+		std::vector<float> positionSize(4 * fieldCount), simdPositionSize(4 * fieldCount);
+		std::vector<unsigned> colors(fieldCount);
+
+		long long scalarParticles = 0, simdParticles = 0;
+		double start = benchmarkTime();
+		for (int f = 0; f < frames; f++){
+			scalarParticles += scalarSystem.count;
+			updateParticlesScalar(scalarSystem, delta, glm::vec3(0.0f), CameraPosition,
+				&positionSize[0], &colors[0], used, usedCount);
+		}
+		double scalarSeconds = benchmarkTime() - start;
+
+		start = benchmarkTime();
+		for (int f = 0; f < frames; f++){
+			simdParticles += system.count;
+			updateParticles(system, delta, glm::vec3(0.0f), CameraPosition,
+				&simdPositionSize[0], &colors[0], used, usedCount);
+		}
+		double simdSeconds = benchmarkTime() - start;
+
+		if (scalarSystem.count != system.count ||
+			memcmp(&positionSize[0], &simdPositionSize[0], system.count * 4 * sizeof(float)) != 0)
+			printf("ERROR : the SIMD path disagrees with the scalar one\n");
+
+		printf("%10s %8d %16.0f %16.0f %7.2fx\n", fieldNames[c], fieldCount,
+			scalarParticles / (scalarSeconds * 1000.0), simdParticles / (simdSeconds * 1000.0),
+			(simdParticles / simdSeconds) / (scalarParticles / scalarSeconds));
+	}
+
+	// 256 fountains of up to 4000 particles on a 16 x 16 grid 50 units
+	// apart, seen from the middle of one side : every emitter awake, then
+	// with culling and levels of detail. Spawn and update are timed, on one
+	// thread.
+	printf("\n%10s %8s %8s %16s %8s\n", "emitters", "awake", "live", "ms/frame", "speedup");
+	glm::vec3 gridCamera(375.0f, 10.0f, 50.0f);
+	glm::mat4 gridProjection = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 1000.0f);
+	glm::mat4 gridView = glm::lookAt(gridCamera, glm::vec3(375.0f, 10.0f, -750.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	Frustum gridFrustum = extractFrustum(gridProjection, gridView);
+	JobSystem* gridJobs = createJobSystem(1);
+	double allSeconds = 0.0;
+	for (int culled = 0; culled < 2; culled++){
+		ParticleEffect effect;
+		addForceField(effect, fields[0]);
+		for (int e = 0; e < 256; e++){
+			EmitterSettings settings;
+			settings.position = glm::vec3(50.0f * (e % 16), 0.0f, -50.0f * (e / 16));
+			settings.rate = 800.0f;
+			settings.budget = 4000;
+			settings.radius = 25.0f;
+			settings.lodNear = culled ? 150.0f : 1e9f;
+			settings.lodFar = culled ? 400.0f : 2e9f;
+			settings.seed = e + 1;
+			addParticleEmitter(effect, settings);
+		}
+		// Every emitter full before timing
+		for (int f = 0; f < 60; f++){
+			startParticleEffectUpdate(effect, gridJobs, 0.1f, gridCamera);
+			finishParticleEffectUpdate(effect, gridJobs);
+		}
+
+		double seconds = 0.0;
+		int awake = 0;
+		for (int f = 0; f < frames; f++){
+			double start = benchmarkTime();
+			startParticleEffectUpdate(effect, gridJobs, delta, gridCamera,
+				culled ? &gridFrustum : NULL);
+			finishParticleEffectUpdate(effect, gridJobs);
+			seconds += benchmarkTime() - start;
+		}
+		for (size_t e = 0; e < effect.emitters.size(); e++)
+			awake += effect.emitters[e]->awake;
+		if (!culled)
+			allSeconds = seconds;
+		printf("%10d %8d %8d %16.3f %7.2fx\n", (int)effect.emitters.size(), awake,
+			countParticleEffect(effect), seconds * 1000.0 / frames, allSeconds / seconds);
+		deleteParticleEffect(effect);
+	}
+	destroyJobSystem(gridJobs);
+}
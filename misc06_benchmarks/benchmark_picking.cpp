@@ -0,0 +1,123 @@
+// Picking 100 to 1M rotated and scaled boxes with rays from a camera :
+// testing every box as misc05_picking_custom did, the binary BVH of
+// common/bvh.hpp with the exact test as its callback, and the wide BVH of
+// common/picking.hpp with its SIMD slab tests. All three must pick the
+// same box.
+
+// Include standard headers
+#include <stdio.h>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+// Include GLM
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/quaternion.hpp>
+#include <glm/gtx/quaternion.hpp>
+using namespace glm;
+
+#include <common/simd.hpp>
+#include <common/culling.hpp>
+#include <common/bvh.hpp>
+#include <common/picking.hpp>
+
+#include "benchmarks.hpp"
+
+// BVHRayTest for the binary BVH : userData is the PickingScene
+static bool rayTestObject(unsigned object, const glm::vec3& origin, const glm::vec3& direction,
+	float& distance, void* userData){
+	const PickingScene& scene = *(const PickingScene*)userData;
+	return intersectPickingObject(scene.objects[object], origin, direction, 100000.0f, distance);
+}
+
+void benchmarkPicking(){
+
+	printf("%d wide nodes (%s)\n", PICKING_WIDTH, simdName());
+	printf("%8s %10s %12s %12s %12s %8s %10s %10s %6s\n", "objects", "build ms", "linear us",
+		"binary us", "wide us", "speedup", "wide nodes", "OBB tests", "same");
+
+	int sizes[] = { 100, 10000, 100000, 1000000 };
+	for (int s = 0; s < 4; s++){
+		int n = sizes[s];
+
+		// The density of the 100 monkeys of misc05, in a bigger cube
+		float side = 20.0f * powf(n / 100.0f, 1.0f / 3.0f);
+		std::mt19937 generator(1234);
+		std::uniform_real_distribution<float> position(-side / 2, side / 2);
+		std::uniform_real_distribution<float> angle(0.0f, 6.2831853f);
+		std::uniform_real_distribution<float> scale(0.5f, 1.5f);
+		PickingScene scene;
+		for (int i = 0; i < n; i++){
+			glm::vec3 center(position(generator), position(generator), position(generator));
+			glm::quat orientation(glm::vec3(angle(generator), angle(generator), angle(generator)));
+			glm::vec3 size(scale(generator), scale(generator), scale(generator));
+			glm::mat4 ModelMatrix = glm::translate(glm::mat4(), center) * glm::toMat4(orientation) * glm::scale(glm::mat4(), size);
+			addPickingObject(scene, ModelMatrix, glm::vec3(-1.0f), glm::vec3(1.0f));
+		}
+
+		double start = benchmarkTime();
+		buildPickingScene(scene);
+		double buildSeconds = benchmarkTime() - start;
+		BVH bvh;
+		buildBVH(bvh, scene.bounds);
+
+		// Through random points of the cube, from a camera in front of it
+		const int rays = 1000;
+		glm::vec3 camera(0.0f, 0.0f, side);
+		std::vector<glm::vec3> directions(rays);
+		for (int r = 0; r < rays; r++){
+			glm::vec3 target(position(generator), position(generator), position(generator));
+			directions[r] = glm::normalize(target - camera);
+		}
+
+		// Every box : fewer rays, about 20 million tests
+		int linearRays = std::min(rays, benchmarkIterations(n));
+		std::vector<int> linearHits(linearRays);
+		std::vector<float> linearDistances(linearRays);
+		start = benchmarkTime();
+		for (int r = 0; r < linearRays; r++)
+			linearHits[r] = pickRayLinear(scene, camera, directions[r], 100000.0f, linearDistances[r]);
+		double linearSeconds = (benchmarkTime() - start) / linearRays;
+
+		std::vector<int> binaryHits(rays);
+		start = benchmarkTime();
+		for (int r = 0; r < rays; r++){
+			float distance;
+			binaryHits[r] = raycastBVH(bvh, camera, directions[r], 100000.0f, rayTestObject, &scene, distance);
+		}
+		double binarySeconds = (benchmarkTime() - start) / rays;
+
+		std::vector<int> wideHits(rays);
+		long long wideNodes = 0;
+		long long wideTests = 0;
+		start = benchmarkTime();
+		for (int r = 0; r < rays; r++){
+			float distance;
+			BVHQueryStats stats;
+			wideHits[r] = pickRay(scene, camera, directions[r], 100000.0f, distance, &stats);
+			wideNodes += stats.nodesVisited;
+			wideTests += stats.objectsTested;
+		}
+		double wideSeconds = (benchmarkTime() - start) / rays;
+
+		// Two boxes may be entered at the same distance : then either is right
+		int different = 0;
+		for (int r = 0; r < rays; r++){
+			if (binaryHits[r] != wideHits[r])
+				different++;
+			if (r < linearRays && linearHits[r] != wideHits[r]){
+				float distance;
+				pickRay(scene, camera, directions[r], 100000.0f, distance);
+				if (distance != linearDistances[r])
+					printf("ERROR : ray %d picks %d at %f, expected %d at %f\n", r,
+						wideHits[r], distance, linearHits[r], linearDistances[r]);
+			}
+		}
+
+		printf("%8d %10.3f %12.3f %12.3f %12.3f %7.0fx %10.1f %10.1f %6s\n", n,
+			buildSeconds * 1e3, linearSeconds * 1e6, binarySeconds * 1e6, wideSeconds * 1e6,
+			linearSeconds / wideSeconds, (double)wideNodes / rays, (double)wideTests / rays,
+			different == 0 ? "yes" : "NO");
+	}
+}
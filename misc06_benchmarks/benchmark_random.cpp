@@ -0,0 +1,171 @@
+// Random numbers : rand() and std::mt19937, which the particle code used,
+// versus the counter based streams of common/random.hpp, one number at a
+// time and 8 at a time. The compiler vectorizes the randomFloat() loop
+// too, so expect both at about the same speed. Then the spawn path : the fountain of
+// tutorial18_particles with rand(), versus an emitter. Last, filling a
+// buffer on 1 to N threads, which must give the numbers of one thread.
+
+// Include standard headers
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <thread>
+
+// Include GLM
+#include <glm/glm.hpp>
+using namespace glm;
+
+#include <common/simd.hpp>
+#include <common/random.hpp>
+#include <common/culling.hpp>
+#include <common/radixsort.hpp>
+#include <common/jobs.hpp>
+#include <common/particles.hpp>
+#include <common/emitters.hpp>
+
+#include "benchmarks.hpp"
+
+// newParticle() of tutorial18_particles.cpp before the emitters : 7 calls
+// to rand() per particle
+static void newParticleRand(glm::vec3& position, glm::vec3& speed,
+                            float& life, float& size, unsigned& color){
+	float spread = 1.5f;
+	glm::vec3 maindir = glm::vec3(0.0f, 10.0f, 0.0f);
+	glm::vec3 randomdir = glm::vec3(
+		(rand()%2000 - 1000.0f)/1000.0f,
+		(rand()%2000 - 1000.0f)/1000.0f,
+		(rand()%2000 - 1000.0f)/1000.0f
+	);
+	speed = maindir + randomdir*spread;
+
+	unsigned char r = rand() % 256;
+	unsigned char g = rand() % 256;
+	unsigned char b = rand() % 256;
+	unsigned char a = (rand() % 256) / 3;
+	color = packParticleColor(r, g, b, a);
+
+	size = (rand()%1000)/2000.0f + 0.1f;
+	position = glm::vec3(0,0,-20.0f);
+	life = 5.0f;
+}
+
+// Fills 8 floats per index from a copy of the stream, as if that many
+// randomFloats8() calls had been made before
+struct FillJob{
+	RandomStream random;
+	float* out;
+};
+
+static void fillChunk(void* data, int begin, int end, int){
+	FillJob& job = *(FillJob*)data;
+	RandomStream random = job.random;
+	random.counter += 8 * begin;
+	for (int i = begin; i < end; i++)
+		randomFloats8(random, job.out + 8 * i);
+}
+
+void benchmarkRandom(){
+
+	// Floats in [0, 1) per millisecond, and how much faster than rand()
+	const int count = 8 * 1000000;
+	std::vector<float> reference(count), simd(count);
+	float sink = 0.0f;
+	printf("%16s %16s %8s\n", "generator", "floats/ms", "speedup");
+
+	double start = benchmarkTime();
+	for (int i = 0; i < count; i++)
+		reference[i] = rand() * (1.0f / (RAND_MAX + 1.0f));
+	double randFloatSeconds = benchmarkTime() - start;
+	sink += reference[count - 1];
+	printf("%16s %16.0f\n", "rand()", count / (randFloatSeconds * 1000.0));
+
+	std::mt19937 generator(1234);
+	std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+	start = benchmarkTime();
+	for (int i = 0; i < count; i++)
+		reference[i] = unit(generator);
+	double seconds = benchmarkTime() - start;
+	sink += reference[count - 1];
+	printf("%16s %16.0f %7.2fx\n", "mt19937", count / (seconds * 1000.0),
+		randFloatSeconds / seconds);
+
+	RandomStream random;
+	seedRandom(random, 1234);
+	start = benchmarkTime();
+	for (int i = 0; i < count; i++)
+		reference[i] = randomFloat(random);
+	seconds = benchmarkTime() - start;
+	printf("%16s %16.0f %7.2fx\n", "randomFloat", count / (seconds * 1000.0),
+		randFloatSeconds / seconds);
+
+	seedRandom(random, 1234);
+	start = benchmarkTime();
+	for (int i = 0; i < count; i += 8)
+		randomFloats8(random, &simd[i]);
+	double simdSeconds = benchmarkTime() - start;
+	printf("%16s %16.0f %7.2fx\n", "randomFloats8", count / (simdSeconds * 1000.0),
+		randFloatSeconds / simdSeconds);
+
+	if (memcmp(&reference[0], &simd[0], count * sizeof(float)) != 0)
+		printf("ERROR : randomFloats8() disagrees with randomFloat()\n");
+	seedRandom(random, 1234);
+	float scalar[8];
+	randomFloats8Scalar(random, scalar);
+	if (memcmp(scalar, &simd[0], sizeof(scalar)) != 0)
+		printf("ERROR : randomFloats8() disagrees with randomFloats8Scalar()\n");
+
+	// The fountain, spawned one particle at a time
+	const int spawns = 1000000;
+	std::vector<unsigned> colors(spawns);
+	printf("\n%16s %16s %8s\n", "spawn", "ns/particle", "speedup");
+	start = benchmarkTime();
+	for (int i = 0; i < spawns; i++){
+		glm::vec3 position, speed;
+		float life, size;
+		newParticleRand(position, speed, life, size, colors[i]);
+		sink += speed.x + size;
+	}
+	double randSeconds = benchmarkTime() - start;
+	printf("%16s %16.2f\n", "rand()", randSeconds * 1e9 / spawns);
+
+	EmitterSettings fountain;
+	fountain.position = glm::vec3(0.0f, 0.0f, -20.0f);
+	fountain.colorMax = packParticleColor(255, 255, 255, 85);
+	seedRandom(random, fountain.seed);
+	start = benchmarkTime();
+	for (int i = 0; i < spawns; i++){
+		glm::vec3 position, speed;
+		float life, size;
+		newEmitterParticle(fountain, random, position, speed, life, size, colors[i]);
+		sink += speed.x + size;
+	}
+	double streamSeconds = benchmarkTime() - start;
+	printf("%16s %16.2f %7.2fx\n", "emitter", streamSeconds * 1e9 / spawns,
+		randSeconds / streamSeconds);
+
+	// 8M floats in chunks of 8192 on more and more threads, checked
+	// against the single threaded fill above
+	int hardwareThreads = std::max(1, (int)std::thread::hardware_concurrency());
+	printf("\n%8s %16s %8s\n", "threads", "floats/ms", "same");
+	for (int threads = 1; ; threads = std::min(threads * 2, hardwareThreads)){
+		JobSystem* jobs = createJobSystem(threads);
+		std::vector<float> parallel(count);
+		FillJob job;
+		seedRandom(job.random, 1234);
+		job.out = &parallel[0];
+		start = benchmarkTime();
+		runJobs(jobs, fillChunk, &job, count / 8, 1024);
+		seconds = benchmarkTime() - start;
+		destroyJobSystem(jobs);
+
+		bool same = memcmp(&parallel[0], &simd[0], count * sizeof(float)) == 0;
+		printf("%8d %16.0f %8s\n", threads, count / (seconds * 1000.0), same ? "yes" : "NO");
+		if (threads == hardwareThreads)
+			break;
+	}
+	if (sink == 0.12345f)
+		printf("\n");
+}
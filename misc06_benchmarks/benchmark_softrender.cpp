@@ -0,0 +1,128 @@
+// Software renderer : a field of textured cubes at 1024x768. Time of each
+// stage per thread count, and a check that every thread count gives the
+// same image as one thread.
+
+// Include standard headers
+#include <stdio.h>
+#include <vector>
+#include <algorithm>
+
+// Include GLM
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+using namespace glm;
+
+#include <common/jobs.hpp>
+#include <common/softrender.hpp>
+
+#include "benchmarks.hpp"
+
+// A unit cube with one UV square and one normal per face, counter-clockwise
+// from outside
+static void cubeMesh(std::vector<SoftMesh>& meshes){
+	std::vector<unsigned short> indices;
+	std::vector<glm::vec3> vertices, normals;
+	std::vector<glm::vec2> uvs;
+	for (int axis = 0; axis < 3; axis++){
+		for (int side = -1; side <= 1; side += 2){
+			glm::vec3 normal(0.0f);
+			normal[axis] = (float)side;
+			glm::vec3 u(0.0f), v(0.0f);
+			u[(axis + 1) % 3] = 1.0f;
+			v[(axis + 2) % 3] = 1.0f;
+			if (side < 0)
+				std::swap(u, v);
+			unsigned short first = (unsigned short)vertices.size();
+			for (int c = 0; c < 4; c++){
+				float a = (c == 1 || c == 2) ? 1.0f : -1.0f;
+				float b = (c >= 2) ? 1.0f : -1.0f;
+				vertices.push_back(normal + u * a + v * b);
+				uvs.push_back(glm::vec2(a * 0.5f + 0.5f, b * 0.5f + 0.5f));
+				normals.push_back(normal);
+			}
+			unsigned short face[6] = { 0, 1, 2, 0, 2, 3 };
+			for (int i = 0; i < 6; i++)
+				indices.push_back(first + face[i]);
+		}
+	}
+	addSoftMesh(meshes, indices, vertices, uvs, normals);
+}
+
+// 256x256 checkerboard of 8x8 texels
+static void checkerTexture(std::vector<SoftTexture>& textures){
+	SoftTexture texture;
+	texture.levels.resize(1);
+	SoftImage& image = texture.levels[0];
+	image.width = image.height = 256;
+	image.pixels.resize(256 * 256 * 4);
+	for (int y = 0; y < 256; y++){
+		for (int x = 0; x < 256; x++){
+			bool light = ((x / 8) + (y / 8)) % 2 == 0;
+			unsigned char* pixel = &image.pixels[(y * 256 + x) * 4];
+			pixel[0] = light ? 230 : 40;
+			pixel[1] = light ? 200 : 60;
+			pixel[2] = light ? 150 : 90;
+			pixel[3] = 255;
+		}
+	}
+	buildSoftMipmaps(texture);
+	textures.push_back(texture);
+}
+
+void benchmarkSoftRender(){
+
+	std::vector<SoftMesh> meshes;
+	cubeMesh(meshes);
+	std::vector<SoftTexture> textures;
+	checkerTexture(textures);
+
+	// Cubes on a 40x40 grid, up to the far distance
+	std::vector<SoftInstance> instances;
+	for (int x = -20; x < 20; x++){
+		for (int z = -40; z < 0; z++){
+			SoftInstance instance;
+			instance.mesh = 0;
+			instance.material = 0;
+			instance.model = glm::rotate(glm::translate(glm::mat4(), glm::vec3(x * 3.0f, 0.0f, z * 3.0f)),
+			                             (float)(x * 7 + z), glm::vec3(0, 1, 0));
+			instances.push_back(instance);
+		}
+	}
+	glm::mat4 ProjectionMatrix = glm::perspective(glm::radians(45.0f), 4.0f / 3.0f, 0.1f, 100.0f);
+	glm::mat4 ViewMatrix = glm::lookAt(glm::vec3(0,6,8), glm::vec3(0,0,-20), glm::vec3(0,1,0));
+	glm::vec3 lightPosition(0, 4, -6);
+	glm::vec3 clearColor(0.0f, 0.0f, 0.4f);
+
+	printf("%d instances, %d triangles, 1024x768\n", (int)instances.size(), (int)(instances.size() * meshes[0].indices.size() / 3));
+	printf("%8s %12s %12s %12s %12s %10s %10s\n", "threads", "geometry ms", "raster ms", "shading ms", "frame ms", "binned", "image");
+
+	SoftImage reference;
+	int threadCounts[] = { 1, 2, 4, 8 };
+	for (int t = 0; t < 4; t++){
+		SoftRenderer renderer;
+		initSoftRenderer(renderer, 1024, 768, threadCounts[t]);
+
+		int iterations = 10;
+		double geometryMs = 0.0, rasterMs = 0.0, shadeMs = 0.0;
+		for (int i = 0; i < iterations; i++){
+			renderSoftScene(renderer, meshes, instances, textures, ProjectionMatrix, ViewMatrix, lightPosition, clearColor);
+			geometryMs += renderer.stats.geometryMs;
+			rasterMs += renderer.stats.rasterMs;
+			shadeMs += renderer.stats.shadeMs;
+		}
+
+		// The tiles and the triangle order don't depend on the threads, so
+		// neither should a single pixel
+		if (t == 0)
+			reference = renderer.color;
+		SoftImageDiff diff = diffSoftImages(reference, renderer.color, 0, NULL);
+		if (diff.differentPixels > 0)
+			printf("ERROR : %d pixels differ from the single thread image\n", diff.differentPixels);
+
+		printf("%8d %12.2f %12.2f %12.2f %12.2f %10d %10s\n", renderer.threadCount,
+			geometryMs / iterations, rasterMs / iterations, shadeMs / iterations,
+			(geometryMs + rasterMs + shadeMs) / iterations, renderer.stats.binnedTriangles,
+			diff.differentPixels > 0 ? "differs" : "same");
+		deleteSoftRenderer(renderer);
+	}
+}
@@ -0,0 +1,169 @@
+// Back to front sorting of particles : std::sort of the whole particles, as
+// tutorial18_particles did, versus the radix sort of indices of
+// common/particles.cpp, from scratch and from the previous frame's order.
+
+// Include standard headers
+#include <stdio.h>
+#include <vector>
+#include <random>
+#include <algorithm>
+
+// Include GLM
+#include <glm/glm.hpp>
+#include <glm/gtx/norm.hpp>
+using namespace glm;
+
+#include <common/radixsort.hpp>
+#include <common/jobs.hpp>
+#include <common/particles.hpp>
+
+#include "benchmarks.hpp"
+
+// The particle of tutorial18_particles.cpp
+struct Particle{
+	glm::vec3 pos, speed;
+	unsigned char r,g,b,a;
+	float size, angle, weight;
+	float life;
+	float cameradistance;
+
+	bool operator<(const Particle& that) const {
+		return this->cameradistance > that.cameradistance;
+	}
+};
+
+// Whether sortOrder is a permutation of the live particles, far first
+static bool checkOrder(const ParticleSystem& system){
+	std::vector<bool> seen(system.count, false);
+	for (int k = 0; k < system.count; k++){
+		unsigned i = system.sortOrder[k];
+		if ((int)i >= system.count || seen[i])
+			return false;
+		seen[i] = true;
+		// Within the precision of the keys
+		if (k > 0 && system.cameraDistance[system.sortOrder[k - 1]] * 1.01f < system.cameraDistance[i])
+			return false;
+	}
+	return true;
+}
+
+// Sorts n particles frame after frame, the particles moving and dying, new
+// ones spawning. Returns the milliseconds per sort ; coherent is the share
+// of sorts that only fixed up the previous order.
+static double sortFrames(int n, int frames, float rise, float spread,
+                         float cameraSpeed, double& coherent, bool& correct){
+	const float delta = 1.0f / 60.0f;
+	std::mt19937 generator(5678);
+	std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+	std::uniform_real_distribution<float> life(0.0f, 5.0f);
+	ParticleSystem system;
+	initParticleSystem(system, n);
+	double seconds = 0.0;
+	int coherentFrames = 0;
+	for (int f = 0; f < frames; f++){
+		glm::vec3 CameraPosition(40.0f * sin(f * cameraSpeed), 0.0f, 40.0f * cos(f * cameraSpeed));
+		while (system.count < n){
+			glm::vec3 pos = glm::vec3(unit(generator), unit(generator), unit(generator)) * 10.0f;
+			glm::vec3 speed = glm::vec3(0.0f, rise, 0.0f) + glm::vec3(unit(generator), unit(generator), unit(generator)) * spread;
+			spawnParticle(system, pos, speed, f == 0 ? life(generator) : 5.0f, 0.5f, 0);
+		}
+		updateParticles(system, delta, glm::vec3(0.0f), CameraPosition, NULL, NULL);
+		double start = benchmarkTime();
+		sortParticles(system);
+		seconds += benchmarkTime() - start;
+		coherentFrames += system.sortWasCoherent ? 1 : 0;
+		correct = correct && checkOrder(system);
+	}
+	coherent = 100.0 * coherentFrames / frames;
+	return seconds * 1000.0 / frames;
+}
+
+void benchmarkSort(){
+
+	const float delta = 1.0f / 60.0f;
+	const int frames = 60;
+	glm::vec3 gravity = glm::vec3(0.0f, -9.81f, 0.0f) * 0.5f;
+
+	// From scratch, then frame after frame : a fountain seen by a camera
+	// going around it, smoke slowly rising in front of a still camera, and
+	// dust hanging in the air. (coh) is the share of frames where the
+	// previous order only needed fixing up. Only sparse or slow particles
+	// keep their order from frame to frame : the fountain never does, and
+	// at 1M the smoke is too dense, so only the dust takes the fast path.
+	printf("%8s %12s %12s %12s %12s %18s %18s %18s\n", "live", "std::sort ms", "std coh. ms",
+		"radix16 ms", "radix32 ms", "fountain ms (coh)", "smoke ms (coh)", "dust ms (coh)");
+
+	int sizes[] = { 10000, 100000, 1000000 };
+	for (int s = 0; s < 3; s++){
+		int n = sizes[s];
+
+		std::mt19937 generator(1234);
+		std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+		std::vector<Particle> particles(n);
+		ParticleSystem system;
+		initParticleSystem(system, n);
+		for (int i = 0; i < n; i++){
+			Particle& p = particles[i];
+			p.pos = glm::vec3(unit(generator), unit(generator), unit(generator)) * 10.0f;
+			p.speed = glm::vec3(0.0f, 5.0f, 0.0f) + glm::vec3(unit(generator), unit(generator), unit(generator)) * 1.5f;
+			p.life = 3.0f + unit(generator) * 2.0f;
+			spawnParticle(system, p.pos, p.speed, p.life, 0.5f, 0);
+		}
+		glm::vec3 CameraPosition(0.0f, 0.0f, 40.0f);
+		updateParticles(system, 0.0f, gravity, CameraPosition, NULL, NULL);
+		for (int i = 0; i < n; i++)
+			particles[i].cameradistance = glm::length2(particles[i].pos - CameraPosition);
+		std::vector<Particle> unsorted = particles;
+
+		// The particles in random order
+		int iterations = 5;
+		double stdSeconds = 0.0;
+		for (int i = 0; i < iterations; i++){
+			particles = unsorted;
+			double start = benchmarkTime();
+			std::sort(particles.begin(), particles.end());
+			stdSeconds += benchmarkTime() - start;
+		}
+		// The tutorial sorts the order of the previous frame
+		double stdCoherentSeconds = 0.0;
+		for (int f = 0; f < iterations; f++){
+			CameraPosition = glm::vec3(40.0f * sin(f * 0.01f), 0.0f, 40.0f * cos(f * 0.01f));
+			for (int i = 0; i < n; i++){
+				Particle& p = particles[i];
+				p.speed += gravity * delta;
+				p.pos += p.speed * delta;
+				p.cameradistance = glm::length2(p.pos - CameraPosition);
+			}
+			double start = benchmarkTime();
+			std::sort(particles.begin(), particles.end());
+			stdCoherentSeconds += benchmarkTime() - start;
+		}
+
+		double radixSeconds[2] = { 0.0, 0.0 };
+		bool correct = true;
+		for (int b = 0; b < 2; b++){
+			system.sortKeyBits = b == 0 ? 16 : 32;
+			for (int i = 0; i < iterations; i++){
+				forgetParticleOrder(system);
+				double start = benchmarkTime();
+				sortParticles(system);
+				radixSeconds[b] += benchmarkTime() - start;
+				correct = correct && !system.sortWasCoherent && checkOrder(system);
+			}
+		}
+		system.sortKeyBits = 16;
+
+		double fountainCoherent, smokeCoherent, dustCoherent;
+		double fountainMs = sortFrames(n, frames, 5.0f, 1.5f, 0.01f, fountainCoherent, correct);
+		double smokeMs = sortFrames(n, frames, 0.2f, 0.01f, 0.0f, smokeCoherent, correct);
+		double dustMs = sortFrames(n, frames, 0.0f, 0.001f, 0.0f, dustCoherent, correct);
+
+		if (!correct)
+			printf("ERROR : the particles are not sorted\n");
+
+		printf("%8d %12.3f %12.3f %12.3f %12.3f %11.3f (%3.0f%%) %11.3f (%3.0f%%) %11.3f (%3.0f%%)\n", n,
+			stdSeconds * 1000.0 / iterations, stdCoherentSeconds * 1000.0 / iterations,
+			radixSeconds[0] * 1000.0 / iterations, radixSeconds[1] * 1000.0 / iterations,
+			fountainMs, fountainCoherent, smokeMs, smokeCoherent, dustMs, dustCoherent);
+	}
+}
@@ -0,0 +1,71 @@
+// CPU side benchmarks for the code in common/ : no window, no OpenGL.
+//
+// Usage : misc06_benchmarks [name ...]
+// Without arguments every benchmark runs.
+
+// Include standard headers
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+
+#include <common/simd.hpp>
+
+#include "benchmarks.hpp"
+
+struct Benchmark{
+	const char * name;
+	void (*run)();
+};
+
+static const Benchmark benchmarks[] = {
+	{ "culling", benchmarkCulling },
+	{ "bvh", benchmarkBVH },
+	{ "occlusion", benchmarkOcclusion },
+	{ "softrender", benchmarkSoftRender },
+	{ "particles", benchmarkParticles },
+	{ "sort", benchmarkSort },
+	{ "random", benchmarkRandom },
+	{ "picking", benchmarkPicking },
+};
+static const int benchmarkCount = sizeof(benchmarks) / sizeof(benchmarks[0]);
+
+double benchmarkTime(){
+	std::chrono::steady_clock::duration now = std::chrono::steady_clock::now().time_since_epoch();
+	return std::chrono::duration<double>(now).count();
+}
+
+int benchmarkIterations(int n){
+	// About 20 million objects per measurement
+	int iterations = 20000000 / n;
+	return iterations < 1 ? 1 : iterations;
+}
+
+int main( int argc, char * argv[] )
+{
+	printf("SIMD path : %s\n", simdName());
+
+	bool ranOne = false;
+	for (int i = 0; i < benchmarkCount; i++){
+		bool selected = argc < 2;
+		for (int a = 1; a < argc; a++){
+			if (strcmp(argv[a], benchmarks[i].name) == 0)
+				selected = true;
+		}
+		if (!selected)
+			continue;
+
+		printf("\n== %s ==\n", benchmarks[i].name);
+		benchmarks[i].run();
+		ranOne = true;
+	}
+
+	if (!ranOne){
+		fprintf(stderr, "Unknown benchmark. Available :");
+		for (int i = 0; i < benchmarkCount; i++)
+			fprintf(stderr, " %s", benchmarks[i].name);
+		fprintf(stderr, "\n");
+		return 1;
+	}
+
+	return 0;
+}
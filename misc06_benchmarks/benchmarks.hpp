@@ -0,0 +1,21 @@
+#ifndef BENCHMARKS_HPP
+#define BENCHMARKS_HPP
+
+// Seconds since an arbitrary origin, from a monotonic high resolution clock.
+double benchmarkTime();
+
+// How many times to repeat a test on n objects so that each measurement
+// handles about the same total number of objects.
+int benchmarkIterations(int n);
+
+// One function per benchmark_*.cpp file
+void benchmarkCulling();
+void benchmarkBVH();
+void benchmarkOcclusion();
+void benchmarkSoftRender();
+void benchmarkParticles();
+void benchmarkSort();
+void benchmarkRandom();
+void benchmarkPicking();
+
+#endif
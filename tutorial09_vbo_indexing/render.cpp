@@ -27,6 +27,11 @@ using namespace std;
 #include <common/shader.hpp>
 #include <common/texture.hpp>
 #include <common/vboindexer.hpp>
+#include <common/streambuffer.hpp>
+#include <common/geometrypool.hpp>
+#include <common/glstate.hpp>
+
+#include "render.h"
 
 float oneGridLength = 275.0f;
 
@@ -34,7 +39,7 @@ void render(int right, int down, glm::mat4 referenceModel, GLuint MatrixID,
             GLuint ModelMatrixID, GLuint ViewMatrixID, GLuint Texture,
             GLuint TextureID, GLuint elementBuffer, GLuint vertexBuffer,
             GLuint uvBuffer, GLuint normalBuffer,
-            vector<unsigned short> indices)
+            const vector<unsigned short>& indices)
 {
     /**
      * @brief Renders a 3D object in the scene.
@@ -81,24 +86,53 @@ void render(int right, int down, glm::mat4 referenceModel, GLuint MatrixID,
     glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]);
 
     // Bind the texture for the second object
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D,
+    stateActiveTexture(GL_TEXTURE0);
+    stateBindTexture(GL_TEXTURE_2D,
                   Texture);    // Texture for the second object
     glUniform1i(TextureID, 0); // Set the sampler to use Texture Unit 0
 
     // Bind buffers and draw the second object
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer);
+    stateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer);
     // Set attribute pointers for the second object
-    glEnableVertexAttribArray(0);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+    stateEnableVertexAttribArray(0);
+    stateBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
     glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
 
-    glEnableVertexAttribArray(1);
-    glBindBuffer(GL_ARRAY_BUFFER, uvBuffer);
+    stateEnableVertexAttribArray(1);
+    stateBindBuffer(GL_ARRAY_BUFFER, uvBuffer);
     glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 0, (void*)0);
 
-    glEnableVertexAttribArray(2);
-    glBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
+    stateEnableVertexAttribArray(2);
+    stateBindBuffer(GL_ARRAY_BUFFER, normalBuffer);
     glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 0, (void*)0);
     glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_SHORT, (void*)0);
 }
+
+void appendPieceInstances(vector<PoolInstance>& instances, int mesh,
+                          int material, const vector<glm::ivec2>& squares,
+                          glm::mat4 referenceModel)
+{
+    /**
+     * @brief Adds every copy of one piece to a geometry pool instance list.
+     *
+     * Each model matrix is the reference model translated by the piece's
+     * grid offset, exactly like render() computes it for a single piece.
+     *
+     * @param instances      The list to append to.
+     * @param mesh           The piece's mesh index in the geometry pool.
+     * @param material       The texture the piece samples.
+     * @param squares        The (right, down) grid coordinates, one per
+     *                       piece.
+     * @param referenceModel The base model matrix the offsets apply to.
+     */
+    for (size_t i = 0; i < squares.size(); i++)
+    {
+        PoolInstance instance;
+        instance.mesh = mesh;
+        instance.material = material;
+        instance.model = glm::translate(
+            referenceModel, glm::vec3(squares[i].x * oneGridLength, 0.0f,
+                                      squares[i].y * oneGridLength));
+        instances.push_back(instance);
+    }
+}
@@ -19,9 +19,17 @@ using namespace std;
 #include <common/shader.hpp>
 #include <common/texture.hpp>
 #include <common/vboindexer.hpp>
+#include <common/streambuffer.hpp>
+#include <common/geometrypool.hpp>
 #pragma once
 void render(int right, int down, glm::mat4 referenceModel, GLuint MatrixID,
             GLuint ModelMatrixID, GLuint ViewMatrixID, GLuint Texture,
             GLuint TextureID, GLuint elementBuffer, GLuint vertexBuffer,
             GLuint uvBuffer, GLuint normalBuffer,
-            vector<unsigned short> indices);
\ No newline at end of file
+            const vector<unsigned short>& indices);
+
+// Appends one pool instance per square, each placed the way render()
+// places a single piece.
+void appendPieceInstances(vector<PoolInstance>& instances, int mesh,
+                          int material, const vector<glm::ivec2>& squares,
+                          glm::mat4 referenceModel);
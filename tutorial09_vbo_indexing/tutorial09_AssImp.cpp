@@ -10,6 +10,7 @@ This is the main file for the assignment that renders the objects
 #include "render.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <vector>
 
 // Include GLEW
@@ -30,15 +31,70 @@ using namespace std;
 #include <common/shader.hpp>
 #include <common/texture.hpp>
 #include <common/vboindexer.hpp>
+#include <common/streambuffer.hpp>
+#include <common/geometrypool.hpp>
+#include <common/glstate.hpp>
+#include <common/culling.hpp>
+#include <common/jobs.hpp>
+#include <common/softrender.hpp>
+#include <common/headless.hpp>
+#include <common/framestats.hpp>
+
+// Adds the mesh to both the GL geometry pool and the software renderer's
+// list, so a mesh index means the same thing to both
+static int addSceneMesh(GeometryPool& pool, vector<SoftMesh>& softMeshes,
+                        const vector<unsigned short>& indices,
+                        const vector<glm::vec3>& vertices,
+                        const vector<glm::vec2>& uvs,
+                        const vector<glm::vec3>& normals)
+{
+    addSoftMesh(softMeshes, indices, vertices, uvs, normals);
+    return addPoolMesh(pool, indices, vertices, uvs, normals);
+}
+
+// The two textures the GL path binds, decoded for the CPU
+static bool loadSoftMaterials(vector<SoftTexture>& materials)
+{
+    materials.resize(2);
+    return loadSoftTextureDDS(
+               "Stone_Chess_Board/12951_Stone_Chess_Board_diff.dds",
+               materials[0]) &&
+           loadSoftTextureBMP("Chess_New/wooddar3.bmp", materials[1]);
+}
 
-int main(void)
+static vector<SoftInstance> toSoftInstances(const vector<PoolInstance>& pool)
+{
+    vector<SoftInstance> instances(pool.size());
+    for (size_t i = 0; i < pool.size(); i++)
+    {
+        instances[i].mesh = pool[i].mesh;
+        instances[i].material = pool[i].material;
+        instances[i].model = pool[i].model;
+    }
+    return instances;
+}
+
+// The camera of --software and --headless: same projection and orbit
+// radius as controls.cpp, 60 degrees above the board and looking at its
+// center
+static void fixedCamera(int width, int height, glm::mat4& ProjectionMatrix,
+                        glm::mat4& ViewMatrix)
+{
+    ProjectionMatrix = glm::perspective(
+        glm::radians(45.0f), (float)width / (float)height, 0.1f, 100.0f);
+    ViewMatrix = glm::lookAt(glm::vec3(2.5f, 0.0f, 4.33f), glm::vec3(0, 0, 0),
+                             glm::vec3(0, 0, 1));
+}
+
+// Opens the window and its 3.3 core context, and loads GL with GLEW
+static bool openWindow()
 {
     // Initialize GLFW
     if (!glfwInit())
     {
         fprintf(stderr, "Failed to initialize GLFW\n");
         getchar();
-        return -1;
+        return false;
     }
 
     glfwWindowHint(GLFW_SAMPLES, 4);
@@ -59,7 +115,7 @@ int main(void)
             "not 3.3 compatible. Try the 2.1 version of the tutorials.\n");
         getchar();
         glfwTerminate();
-        return -1;
+        return false;
     }
     glfwMakeContextCurrent(window);
 
@@ -70,7 +126,7 @@ int main(void)
         fprintf(stderr, "Failed to initialize GLEW\n");
         getchar();
         glfwTerminate();
-        return -1;
+        return false;
     }
 
     // Ensure we can capture the escape key being pressed below
@@ -81,36 +137,49 @@ int main(void)
     // Set the mouse at the center of the screen
     glfwPollEvents();
     glfwSetCursorPos(window, 1024 / 2, 768 / 2);
+    return true;
+}
 
-    // Dark blue background
-    glClearColor(0.0f, 0.0f, 0.4f, 0.0f);
-
-    // Enable depth test
-    glEnable(GL_DEPTH_TEST);
-    // Accept fragment if it is closer to the camera than the former one
-    glDepthFunc(GL_LESS);
-
-    // Cull triangles which normal is not towards the camera
-    glEnable(GL_CULL_FACE);
-
-    GLuint VertexArrayID;
-    glGenVertexArrays(1, &VertexArrayID);
-    glBindVertexArray(VertexArrayID);
-
-    // Create and compile our GLSL program from the shaders
-    GLuint programID = LoadShaders("StandardShading.vertexshader",
-                                   "StandardShading.fragmentshader");
-
-    // Get a handle for our "MVP" uniform
-    GLuint MatrixID = glGetUniformLocation(programID, "MVP");
-    GLuint ViewMatrixID = glGetUniformLocation(programID, "V");
-    GLuint ModelMatrixID = glGetUniformLocation(programID, "M");
-
-    GLuint Texture =
-        loadDDS("Stone_Chess_Board/12951_Stone_Chess_Board_diff.dds");
-    // Get a handle for our "myTextureSampler" uniform
-    GLuint TextureID = glGetUniformLocation(programID, "myTextureSampler");
+int main(int argc, char* argv[])
+{
+    // --software [frames] renders the scene on the CPU, without a window or
+    // a GPU, prints the time of each frame and writes the last one to
+    // software.ppm. --compare image.ppm then diffs it against a reference
+    // (e.g. a gl.ppm saved with the P key from the same view).
+    // --headless [frames] draws that many frames with GL into an offscreen
+    // framebuffer, from the same view as --software, then prints a JSON
+    // summary of the frame times and writes the last frame to gl.ppm.
+    // --size WxH sets the resolution of both (1024x768 by default).
+    // --record path.cam saves the camera of every frame, --replay path.cam
+    // plays it back one frame per recorded frame, with or without a window,
+    // and prints the same JSON summary at the end.
+    bool software = false;
+    int softwareFrames = 10;
+    const char* referencePath = NULL;
+    const char* recordPath = NULL;
+    const char* replayPath = NULL;
+    for (int i = 1; i < argc; i++)
+    {
+        if (strcmp(argv[i], "--software") == 0)
+        {
+            software = true;
+            if (i + 1 < argc && atoi(argv[i + 1]) > 0)
+                softwareFrames = atoi(argv[++i]);
+        }
+        else if (strcmp(argv[i], "--compare") == 0 && i + 1 < argc)
+            referencePath = argv[++i];
+        else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc)
+            recordPath = argv[++i];
+        else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc)
+            replayPath = argv[++i];
+    }
+    if (replayPath && !startCameraReplay(replayPath))
+        return -1;
+    HeadlessOptions headless;
+    parseHeadlessOptions(argc, argv, headless);
 
+    // Nothing below needs GL until the window is opened, so the software
+    // path shares the loading code
     // Read our .obj file
     std::vector<unsigned short> indices;
     std::vector<glm::vec3> indexed_vertices;
@@ -121,33 +190,12 @@ int main(void)
         loadAssImp("Stone_Chess_Board/12951_Stone_Chess_Board_v1_L3.obj",
                    indices, indexed_vertices, indexed_uvs, indexed_normals);
 
-    // Load it into a VBO
-
-    GLuint vertexbuffer;
-    glGenBuffers(1, &vertexbuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-    glBufferData(GL_ARRAY_BUFFER, indexed_vertices.size() * sizeof(glm::vec3),
-                 &indexed_vertices[0], GL_STATIC_DRAW);
-
-    GLuint uvbuffer;
-    glGenBuffers(1, &uvbuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-    glBufferData(GL_ARRAY_BUFFER, indexed_uvs.size() * sizeof(glm::vec2),
-                 &indexed_uvs[0], GL_STATIC_DRAW);
-
-    GLuint normalbuffer;
-    glGenBuffers(1, &normalbuffer);
-    glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-    glBufferData(GL_ARRAY_BUFFER, indexed_normals.size() * sizeof(glm::vec3),
-                 &indexed_normals[0], GL_STATIC_DRAW);
-
-    // Generate a buffer for the indices as well
-    GLuint elementbuffer;
-    glGenBuffers(1, &elementbuffer);
-    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-    glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                 indices.size() * sizeof(unsigned short), &indices[0],
-                 GL_STATIC_DRAW);
+    // Every mesh of the scene goes into one set of buffers
+    GeometryPool scenePool;
+    vector<SoftMesh> softMeshes;
+    int boardMesh = addSceneMesh(scenePool, softMeshes, indices,
+                                 indexed_vertices, indexed_uvs,
+                                 indexed_normals);
 
     //  **********************************************************
 
@@ -184,388 +232,419 @@ int main(void)
     // 6 -> King
     // 8 -> Queen
     // 10 -> Rook
-    GLuint bishopVertexBuffer, knightVertexBuffer, pawnVertexBuffer,
-        kingVertexBuffer, queenVertexBuffer, rookVertexBuffer, bishopUvBuffer,
-        knightUvBuffer, pawnUvBuffer, kingUvBuffer, queenUvBuffer, rookUvBuffer,
-        bishopNormalBuffer, knightNormalBuffer, pawnNormalBuffer,
-        kingNormalBuffer, queenNormalBuffer, rookNormalBuffer,
-        bishopElementBuffer, knightElementBuffer, pawnElementBuffer,
-        kingElementBuffer, queenElementBuffer, rookElementBuffer;
-    vector<unsigned short> bishopIndices, knightIndices, pawnIndices,
-        kingIndices, queenIndices, rookIndices;
-    for (int i = 0; i < 12; i += 2)
+    int bishopMesh =
+        addSceneMesh(scenePool, softMeshes, chessIndices[0],
+                     chessIndexedVertices[0], chessIndexedUvs[0],
+                     chessIndexedNormals[0]);
+    int knightMesh =
+        addSceneMesh(scenePool, softMeshes, chessIndices[2],
+                     chessIndexedVertices[2], chessIndexedUvs[2],
+                     chessIndexedNormals[2]);
+    int pawnMesh =
+        addSceneMesh(scenePool, softMeshes, chessIndices[4],
+                     chessIndexedVertices[4], chessIndexedUvs[4],
+                     chessIndexedNormals[4]);
+    int kingMesh =
+        addSceneMesh(scenePool, softMeshes, chessIndices[6],
+                     chessIndexedVertices[6], chessIndexedUvs[6],
+                     chessIndexedNormals[6]);
+    int queenMesh =
+        addSceneMesh(scenePool, softMeshes, chessIndices[8],
+                     chessIndexedVertices[8], chessIndexedUvs[8],
+                     chessIndexedNormals[8]);
+    int rookMesh =
+        addSceneMesh(scenePool, softMeshes, chessIndices[10],
+                     chessIndexedVertices[10], chessIndexedUvs[10],
+                     chessIndexedNormals[10]);
+    double scaleFactor2 = 0.002;
+    glm::mat4 chessModelMatrix = glm::scale(
+        glm::mat4(1.0), glm::vec3(scaleFactor2, scaleFactor2, scaleFactor2));
+    // * First We need to translate and rotate to put the chess pieces ON
+    // * the board
+    chessModelMatrix =
+        glm::translate(chessModelMatrix, glm::vec3(0.0f, -100.0f, -100.0f));
+
+    chessModelMatrix = glm::rotate(chessModelMatrix, glm::radians(90.0f),
+                                   glm::vec3(1.0f, 0.0f, 0.0f));
+
+    // * The instance list: the board, then every piece in (right, down)
+    // * grid units
+    vector<PoolInstance> sceneInstances;
+    float scaleFactor = 0.1f; // Scale factor for all axes
+    PoolInstance board;
+    board.mesh = boardMesh;
+    board.material = 0;
+    board.model = glm::scale(glm::mat4(1.0),
+                             glm::vec3(scaleFactor, scaleFactor, scaleFactor));
+    sceneInstances.push_back(board);
+    appendPieceInstances(sceneInstances, kingMesh, 1, {{-2, 2}, {-2, -5}},
+                         chessModelMatrix);
+    appendPieceInstances(sceneInstances, queenMesh, 1, {{0, 2}, {0, -5}},
+                         chessModelMatrix);
+    appendPieceInstances(sceneInstances, bishopMesh, 1,
+                         {{-1, 2}, {-1, -5}, {2, 2}, {2, -5}},
+                         chessModelMatrix);
+    appendPieceInstances(sceneInstances, knightMesh, 1,
+                         {{-1, 2}, {-1, -5}, {4, 2}, {4, -5}},
+                         chessModelMatrix);
+    appendPieceInstances(sceneInstances, rookMesh, 1,
+                         {{-1, 2}, {-1, -5}, {6, 2}, {6, -5}},
+                         chessModelMatrix);
+    vector<glm::ivec2> pawnSquares;
+    for (int i = -6; i < 2; i++)
     {
-        // Here we assign buffer according to their indcies i
-        if (i == 0)
-        {
-            bishopIndices = chessIndices[i];
-            // This is Bishop
-            glGenBuffers(1, &bishopVertexBuffer);
-            glBindBuffer(GL_ARRAY_BUFFER, bishopVertexBuffer);
-            glBufferData(GL_ARRAY_BUFFER,
-                         chessIndexedVertices[i].size() * sizeof(glm::vec3),
-                         &chessIndexedVertices[i][0], GL_STATIC_DRAW);
-
-            glGenBuffers(1, &bishopUvBuffer);
-            glBindBuffer(GL_ARRAY_BUFFER, bishopUvBuffer);
-            glBufferData(GL_ARRAY_BUFFER,
-                         chessIndexedUvs[i].size() * sizeof(glm::vec2),
-                         &chessIndexedUvs[i][0], GL_STATIC_DRAW);
-
-            glGenBuffers(1, &bishopNormalBuffer);
-            glBindBuffer(GL_ARRAY_BUFFER, bishopNormalBuffer);
-            glBufferData(GL_ARRAY_BUFFER,
-                         chessIndexedNormals[i].size() * sizeof(glm::vec3),
-                         &chessIndexedNormals[i][0], GL_STATIC_DRAW);
-
-            glGenBuffers(1, &bishopElementBuffer);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bishopElementBuffer);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                         chessIndices[i].size() * sizeof(unsigned short),
-                         &chessIndices[i][0], GL_STATIC_DRAW);
-        }
-        if (i == 2)
-        {
-            knightIndices = chessIndices[i];
-            // This is knight
-            glGenBuffers(1, &knightVertexBuffer);
-            glBindBuffer(GL_ARRAY_BUFFER, knightVertexBuffer);
-            glBufferData(GL_ARRAY_BUFFER,
-                         chessIndexedVertices[i].size() * sizeof(glm::vec3),
-                         &chessIndexedVertices[i][0], GL_STATIC_DRAW);
-
-            glGenBuffers(1, &knightUvBuffer);
-            glBindBuffer(GL_ARRAY_BUFFER, knightUvBuffer);
-            glBufferData(GL_ARRAY_BUFFER,
-                         chessIndexedUvs[i].size() * sizeof(glm::vec2),
-                         &chessIndexedUvs[i][0], GL_STATIC_DRAW);
-
-            glGenBuffers(1, &knightNormalBuffer);
-            glBindBuffer(GL_ARRAY_BUFFER, knightNormalBuffer);
-            glBufferData(GL_ARRAY_BUFFER,
-                         chessIndexedNormals[i].size() * sizeof(glm::vec3),
-                         &chessIndexedNormals[i][0], GL_STATIC_DRAW);
-
-            glGenBuffers(1, &knightElementBuffer);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, knightElementBuffer);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                         chessIndices[i].size() * sizeof(unsigned short),
-                         &chessIndices[i][0], GL_STATIC_DRAW);
-        }
-        if (i == 4)
-        {
-            pawnIndices = chessIndices[i];
-            // This is pawn
-            glGenBuffers(1, &pawnVertexBuffer);
-            glBindBuffer(GL_ARRAY_BUFFER, pawnVertexBuffer);
-            glBufferData(GL_ARRAY_BUFFER,
-                         chessIndexedVertices[i].size() * sizeof(glm::vec3),
-                         &chessIndexedVertices[i][0], GL_STATIC_DRAW);
-
-            glGenBuffers(1, &pawnUvBuffer);
-            glBindBuffer(GL_ARRAY_BUFFER, pawnUvBuffer);
-            glBufferData(GL_ARRAY_BUFFER,
-                         chessIndexedUvs[i].size() * sizeof(glm::vec2),
-                         &chessIndexedUvs[i][0], GL_STATIC_DRAW);
-
-            glGenBuffers(1, &pawnNormalBuffer);
-            glBindBuffer(GL_ARRAY_BUFFER, pawnNormalBuffer);
-            glBufferData(GL_ARRAY_BUFFER,
-                         chessIndexedNormals[i].size() * sizeof(glm::vec3),
-                         &chessIndexedNormals[i][0], GL_STATIC_DRAW);
-
-            glGenBuffers(1, &pawnElementBuffer);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, pawnElementBuffer);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                         chessIndices[i].size() * sizeof(unsigned short),
-                         &chessIndices[i][0], GL_STATIC_DRAW);
-        }
-        if (i == 6)
-        {
-            kingIndices = chessIndices[i];
-            // This is king
-            glGenBuffers(1, &kingVertexBuffer);
-            glBindBuffer(GL_ARRAY_BUFFER, kingVertexBuffer);
-            glBufferData(GL_ARRAY_BUFFER,
-                         chessIndexedVertices[i].size() * sizeof(glm::vec3),
-                         &chessIndexedVertices[i][0], GL_STATIC_DRAW);
-
-            glGenBuffers(1, &kingUvBuffer);
-            glBindBuffer(GL_ARRAY_BUFFER, kingUvBuffer);
-            glBufferData(GL_ARRAY_BUFFER,
-                         chessIndexedUvs[i].size() * sizeof(glm::vec2),
-                         &chessIndexedUvs[i][0], GL_STATIC_DRAW);
-
-            glGenBuffers(1, &kingNormalBuffer);
-            glBindBuffer(GL_ARRAY_BUFFER, kingNormalBuffer);
-            glBufferData(GL_ARRAY_BUFFER,
-                         chessIndexedNormals[i].size() * sizeof(glm::vec3),
-                         &chessIndexedNormals[i][0], GL_STATIC_DRAW);
-
-            glGenBuffers(1, &kingElementBuffer);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, kingElementBuffer);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                         chessIndices[i].size() * sizeof(unsigned short),
-                         &chessIndices[i][0], GL_STATIC_DRAW);
-        }
-        if (i == 8)
+        pawnSquares.push_back(glm::ivec2(i, 1));
+        pawnSquares.push_back(glm::ivec2(i, -4));
+    }
+    appendPieceInstances(sceneInstances, pawnMesh, 1, pawnSquares,
+                         chessModelMatrix);
+    // * The pool only rebuilds its instance buffer when this list or the
+    // * visible set changes
+    setPoolInstances(scenePool, sceneInstances);
+
+    // * Nothing moves, so the world bounding boxes are computed once
+    AABBArray sceneBounds;
+    for (size_t i = 0; i < sceneInstances.size(); i++)
+    {
+        const PoolMesh& mesh = scenePool.meshes[sceneInstances[i].mesh];
+        glm::vec3 worldMin, worldMax;
+        transformAABB(sceneInstances[i].model, mesh.boundsMin, mesh.boundsMax,
+                      worldMin, worldMax);
+        addAABB(sceneBounds, worldMin, worldMax);
+    }
+
+    glm::vec3 lightPos = glm::vec3(0, 0, 6);
+    // Dark blue background
+    glm::vec3 clearColor = glm::vec3(0.0f, 0.0f, 0.4f);
+    vector<SoftInstance> softInstances = toSoftInstances(sceneInstances);
+    vector<SoftTexture> softMaterials;
+    SoftRenderer softRenderer;
+
+    if (software)
+    {
+        if (!loadSoftMaterials(softMaterials))
+            return -1;
+        initSoftRenderer(softRenderer, headless.width, headless.height, 0);
+        glm::mat4 ProjectionMatrix, ViewMatrix;
+        fixedCamera(headless.width, headless.height, ProjectionMatrix,
+                    ViewMatrix);
+
+        double totalMs = 0.0;
+        for (int frame = 0; frame < softwareFrames; frame++)
         {
-            queenIndices = chessIndices[i];
-            // This is queen
-            glGenBuffers(1, &queenVertexBuffer);
-            glBindBuffer(GL_ARRAY_BUFFER, queenVertexBuffer);
-            glBufferData(GL_ARRAY_BUFFER,
-                         chessIndexedVertices[i].size() * sizeof(glm::vec3),
-                         &chessIndexedVertices[i][0], GL_STATIC_DRAW);
-
-            glGenBuffers(1, &queenUvBuffer);
-            glBindBuffer(GL_ARRAY_BUFFER, queenUvBuffer);
-            glBufferData(GL_ARRAY_BUFFER,
-                         chessIndexedUvs[i].size() * sizeof(glm::vec2),
-                         &chessIndexedUvs[i][0], GL_STATIC_DRAW);
-
-            glGenBuffers(1, &queenNormalBuffer);
-            glBindBuffer(GL_ARRAY_BUFFER, queenNormalBuffer);
-            glBufferData(GL_ARRAY_BUFFER,
-                         chessIndexedNormals[i].size() * sizeof(glm::vec3),
-                         &chessIndexedNormals[i][0], GL_STATIC_DRAW);
-
-            glGenBuffers(1, &queenElementBuffer);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, queenElementBuffer);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                         chessIndices[i].size() * sizeof(unsigned short),
-                         &chessIndices[i][0], GL_STATIC_DRAW);
+            renderSoftScene(softRenderer, softMeshes, softInstances,
+                            softMaterials, ProjectionMatrix, ViewMatrix,
+                            lightPos, clearColor);
+            const SoftRenderStats& stats = softRenderer.stats;
+            double frameMs = stats.geometryMs + stats.rasterMs + stats.shadeMs;
+            totalMs += frameMs;
+            printf("%f ms/frame (geometry %f, raster %f, shading %f), "
+                   "%d/%d triangles, %d threads\n",
+                   frameMs, stats.geometryMs, stats.rasterMs, stats.shadeMs,
+                   stats.binnedTriangles, stats.triangles,
+                   softRenderer.threadCount);
         }
-        if (i == 10)
+        printf("%f ms/frame on average\n", totalMs / softwareFrames);
+        writeSoftImagePPM("software.ppm", softRenderer.color);
+
+        SoftImage reference;
+        if (referencePath && readSoftImagePPM(referencePath, reference))
         {
-            rookIndices = chessIndices[i];
-            // This is rook
-            glGenBuffers(1, &rookVertexBuffer);
-            glBindBuffer(GL_ARRAY_BUFFER, rookVertexBuffer);
-            glBufferData(GL_ARRAY_BUFFER,
-                         chessIndexedVertices[i].size() * sizeof(glm::vec3),
-                         &chessIndexedVertices[i][0], GL_STATIC_DRAW);
-
-            glGenBuffers(1, &rookUvBuffer);
-            glBindBuffer(GL_ARRAY_BUFFER, rookUvBuffer);
-            glBufferData(GL_ARRAY_BUFFER,
-                         chessIndexedUvs[i].size() * sizeof(glm::vec2),
-                         &chessIndexedUvs[i][0], GL_STATIC_DRAW);
-
-            glGenBuffers(1, &rookNormalBuffer);
-            glBindBuffer(GL_ARRAY_BUFFER, rookNormalBuffer);
-            glBufferData(GL_ARRAY_BUFFER,
-                         chessIndexedNormals[i].size() * sizeof(glm::vec3),
-                         &chessIndexedNormals[i][0], GL_STATIC_DRAW);
-
-            glGenBuffers(1, &rookElementBuffer);
-            glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, rookElementBuffer);
-            glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-                         chessIndices[i].size() * sizeof(unsigned short),
-                         &chessIndices[i][0], GL_STATIC_DRAW);
+            if (reference.width != softRenderer.width ||
+                reference.height != softRenderer.height)
+            {
+                printf("%s is %dx%d, expected %dx%d\n", referencePath,
+                       reference.width, reference.height, softRenderer.width,
+                       softRenderer.height);
+                return -1;
+            }
+            SoftImage diffImage;
+            SoftImageDiff diff = diffSoftImages(reference, softRenderer.color,
+                                                8, &diffImage);
+            printf("Mean error %f, max %d, %d pixels off by more than 8\n",
+                   diff.meanError, diff.maxError, diff.differentPixels);
+            writeSoftImagePPM("diff.ppm", diffImage);
         }
+        deleteSoftRenderer(softRenderer);
+        return 0;
     }
 
-    GLuint Texture2 = loadBMP_custom("Chess_New/wooddar3.bmp");
-    // Get a handle for our "myTextureSampler" uniform
-    GLuint TextureID2 = glGetUniformLocation(programID, "myTextureSampler");
+    // Without a window, an offscreen framebuffer stands in for its back
+    // buffer
+    if (headless.enabled ? !createHeadlessContext(headless) : !openWindow())
+        return -1;
 
-    // Get a handle for our "LightPosition" uniform
-    glUseProgram(programID);
+    glClearColor(clearColor.r, clearColor.g, clearColor.b, 0.0f);
+
+    // Enable depth test
+    glEnable(GL_DEPTH_TEST);
+    // Accept fragment if it is closer to the camera than the former one
+    glDepthFunc(GL_LESS);
+
+    // Cull triangles which normal is not towards the camera
+    glEnable(GL_CULL_FACE);
+
+    GLuint VertexArrayID;
+    glGenVertexArrays(1, &VertexArrayID);
+    glBindVertexArray(VertexArrayID);
+
+    // The whole scene is drawn with the instanced shading: the model matrix
+    // and the texture to use come from per-instance attributes, so the
+    // board and every piece can go out in a single multi-draw.
+    GLuint programID = LoadShaders("StandardShadingInstanced.vertexshader",
+                                   "StandardShadingPool.fragmentshader");
+
+    // Get a handle for our uniforms
+    GLuint ViewProjectionID = glGetUniformLocation(programID, "VP");
+    GLuint ViewMatrixID = glGetUniformLocation(programID, "V");
     GLuint LightID =
         glGetUniformLocation(programID, "LightPosition_worldspace");
+    GLuint TextureID = glGetUniformLocation(programID, "materialSamplers");
+
+    GLuint Texture =
+        loadDDS("Stone_Chess_Board/12951_Stone_Chess_Board_diff.dds");
+    GLuint Texture2 = loadBMP_custom("Chess_New/wooddar3.bmp");
+    uploadGeometryPool(scenePool);
+
+    // Material 0 samples texture unit 0, material 1 texture unit 1
+    glUseProgram(programID);
+    GLint materialUnits[2] = {0, 1};
+    glUniform1iv(TextureID, 2, materialUnits);
+
+    vector<unsigned> visibleIndices;
 
     // For speed computation
     double lastTime = glfwGetTime();
     int nbFrames = 0;
 
+    // Press V to go through one glMultiDrawElementsIndirect for the whole
+    // scene, one draw per mesh with the pool's VAO, and one draw per mesh
+    // re-specifying every attribute on a shared VAO; the CPU submit time
+    // and the time per draw are printed for each
+    const char* drawModeNames[] = {"multi-draw indirect", "VAO per mesh",
+                                   "shared VAO"};
+    PoolDrawMode drawMode = POOL_MULTI_DRAW;
+    if (!geometryPoolHasIndirect())
+    {
+        printf("No multi-draw indirect support, drawing one mesh at a "
+               "time\n");
+        drawMode = POOL_DRAW_PER_MESH;
+    }
+    int lastDrawModeKeyState = GLFW_RELEASE;
+    double submitSeconds = 0.0;
+    int drawCount = 0;
+
+    // Press P to render the current frame in software too and compare:
+    // writes gl.ppm, software.ppm and diff.ppm (brighter where they differ)
+    int lastCompareKeyState = GLFW_RELEASE;
+
+    // The frustum culling and the command buffer it fills
+    auto cullScene = [&](const glm::mat4& ProjectionMatrix,
+                         const glm::mat4& ViewMatrix)
+    {
+        // * The command buffer is rebuilt from the instances that are in
+        // * the view frustum, only when that set changes
+        Frustum frustum = extractFrustum(ProjectionMatrix, ViewMatrix);
+        cullAABBs(frustum, sceneBounds, visibleIndices);
+        updatePoolCommands(scenePool, visibleIndices);
+    };
+    // Uniforms, textures and the draws themselves; returns the draw count
+    auto submitScene = [&](const glm::mat4& ProjectionMatrix,
+                           const glm::mat4& ViewMatrix)
+    {
+        glm::mat4 ViewProjectionMatrix = ProjectionMatrix * ViewMatrix;
+
+        // Send our transformation to the currently bound shader
+        glUniformMatrix4fv(ViewProjectionID, 1, GL_FALSE,
+                           &ViewProjectionMatrix[0][0]);
+        glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]);
+
+        glUniform3f(LightID, lightPos.x, lightPos.y, lightPos.z);
+
+        // Board texture in unit 0, pieces texture in unit 1
+        stateActiveTexture(GL_TEXTURE0);
+        stateBindTexture(GL_TEXTURE_2D, Texture);
+        stateActiveTexture(GL_TEXTURE1);
+        stateBindTexture(GL_TEXTURE_2D, Texture2);
+
+        return drawGeometryPool(scenePool, drawMode, VertexArrayID);
+    };
+
+    if (headless.enabled)
+    {
+        // * A camera path is played whole, whatever the frame count
+        glm::mat4 ProjectionMatrix, ViewMatrix;
+        fixedCamera(headless.width, headless.height, ProjectionMatrix,
+                    ViewMatrix);
+        int frames = isCameraReplaying() ? getCameraReplayFrames()
+                                         : headless.frames;
+        FrameStats stats;
+        for (int frame = 0; frame < frames; frame++)
+        {
+            beginStatsFrame(stats);
+            if (isCameraReplaying())
+            {
+                computeMatricesFromInputs();
+                ProjectionMatrix = getProjectionMatrix();
+                ViewMatrix = getViewMatrix();
+            }
+            double cullStart = statsNow();
+            glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+            stateUseProgram(programID);
+            cullScene(ProjectionMatrix, ViewMatrix);
+            double submitStart = statsNow();
+            int draws = submitScene(ProjectionMatrix, ViewMatrix);
+            // * Nothing to swap: wait for the GPU instead, or the frames
+            // * would only measure how fast the driver queues them
+            double finishStart = statsNow();
+            glFinish();
+            double frameEnd = statsNow();
+            addStatsPhase(stats, "cull", submitStart - cullStart);
+            addStatsPhase(stats, "submit", finishStart - submitStart);
+            addStatsPhase(stats, "finish", frameEnd - finishStart);
+            endStatsFrame(stats, draws);
+        }
+        printFrameStatsJSON(stats, "tutorial09_AssImp",
+                            (const char*)glGetString(GL_RENDERER),
+                            headless.width, headless.height);
+
+        SoftImage glImage;
+        glImage.width = headless.width;
+        glImage.height = headless.height;
+        readHeadlessPixels(glImage.pixels);
+        writeSoftImagePPM("gl.ppm", glImage);
+
+        deleteGeometryPool(scenePool);
+        deleteSoftRenderer(softRenderer);
+        glDeleteProgram(programID);
+        glDeleteVertexArrays(1, &VertexArrayID);
+        destroyHeadlessContext();
+        return 0;
+    }
+
+    if (recordPath)
+        startCameraRecording(recordPath);
+    // Only a replay keeps per frame stats : they grow with every frame
+    bool collectStats = isCameraReplaying();
+    FrameStats replayStats;
+
     do
     {
+        if (collectStats)
+            beginStatsFrame(replayStats);
+
         // Measure speed
         double currentTime = glfwGetTime();
         nbFrames++;
         if (currentTime - lastTime >= 1.0)
         { // If last prinf() was more than 1sec ago
             // printf and reset
-            printf("%f ms/frame\n", 1000.0 / double(nbFrames));
+            printf("%f ms/frame, %f us submit, %f us/draw, %d draws/frame, "
+                   "%d/%d objects visible (%s)\n",
+                   1000.0 / double(nbFrames),
+                   1000000.0 * submitSeconds / double(nbFrames),
+                   drawCount > 0 ? 1000000.0 * submitSeconds / drawCount
+                                 : 0.0,
+                   drawCount / nbFrames, (int)visibleIndices.size(),
+                   (int)sceneInstances.size(), drawModeNames[drawMode]);
+            printGLStateStats(nbFrames);
             nbFrames = 0;
+            submitSeconds = 0.0;
+            drawCount = 0;
             lastTime += 1.0;
         }
 
+        int drawModeKeyState = glfwGetKey(window, GLFW_KEY_V);
+        if (drawModeKeyState == GLFW_PRESS &&
+            lastDrawModeKeyState == GLFW_RELEASE)
+        {
+            drawMode = (PoolDrawMode)((drawMode + 1) % 3);
+            if (drawMode == POOL_MULTI_DRAW && !geometryPoolHasIndirect())
+                drawMode = POOL_DRAW_PER_MESH;
+        }
+        lastDrawModeKeyState = drawModeKeyState;
+
         // Clear the screen
         glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
         // Use our shader
-        glUseProgram(programID);
+        stateUseProgram(programID);
 
         // Compute the MVP matrix from keyboard and mouse input
         computeMatricesFromInputs();
         glm::mat4 ProjectionMatrix = getProjectionMatrix();
         glm::mat4 ViewMatrix = getViewMatrix();
-        // glm::mat4 ModelMatrix = glm::mat4(1.0);
-        float scaleFactor = 0.1f; // Scale factor for all axes
-        glm::mat4 ModelMatrix = glm::scale(
-            glm::mat4(1.0), glm::vec3(scaleFactor, scaleFactor, scaleFactor));
-
-        glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
-
-        // Send our transformation to the currently bound shader,
-        // in the "MVP" uniform
-        glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-        glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &ModelMatrix[0][0]);
-        glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]);
 
-        glm::vec3 lightPos = glm::vec3(0, 0, 6);
-        glUniform3f(LightID, lightPos.x, lightPos.y, lightPos.z);
-
-        // Bind our texture in Texture Unit 0
-        glActiveTexture(GL_TEXTURE0);
-        glBindTexture(GL_TEXTURE_2D, Texture);
-        // Set our "myTextureSampler" sampler to use Texture Unit 0
-        glUniform1i(TextureID, 0);
-
-        // 1rst attribute buffer : vertices
-        glEnableVertexAttribArray(0);
-        glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
-        glVertexAttribPointer(0,        // attribute
-                              3,        // size
-                              GL_FLOAT, // type
-                              GL_FALSE, // normalized?
-                              0,        // stride
-                              (void*)0  // array buffer offset
-        );
-
-        // 2nd attribute buffer : UVs
-        glEnableVertexAttribArray(1);
-        glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
-        glVertexAttribPointer(1,        // attribute
-                              2,        // size
-                              GL_FLOAT, // type
-                              GL_FALSE, // normalized?
-                              0,        // stride
-                              (void*)0  // array buffer offset
-        );
-
-        // 3rd attribute buffer : normals
-        glEnableVertexAttribArray(2);
-        glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
-        glVertexAttribPointer(2,        // attribute
-                              3,        // size
-                              GL_FLOAT, // type
-                              GL_FALSE, // normalized?
-                              0,        // stride
-                              (void*)0  // array buffer offset
-        );
-
-        // Index buffer
-        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
-
-        // Draw the triangles !
-        glDrawElements(GL_TRIANGLES,      // mode
-                       indices.size(),    // count
-                       GL_UNSIGNED_SHORT, // type
-                       (void*)0           // element array buffer offset
-        );
-
-        // *********************************************************************************
-        // * THE CHESS MESHES
-
-        double scaleFactor2 = 0.002;
-        glm::mat4 chessModelMatrix =
-            glm::scale(glm::mat4(1.0),
-                       glm::vec3(scaleFactor2, scaleFactor2, scaleFactor2));
-        // * First We need to translate and rotate to put the chess pieces ON
-        // * the board
-        chessModelMatrix =
-            glm::translate(chessModelMatrix, glm::vec3(0.0f, -100.0f, -100.0f));
-
-        chessModelMatrix = glm::rotate(chessModelMatrix, glm::radians(90.0f),
-                                       glm::vec3(1.0f, 0.0f, 0.0f));
-
-        // * Render KING
-        render(-2, 2, chessModelMatrix, MatrixID, ModelMatrixID, ViewMatrixID,
-               Texture2, TextureID2, kingElementBuffer, kingVertexBuffer,
-               kingUvBuffer, kingNormalBuffer, kingIndices);
-        render(-2, -5, chessModelMatrix, MatrixID, ModelMatrixID, ViewMatrixID,
-               Texture2, TextureID2, kingElementBuffer, kingVertexBuffer,
-               kingUvBuffer, kingNormalBuffer, kingIndices);
-        // * Render QUEEN
-        render(0, 2, chessModelMatrix, MatrixID, ModelMatrixID, ViewMatrixID,
-               Texture2, TextureID2, queenElementBuffer, queenVertexBuffer,
-               queenUvBuffer, queenNormalBuffer, queenIndices);
-        render(0, -5, chessModelMatrix, MatrixID, ModelMatrixID, ViewMatrixID,
-               Texture2, TextureID2, queenElementBuffer, queenVertexBuffer,
-               queenUvBuffer, queenNormalBuffer, queenIndices);
-        // * Render BISHOP
-        render(-1, 2, chessModelMatrix, MatrixID, ModelMatrixID, ViewMatrixID,
-               Texture2, TextureID2, bishopElementBuffer, bishopVertexBuffer,
-               bishopUvBuffer, bishopNormalBuffer, bishopIndices);
-        render(-1, -5, chessModelMatrix, MatrixID, ModelMatrixID, ViewMatrixID,
-               Texture2, TextureID2, bishopElementBuffer, bishopVertexBuffer,
-               bishopUvBuffer, bishopNormalBuffer, bishopIndices);
-        render(2, 2, chessModelMatrix, MatrixID, ModelMatrixID, ViewMatrixID,
-               Texture2, TextureID2, bishopElementBuffer, bishopVertexBuffer,
-               bishopUvBuffer, bishopNormalBuffer, bishopIndices);
-        render(2, -5, chessModelMatrix, MatrixID, ModelMatrixID, ViewMatrixID,
-               Texture2, TextureID2, bishopElementBuffer, bishopVertexBuffer,
-               bishopUvBuffer, bishopNormalBuffer, bishopIndices);
-
-        // * Render KNIGHT
-        render(-1, 2, chessModelMatrix, MatrixID, ModelMatrixID, ViewMatrixID,
-               Texture2, TextureID2, knightElementBuffer, knightVertexBuffer,
-               knightUvBuffer, knightNormalBuffer, knightIndices);
-        render(-1, -5, chessModelMatrix, MatrixID, ModelMatrixID, ViewMatrixID,
-               Texture2, TextureID2, knightElementBuffer, knightVertexBuffer,
-               knightUvBuffer, knightNormalBuffer, knightIndices);
-        render(4, 2, chessModelMatrix, MatrixID, ModelMatrixID, ViewMatrixID,
-               Texture2, TextureID2, knightElementBuffer, knightVertexBuffer,
-               knightUvBuffer, knightNormalBuffer, knightIndices);
-        render(4, -5, chessModelMatrix, MatrixID, ModelMatrixID, ViewMatrixID,
-               Texture2, TextureID2, knightElementBuffer, knightVertexBuffer,
-               knightUvBuffer, knightNormalBuffer, knightIndices);
-        // * Render ROOK
-        render(-1, 2, chessModelMatrix, MatrixID, ModelMatrixID, ViewMatrixID,
-               Texture2, TextureID2, rookElementBuffer, rookVertexBuffer,
-               rookUvBuffer, rookNormalBuffer, rookIndices);
-        render(-1, -5, chessModelMatrix, MatrixID, ModelMatrixID, ViewMatrixID,
-               Texture2, TextureID2, rookElementBuffer, rookVertexBuffer,
-               rookUvBuffer, rookNormalBuffer, rookIndices);
-        render(6, 2, chessModelMatrix, MatrixID, ModelMatrixID, ViewMatrixID,
-               Texture2, TextureID2, rookElementBuffer, rookVertexBuffer,
-               rookUvBuffer, rookNormalBuffer, rookIndices);
-        render(6, -5, chessModelMatrix, MatrixID, ModelMatrixID, ViewMatrixID,
-               Texture2, TextureID2, rookElementBuffer, rookVertexBuffer,
-               rookUvBuffer, rookNormalBuffer, rookIndices);
-        // * Render PAWN
-        for (int i = -6; i < 2; i++)
+        cullScene(ProjectionMatrix, ViewMatrix);
+        double submitStartTime = glfwGetTime();
+        int frameDraws = submitScene(ProjectionMatrix, ViewMatrix);
+        drawCount += frameDraws;
+        submitSeconds += glfwGetTime() - submitStartTime;
+        if (collectStats)
+            addStatsPhase(replayStats, "submit",
+                          1000.0 * (glfwGetTime() - submitStartTime));
+
+        int compareKeyState = glfwGetKey(window, GLFW_KEY_P);
+        if (compareKeyState == GLFW_PRESS &&
+            lastCompareKeyState == GLFW_RELEASE &&
+            (!softMaterials.empty() || loadSoftMaterials(softMaterials)))
         {
-            render(i, 1, chessModelMatrix, MatrixID, ModelMatrixID,
-                   ViewMatrixID, Texture2, TextureID2, pawnElementBuffer,
-                   pawnVertexBuffer, pawnUvBuffer, pawnNormalBuffer,
-                   pawnIndices);
-            render(i, -4, chessModelMatrix, MatrixID, ModelMatrixID,
-                   ViewMatrixID, Texture2, TextureID2, pawnElementBuffer,
-                   pawnVertexBuffer, pawnUvBuffer, pawnNormalBuffer,
-                   pawnIndices);
+            int width, height;
+            glfwGetFramebufferSize(window, &width, &height);
+            if (softRenderer.width != width || softRenderer.height != height)
+                initSoftRenderer(softRenderer, width, height, 0);
+            SoftImage glImage;
+            glImage.width = width;
+            glImage.height = height;
+            glImage.pixels.resize(width * height * 4);
+            glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE,
+                         &glImage.pixels[0]);
+
+            renderSoftScene(softRenderer, softMeshes, softInstances,
+                            softMaterials, ProjectionMatrix, ViewMatrix,
+                            lightPos, clearColor);
+            SoftImage diffImage;
+            SoftImageDiff diff = diffSoftImages(glImage, softRenderer.color,
+                                                8, &diffImage);
+            // Expect small differences : GL uses 4x MSAA on the edges and
+            // picks mip levels per 2x2 pixels
+            printf("Software frame: %f ms; mean error %f, max %d, %d of %d "
+                   "pixels off by more than 8\n",
+                   softRenderer.stats.geometryMs + softRenderer.stats.rasterMs +
+                       softRenderer.stats.shadeMs,
+                   diff.meanError, diff.maxError, diff.differentPixels,
+                   width * height);
+            writeSoftImagePPM("gl.ppm", glImage);
+            writeSoftImagePPM("software.ppm", softRenderer.color);
+            writeSoftImagePPM("diff.ppm", diffImage);
         }
-
-        glDisableVertexAttribArray(0);
-        glDisableVertexAttribArray(1);
-        glDisableVertexAttribArray(2);
+        lastCompareKeyState = compareKeyState;
 
         // Swap buffers
         glfwSwapBuffers(window);
         glfwPollEvents();
 
-    } // Check if the ESC key was pressed or the window was closed
+        if (collectStats)
+            endStatsFrame(replayStats, frameDraws);
+
+    } // Check if the ESC key was pressed or the window was closed, or if the
+      // camera path is over
     while (glfwGetKey(window, GLFW_KEY_ESCAPE) != GLFW_PRESS &&
-           glfwWindowShouldClose(window) == 0);
+           glfwWindowShouldClose(window) == 0 && !cameraReplayFinished());
+
+    stopCameraRecording();
+    if (collectStats)
+    {
+        int width, height;
+        glfwGetFramebufferSize(window, &width, &height);
+        printFrameStatsJSON(replayStats, "tutorial09_AssImp",
+                            (const char*)glGetString(GL_RENDERER), width,
+                            height);
+    }
 
     // Cleanup VBO and shader
-    glDeleteBuffers(1, &vertexbuffer);
-    glDeleteBuffers(1, &uvbuffer);
-    glDeleteBuffers(1, &normalbuffer);
-    glDeleteBuffers(1, &elementbuffer);
+    deleteGeometryPool(scenePool);
+    deleteSoftRenderer(softRenderer);
     glDeleteProgram(programID);
     // glDeleteTextures(1, &Texture);
     glDeleteVertexArrays(1, &VertexArrayID);
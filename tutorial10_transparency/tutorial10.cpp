@@ -20,6 +20,7 @@ using namespace glm;
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
+#include <common/oit.hpp>
 
 int main( void )
 {
@@ -80,19 +81,34 @@ int main( void )
 	glGenVertexArrays(1, &VertexArrayID);
 	glBindVertexArray(VertexArrayID);
 
-	// Create and compile our GLSL program from the shaders
-	GLuint programID = LoadShaders( "StandardShading.vertexshader", "StandardTransparentShading.fragmentshader" );
-
-	// Get a handle for our "MVP" uniform
-	GLuint MatrixID = glGetUniformLocation(programID, "MVP");
-	GLuint ViewMatrixID = glGetUniformLocation(programID, "V");
-	GLuint ModelMatrixID = glGetUniformLocation(programID, "M");
+	// Create and compile our GLSL programs from the shaders : alpha
+	// blending, in whatever order the triangles come in the file, and
+	// weighted blended order independent transparency, which writes to the
+	// targets of common/oit.hpp. Press O to switch.
+	GLuint programIDs[2];
+	programIDs[0] = LoadShaders( "StandardShading.vertexshader", "StandardTransparentShading.fragmentshader" );
+	programIDs[1] = LoadShaders( "StandardShading.vertexshader", "StandardTransparentShadingOIT.fragmentshader" );
+
+	int framebufferWidth, framebufferHeight;
+	glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+	OITTargets oit;
+	bool useOIT = false;
+	bool hasOIT = initOIT(oit, framebufferWidth, framebufferHeight, "OITComposite.vertexshader", "OITComposite.fragmentshader");
+	int lastOITKeyState = GLFW_RELEASE;
 
 	// Load the texture
 	GLuint Texture = loadDDS("uvmap.DDS");
-	
-	// Get a handle for our "myTextureSampler" uniform
-	GLuint TextureID = glGetUniformLocation(programID, "myTextureSampler");
+
+	// Get a handle for our "MVP", "V", "M", "myTextureSampler" and
+	// "LightPosition" uniforms, in both programs
+	GLuint MatrixIDs[2], ViewMatrixIDs[2], ModelMatrixIDs[2], TextureIDs[2], LightIDs[2];
+	for (int i = 0; i < 2; i++){
+		MatrixIDs[i] = glGetUniformLocation(programIDs[i], "MVP");
+		ViewMatrixIDs[i] = glGetUniformLocation(programIDs[i], "V");
+		ModelMatrixIDs[i] = glGetUniformLocation(programIDs[i], "M");
+		TextureIDs[i] = glGetUniformLocation(programIDs[i], "myTextureSampler");
+		LightIDs[i] = glGetUniformLocation(programIDs[i], "LightPosition_worldspace");
+	}
 
 	// Read our .obj file
 	std::vector<glm::vec3> vertices;
@@ -129,10 +145,6 @@ int main( void )
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), &indices[0], GL_STATIC_DRAW);
 
-	// Get a handle for our "LightPosition" uniform
-	glUseProgram(programID);
-	GLuint LightID = glGetUniformLocation(programID, "LightPosition_worldspace");
-
 	// For speed computation
 	double lastTime = glfwGetTime();
 	int nbFrames = 0;
@@ -153,11 +165,24 @@ int main( void )
 			lastTime += 1.0;
 		}
 
+		int OITKeyState = glfwGetKey(window, GLFW_KEY_O);
+		if ( OITKeyState == GLFW_PRESS && lastOITKeyState == GLFW_RELEASE && hasOIT ){
+			useOIT = !useOIT;
+			printf("Order independent transparency : %s\n", useOIT ? "on" : "off");
+		}
+		lastOITKeyState = OITKeyState;
+
 		// Clear the screen
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+		// The transparent surfaces go to the OIT targets, then are blended
+		// over the screen
+		int mode = useOIT ? 1 : 0;
+		if (useOIT)
+			beginOIT(oit);
+
 		// Use our shader
-		glUseProgram(programID);
+		glUseProgram(programIDs[mode]);
 
 		// Compute the MVP matrix from keyboard and mouse input
 		computeMatricesFromInputs();
@@ -168,18 +193,18 @@ int main( void )
 
 		// Send our transformation to the currently bound shader, 
 		// in the "MVP" uniform
-		glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &MVP[0][0]);
-		glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &ModelMatrix[0][0]);
-		glUniformMatrix4fv(ViewMatrixID, 1, GL_FALSE, &ViewMatrix[0][0]);
+		glUniformMatrix4fv(MatrixIDs[mode], 1, GL_FALSE, &MVP[0][0]);
+		glUniformMatrix4fv(ModelMatrixIDs[mode], 1, GL_FALSE, &ModelMatrix[0][0]);
+		glUniformMatrix4fv(ViewMatrixIDs[mode], 1, GL_FALSE, &ViewMatrix[0][0]);
 
 		glm::vec3 lightPos = glm::vec3(4,4,4);
-		glUniform3f(LightID, lightPos.x, lightPos.y, lightPos.z);
+		glUniform3f(LightIDs[mode], lightPos.x, lightPos.y, lightPos.z);
 
 		// Bind our texture in Texture Unit 0
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, Texture);
 		// Set our "myTextureSampler" sampler to use Texture Unit 0
-		glUniform1i(TextureID, 0);
+		glUniform1i(TextureIDs[mode], 0);
 
 		// 1rst attribute buffer : vertices
 		glEnableVertexAttribArray(0);
@@ -232,6 +257,11 @@ int main( void )
 		glDisableVertexAttribArray(1);
 		glDisableVertexAttribArray(2);
 
+		if (useOIT){
+			endOIT(oit);
+			glBindVertexArray(VertexArrayID);
+		}
+
 		// Swap buffers
 		glfwSwapBuffers(window);
 		glfwPollEvents();
@@ -245,7 +275,10 @@ int main( void )
 	glDeleteBuffers(1, &uvbuffer);
 	glDeleteBuffers(1, &normalbuffer);
 	glDeleteBuffers(1, &elementbuffer);
-	glDeleteProgram(programID);
+	glDeleteProgram(programIDs[0]);
+	glDeleteProgram(programIDs[1]);
+	if (hasOIT)
+		deleteOIT(oit);
 	glDeleteTextures(1, &Texture);
 	glDeleteVertexArrays(1, &VertexArrayID);
 
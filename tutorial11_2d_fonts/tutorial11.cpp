@@ -21,6 +21,8 @@ using namespace glm;
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
 #include <common/text2D.hpp>
+#include <common/glstate.hpp>
+#include <common/profiler.hpp>
 
 int main( void )
 {
@@ -137,11 +139,16 @@ int main( void )
 	// Initialize our little text library with the Holstein font
 	initText2D( "Holstein.DDS" );
 
+	// Press I to switch between the per-vertex and the instanced text paths
+	bool textInstanced = false;
+	int lastInstancedKeyState = GLFW_RELEASE;
+
 	// For speed computation
 	double lastTime = glfwGetTime();
 	int nbFrames = 0;
 
 	do{
+		beginProfilerFrame();
 
 		// Measure speed
 		double currentTime = glfwGetTime();
@@ -149,6 +156,8 @@ int main( void )
 		if ( currentTime - lastTime >= 1.0 ){ // If last prinf() was more than 1sec ago
 			// printf and reset
 			printf("%f ms/frame\n", 1000.0/double(nbFrames));
+			printGLStateStats(nbFrames);
+			printProfilerStats(nbFrames);
 			nbFrames = 0;
 			lastTime += 1.0;
 		}
@@ -156,8 +165,13 @@ int main( void )
 		// Clear the screen
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
+		beginProfilePass("main pass");
+
+		// The text of the last frame left its own VAO bound
+		stateBindVertexArray(VertexArrayID);
+
 		// Use our shader
-		glUseProgram(programID);
+		stateUseProgram(programID);
 
 		// Compute the MVP matrix from keyboard and mouse input
 		computeMatricesFromInputs();
@@ -176,14 +190,14 @@ int main( void )
 		glUniform3f(LightID, lightPos.x, lightPos.y, lightPos.z);
 
 		// Bind our texture in Texture Unit 0
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, Texture);
+		stateActiveTexture(GL_TEXTURE0);
+		stateBindTexture(GL_TEXTURE_2D, Texture);
 		// Set our "myTextureSampler" sampler to use Texture Unit 0
 		glUniform1i(TextureID, 0);
 
 		// 1rst attribute buffer : vertices
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+		stateEnableVertexAttribArray(0);
+		stateBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
 		glVertexAttribPointer(
 			0,                  // attribute
 			3,                  // size
@@ -194,8 +208,8 @@ int main( void )
 		);
 
 		// 2nd attribute buffer : UVs
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
+		stateEnableVertexAttribArray(1);
+		stateBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
 		glVertexAttribPointer(
 			1,                                // attribute
 			2,                                // size
@@ -206,8 +220,8 @@ int main( void )
 		);
 
 		// 3rd attribute buffer : normals
-		glEnableVertexAttribArray(2);
-		glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
+		stateEnableVertexAttribArray(2);
+		stateBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
 		glVertexAttribPointer(
 			2,                                // attribute
 			3,                                // size
@@ -218,7 +232,7 @@ int main( void )
 		);
 
 		// Index buffer
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
+		stateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
 
 		// Draw the triangles !
 		glDrawElements(
@@ -228,13 +242,26 @@ int main( void )
 			(void*)0           // element array buffer offset
 		);
 
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-		glDisableVertexAttribArray(2);
+		stateDisableVertexAttribArray(0);
+		stateDisableVertexAttribArray(1);
+		stateDisableVertexAttribArray(2);
+		endProfilePass();
 
+		int instancedKeyState = glfwGetKey(window, GLFW_KEY_I);
+		if ( instancedKeyState == GLFW_PRESS && lastInstancedKeyState == GLFW_RELEASE ){
+			textInstanced = !textInstanced;
+			setText2DInstanced(textInstanced);
+		}
+		lastInstancedKeyState = instancedKeyState;
+
+		beginProfilePass("text");
 		char text[256];
 		sprintf(text,"%.2f sec", glfwGetTime() );
 		printText2D(text, 10, 500, 60);
+		flushText2D();
+		endProfilePass();
+
+		endProfilerFrame();
 
 		// Swap buffers
 		glfwSwapBuffers(window);
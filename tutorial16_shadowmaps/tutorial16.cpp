@@ -20,6 +20,13 @@ using namespace glm;
 #include <common/controls.hpp>
 #include <common/objloader.hpp>
 #include <common/vboindexer.hpp>
+#include <common/mesh.hpp>
+#include <common/glstate.hpp>
+#include <common/culling.hpp>
+#include <common/bvh.hpp>
+#include <common/jobs.hpp>
+#include <common/occlusion.hpp>
+#include <common/profiler.hpp>
 
 int main( void )
 {
@@ -75,17 +82,17 @@ int main( void )
 	glClearColor(0.0f, 0.0f, 0.4f, 0.0f);
 
 	// Enable depth test
-	glEnable(GL_DEPTH_TEST);
+	stateEnable(GL_DEPTH_TEST);
 
 	// Accept fragment if it is closer to the camera than the former one
 	glDepthFunc(GL_LESS); 
 
 	// Cull triangles which normal is not towards the camera
-	glEnable(GL_CULL_FACE);
+	stateEnable(GL_CULL_FACE);
 
 	GLuint VertexArrayID;
 	glGenVertexArrays(1, &VertexArrayID);
-	glBindVertexArray(VertexArrayID);
+	stateBindVertexArray(VertexArrayID);
 
 	// Create and compile our GLSL program from the shaders
 	GLuint depthProgramID = LoadShaders( "DepthRTT.vertexshader", "DepthRTT.fragmentshader" );
@@ -112,25 +119,80 @@ int main( void )
 
 	GLuint vertexbuffer;
 	glGenBuffers(1, &vertexbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+	stateBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
 	glBufferData(GL_ARRAY_BUFFER, indexed_vertices.size() * sizeof(glm::vec3), &indexed_vertices[0], GL_STATIC_DRAW);
 
 	GLuint uvbuffer;
 	glGenBuffers(1, &uvbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
+	stateBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
 	glBufferData(GL_ARRAY_BUFFER, indexed_uvs.size() * sizeof(glm::vec2), &indexed_uvs[0], GL_STATIC_DRAW);
 
 	GLuint normalbuffer;
 	glGenBuffers(1, &normalbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
+	stateBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
 	glBufferData(GL_ARRAY_BUFFER, indexed_normals.size() * sizeof(glm::vec3), &indexed_normals[0], GL_STATIC_DRAW);
 
 	// Generate a buffer for the indices as well
 	GLuint elementbuffer;
 	glGenBuffers(1, &elementbuffer);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
+	stateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned short), &indices[0], GL_STATIC_DRAW);
 
+	// Small cubes in and around the room. From inside, the thick walls hide
+	// most of them : the software occlusion culling below finds out which
+	// ones before they are drawn.
+	std::vector<glm::vec3> cube_vertices;
+	std::vector<glm::vec2> cube_uvs;
+	std::vector<glm::vec3> cube_normals;
+	loadOBJ("cube.obj", cube_vertices, cube_uvs, cube_normals);
+
+	std::vector<unsigned short> cube_indices;
+	std::vector<glm::vec3> cube_indexed_vertices;
+	std::vector<glm::vec2> cube_indexed_uvs;
+	std::vector<glm::vec3> cube_indexed_normals;
+	indexVBO(cube_vertices, cube_uvs, cube_normals, cube_indices, cube_indexed_vertices, cube_indexed_uvs, cube_indexed_normals);
+	Mesh cubeMesh = createMesh(cube_indices, cube_indexed_vertices, cube_indexed_uvs, cube_indexed_normals);
+	// createMesh() leaves its own VAO bound
+	stateBindVertexArray(VertexArrayID);
+
+	std::vector<glm::mat4> propMatrices;
+	AABBArray propBounds;
+	for (int x = -8; x <= 8; x++){
+		for (int z = -8; z <= 8; z++){
+			glm::mat4 propMatrix = translate(mat4(), glm::vec3(x * 2.5f, 0.25f, z * 2.5f)) * scale(mat4(), glm::vec3(0.25f));
+			propMatrices.push_back(propMatrix);
+			glm::vec3 boundsMin, boundsMax;
+			transformAABB(propMatrix, glm::vec3(-1.0f), glm::vec3(1.0f), boundsMin, boundsMax);
+			addAABB(propBounds, boundsMin, boundsMax);
+		}
+	}
+	std::vector<unsigned> visibleProps;
+
+	// The cubes don't move : one BVH, to find the ones inside the light's
+	// bounds for the shadow pass
+	BVH propBVH;
+	buildBVH(propBVH, propBounds);
+	std::vector<unsigned> shadowCasters;
+	int casterProps = 0;
+
+	// 256x128 CPU depth buffer, one band of rows per hardware thread. The
+	// room itself is the occluder.
+	OcclusionBuffer occlusionBuffer;
+	initOcclusionBuffer(occlusionBuffer, 256, 128, 0);
+
+	// Press O to turn the occlusion culling on and off
+	bool useOcclusion = true;
+	int lastOcclusionKeyState = GLFW_RELEASE;
+	double lastTime = glfwGetTime();
+	int nbFrames = 0;
+	double occlusionSeconds = 0.0;
+	int testedProps = 0;
+	int occludedProps = 0;
+
+	// Press T to write the last profiled frames to trace.json, for
+	// chrome://tracing or ui.perfetto.dev
+	int lastTraceKeyState = GLFW_RELEASE;
+
 
 	// ---------------------------------------------
 	// Render to Texture - specific code begins here
@@ -144,7 +206,7 @@ int main( void )
 	// Depth texture. Slower than a depth buffer, but you can sample it later in your shader
 	GLuint depthTexture;
 	glGenTextures(1, &depthTexture);
-	glBindTexture(GL_TEXTURE_2D, depthTexture);
+	stateBindTexture(GL_TEXTURE_2D, depthTexture);
 	glTexImage2D(GL_TEXTURE_2D, 0,GL_DEPTH_COMPONENT16, 1024, 1024, 0,GL_DEPTH_COMPONENT, GL_FLOAT, 0);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR); 
@@ -175,7 +237,7 @@ int main( void )
 
 	GLuint quad_vertexbuffer;
 	glGenBuffers(1, &quad_vertexbuffer);
-	glBindBuffer(GL_ARRAY_BUFFER, quad_vertexbuffer);
+	stateBindBuffer(GL_ARRAY_BUFFER, quad_vertexbuffer);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(g_quad_vertex_buffer_data), g_quad_vertex_buffer_data, GL_STATIC_DRAW);
 
 	// Create and compile our GLSL program from the shaders
@@ -202,22 +264,54 @@ int main( void )
 
 	
 	do{
+		beginProfilerFrame();
+
+		// Measure speed, and what the occlusion culling did
+		double currentTime = glfwGetTime();
+		nbFrames++;
+		if ( currentTime - lastTime >= 1.0 ){
+			printf("%f ms/frame, occlusion culling %s : %d of %d draws rejected (%.0f%%), %f ms CPU/frame\n",
+				1000.0/double(nbFrames), useOcclusion ? "on" : "off",
+				occludedProps / nbFrames, testedProps / nbFrames,
+				testedProps > 0 ? 100.0 * occludedProps / testedProps : 0.0,
+				1000.0 * occlusionSeconds / nbFrames);
+			printf("shadow pass : %d of %d cubes inside the light's bounds\n",
+				casterProps / nbFrames, (int)propMatrices.size());
+			printProfilerStats(nbFrames);
+			nbFrames = 0;
+			occlusionSeconds = 0.0;
+			testedProps = 0;
+			occludedProps = 0;
+			casterProps = 0;
+			lastTime += 1.0;
+		}
+
+		int occlusionKeyState = glfwGetKey(window, GLFW_KEY_O);
+		if ( occlusionKeyState == GLFW_PRESS && lastOcclusionKeyState == GLFW_RELEASE )
+			useOcclusion = !useOcclusion;
+		lastOcclusionKeyState = occlusionKeyState;
+
+		int traceKeyState = glfwGetKey(window, GLFW_KEY_T);
+		if ( traceKeyState == GLFW_PRESS && lastTraceKeyState == GLFW_RELEASE )
+			writeProfilerTrace("trace.json");
+		lastTraceKeyState = traceKeyState;
 
 		// Render to our framebuffer
+		beginProfilePass("shadow pass");
 		glBindFramebuffer(GL_FRAMEBUFFER, FramebufferName);
 		glViewport(0,0,1024,1024); // Render on the whole framebuffer, complete from the lower left corner to the upper right
 
 		// We don't use bias in the shader, but instead we draw back faces, 
 		// which are already separated from the front faces by a small distance 
 		// (if your geometry is made this way)
-		glEnable(GL_CULL_FACE);
+		stateEnable(GL_CULL_FACE);
 		glCullFace(GL_BACK); // Cull back-facing triangles -> draw only front-facing triangles
 
 		// Clear the screen
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		// Use our shader
-		glUseProgram(depthProgramID);
+		stateUseProgram(depthProgramID);
 
 		glm::vec3 lightInvDir = glm::vec3(0.5f,2,2);
 
@@ -237,8 +331,8 @@ int main( void )
 		glUniformMatrix4fv(depthMatrixID, 1, GL_FALSE, &depthMVP[0][0]);
 
 		// 1rst attribute buffer : vertices
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+		stateEnableVertexAttribArray(0);
+		stateBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
 		glVertexAttribPointer(
 			0,  // The attribute we want to configure
 			3,                  // size
@@ -249,7 +343,7 @@ int main( void )
 		);
 
 		// Index buffer
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
+		stateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
 
 		// Draw the triangles !
 		glDrawElements(
@@ -259,22 +353,40 @@ int main( void )
 			(void*)0           // element array buffer offset
 		);
 
-		glDisableVertexAttribArray(0);
+		stateDisableVertexAttribArray(0);
+
+		// The cubes cast shadows too, whether the camera sees them or not,
+		// but only those inside the light's box can land in the shadow map.
+		// Its world bounds : the orthographic volume (z from -near to -far
+		// in light space) taken back to world space.
+		glm::vec3 lightMin, lightMax;
+		transformAABB(glm::inverse(depthViewMatrix), glm::vec3(-10,-10,-20), glm::vec3(10,10,10), lightMin, lightMax);
+		queryBVHOverlap(propBVH, lightMin, lightMax, shadowCasters);
+		casterProps += (int)shadowCasters.size();
+		for (size_t c = 0; c < shadowCasters.size(); c++){
+			int i = shadowCasters[c];
+			glm::mat4 propDepthMVP = depthProjectionMatrix * depthViewMatrix * propMatrices[i];
+			glUniformMatrix4fv(depthMatrixID, 1, GL_FALSE, &propDepthMVP[0][0]);
+			drawMesh(cubeMesh);
+		}
+		stateBindVertexArray(VertexArrayID);
+		endProfilePass();
 
 
 
 		// Render to the screen
+		beginProfilePass("main pass");
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
 		glViewport(0,0,windowWidth,windowHeight); // Render on the whole framebuffer, complete from the lower left corner to the upper right
 
-		glEnable(GL_CULL_FACE);
+		stateEnable(GL_CULL_FACE);
 		glCullFace(GL_BACK); // Cull back-facing triangles -> draw only front-facing triangles
 
 		// Clear the screen
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
 		// Use our shader
-		glUseProgram(programID);
+		stateUseProgram(programID);
 
 		// Compute the MVP matrix from keyboard and mouse input
 		computeMatricesFromInputs();
@@ -282,6 +394,23 @@ int main( void )
 		glm::mat4 ViewMatrix = getViewMatrix();
 		//ViewMatrix = glm::lookAt(glm::vec3(14,6,4), glm::vec3(0,1,0), glm::vec3(0,1,0));
 		glm::mat4 ModelMatrix = glm::mat4(1.0);
+
+		// Cubes in the view frustum, then only those not hidden by the room
+		cullAABBs(extractFrustum(ProjectionMatrix, ViewMatrix), propBounds, visibleProps);
+		if (useOcclusion){
+			beginCPUScope("occlusion");
+			double occlusionStartTime = glfwGetTime();
+			beginOcclusionFrame(occlusionBuffer, ProjectionMatrix, ViewMatrix);
+			addOccluder(occlusionBuffer, ModelMatrix, indexed_vertices, indices);
+			rasterizeOccluders(occlusionBuffer);
+			cullOccludedAABBs(occlusionBuffer, propBounds, visibleProps);
+			occlusionSeconds += glfwGetTime() - occlusionStartTime;
+			endCPUScope();
+			testedProps += occlusionBuffer.stats.tested;
+			occludedProps += occlusionBuffer.stats.occluded;
+		}else{
+			testedProps += (int)visibleProps.size();
+		}
 		glm::mat4 MVP = ProjectionMatrix * ViewMatrix * ModelMatrix;
 		
 		glm::mat4 biasMatrix(
@@ -303,18 +432,18 @@ int main( void )
 		glUniform3f(lightInvDirID, lightInvDir.x, lightInvDir.y, lightInvDir.z);
 
 		// Bind our texture in Texture Unit 0
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, Texture);
+		stateActiveTexture(GL_TEXTURE0);
+		stateBindTexture(GL_TEXTURE_2D, Texture);
 		// Set our "myTextureSampler" sampler to use Texture Unit 0
 		glUniform1i(TextureID, 0);
 
-		glActiveTexture(GL_TEXTURE1);
-		glBindTexture(GL_TEXTURE_2D, depthTexture);
+		stateActiveTexture(GL_TEXTURE1);
+		stateBindTexture(GL_TEXTURE_2D, depthTexture);
 		glUniform1i(ShadowMapID, 1);
 
 		// 1rst attribute buffer : vertices
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
+		stateEnableVertexAttribArray(0);
+		stateBindBuffer(GL_ARRAY_BUFFER, vertexbuffer);
 		glVertexAttribPointer(
 			0,                  // attribute
 			3,                  // size
@@ -325,8 +454,8 @@ int main( void )
 		);
 
 		// 2nd attribute buffer : UVs
-		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
+		stateEnableVertexAttribArray(1);
+		stateBindBuffer(GL_ARRAY_BUFFER, uvbuffer);
 		glVertexAttribPointer(
 			1,                                // attribute
 			2,                                // size
@@ -337,8 +466,8 @@ int main( void )
 		);
 
 		// 3rd attribute buffer : normals
-		glEnableVertexAttribArray(2);
-		glBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
+		stateEnableVertexAttribArray(2);
+		stateBindBuffer(GL_ARRAY_BUFFER, normalbuffer);
 		glVertexAttribPointer(
 			2,                                // attribute
 			3,                                // size
@@ -349,7 +478,7 @@ int main( void )
 		);
 
 		// Index buffer
-		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
+		stateBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementbuffer);
 
 		// Draw the triangles !
 		glDrawElements(
@@ -359,9 +488,21 @@ int main( void )
 			(void*)0           // element array buffer offset
 		);
 
-		glDisableVertexAttribArray(0);
-		glDisableVertexAttribArray(1);
-		glDisableVertexAttribArray(2);
+		stateDisableVertexAttribArray(0);
+		stateDisableVertexAttribArray(1);
+		stateDisableVertexAttribArray(2);
+
+		for (size_t v = 0; v < visibleProps.size(); v++){
+			glm::mat4 PropModelMatrix = propMatrices[visibleProps[v]];
+			glm::mat4 PropMVP = ProjectionMatrix * ViewMatrix * PropModelMatrix;
+			glm::mat4 PropDepthBiasMVP = biasMatrix * depthProjectionMatrix * depthViewMatrix * PropModelMatrix;
+			glUniformMatrix4fv(MatrixID, 1, GL_FALSE, &PropMVP[0][0]);
+			glUniformMatrix4fv(ModelMatrixID, 1, GL_FALSE, &PropModelMatrix[0][0]);
+			glUniformMatrix4fv(DepthBiasID, 1, GL_FALSE, &PropDepthBiasMVP[0][0]);
+			drawMesh(cubeMesh);
+		}
+		stateBindVertexArray(VertexArrayID);
+		endProfilePass();
 
 
 		// Optionally render the shadowmap (for debug only)
@@ -370,17 +511,17 @@ int main( void )
 		glViewport(0,0,512,512);
 
 		// Use our shader
-		glUseProgram(quad_programID);
+		stateUseProgram(quad_programID);
 
 		// Bind our texture in Texture Unit 0
-		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, depthTexture);
+		stateActiveTexture(GL_TEXTURE0);
+		stateBindTexture(GL_TEXTURE_2D, depthTexture);
 		// Set our "renderedTexture" sampler to use Texture Unit 0
 		glUniform1i(texID, 0);
 
 		// 1rst attribute buffer : vertices
-		glEnableVertexAttribArray(0);
-		glBindBuffer(GL_ARRAY_BUFFER, quad_vertexbuffer);
+		stateEnableVertexAttribArray(0);
+		stateBindBuffer(GL_ARRAY_BUFFER, quad_vertexbuffer);
 		glVertexAttribPointer(
 			0,                  // attribute 0. No particular reason for 0, but must match the layout in the shader.
 			3,                  // size
@@ -393,8 +534,9 @@ int main( void )
 		// Draw the triangle !
 		// You have to disable GL_COMPARE_R_TO_TEXTURE above in order to see anything !
 		//glDrawArrays(GL_TRIANGLES, 0, 6); // 2*3 indices starting at 0 -> 2 triangles
-		glDisableVertexAttribArray(0);
+		stateDisableVertexAttribArray(0);
 
+		endProfilerFrame();
 
 		// Swap buffers
 		glfwSwapBuffers(window);
@@ -409,6 +551,8 @@ int main( void )
 	glDeleteBuffers(1, &uvbuffer);
 	glDeleteBuffers(1, &normalbuffer);
 	glDeleteBuffers(1, &elementbuffer);
+	deleteMesh(cubeMesh);
+	deleteOcclusionBuffer(occlusionBuffer);
 	glDeleteProgram(programID);
 	glDeleteProgram(depthProgramID);
 	glDeleteProgram(quad_programID);
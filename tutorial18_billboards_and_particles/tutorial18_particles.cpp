@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include <vector>
 #include <algorithm>
@@ -18,58 +19,71 @@ using namespace glm;
 #include <common/shader.hpp>
 #include <common/texture.hpp>
 #include <common/controls.hpp>
-
-// CPU representation of a particle
-struct Particle{
-	glm::vec3 pos, speed;
-	unsigned char r,g,b,a; // Color
-	float size, angle, weight;
-	float life; // Remaining life of the particle. if <0 : dead and unused.
-	float cameradistance; // *Squared* distance to the camera. if dead : -1.0f
-
-	bool operator<(const Particle& that) const {
-		// Sort in reverse order : far particles drawn first.
-		return this->cameradistance > that.cameradistance;
-	}
-};
-
-const int MaxParticles = 100000;
-Particle ParticlesContainer[MaxParticles];
-int LastUsedParticle = 0;
-
-// Finds a Particle in ParticlesContainer which isn't used yet.
-// (i.e. life < 0);
-int FindUnusedParticle(){
-
-	for(int i=LastUsedParticle; i<MaxParticles; i++){
-		if (ParticlesContainer[i].life < 0){
-			LastUsedParticle = i;
-			return i;
-		}
-	}
-
-	for(int i=0; i<LastUsedParticle; i++){
-		if (ParticlesContainer[i].life < 0){
-			LastUsedParticle = i;
-			return i;
-		}
-	}
-
-	return 0; // All particles are taken, override the first one
+#include <common/profiler.hpp>
+#include <common/headless.hpp>
+#include <common/framestats.hpp>
+#include <common/simd.hpp>
+#include <common/random.hpp>
+#include <common/culling.hpp>
+#include <common/radixsort.hpp>
+#include <common/jobs.hpp>
+#include <common/particles.hpp>
+#include <common/emitters.hpp>
+#include <common/gpuparticles.hpp>
+#include <common/streambuffer.hpp>
+#include <common/oit.hpp>
+
+// CPU representation of the particles : emitters, each with its own
+// particles, one array per component (position, speed, life, size, color),
+// and the force fields that move them. See common/emitters.hpp.
+int MaxParticles = 100000;
+ParticleEffect Effect;
+
+// With --gpu, the fountain's particles stay in GL buffers instead, see
+// common/gpuparticles.hpp. The GPU simulation only knows about gravity.
+GPUParticleSystem GPUParticles;
+
+// Gravity, as in the tutorials before force fields
+static const glm::vec3 Gravity = glm::vec3(0.0f,-9.81f, 0.0f) * 0.5f;
+
+// The fountain : straight up at 10 units per second, give or take 1.5 on
+// each axis, for 5 seconds, in any colour a third opaque at most
+static EmitterSettings fountainSettings(double particlesPerSecond){
+	EmitterSettings fountain;
+	fountain.position = glm::vec3(0.0f, 0.0f, -20.0f);
+	fountain.rate = (float)particlesPerSecond;
+	fountain.velocity = VELOCITY_BOX;
+	fountain.speed = 10.0f;
+	fountain.spread = 1.5f;
+	fountain.colorMax = packParticleColor(255, 255, 255, 85);
+	fountain.budget = MaxParticles;
+	// Up to 10 above the ground and 11 below it after 5 seconds
+	fountain.radius = 20.0f;
+	// The camera of common/controls.cpp starts about 100 units away
+	fountain.lodNear = 150.0f;
+	fountain.lodFar = 300.0f;
+	return fountain;
 }
 
-void SortParticles(){
-	std::sort(&ParticlesContainer[0], &ParticlesContainer[MaxParticles]);
+// A new particle of the fountain, already age seconds old, for the GPU
+// simulation
+static void newParticle(const EmitterSettings& fountain, RandomStream& random,
+                        float age, glm::vec3& position, glm::vec3& speed,
+                        float& life, float& size, unsigned& color){
+	newEmitterParticle(fountain, random, position, speed, life, size, color);
+	position += speed * age + Gravity * (0.5f * age * age);
+	speed += Gravity * age;
+	life -= age;
 }
 
-int main( void )
-{
+// Opens the window and its 3.3 core context, and loads GL with GLEW
+static bool openWindow(){
 	// Initialize GLFW
 	if( !glfwInit() )
 	{
 		fprintf( stderr, "Failed to initialize GLFW\n" );
 		getchar();
-		return -1;
+		return false;
 	}
 
 	glfwWindowHint(GLFW_SAMPLES, 4);
@@ -85,7 +99,7 @@ int main( void )
 		fprintf( stderr, "Failed to open GLFW window. If you have an Intel GPU, they are not 3.3 compatible. Try the 2.1 version of the tutorials.\n" );
 		getchar();
 		glfwTerminate();
-		return -1;
+		return false;
 	}
 	glfwMakeContextCurrent(window);
 
@@ -95,7 +109,7 @@ int main( void )
 		fprintf(stderr, "Failed to initialize GLEW\n");
 		getchar();
 		glfwTerminate();
-		return -1;
+		return false;
 	}
 
 	// Ensure we can capture the escape key being pressed below
@@ -106,6 +120,46 @@ int main( void )
     // Set the mouse at the center of the screen
     glfwPollEvents();
     glfwSetCursorPos(window, 1024/2, 768/2);
+	return true;
+}
+
+int main( int argc, char* argv[] )
+{
+	// --gpu simulates the particles on the GPU with transform feedback.
+	// --orphan streams the CPU particles by orphaning the buffers, even
+	// where they can stay mapped (see common/streambuffer.hpp).
+	// --oit starts with order independent transparency instead of sorted
+	// blending (see common/oit.hpp) ; O switches between them.
+	// --particles N makes room for N particles in the fountain and spawns
+	// enough to keep that many alive (the default spawns 10 per millisecond
+	// for 100000), and a quarter of that for the smoke.
+	// --headless [frames] draws that many frames of 1/60 s into an
+	// offscreen framebuffer, from a fixed camera, with the effect already
+	// running, then prints a JSON summary of the frame times (see
+	// common/headless.hpp, --size WxH).
+	bool useGPU = false;
+	bool orphan = false;
+	bool useOIT = false;
+	double particlesPerSecond = 10000.0;
+	for (int i = 1; i < argc; i++){
+		if (strcmp(argv[i], "--gpu") == 0)
+			useGPU = true;
+		else if (strcmp(argv[i], "--orphan") == 0)
+			orphan = true;
+		else if (strcmp(argv[i], "--oit") == 0)
+			useOIT = true;
+		else if (strcmp(argv[i], "--particles") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0){
+			MaxParticles = atoi(argv[++i]);
+			particlesPerSecond = MaxParticles / 5.0;
+		}
+	}
+	HeadlessOptions headless;
+	parseHeadlessOptions(argc, argv, headless);
+
+	// Without a window, an offscreen framebuffer stands in for its back
+	// buffer
+	if (headless.enabled ? !createHeadlessContext(headless) : !openWindow())
+		return -1;
 
 	// Dark blue background
 	glClearColor(0.0f, 0.0f, 0.4f, 0.0f);
@@ -120,24 +174,107 @@ int main( void )
 	glBindVertexArray(VertexArrayID);
 
 
-	// Create and compile our GLSL program from the shaders
-	GLuint programID = LoadShaders( "Particle.vertexshader", "Particle.fragmentshader" );
+	// Create and compile our GLSL programs from the shaders : one for
+	// blending the sorted particles, one that writes to the targets of
+	// order independent transparency, with no sorting
+	GLuint programIDs[2];
+	programIDs[0] = LoadShaders( "Particle.vertexshader", "Particle.fragmentshader" );
+	programIDs[1] = LoadShaders( "Particle.vertexshader", "ParticleOIT.fragmentshader" );
 
-	// Vertex shader
-	GLuint CameraRight_worldspace_ID  = glGetUniformLocation(programID, "CameraRight_worldspace");
-	GLuint CameraUp_worldspace_ID  = glGetUniformLocation(programID, "CameraUp_worldspace");
-	GLuint ViewProjMatrixID = glGetUniformLocation(programID, "VP");
+	GLuint CameraRight_worldspace_IDs[2], CameraUp_worldspace_IDs[2], ViewProjMatrixIDs[2], TextureIDs[2];
+	for (int i = 0; i < 2; i++){
+		// Vertex shader
+		CameraRight_worldspace_IDs[i] = glGetUniformLocation(programIDs[i], "CameraRight_worldspace");
+		CameraUp_worldspace_IDs[i] = glGetUniformLocation(programIDs[i], "CameraUp_worldspace");
+		ViewProjMatrixIDs[i] = glGetUniformLocation(programIDs[i], "VP");
 
-	// fragment shader
-	GLuint TextureID  = glGetUniformLocation(programID, "myTextureSampler");
+		// fragment shader
+		TextureIDs[i] = glGetUniformLocation(programIDs[i], "myTextureSampler");
+	}
+
+	int framebufferWidth = headless.width, framebufferHeight = headless.height;
+	if (!headless.enabled)
+		glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+	OITTargets oit;
+	bool hasOIT = initOIT(oit, framebufferWidth, framebufferHeight,
+		"../tutorial10_transparency/OITComposite.vertexshader", "../tutorial10_transparency/OITComposite.fragmentshader");
+	useOIT = useOIT && hasOIT;
 
 	
-	static GLfloat* g_particule_position_size_data = new GLfloat[MaxParticles * 4];
-	static GLubyte* g_particule_color_data         = new GLubyte[MaxParticles * 4];
+	EmitterSettings fountain = fountainSettings(particlesPerSecond);
+	RandomStream random;
+	seedRandom(random, fountain.seed);
+	if (useGPU){
+		if (!initGPUParticleSystem(GPUParticles, MaxParticles, "ParticleSimulation.vertexshader"))
+			return -1;
+	}else{
+		// The fountain falls and slows down a little. Next to it, smoke
+		// rises from the ground, turns around its column, slows down and is
+		// pulled towards a point above the fountain.
+		ForceField gravity = { FORCE_GRAVITY, glm::vec3(0.0f), glm::vec3(0.0f,-1.0f, 0.0f), 4.905f, 0.0f };
+		ForceField drag = { FORCE_DRAG, glm::vec3(0.0f), glm::vec3(0.0f), 0.2f, 0.0f };
+		ForceField vortex = { FORCE_VORTEX, glm::vec3(6.0f, 0.0f,-24.0f), glm::vec3(0.0f, 1.0f, 0.0f), 12.0f, 8.0f };
+		ForceField attractor = { FORCE_ATTRACTOR, glm::vec3(0.0f, 12.0f,-20.0f), glm::vec3(0.0f), 60.0f, 0.0f };
+		int gravityField = addForceField(Effect, gravity);
+		int dragField = addForceField(Effect, drag);
+		int vortexField = addForceField(Effect, vortex);
+		int attractorField = addForceField(Effect, attractor);
+
+		fountain.fieldMask = (1u << gravityField) | (1u << dragField);
+		addParticleEmitter(Effect, fountain);
+
+		EmitterSettings smoke;
+		smoke.position = glm::vec3(6.0f, 0.0f,-24.0f);
+		smoke.positionSpread = 1.0f;
+		smoke.rate = (float)particlesPerSecond / 4.0f;
+		smoke.velocity = VELOCITY_CONE;
+		smoke.speed = 3.0f;
+		smoke.spread = 0.3f;
+		smoke.lifeMin = 4.0f;
+		smoke.lifeMax = 6.0f;
+		smoke.sizeMin = 0.4f;
+		smoke.sizeMax = 1.0f;
+		smoke.colorMin = packParticleColor(90, 90, 100, 20);
+		smoke.colorMax = packParticleColor(160, 160, 170, 60);
+		smoke.budget = MaxParticles / 4 + 1;
+		smoke.radius = 20.0f;
+		smoke.lodNear = 150.0f;
+		smoke.lodFar = 300.0f;
+		smoke.fieldMask = (1u << dragField) | (1u << vortexField) | (1u << attractorField);
+		smoke.seed = 2;
+		addParticleEmitter(Effect, smoke);
+	}
 
-	for(int i=0; i<MaxParticles; i++){
-		ParticlesContainer[i].life = -1.0f;
-		ParticlesContainer[i].cameradistance = -1.0f;
+	// Room in the streamed buffers for every emitter full
+	int drawCapacity = 0;
+	for (size_t e = 0; e < Effect.emitters.size(); e++)
+		drawCapacity += Effect.emitters[e]->settings.budget;
+
+	// The simulation runs on one thread per core, in chunks. An update is
+	// always in flight : it is started at the end of a frame and finished
+	// at the beginning of the next one.
+	JobSystem* jobs = useGPU ? NULL : createJobSystem();
+
+	// Benchmarks start with the effect already running : the fountain keeps
+	// as many particles alive, of all ages
+	if (headless.enabled){
+		if (useGPU){
+			int alive = std::min(MaxParticles, (int)(particlesPerSecond * 5.0));
+			for (int i = 0; i < alive; i++){
+				glm::vec3 position, speed;
+				float life, size;
+				unsigned color;
+				newParticle(fountain, random, 5.0f * i / alive, position, speed, life, size, color);
+				spawnGPUParticle(GPUParticles, position, speed, life, size, color);
+			}
+		}else{
+			// 6 seconds in large steps : the spawns are spread over each
+			// step, so the particles are of all ages
+			for (int i = 0; i < 60; i++){
+				startParticleEffectUpdate(Effect, jobs, 0.1f, glm::vec3(0.0f, 5.0f, 10.0f));
+				finishParticleEffectUpdate(Effect, jobs);
+			}
+		}
 	}
 
 
@@ -157,36 +294,71 @@ int main( void )
 	glBindBuffer(GL_ARRAY_BUFFER, billboard_vertex_buffer);
 	glBufferData(GL_ARRAY_BUFFER, sizeof(g_vertex_buffer_data), g_vertex_buffer_data, GL_STATIC_DRAW);
 
-	// The VBO containing the positions and sizes of the particles
-	GLuint particles_position_buffer;
-	glGenBuffers(1, &particles_position_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, particles_position_buffer);
-	// Initialize with empty (NULL) buffer : it will be updated later, each frame.
-	glBufferData(GL_ARRAY_BUFFER, MaxParticles * 4 * sizeof(GLfloat), NULL, GL_STREAM_DRAW);
-
-	// The VBO containing the colors of the particles
-	GLuint particles_color_buffer;
-	glGenBuffers(1, &particles_color_buffer);
-	glBindBuffer(GL_ARRAY_BUFFER, particles_color_buffer);
-	// Initialize with empty (NULL) buffer : it will be updated later, each frame.
-	glBufferData(GL_ARRAY_BUFFER, MaxParticles * 4 * sizeof(GLubyte), NULL, GL_STREAM_DRAW);
+	// The VBOs containing the positions and sizes of the particles, and
+	// their colors. Each frame is written straight into them, in one of
+	// three regions that the GPU is not reading anymore.
+	StreamBuffer particlesPositions, particlesColors;
+	if (!useGPU){
+		initStreamBuffer(particlesPositions, GL_ARRAY_BUFFER, drawCapacity * 4 * sizeof(GLfloat), !orphan);
+		initStreamBuffer(particlesColors, GL_ARRAY_BUFFER, drawCapacity * 4 * sizeof(GLubyte), !orphan);
+	}
 
 
 	
-	double lastTime = glfwGetTime();
+	double lastTime = headless.enabled ? 0.0 : glfwGetTime();
+	// Profiler statistics, printed every second. Press T to write the last
+	// profiled frames to trace.json.
+	double lastPrintTime = lastTime;
+	int nbFrames = 0;
+	int lastTraceKeyState = GLFW_RELEASE;
+	int lastOITKeyState = GLFW_RELEASE;
+	// Set when the update in flight writes the particles itself
+	bool streamedUpdate = false;
+	FrameStats stats;
+	int frame = 0;
 	do
 	{
+		beginProfilerFrame();
+		beginStatsFrame(stats);
+
 		// Clear the screen
 		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-		double currentTime = glfwGetTime();
+		double currentTime = headless.enabled ? frame / 60.0 : glfwGetTime();
 		double delta = currentTime - lastTime;
 		lastTime = currentTime;
 
+		glm::mat4 ProjectionMatrix, ViewMatrix;
+		if (headless.enabled){
+			// The whole fountain, from the side
+			ProjectionMatrix = glm::perspective(glm::radians(45.0f), (float)headless.width / (float)headless.height, 0.1f, 100.0f);
+			ViewMatrix = glm::lookAt(glm::vec3(0.0f, 5.0f, 10.0f), glm::vec3(0.0f, 5.0f, -20.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+		}else{
+			nbFrames++;
+			if ( currentTime - lastPrintTime >= 1.0 ){
+				printf("%f ms/frame\n", 1000.0/double(nbFrames));
+				printProfilerStats(nbFrames);
+				nbFrames = 0;
+				lastPrintTime += 1.0;
+			}
+
+			int traceKeyState = glfwGetKey(window, GLFW_KEY_T);
+			if ( traceKeyState == GLFW_PRESS && lastTraceKeyState == GLFW_RELEASE )
+				writeProfilerTrace("trace.json");
+			lastTraceKeyState = traceKeyState;
+
+			int OITKeyState = glfwGetKey(window, GLFW_KEY_O);
+			if ( OITKeyState == GLFW_PRESS && lastOITKeyState == GLFW_RELEASE && hasOIT ){
+				useOIT = !useOIT;
+				printf("Order independent transparency : %s\n", useOIT ? "on" : "off");
+			}
+			lastOITKeyState = OITKeyState;
+
 
-		computeMatricesFromInputs();
-		glm::mat4 ProjectionMatrix = getProjectionMatrix();
-		glm::mat4 ViewMatrix = getViewMatrix();
+			computeMatricesFromInputs();
+			ProjectionMatrix = getProjectionMatrix();
+			ViewMatrix = getViewMatrix();
+		}
 
 		// We will need the camera's position in order to sort the particles
 		// w.r.t the camera's distance.
@@ -197,119 +369,87 @@ int main( void )
 		glm::mat4 ViewProjectionMatrix = ProjectionMatrix * ViewMatrix;
 
 
-		// Generate 10 new particle each millisecond,
-		// but limit this to 16 ms (60 fps), or if you have 1 long frame (1sec),
-		// new particles will be huge and the next frame even longer.
-		int newparticles = (int)(delta*10000.0);
-		if (newparticles > (int)(0.016f*10000.0))
-			newparticles = (int)(0.016f*10000.0);
-		
-		for(int i=0; i<newparticles; i++){
-			int particleIndex = FindUnusedParticle();
-			ParticlesContainer[particleIndex].life = 5.0f; // This particle will live 5 seconds.
-			ParticlesContainer[particleIndex].pos = glm::vec3(0,0,-20.0f);
-
-			float spread = 1.5f;
-			glm::vec3 maindir = glm::vec3(0.0f, 10.0f, 0.0f);
-			// Very bad way to generate a random direction; 
-			// See for instance http://stackoverflow.com/questions/5408276/python-uniform-spherical-distribution instead,
-			// combined with some user-controlled parameters (main direction, spread, etc)
-			glm::vec3 randomdir = glm::vec3(
-				(rand()%2000 - 1000.0f)/1000.0f,
-				(rand()%2000 - 1000.0f)/1000.0f,
-				(rand()%2000 - 1000.0f)/1000.0f
-			);
-			
-			ParticlesContainer[particleIndex].speed = maindir + randomdir*spread;
-
-
-			// Very bad way to generate a random color
-			ParticlesContainer[particleIndex].r = rand() % 256;
-			ParticlesContainer[particleIndex].g = rand() % 256;
-			ParticlesContainer[particleIndex].b = rand() % 256;
-			ParticlesContainer[particleIndex].a = (rand() % 256) / 3;
-
-			ParticlesContainer[particleIndex].size = (rand()%1000)/2000.0f + 0.1f;
-			
-		}
-
-
-
-		// Simulate all particles
-		int ParticlesCount = 0;
-		for(int i=0; i<MaxParticles; i++){
-
-			Particle& p = ParticlesContainer[i]; // shortcut
-
-			if(p.life > 0.0f){
-
-				// Decrease life
-				p.life -= delta;
-				if (p.life > 0.0f){
-
-					// Simulate simple physics : gravity only, no collisions
-					p.speed += glm::vec3(0.0f,-9.81f, 0.0f) * (float)delta * 0.5f;
-					p.pos += p.speed * (float)delta;
-					p.cameradistance = glm::length2( p.pos - CameraPosition );
-					//ParticlesContainer[i].pos += glm::vec3(0.0f,10.0f, 0.0f) * (float)delta;
-
-					// Fill the GPU buffer
-					g_particule_position_size_data[4*ParticlesCount+0] = p.pos.x;
-					g_particule_position_size_data[4*ParticlesCount+1] = p.pos.y;
-					g_particule_position_size_data[4*ParticlesCount+2] = p.pos.z;
-												   
-					g_particule_position_size_data[4*ParticlesCount+3] = p.size;
-												   
-					g_particule_color_data[4*ParticlesCount+0] = p.r;
-					g_particule_color_data[4*ParticlesCount+1] = p.g;
-					g_particule_color_data[4*ParticlesCount+2] = p.b;
-					g_particule_color_data[4*ParticlesCount+3] = p.a;
-
-				}else{
-					// Particles that just died will be put at the end of the buffer in SortParticles();
-					p.cameradistance = -1.0f;
-				}
-
-				ParticlesCount++;
-
+		int ParticlesCount;
+		GLuint positionBuffer, colorBuffer;
+		GLsizei positionStride;
+		GLintptr positionOffset = 0, colorOffset = 0;
+		double simulationStart = statsNow();
+		double sortStart = simulationStart;
+		double submitStart = simulationStart;
+		if (useGPU){
+			// The particles spawned last frame are uploaded, then a
+			// transform feedback pass advances all of them on the GPU.
+			// Slots of dead particles are drawn too, with a size of 0. The
+			// particles are not sorted.
+			beginProfilePass("particle simulation");
+			updateGPUParticles(GPUParticles, (float)delta, Gravity);
+			glBindVertexArray(VertexArrayID);
+			endProfilePass();
+			ParticlesCount = GPUParticles.count;
+			positionBuffer = gpuParticleStateBuffer(GPUParticles);
+			positionStride = GPU_PARTICLE_STRIDE;
+			colorBuffer = GPUParticles.colorBuffer;
+			sortStart = submitStart = statsNow();
+			beginProfilePass("particles");
+		}else{
+			// Wait for the simulation started at the end of the previous frame.
+			// The dead particles are removed. With order independent
+			// transparency nothing is sorted : the live particles of each
+			// chunk are written by the job threads at once, to the buffers
+			// mapped when the update started.
+			beginCPUScope("particle simulation");
+			ParticlesCount = finishParticleEffectUpdate(Effect, jobs);
+			endCPUScope();
+
+			// Far particles drawn first : sort each emitter, and fill the
+			// GPU buffers in that order, the farthest emitter first. Sleeping
+			// emitters are not drawn. The particles go straight to memory
+			// the GPU reads ; without persistent mapping, to a copy that is
+			// uploaded to an orphaned buffer.
+			// http://www.opengl.org/wiki/Buffer_Object_Streaming
+			sortStart = statsNow();
+			beginCPUScope("particle sort");
+			if (!streamedUpdate){
+				GLfloat* positionSize = (GLfloat*)beginStreamWrite(particlesPositions);
+				GLuint* colors = (GLuint*)beginStreamWrite(particlesColors); // 4 GLubytes each
+				ParticlesCount = writeParticleEffect(Effect, positionSize, colors, jobs);
 			}
+			endCPUScope();
+			submitStart = statsNow();
+
+			beginProfilePass("particles");
+			positionOffset = endStreamWrite(particlesPositions, ParticlesCount * sizeof(GLfloat) * 4);
+			colorOffset = endStreamWrite(particlesColors, ParticlesCount * sizeof(GLubyte) * 4);
+			positionBuffer = particlesPositions.buffer;
+			positionStride = 0;
+			colorBuffer = particlesColors.buffer;
 		}
 
-		SortParticles();
-
-		//printf("%d ",ParticlesCount);
 
-		// Update the buffers that OpenGL uses for rendering.
-		// There are much more sophisticated means to stream data from the CPU to the GPU, 
-		// but this is outside the scope of this tutorial.
-		// http://www.opengl.org/wiki/Buffer_Object_Streaming
-
-		glBindBuffer(GL_ARRAY_BUFFER, particles_position_buffer);
-		glBufferData(GL_ARRAY_BUFFER, MaxParticles * 4 * sizeof(GLfloat), NULL, GL_STREAM_DRAW); // Buffer orphaning, a common way to improve streaming perf. See above link for details.
-		glBufferSubData(GL_ARRAY_BUFFER, 0, ParticlesCount * sizeof(GLfloat) * 4, g_particule_position_size_data);
-
-		glBindBuffer(GL_ARRAY_BUFFER, particles_color_buffer);
-		glBufferData(GL_ARRAY_BUFFER, MaxParticles * 4 * sizeof(GLubyte), NULL, GL_STREAM_DRAW); // Buffer orphaning, a common way to improve streaming perf. See above link for details.
-		glBufferSubData(GL_ARRAY_BUFFER, 0, ParticlesCount * sizeof(GLubyte) * 4, g_particule_color_data);
-
-
-		glEnable(GL_BLEND);
-		glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		// The particles go to the OIT targets, in any order, then are
+		// blended over the screen at once
+		int mode = useOIT ? 1 : 0;
+		if (useOIT){
+			beginOIT(oit);
+		}else{
+			glEnable(GL_BLEND);
+			glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+		}
 
 		// Use our shader
-		glUseProgram(programID);
+		glUseProgram(programIDs[mode]);
 
 		// Bind our texture in Texture Unit 0
 		glActiveTexture(GL_TEXTURE0);
 		glBindTexture(GL_TEXTURE_2D, Texture);
 		// Set our "myTextureSampler" sampler to use Texture Unit 0
-		glUniform1i(TextureID, 0);
+		glUniform1i(TextureIDs[mode], 0);
 
 		// Same as the billboards tutorial
-		glUniform3f(CameraRight_worldspace_ID, ViewMatrix[0][0], ViewMatrix[1][0], ViewMatrix[2][0]);
-		glUniform3f(CameraUp_worldspace_ID   , ViewMatrix[0][1], ViewMatrix[1][1], ViewMatrix[2][1]);
+		glUniform3f(CameraRight_worldspace_IDs[mode], ViewMatrix[0][0], ViewMatrix[1][0], ViewMatrix[2][0]);
+		glUniform3f(CameraUp_worldspace_IDs[mode]   , ViewMatrix[0][1], ViewMatrix[1][1], ViewMatrix[2][1]);
 
-		glUniformMatrix4fv(ViewProjMatrixID, 1, GL_FALSE, &ViewProjectionMatrix[0][0]);
+		glUniformMatrix4fv(ViewProjMatrixIDs[mode], 1, GL_FALSE, &ViewProjectionMatrix[0][0]);
 
 		// 1rst attribute buffer : vertices
 		glEnableVertexAttribArray(0);
@@ -325,26 +465,26 @@ int main( void )
 		
 		// 2nd attribute buffer : positions of particles' centers
 		glEnableVertexAttribArray(1);
-		glBindBuffer(GL_ARRAY_BUFFER, particles_position_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, positionBuffer);
 		glVertexAttribPointer(
 			1,                                // attribute. No particular reason for 1, but must match the layout in the shader.
 			4,                                // size : x + y + z + size => 4
 			GL_FLOAT,                         // type
 			GL_FALSE,                         // normalized?
-			0,                                // stride
-			(void*)0                          // array buffer offset
+			positionStride,                   // stride : 0 for tightly packed, or the whole GPU particle
+			(void*)positionOffset             // array buffer offset : the region of this frame
 		);
 
 		// 3rd attribute buffer : particles' colors
 		glEnableVertexAttribArray(2);
-		glBindBuffer(GL_ARRAY_BUFFER, particles_color_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, colorBuffer);
 		glVertexAttribPointer(
 			2,                                // attribute. No particular reason for 1, but must match the layout in the shader.
 			4,                                // size : r + g + b + a => 4
 			GL_UNSIGNED_BYTE,                 // type
 			GL_TRUE,                          // normalized?    *** YES, this means that the unsigned char[4] will be accessible with a vec4 (floats) in the shader ***
 			0,                                // stride
-			(void*)0                          // array buffer offset
+			(void*)colorOffset                // array buffer offset
 		);
 
 		// These functions are specific to glDrawArrays*Instanced*.
@@ -361,33 +501,124 @@ int main( void )
 		// for(i in ParticlesCount) : glDrawArrays(GL_TRIANGLE_STRIP, 0, 4), 
 		// but faster.
 		glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, ParticlesCount);
+		if (!useGPU){
+			fenceStreamWrite(particlesPositions);
+			fenceStreamWrite(particlesColors);
+		}
 
 		glDisableVertexAttribArray(0);
 		glDisableVertexAttribArray(1);
 		glDisableVertexAttribArray(2);
-
-		// Swap buffers
-		glfwSwapBuffers(window);
-		glfwPollEvents();
+		if (useOIT){
+			endOIT(oit);
+			glBindVertexArray(VertexArrayID);
+		}
+		endProfilePass();
+
+		double spawnStart = statsNow();
+		beginCPUScope("particle spawn");
+		if (useGPU){
+			// Generate 10 new particle each millisecond,
+			// but limit this to 16 ms (60 fps), or if you have 1 long frame (1sec),
+			// new particles will be huge and the next frame even longer.
+			int newparticles = (int)(delta*particlesPerSecond);
+			if (newparticles > (int)(0.016f*particlesPerSecond))
+				newparticles = (int)(0.016f*particlesPerSecond);
+
+			// The oldest particle is replaced when all the slots are taken
+			for(int i=0; i<newparticles; i++){
+				glm::vec3 position, speed;
+				float life, size;
+				unsigned color;
+				newParticle(fountain, random, 0.0f, position, speed, life, size, color);
+				spawnGPUParticle(GPUParticles, position, speed, life, size, color);
+			}
+		}else{
+			// Each emitter in view spawns at its rate, less when it is far,
+			// until it has its budget of particles, then all of them move
+			// under their force fields. The jobs run while this thread
+			// submits the frame and waits for the swap ; the sort of the
+			// next frame uses distances to this frame's camera. Unsorted,
+			// the next region of the buffers is taken now for the jobs to
+			// write to (a frame is drawn unsorted when O is pressed then).
+			Frustum frustum = extractFrustum(ProjectionMatrix, ViewMatrix);
+			GLfloat* positionSize = NULL;
+			GLuint* colors = NULL;
+			streamedUpdate = useOIT;
+			if (streamedUpdate){
+				positionSize = (GLfloat*)beginStreamWrite(particlesPositions);
+				colors = (GLuint*)beginStreamWrite(particlesColors);
+			}
+			startParticleEffectUpdate(Effect, jobs, (float)delta, CameraPosition, &frustum, positionSize, colors);
+		}
+		endCPUScope();
+
+
+		endProfilerFrame();
+
+		if (headless.enabled){
+			// Nothing to swap : wait for the GPU instead, or the frames
+			// would only measure how fast the driver queues them
+			double finishStart = statsNow();
+			glFinish();
+			double frameEnd = statsNow();
+			addStatsPhase(stats, "simulation", sortStart - simulationStart);
+			addStatsPhase(stats, "sort", submitStart - sortStart);
+			addStatsPhase(stats, "submit", spawnStart - submitStart);
+			addStatsPhase(stats, "spawn", finishStart - spawnStart);
+			addStatsPhase(stats, "finish", frameEnd - finishStart);
+			endStatsFrame(stats, 1);
+			frame++;
+		}else{
+			// Swap buffers
+			glfwSwapBuffers(window);
+			glfwPollEvents();
+		}
 
 	} // Check if the ESC key was pressed or the window was closed
-	while( glfwGetKey(window, GLFW_KEY_ESCAPE ) != GLFW_PRESS &&
+	while( headless.enabled ? frame < headless.frames :
+		   glfwGetKey(window, GLFW_KEY_ESCAPE ) != GLFW_PRESS &&
 		   glfwWindowShouldClose(window) == 0 );
 
 
-	delete[] g_particule_position_size_data;
+	if (!useGPU){
+		finishParticleEffectUpdate(Effect, jobs);
+		destroyJobSystem(jobs);
+	}
+	if (headless.enabled){
+		printf("%s simulation, %d particles, %s\n", useGPU ? "GPU" : "CPU",
+			useGPU ? GPUParticles.count : countParticleEffect(Effect),
+			useOIT ? "order independent transparency" : "sorted blending");
+		if (!useGPU)
+			printf("%s streaming, %d stalls\n", particlesPositions.persistent ? "Persistent" : "Orphaning",
+				particlesPositions.stalls + particlesColors.stalls);
+		printFrameStatsJSON(stats, "tutorial18_particles",
+			(const char*)glGetString(GL_RENDERER), headless.width, headless.height);
+	}
+	if (useGPU)
+		deleteGPUParticleSystem(GPUParticles);
+	else
+		deleteParticleEffect(Effect);
 
 	// Cleanup VBO and shader
-	glDeleteBuffers(1, &particles_color_buffer);
-	glDeleteBuffers(1, &particles_position_buffer);
+	if (!useGPU){
+		deleteStreamBuffer(particlesColors);
+		deleteStreamBuffer(particlesPositions);
+	}
 	glDeleteBuffers(1, &billboard_vertex_buffer);
-	glDeleteProgram(programID);
+	glDeleteProgram(programIDs[0]);
+	glDeleteProgram(programIDs[1]);
+	if (hasOIT)
+		deleteOIT(oit);
 	glDeleteTextures(1, &Texture);
 	glDeleteVertexArrays(1, &VertexArrayID);
 	
 
 	// Close OpenGL window and terminate GLFW
-	glfwTerminate();
+	if (headless.enabled)
+		destroyHeadlessContext();
+	else
+		glfwTerminate();
 
 	return 0;
 }